@@ -12,6 +12,9 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include "ch.h"
+#include "hal.h"
+
 #include "bsp_can.h"
 #include "bsp_can_conf.h"
 #include "stm32f405xx.h"
@@ -22,12 +25,57 @@ Warning in order to use this driver all GPIOs peripherals shall be enabled.
 #define CANx_TIMEOUT_MAX (100000) // About 10sec (see common/chconf.h/CH_CFG_ST_FREQUENCY) can be aborted by UBTN too
 #define NB_CAN (BSP_DEV_CAN_END)
 
+/* Filter banks are shared, CAN1 use banks 0 to 13 and CAN2 banks 14 to 27 */
+#define CAN_FILTER_BANKS (14)
+
 /* For whatever reason, this flag is not in stm32f4xx_hal_can.h */
 #define CAN_FLAG_FMP0 ((uint32_t)0x12000003)
 
 static CAN_HandleTypeDef can_handle[NB_CAN];
 static mode_config_proto_t* can_mode_conf[NB_CAN];
 
+#define BSP_CAN_RX_RING_MASK (BSP_CAN_RX_RING_SIZE-1)
+
+/* Single producer (RX IRQ) / single consumer (thread) ring buffer */
+typedef struct {
+	volatile bool active;
+	volatile uint32_t head; /* Written by IRQ only */
+	volatile uint32_t tail; /* Written by consumer only */
+	volatile uint32_t frames;
+	volatile uint32_t dropped;
+	volatile uint32_t overrun;
+	volatile uint32_t errors;
+	bsp_can_rx_frame_t frame[BSP_CAN_RX_RING_SIZE];
+} can_rx_ring_t;
+
+static can_rx_ring_t can_rx_ring[NB_CAN];
+
+#define BSP_CAN_TX_RING_MASK (BSP_CAN_TX_RING_SIZE-1)
+
+/*
+ * Scheduled transmission time base is the DWT cycle counter, TIM3 is used
+ * as one shot alarm (max 0xFFFF ticks, re-armed for longer delays).
+ */
+#define CAN_TX_TIM (TIM3)
+#define CAN_TX_TIM_DIV (STM32_SYSCLK / STM32_TIMCLK1) /* Cycles per TIM3 tick */
+
+/* Single producer (thread) / single consumer (TIM3 & CAN TX IRQ) queue */
+typedef struct {
+	CAN_TypeDef* volatile can; /* NULL when stopped */
+	bsp_dev_can_t dev_num;
+	volatile uint32_t head; /* Written by producer only */
+	volatile uint32_t tail; /* Written by IRQ only */
+	volatile bool starved; /* IRQ found the queue empty */
+	bool due_valid; /* due is computed for frame at tail */
+	uint32_t due; /* Cycle counter when frame at tail shall be sent */
+	uint32_t last_due; /* Cycle counter when previous frame was sent */
+	volatile uint32_t frames;
+	volatile uint32_t late;
+	bsp_can_tx_frame_t frame[BSP_CAN_TX_RING_SIZE];
+} can_tx_sched_t;
+
+static can_tx_sched_t can_tx_sched;
+
 /**
   * @brief  Init low level hardware: GPIO, CLOCK, NVIC...
   * @param  dev_num: CAN dev num
@@ -83,9 +131,12 @@ static void can_gpio_hw_init(bsp_dev_can_t dev_num)
 static void can_gpio_hw_deinit(bsp_dev_can_t dev_num)
 {
 	if(dev_num == BSP_DEV_CAN1) {
-		/* Reset peripherals */
-		__CAN1_FORCE_RESET();
-		__CAN1_RELEASE_RESET();
+		/* CAN2 filters are in CAN1 cell, do not reset it while CAN2 is used */
+		if(can_handle[BSP_DEV_CAN2].Instance == NULL) {
+			/* Reset peripherals */
+			__CAN1_FORCE_RESET();
+			__CAN1_RELEASE_RESET();
+		}
 
 		/* Disable peripherals GPIO */
 		HAL_GPIO_DeInit(BSP_CAN1_TX_PORT, BSP_CAN1_TX_PIN);
@@ -235,11 +286,11 @@ bsp_status_t bsp_can_init_filter(bsp_dev_can_t dev_num, mode_config_proto_t* mod
 	hcanfilter.FilterMaskIdHigh = 0;
 	hcanfilter.FilterMaskIdLow = 0;
 	hcanfilter.FilterFIFOAssignment = CAN_FILTER_FIFO0;
-	hcanfilter.FilterNumber = 14*dev_num;
+	hcanfilter.FilterNumber = CAN_FILTER_BANKS*dev_num;
 	hcanfilter.FilterMode = CAN_FILTERMODE_IDMASK;
 	hcanfilter.FilterScale = CAN_FILTERSCALE_16BIT;
 	hcanfilter.FilterActivation = ENABLE;
-	hcanfilter.BankNumber = 14;
+	hcanfilter.BankNumber = CAN_FILTER_BANKS;
 
 	status = HAL_CAN_ConfigFilter(hcan, &hcanfilter);
 
@@ -273,11 +324,11 @@ bsp_status_t bsp_can_set_filter(bsp_dev_can_t dev_num,
 	hcanfilter.FilterMaskIdHigh = 0;
 	hcanfilter.FilterMaskIdLow = 0;
 	hcanfilter.FilterFIFOAssignment = CAN_FILTER_FIFO0;
-	hcanfilter.FilterNumber = 14*dev_num;
+	hcanfilter.FilterNumber = CAN_FILTER_BANKS*dev_num;
 	hcanfilter.FilterMode = CAN_FILTERMODE_IDLIST;
 	hcanfilter.FilterScale = CAN_FILTERSCALE_16BIT;
 	hcanfilter.FilterActivation = ENABLE;
-	hcanfilter.BankNumber = 14;
+	hcanfilter.BankNumber = CAN_FILTER_BANKS;
 
 	status = HAL_CAN_ConfigFilter(hcan, &hcanfilter);
 
@@ -296,10 +347,15 @@ bsp_status_t bsp_can_deinit(bsp_dev_can_t dev_num)
 
 	hcan = &can_handle[dev_num];
 
+	bsp_can_rx_irq_stop(dev_num);
+	if(can_tx_sched.can != NULL && can_tx_sched.dev_num == dev_num)
+		bsp_can_tx_sched_stop();
+
 	/* De-initialize the CAN comunication bus */
 	status = HAL_CAN_DeInit(hcan);
 
 	/* DeInit the low level hardware: GPIO, CLOCK, NVIC... */
+	hcan->Instance = NULL;
 	can_gpio_hw_deinit(dev_num);
 
 	return status;
@@ -361,3 +417,555 @@ bsp_status_t bsp_can_rxne(bsp_dev_can_t dev_num)
 	return __HAL_CAN_MSG_PENDING(hcan, CAN_FIFO0);
 }
 
+
+/**
+  * @brief  Drain a CAN RX FIFO to the device ring buffer (called from IRQ).
+  * @param  dev_num: CAN dev num.
+  * @param  fifo: FIFO number 0 or 1.
+  * @retval None
+  */
+static void can_rx_fifo_irq(bsp_dev_can_t dev_num, uint32_t fifo)
+{
+	CAN_TypeDef* can;
+	CAN_FIFOMailBox_TypeDef* mb;
+	volatile uint32_t* rfr;
+	can_rx_ring_t* ring;
+	bsp_can_rx_frame_t* frame;
+	uint32_t timestamp, head, rir, rdtr, data;
+
+	timestamp = DWT->CYCCNT;
+
+	can = can_handle[dev_num].Instance;
+	rfr = (fifo == 0) ? &can->RF0R : &can->RF1R;
+	mb = &can->sFIFOMailBox[fifo];
+	ring = &can_rx_ring[dev_num];
+
+	if(*rfr & CAN_RF0R_FOVR0) {
+		ring->overrun++;
+		/* Clear FULL & FOVR (rc_w1) */
+		*rfr = CAN_RF0R_FOVR0 | CAN_RF0R_FULL0;
+	}
+
+	while(*rfr & CAN_RF0R_FMP0) {
+		ring->frames++;
+		head = ring->head;
+		if((head - ring->tail) >= BSP_CAN_RX_RING_SIZE) {
+			ring->dropped++;
+		} else {
+			frame = &ring->frame[head & BSP_CAN_RX_RING_MASK];
+			rir = mb->RIR;
+			rdtr = mb->RDTR;
+			frame->timestamp = timestamp;
+			frame->dev_num = dev_num;
+			frame->flags = (fifo == 0) ? 0 : BSP_CAN_RX_FLAG_FIFO1;
+			if(rir & CAN_RI0R_IDE) {
+				frame->id = rir >> 3;
+				frame->flags |= BSP_CAN_RX_FLAG_EXT;
+			} else {
+				frame->id = rir >> 21;
+			}
+			if(rir & CAN_RI0R_RTR)
+				frame->flags |= BSP_CAN_RX_FLAG_RTR;
+			frame->dlc = rdtr & 0x0F;
+			frame->fmi = (rdtr & CAN_RDT0R_FMI) >> 8;
+			data = mb->RDLR;
+			frame->data[0] = data;
+			frame->data[1] = data >> 8;
+			frame->data[2] = data >> 16;
+			frame->data[3] = data >> 24;
+			data = mb->RDHR;
+			frame->data[4] = data;
+			frame->data[5] = data >> 8;
+			frame->data[6] = data >> 16;
+			frame->data[7] = data >> 24;
+			__DMB();
+			ring->head = head + 1;
+		}
+		/* Release the output mailbox */
+		*rfr = CAN_RF0R_RFOM0;
+	}
+}
+
+/**
+  * @brief  Count bus errors (called from status change/error IRQ).
+  * @param  dev_num: CAN dev num.
+  * @retval None
+  */
+static void can_sce_irq(bsp_dev_can_t dev_num)
+{
+	CAN_TypeDef* can;
+	uint32_t lec;
+
+	can = can_handle[dev_num].Instance;
+	lec = can->ESR & CAN_ESR_LEC;
+	/* LEC 0 no error, LEC 7 set by software */
+	if(lec != 0 && lec != CAN_ESR_LEC) {
+		can_rx_ring[dev_num].errors++;
+		can->ESR = CAN_ESR_LEC;
+	}
+	can->MSR = CAN_MSR_ERRI;
+}
+
+CH_IRQ_HANDLER(STM32_CAN1_RX0_HANDLER)
+{
+	CH_IRQ_PROLOGUE();
+	can_rx_fifo_irq(BSP_DEV_CAN1, 0);
+	CH_IRQ_EPILOGUE();
+}
+
+CH_IRQ_HANDLER(STM32_CAN1_RX1_HANDLER)
+{
+	CH_IRQ_PROLOGUE();
+	can_rx_fifo_irq(BSP_DEV_CAN1, 1);
+	CH_IRQ_EPILOGUE();
+}
+
+CH_IRQ_HANDLER(STM32_CAN2_RX0_HANDLER)
+{
+	CH_IRQ_PROLOGUE();
+	can_rx_fifo_irq(BSP_DEV_CAN2, 0);
+	CH_IRQ_EPILOGUE();
+}
+
+CH_IRQ_HANDLER(STM32_CAN2_RX1_HANDLER)
+{
+	CH_IRQ_PROLOGUE();
+	can_rx_fifo_irq(BSP_DEV_CAN2, 1);
+	CH_IRQ_EPILOGUE();
+}
+
+CH_IRQ_HANDLER(STM32_CAN1_SCE_HANDLER)
+{
+	CH_IRQ_PROLOGUE();
+	can_sce_irq(BSP_DEV_CAN1);
+	CH_IRQ_EPILOGUE();
+}
+
+CH_IRQ_HANDLER(STM32_CAN2_SCE_HANDLER)
+{
+	CH_IRQ_PROLOGUE();
+	can_sce_irq(BSP_DEV_CAN2);
+	CH_IRQ_EPILOGUE();
+}
+
+/**
+  * @brief  Start interrupt driven reception on FIFO0 and FIFO1.
+  *         Frames are then read with bsp_can_rx_irq_get().
+  * @param  dev_num: CAN dev num.
+  * @retval status of the start.
+  */
+bsp_status_t bsp_can_rx_irq_start(bsp_dev_can_t dev_num)
+{
+	CAN_TypeDef* can;
+	can_rx_ring_t* ring;
+
+	can = can_handle[dev_num].Instance;
+	if(can == NULL)
+		return BSP_ERROR;
+
+	ring = &can_rx_ring[dev_num];
+	ring->head = 0;
+	ring->tail = 0;
+	ring->frames = 0;
+	ring->dropped = 0;
+	ring->overrun = 0;
+	ring->errors = 0;
+	ring->active = TRUE;
+
+	if(dev_num == BSP_DEV_CAN1) {
+		nvicEnableVector(STM32_CAN1_RX0_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
+		nvicEnableVector(STM32_CAN1_RX1_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
+		nvicEnableVector(STM32_CAN1_SCE_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
+	} else {
+		nvicEnableVector(STM32_CAN2_RX0_NUMBER, STM32_CAN_CAN2_IRQ_PRIORITY);
+		nvicEnableVector(STM32_CAN2_RX1_NUMBER, STM32_CAN_CAN2_IRQ_PRIORITY);
+		nvicEnableVector(STM32_CAN2_SCE_NUMBER, STM32_CAN_CAN2_IRQ_PRIORITY);
+	}
+	can->ESR = CAN_ESR_LEC;
+	can->IER |= CAN_IER_FMPIE0 | CAN_IER_FOVIE0 |
+		    CAN_IER_FMPIE1 | CAN_IER_FOVIE1 |
+		    CAN_IER_ERRIE | CAN_IER_LECIE;
+
+	return BSP_OK;
+}
+
+/**
+  * @brief  Stop interrupt driven reception.
+  * @param  dev_num: CAN dev num.
+  * @retval None
+  */
+void bsp_can_rx_irq_stop(bsp_dev_can_t dev_num)
+{
+	CAN_TypeDef* can;
+
+	can = can_handle[dev_num].Instance;
+	if(can == NULL)
+		return;
+
+	can_rx_ring[dev_num].active = FALSE;
+	can->IER &= ~(CAN_IER_FMPIE0 | CAN_IER_FOVIE0 |
+		      CAN_IER_FMPIE1 | CAN_IER_FOVIE1 |
+		      CAN_IER_ERRIE | CAN_IER_LECIE);
+
+	if(dev_num == BSP_DEV_CAN1) {
+		nvicDisableVector(STM32_CAN1_RX0_NUMBER);
+		nvicDisableVector(STM32_CAN1_RX1_NUMBER);
+		nvicDisableVector(STM32_CAN1_SCE_NUMBER);
+	} else {
+		nvicDisableVector(STM32_CAN2_RX0_NUMBER);
+		nvicDisableVector(STM32_CAN2_RX1_NUMBER);
+		nvicDisableVector(STM32_CAN2_SCE_NUMBER);
+	}
+}
+
+/**
+  * @brief  Get oldest frame received by interrupt without removing it.
+  * @param  dev_num: CAN dev num.
+  * @retval Pointer to the frame or NULL if no frame is pending.
+  */
+bsp_can_rx_frame_t* bsp_can_rx_irq_get(bsp_dev_can_t dev_num)
+{
+	can_rx_ring_t* ring;
+	uint32_t tail;
+
+	ring = &can_rx_ring[dev_num];
+	tail = ring->tail;
+	if(ring->head == tail)
+		return NULL;
+	__DMB();
+	return &ring->frame[tail & BSP_CAN_RX_RING_MASK];
+}
+
+/**
+  * @brief  Get oldest frame received by interrupt on all started devices.
+  *         Used to merge CAN1 & CAN2 frames in timestamp order.
+  * @retval Pointer to the frame or NULL if no frame is pending,
+  *         shall be released with bsp_can_rx_irq_release(frame->dev_num).
+  */
+bsp_can_rx_frame_t* bsp_can_rx_irq_get_any(void)
+{
+	bsp_can_rx_frame_t* frame;
+	bsp_can_rx_frame_t* oldest;
+	int dev_num;
+
+	oldest = NULL;
+	for(dev_num = 0; dev_num < NB_CAN; dev_num++) {
+		if(can_rx_ring[dev_num].active == FALSE)
+			continue;
+		frame = bsp_can_rx_irq_get(dev_num);
+		if(frame == NULL)
+			continue;
+		/* Timestamps wrap, compare them with signed difference */
+		if(oldest == NULL ||
+		   (int32_t)(frame->timestamp - oldest->timestamp) < 0)
+			oldest = frame;
+	}
+	return oldest;
+}
+
+/**
+  * @brief  Release the frame returned by bsp_can_rx_irq_get().
+  * @param  dev_num: CAN dev num.
+  * @retval None
+  */
+void bsp_can_rx_irq_release(bsp_dev_can_t dev_num)
+{
+	can_rx_ring_t* ring;
+
+	ring = &can_rx_ring[dev_num];
+	__DMB();
+	ring->tail = ring->tail + 1;
+}
+
+/**
+  * @brief  Get interrupt driven reception counters.
+  * @param  dev_num: CAN dev num.
+  * @param  stats: counters.
+  * @retval None
+  */
+void bsp_can_rx_irq_get_stats(bsp_dev_can_t dev_num, bsp_can_rx_stats_t* stats)
+{
+	can_rx_ring_t* ring;
+
+	ring = &can_rx_ring[dev_num];
+	stats->frames = ring->frames;
+	stats->dropped = ring->dropped;
+	stats->overrun = ring->overrun;
+	stats->errors = ring->errors;
+	stats->tec = 0;
+	stats->rec = 0;
+	if(can_handle[dev_num].Instance != NULL) {
+		stats->tec = (can_handle[dev_num].Instance->ESR & CAN_ESR_TEC) >> 16;
+		stats->rec = (can_handle[dev_num].Instance->ESR & CAN_ESR_REC) >> 24;
+	}
+}
+
+/**
+  * @brief  Load a frame in a free TX mailbox.
+  * @param  can: CAN registers.
+  * @param  frame: frame to send.
+  * @retval FALSE if all mailboxes are busy.
+  */
+static bool can_tx_mailbox_load(CAN_TypeDef* can, bsp_can_tx_frame_t* frame)
+{
+	CAN_TxMailBox_TypeDef* mb;
+	uint32_t tsr, tir;
+
+	tsr = can->TSR;
+	if(tsr & CAN_TSR_TME0)
+		mb = &can->sTxMailBox[0];
+	else if(tsr & CAN_TSR_TME1)
+		mb = &can->sTxMailBox[1];
+	else if(tsr & CAN_TSR_TME2)
+		mb = &can->sTxMailBox[2];
+	else
+		return FALSE;
+
+	if(frame->flags & BSP_CAN_RX_FLAG_EXT)
+		tir = (frame->id << 3) | CAN_TI0R_IDE;
+	else
+		tir = frame->id << 21;
+	if(frame->flags & BSP_CAN_RX_FLAG_RTR)
+		tir |= CAN_TI0R_RTR;
+
+	mb->TIR = tir;
+	mb->TDTR = frame->dlc & 0x0F;
+	mb->TDLR = frame->data[0] | (frame->data[1] << 8) |
+		   (frame->data[2] << 16) | (frame->data[3] << 24);
+	mb->TDHR = frame->data[4] | (frame->data[5] << 8) |
+		   (frame->data[6] << 16) | (frame->data[7] << 24);
+	mb->TIR = tir | CAN_TI0R_TXRQ;
+	return TRUE;
+}
+
+/**
+  * @brief  Load due frames in TX mailboxes and arm the timer
+  *         for the next one (called from TIM3 and CAN TX IRQ).
+  * @retval None
+  */
+static void can_tx_sched_irq(void)
+{
+	can_tx_sched_t* sched;
+	bsp_can_tx_frame_t* frame;
+	uint32_t tail, ticks;
+	int32_t remaining;
+
+	sched = &can_tx_sched;
+	if(sched->can == NULL)
+		return;
+
+	while((tail = sched->tail) != sched->head) {
+		frame = &sched->frame[tail & BSP_CAN_TX_RING_MASK];
+		if(sched->due_valid == FALSE) {
+			sched->due = sched->last_due + frame->delay;
+			/* Queue was empty, do not try to catch up */
+			if(sched->starved && (int32_t)(sched->due - DWT->CYCCNT) < 0) {
+				sched->due = DWT->CYCCNT;
+				if(sched->frames > 0)
+					sched->late++;
+			}
+			sched->starved = FALSE;
+			sched->due_valid = TRUE;
+		}
+
+		remaining = sched->due - DWT->CYCCNT;
+		ticks = (remaining > 0) ? (remaining / CAN_TX_TIM_DIV) : 0;
+		if(ticks > 0) {
+			/* One shot, update event after ticks + 1 counts */
+			CAN_TX_TIM->CR1 = 0;
+			CAN_TX_TIM->CNT = 0;
+			CAN_TX_TIM->ARR = (ticks > 0xFFFF) ? 0xFFFF : ticks;
+			CAN_TX_TIM->SR = 0;
+			CAN_TX_TIM->CR1 = TIM_CR1_OPM | TIM_CR1_CEN;
+			return;
+		}
+
+		if(can_tx_mailbox_load(sched->can, frame) == FALSE) {
+			/* Continue when a mailbox is released */
+			sched->can->IER |= CAN_IER_TMEIE;
+			return;
+		}
+		sched->last_due = sched->due;
+		sched->due_valid = FALSE;
+		sched->frames++;
+		__DMB();
+		sched->tail = tail + 1;
+	}
+	sched->starved = TRUE;
+}
+
+static void can_tx_irq(bsp_dev_can_t dev_num)
+{
+	CAN_TypeDef* can;
+
+	can = can_handle[dev_num].Instance;
+	/* Clear request completed flags (and TXOK/ALST/TERR) */
+	can->TSR = CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2;
+	can->IER &= ~CAN_IER_TMEIE;
+	can_tx_sched_irq();
+}
+
+CH_IRQ_HANDLER(STM32_CAN1_TX_HANDLER)
+{
+	CH_IRQ_PROLOGUE();
+	can_tx_irq(BSP_DEV_CAN1);
+	CH_IRQ_EPILOGUE();
+}
+
+CH_IRQ_HANDLER(STM32_CAN2_TX_HANDLER)
+{
+	CH_IRQ_PROLOGUE();
+	can_tx_irq(BSP_DEV_CAN2);
+	CH_IRQ_EPILOGUE();
+}
+
+CH_IRQ_HANDLER(STM32_TIM3_HANDLER)
+{
+	CH_IRQ_PROLOGUE();
+	CAN_TX_TIM->SR = 0;
+	can_tx_sched_irq();
+	CH_IRQ_EPILOGUE();
+}
+
+/**
+  * @brief  Start scheduled transmission.
+  *         Frames queued with bsp_can_tx_sched_get()/bsp_can_tx_sched_commit()
+  *         are loaded in TX mailboxes by TIM3 interrupt at
+  *         previous frame time + frame delay. Mailboxes are sent in request
+  *         order so back to back frames keep the 3 mailboxes full.
+  * @param  dev_num: CAN dev num.
+  * @retval status of the start.
+  */
+bsp_status_t bsp_can_tx_sched_start(bsp_dev_can_t dev_num)
+{
+	can_tx_sched_t* sched;
+	CAN_TypeDef* can;
+
+	can = can_handle[dev_num].Instance;
+	if(can == NULL)
+		return BSP_ERROR;
+
+	sched = &can_tx_sched;
+	sched->can = NULL;
+	sched->dev_num = dev_num;
+	sched->head = 0;
+	sched->tail = 0;
+	sched->frames = 0;
+	sched->late = 0;
+	sched->due_valid = FALSE;
+	sched->starved = TRUE;
+
+	__TIM3_CLK_ENABLE();
+	__TIM3_FORCE_RESET();
+	__TIM3_RELEASE_RESET();
+	CAN_TX_TIM->PSC = 0;
+	CAN_TX_TIM->SR = 0;
+	CAN_TX_TIM->DIER = TIM_DIER_UIE;
+	sched->last_due = DWT->CYCCNT;
+
+	/* Transmit mailboxes by request order instead of ID priority */
+	can->MCR |= CAN_MCR_TXFP;
+	can->TSR = CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2;
+
+	sched->can = can;
+	if(dev_num == BSP_DEV_CAN1)
+		nvicEnableVector(STM32_CAN1_TX_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
+	else
+		nvicEnableVector(STM32_CAN2_TX_NUMBER, STM32_CAN_CAN2_IRQ_PRIORITY);
+	nvicEnableVector(STM32_TIM3_NUMBER, STM32_CAN_CAN1_IRQ_PRIORITY);
+
+	return BSP_OK;
+}
+
+/**
+  * @brief  Stop scheduled transmission, frames not yet sent are aborted.
+  * @retval None
+  */
+void bsp_can_tx_sched_stop(void)
+{
+	can_tx_sched_t* sched;
+	CAN_TypeDef* can;
+
+	sched = &can_tx_sched;
+	can = sched->can;
+	if(can == NULL)
+		return;
+
+	nvicDisableVector(STM32_TIM3_NUMBER);
+	CAN_TX_TIM->CR1 = 0;
+	CAN_TX_TIM->DIER = 0;
+	__TIM3_CLK_DISABLE();
+
+	can->IER &= ~CAN_IER_TMEIE;
+	if(sched->dev_num == BSP_DEV_CAN1)
+		nvicDisableVector(STM32_CAN1_TX_NUMBER);
+	else
+		nvicDisableVector(STM32_CAN2_TX_NUMBER);
+
+	can->TSR = CAN_TSR_ABRQ0 | CAN_TSR_ABRQ1 | CAN_TSR_ABRQ2;
+	can->MCR &= ~CAN_MCR_TXFP;
+	sched->can = NULL;
+}
+
+/**
+  * @brief  Get a free frame in the scheduled transmission queue.
+  * @retval Pointer to the frame to fill or NULL if queue is full,
+  *         shall be queued with bsp_can_tx_sched_commit().
+  */
+bsp_can_tx_frame_t* bsp_can_tx_sched_get(void)
+{
+	can_tx_sched_t* sched;
+	uint32_t head;
+
+	sched = &can_tx_sched;
+	head = sched->head;
+	if((head - sched->tail) >= BSP_CAN_TX_RING_SIZE)
+		return NULL;
+	return &sched->frame[head & BSP_CAN_TX_RING_MASK];
+}
+
+/**
+  * @brief  Queue the frame returned by bsp_can_tx_sched_get().
+  * @retval None
+  */
+void bsp_can_tx_sched_commit(void)
+{
+	can_tx_sched_t* sched;
+
+	sched = &can_tx_sched;
+	__DMB();
+	sched->head = sched->head + 1;
+	/* Software update event, runs the scheduler if it is idle */
+	if(sched->starved)
+		CAN_TX_TIM->EGR = TIM_EGR_UG;
+}
+
+/**
+  * @brief  Number of frames queued or in TX mailboxes not yet sent.
+  * @retval Number of frames.
+  */
+uint32_t bsp_can_tx_sched_pending(void)
+{
+	CAN_TypeDef* can;
+	uint32_t nb, tsr;
+
+	nb = can_tx_sched.head - can_tx_sched.tail;
+	can = can_tx_sched.can;
+	if(can != NULL) {
+		tsr = can->TSR;
+		nb += ((tsr & CAN_TSR_TME0) == 0) + ((tsr & CAN_TSR_TME1) == 0) +
+		      ((tsr & CAN_TSR_TME2) == 0);
+	}
+	return nb;
+}
+
+/**
+  * @brief  Get scheduled transmission counters.
+  * @param  stats: counters.
+  * @retval None
+  */
+void bsp_can_tx_sched_get_stats(bsp_can_tx_stats_t* stats)
+{
+	stats->frames = can_tx_sched.frames;
+	stats->late = can_tx_sched.late;
+}
@@ -26,6 +26,52 @@ typedef enum {
 	BSP_DEV_CAN_END = 2
 } bsp_dev_can_t;
 
+/* Interrupt driven reception, number of frames per device (power of 2) */
+#define BSP_CAN_RX_RING_SIZE (256)
+
+#define BSP_CAN_RX_FLAG_EXT   (1 << 0) /* Extended ID */
+#define BSP_CAN_RX_FLAG_RTR   (1 << 1) /* Remote frame */
+#define BSP_CAN_RX_FLAG_FIFO1 (1 << 2) /* Received in FIFO1 */
+
+typedef struct {
+	uint32_t timestamp; /* DWT cycle counter at reception */
+	uint32_t id; /* StdId or ExtId */
+	uint8_t dev_num;
+	uint8_t flags; /* BSP_CAN_RX_FLAG_xxx */
+	uint8_t dlc;
+	uint8_t fmi; /* Filter match index */
+	uint8_t data[8];
+} bsp_can_rx_frame_t;
+
+typedef struct {
+	uint32_t frames; /* Frames read from hardware FIFOs */
+	uint32_t dropped; /* Frames lost because ring buffer was full */
+	uint32_t overrun; /* Hardware FIFO overruns (frames lost by controller) */
+	uint32_t errors; /* Bus errors (last error code) */
+	uint8_t tec; /* Transmit error counter */
+	uint8_t rec; /* Receive error counter */
+} bsp_can_rx_stats_t;
+
+/* Scheduled transmission by timer interrupt, number of frames (power of 2) */
+#define BSP_CAN_TX_RING_SIZE (256)
+/* Scheduled transmission time base is the DWT cycle counter */
+#define BSP_CAN_TX_CLOCK (STM32_SYSCLK)
+/* Max delay between 2 frames in cycles */
+#define BSP_CAN_TX_DELAY_MAX (0x7FFFFFFF)
+
+typedef struct {
+	uint32_t delay; /* Cycles after previous frame, 0 = as soon as possible */
+	uint32_t id; /* StdId or ExtId */
+	uint8_t flags; /* BSP_CAN_RX_FLAG_EXT and BSP_CAN_RX_FLAG_RTR */
+	uint8_t dlc;
+	uint8_t data[8];
+} bsp_can_tx_frame_t;
+
+typedef struct {
+	uint32_t frames; /* Frames loaded in TX mailboxes */
+	uint32_t late; /* Frames delayed because queue was empty */
+} bsp_can_tx_stats_t;
+
 bsp_status_t bsp_can_init(bsp_dev_can_t dev_num, mode_config_proto_t* mode_conf);
 uint32_t bsp_can_get_speed(bsp_dev_can_t dev_num);
 bsp_status_t bsp_can_set_speed(bsp_dev_can_t dev_num, uint32_t speed);
@@ -37,4 +83,18 @@ bsp_status_t bsp_can_read(bsp_dev_can_t dev_num, CanRxMsgTypeDef* rx_msg);
 
 bsp_status_t bsp_can_rxne(bsp_dev_can_t dev_num);
 
+bsp_status_t bsp_can_rx_irq_start(bsp_dev_can_t dev_num);
+void bsp_can_rx_irq_stop(bsp_dev_can_t dev_num);
+bsp_can_rx_frame_t* bsp_can_rx_irq_get(bsp_dev_can_t dev_num);
+bsp_can_rx_frame_t* bsp_can_rx_irq_get_any(void);
+void bsp_can_rx_irq_release(bsp_dev_can_t dev_num);
+void bsp_can_rx_irq_get_stats(bsp_dev_can_t dev_num, bsp_can_rx_stats_t* stats);
+
+bsp_status_t bsp_can_tx_sched_start(bsp_dev_can_t dev_num);
+void bsp_can_tx_sched_stop(void);
+bsp_can_tx_frame_t* bsp_can_tx_sched_get(void);
+void bsp_can_tx_sched_commit(void);
+uint32_t bsp_can_tx_sched_pending(void);
+void bsp_can_tx_sched_get_stats(bsp_can_tx_stats_t* stats);
+
 #endif /* _BSP_CAN_H_ */
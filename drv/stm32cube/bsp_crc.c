@@ -0,0 +1,113 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2016 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "bsp_crc.h"
+#include "stm32f405xx.h"
+
+/*
+ * CRC calculation unit: polynomial 0x04C11DB7, 32bits words input,
+ * MSB first, initial value 0xFFFFFFFF, no final XOR (CRC-32/MPEG-2).
+ * One word is processed in 4 AHB clock cycles.
+ */
+CRC_HandleTypeDef hcrc;
+
+/** \brief Init CRC calculation unit and reset its data register.
+ *
+ * \return bsp_status_t: status of the init.
+ *
+ */
+bsp_status_t bsp_crc_init(void)
+{
+	hcrc.Instance = CRC;
+
+	__HAL_RCC_CRC_CLK_ENABLE();
+
+	__HAL_CRC_DR_RESET(&hcrc);
+
+	return BSP_OK;
+}
+
+/** \brief De-initialize the CRC calculation unit.
+ *
+ * \return bsp_status_t: Status of the deinit.
+ *
+ */
+bsp_status_t bsp_crc_deinit(void)
+{
+	hcrc.Instance = CRC;
+
+	__HAL_RCC_CRC_CLK_DISABLE();
+
+	return BSP_OK;
+}
+
+/** \brief Reset CRC data register to 0xFFFFFFFF.
+ *
+ * \return void
+ *
+ */
+void bsp_crc_reset(void)
+{
+	hcrc.Instance = CRC;
+
+	__HAL_CRC_DR_RESET(&hcrc);
+}
+
+/** \brief Accumulate words in CRC.
+ *
+ * \param buf const uint32_t*: words to process.
+ * \param nb_words uint32_t: number of words.
+ * \return uint32_t: CRC data register.
+ *
+ */
+uint32_t bsp_crc_update(const uint32_t *buf, uint32_t nb_words)
+{
+	uint32_t i;
+
+	for(i = 0; i < nb_words; i++)
+		CRC->DR = buf[i];
+
+	return CRC->DR;
+}
+
+/** \brief Accumulate little endian words with bits reversed, for reflected
+ * CRC-32 (IEEE 802.3, zlib) the result is ~__RBIT(CRC data register).
+ *
+ * \param buf const uint8_t*: data, no alignment constraint.
+ * \param nb_words uint32_t: number of 32bits words.
+ * \return uint32_t: CRC data register.
+ *
+ */
+uint32_t bsp_crc_update_reflected(const uint8_t *buf, uint32_t nb_words)
+{
+	uint32_t i, word;
+
+	for(i = 0; i < nb_words; i++) {
+		word = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+		CRC->DR = __RBIT(word);
+		buf += 4;
+	}
+
+	return CRC->DR;
+}
+
+/** \brief Returns current CRC value.
+ *
+ * \return uint32_t: CRC data register.
+ *
+ */
+uint32_t bsp_crc_get(void)
+{
+	return CRC->DR;
+}
@@ -0,0 +1,29 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2016 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef _BSP_CRC_H_
+#define _BSP_CRC_H_
+
+#include "bsp.h"
+#include "stm32f4xx_hal.h"
+
+bsp_status_t bsp_crc_init(void);
+bsp_status_t bsp_crc_deinit(void);
+
+void bsp_crc_reset(void);
+uint32_t bsp_crc_update(const uint32_t *buf, uint32_t nb_words);
+uint32_t bsp_crc_update_reflected(const uint8_t *buf, uint32_t nb_words);
+uint32_t bsp_crc_get(void);
+
+#endif /* _BSP_CRC_H_ */
@@ -12,10 +12,28 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include "ch.h"
+#include "hal.h"
+
 #include "bsp_gpio.h"
 #include "stm32f405xx.h"
 #include "stm32f4xx_hal.h"
 
+/*
+ * Port waveform: TIM1 CC1 DMA request writes the next state in BSRR at
+ * the start of each period, TIM1 CC3 DMA request samples IDR at half
+ * period. DMA2 channel 6 stream 1 (TIM1_CH1) and stream 6 (TIM1_CH3)
+ * are not used by other drivers.
+ */
+#define GPIO_WAVE_TIM (TIM1)
+#define GPIO_WAVE_OUT_DMA_STREAM STM32_DMA_STREAM_ID(2, 1)
+#define GPIO_WAVE_IN_DMA_STREAM STM32_DMA_STREAM_ID(2, 6)
+#define GPIO_WAVE_DMA_CHANNEL (6)
+#define GPIO_WAVE_DMA_PRIORITY (3)
+#define GPIO_WAVE_IRQ_PRIORITY (10)
+/* Added to waveform duration */
+#define GPIO_WAVE_TIMEOUT_MS (100)
+
 /** \brief Init GPIO
  *
  * \param gpio_port bsp_gpio_port_t GPIO port to configure
@@ -145,3 +163,114 @@ uint16_t bsp_gpio_port_read(bsp_gpio_port_t gpio_port)
 
 	return hal_gpio_port->IDR;
 }
+
+/** \brief Set and clear pins of a port at the same time (BSRR write)
+ *
+ * \param gpio_port bsp_gpio_port_t GPIO port
+ * \param set_mask uint16_t pins to set
+ * \param clr_mask uint16_t pins to clear, set has priority
+ * \return void
+ *
+ */
+void bsp_gpio_port_write(bsp_gpio_port_t gpio_port, uint16_t set_mask,
+			 uint16_t clr_mask)
+{
+	GPIO_TypeDef *hal_gpio_port;
+
+	hal_gpio_port = (GPIO_TypeDef *)gpio_port;
+	*(__IO uint32_t *)&hal_gpio_port->BSRRL = set_mask | (clr_mask << 16);
+}
+
+/** \brief Play BSRR values at a fixed rate and sample the port input
+ * at half period, blocking until the end of the waveform.
+ *
+ * \param gpio_port bsp_gpio_port_t GPIO port
+ * \param bsrr const uint32_t* BSRR value of each period (DMA capable memory)
+ * \param idr uint16_t* IDR samples, one per period (DMA capable memory)
+ * \param nb uint16_t number of periods
+ * \param rate uint32_t periods per second (max BSP_GPIO_WAVE_RATE_MAX)
+ * \return bsp_status_t BSP_ERROR on invalid parameters or DMA busy,
+ * BSP_TIMEOUT if the waveform did not end.
+ *
+ */
+bsp_status_t bsp_gpio_port_wave(bsp_gpio_port_t gpio_port, const uint32_t *bsrr,
+				uint16_t *idr, uint16_t nb, uint32_t rate)
+{
+	const stm32_dma_stream_t *out, *in;
+	GPIO_TypeDef *hal_gpio_port;
+	bsp_status_t status;
+	uint32_t div, psc, arr, mode, duration;
+	systime_t start;
+
+	if(nb == 0 || rate == 0 || rate > BSP_GPIO_WAVE_RATE_MAX)
+		return BSP_ERROR;
+	hal_gpio_port = (GPIO_TypeDef *)gpio_port;
+
+	out = STM32_DMA_STREAM(GPIO_WAVE_OUT_DMA_STREAM);
+	in = STM32_DMA_STREAM(GPIO_WAVE_IN_DMA_STREAM);
+	/* End of waveform is polled, no DMA IRQ */
+	if(dmaStreamAllocate(out, GPIO_WAVE_IRQ_PRIORITY, NULL, NULL))
+		return BSP_ERROR;
+	if(dmaStreamAllocate(in, GPIO_WAVE_IRQ_PRIORITY, NULL, NULL)) {
+		dmaStreamRelease(out);
+		return BSP_ERROR;
+	}
+
+	/* Period = (PSC + 1) * (ARR + 1) timer clocks */
+	div = STM32_TIMCLK2 / rate;
+	psc = (div - 1) >> 16;
+	arr = div / (psc + 1) - 1;
+
+	__TIM1_CLK_ENABLE();
+	__TIM1_FORCE_RESET();
+	__TIM1_RELEASE_RESET();
+	GPIO_WAVE_TIM->PSC = psc;
+	GPIO_WAVE_TIM->ARR = arr;
+	GPIO_WAVE_TIM->CCR1 = 0;
+	GPIO_WAVE_TIM->CCR3 = (arr + 1) / 2;
+	GPIO_WAVE_TIM->EGR = TIM_EGR_UG;
+	GPIO_WAVE_TIM->SR = 0;
+	/* First period starts at next counter wrap */
+	GPIO_WAVE_TIM->CNT = arr;
+	GPIO_WAVE_TIM->DIER = TIM_DIER_CC1DE | TIM_DIER_CC3DE;
+
+	mode = STM32_DMA_CR_CHSEL(GPIO_WAVE_DMA_CHANNEL) |
+	       STM32_DMA_CR_PL(GPIO_WAVE_DMA_PRIORITY) | STM32_DMA_CR_MINC;
+	dmaStreamSetPeripheral(out, &hal_gpio_port->BSRRL);
+	dmaStreamSetMemory0(out, bsrr);
+	dmaStreamSetTransactionSize(out, nb);
+	dmaStreamSetMode(out, mode | STM32_DMA_CR_DIR_M2P |
+			 STM32_DMA_CR_PSIZE_WORD | STM32_DMA_CR_MSIZE_WORD);
+	dmaStreamSetPeripheral(in, &hal_gpio_port->IDR);
+	dmaStreamSetMemory0(in, idr);
+	dmaStreamSetTransactionSize(in, nb);
+	dmaStreamSetMode(in, mode | STM32_DMA_CR_DIR_P2M |
+			 STM32_DMA_CR_PSIZE_HWORD | STM32_DMA_CR_MSIZE_HWORD);
+	dmaStreamEnable(out);
+	dmaStreamEnable(in);
+
+	GPIO_WAVE_TIM->CR1 = TIM_CR1_CEN;
+
+	status = BSP_OK;
+	duration = ((uint64_t)nb * 1000) / rate; /* ms */
+	start = chVTGetSystemTime();
+	while(dmaStreamGetTransactionSize(in) > 0) {
+		if((chVTGetSystemTime() - start) > MS2ST(duration + GPIO_WAVE_TIMEOUT_MS)) {
+			status = BSP_TIMEOUT;
+			break;
+		}
+		/* Short waveforms are polled to return as soon as possible */
+		if(duration > 1)
+			chThdSleepMilliseconds(1);
+	}
+
+	GPIO_WAVE_TIM->CR1 = 0;
+	GPIO_WAVE_TIM->DIER = 0;
+	__TIM1_CLK_DISABLE();
+	dmaStreamDisable(out);
+	dmaStreamDisable(in);
+	dmaStreamRelease(out);
+	dmaStreamRelease(in);
+
+	return status;
+}
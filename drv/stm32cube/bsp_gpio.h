@@ -43,4 +43,13 @@ bsp_gpio_pinstate bsp_gpio_pin_read(bsp_gpio_port_t gpio_port, uint16_t gpio_pin
 
 uint16_t bsp_gpio_port_read(bsp_gpio_port_t gpio_port);
 
+void bsp_gpio_port_write(bsp_gpio_port_t gpio_port, uint16_t set_mask,
+			 uint16_t clr_mask);
+
+/* Max periods per second of bsp_gpio_port_wave() */
+#define BSP_GPIO_WAVE_RATE_MAX (4000000)
+
+bsp_status_t bsp_gpio_port_wave(bsp_gpio_port_t gpio_port, const uint32_t *bsrr,
+				uint16_t *idr, uint16_t nb, uint32_t rate);
+
 #endif /* _BSP_GPIO_H_ */
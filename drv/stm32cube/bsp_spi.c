@@ -12,6 +12,9 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include "ch.h"
+#include "hal.h"
+
 #include "bsp_spi.h"
 #include "bsp_spi_conf.h"
 #include "stm32f405xx.h"
@@ -25,6 +28,31 @@ Warning in order to use this driver all GPIOs peripherals shall be enabled.
 static SPI_HandleTypeDef spi_handle[NB_SPI];
 static mode_config_proto_t* spi_mode_conf[NB_SPI];
 
+/* DMA RX streams/channels, see mcuconf.h */
+#define SPI1_RX_DMA_CHANNEL STM32_DMA_GETCHANNEL(STM32_SPI_SPI1_RX_DMA_STREAM, STM32_SPI1_RX_DMA_CHN)
+#define SPI2_RX_DMA_CHANNEL STM32_DMA_GETCHANNEL(STM32_SPI_SPI2_RX_DMA_STREAM, STM32_SPI2_RX_DMA_CHN)
+#define SPI1_TX_DMA_CHANNEL STM32_DMA_GETCHANNEL(STM32_SPI_SPI1_TX_DMA_STREAM, STM32_SPI1_TX_DMA_CHN)
+#define SPI2_TX_DMA_CHANNEL STM32_DMA_GETCHANNEL(STM32_SPI_SPI2_TX_DMA_STREAM, STM32_SPI2_TX_DMA_CHN)
+#define SPIx_DMA_TIMEOUT_MS (1000)
+
+/* Circular DMA reception */
+typedef struct {
+	const stm32_dma_stream_t* dma;
+	uint32_t size;
+	volatile uint32_t laps; /* Number of buffer wrap */
+} spi_rx_dma_t;
+static spi_rx_dma_t spi_rx_dma[NB_SPI];
+
+/* Full duplex DMA transfer (master) */
+typedef struct {
+	const stm32_dma_stream_t* rx;
+	const stm32_dma_stream_t* tx;
+	binary_semaphore_t done; /* Signaled by RX DMA end of transfer */
+} spi_dma_t;
+static spi_dma_t spi_dma[NB_SPI];
+static const uint8_t spi_dma_tx_dummy = 0xFF;
+static uint8_t spi_dma_rx_dummy;
+
 /**
   * @brief  Init low level hardware: GPIO, CLOCK, NVIC...
   * @param  dev_num: SPI dev num
@@ -238,6 +266,8 @@ bsp_status_t bsp_spi_deinit(bsp_dev_spi_t dev_num)
 
 	hspi = &spi_handle[dev_num];
 
+	bsp_spi_rx_dma_stop(dev_num);
+
 	/* De-initialize the SPI comunication bus */
 	status = HAL_SPI_DeInit(hspi);
 
@@ -360,3 +390,328 @@ bsp_status_t bsp_spi_write_read_u8(bsp_dev_spi_t dev_num, uint8_t* tx_data, uint
 	return status;
 }
 
+
+static void spi_rx_dma_irq(void* p, uint32_t flags)
+{
+	spi_rx_dma_t* rx = (spi_rx_dma_t*)p;
+
+	if(flags & STM32_DMA_ISR_TCIF)
+		rx->laps++;
+}
+
+/**
+  * @brief  Start continuous reception with circular DMA (slave mode only).
+  *         SPI is set in receive only mode, MISO is not driven.
+  * @param  dev_num: SPI dev num.
+  * @param  rx_buf: Circular buffer.
+  * @param  size: Size of rx_buf, power of 2 up to 32768.
+  * @retval status: BSP_ERROR if not in slave mode or DMA stream is used.
+  */
+bsp_status_t bsp_spi_rx_dma_start(bsp_dev_spi_t dev_num, uint8_t* rx_buf, uint32_t size)
+{
+	SPI_HandleTypeDef* hspi;
+	spi_rx_dma_t* rx;
+	uint32_t mode, irq_prio;
+
+	hspi = &spi_handle[dev_num];
+	rx = &spi_rx_dma[dev_num];
+
+	if(hspi->Init.Mode != SPI_MODE_SLAVE || size == 0 || size > 32768)
+		return BSP_ERROR;
+
+	if(dev_num == BSP_DEV_SPI1) {
+		rx->dma = STM32_DMA_STREAM(STM32_SPI_SPI1_RX_DMA_STREAM);
+		mode = STM32_DMA_CR_CHSEL(SPI1_RX_DMA_CHANNEL) |
+		       STM32_DMA_CR_PL(STM32_SPI_SPI1_DMA_PRIORITY);
+		irq_prio = STM32_SPI_SPI1_IRQ_PRIORITY;
+	} else { /* SPI2 */
+		rx->dma = STM32_DMA_STREAM(STM32_SPI_SPI2_RX_DMA_STREAM);
+		mode = STM32_DMA_CR_CHSEL(SPI2_RX_DMA_CHANNEL) |
+		       STM32_DMA_CR_PL(STM32_SPI_SPI2_DMA_PRIORITY);
+		irq_prio = STM32_SPI_SPI2_IRQ_PRIORITY;
+	}
+
+	/* Stream already used (HydraNFC sniffer use SPI1 RX stream) */
+	if(dmaStreamAllocate(rx->dma, irq_prio, spi_rx_dma_irq, rx)) {
+		rx->dma = NULL;
+		return BSP_ERROR;
+	}
+	rx->size = size;
+	rx->laps = 0;
+
+	__HAL_SPI_DISABLE(hspi);
+	hspi->Instance->CR1 |= SPI_CR1_RXONLY;
+	/* Flush data received before start */
+	(void)hspi->Instance->DR;
+
+	dmaStreamSetPeripheral(rx->dma, &hspi->Instance->DR);
+	dmaStreamSetMemory0(rx->dma, rx_buf);
+	dmaStreamSetTransactionSize(rx->dma, size);
+	dmaStreamSetMode(rx->dma, mode | STM32_DMA_CR_DIR_P2M |
+			 STM32_DMA_CR_MINC | STM32_DMA_CR_CIRC |
+			 STM32_DMA_CR_PSIZE_BYTE | STM32_DMA_CR_MSIZE_BYTE |
+			 STM32_DMA_CR_TCIE);
+	dmaStreamEnable(rx->dma);
+
+	hspi->Instance->CR2 |= SPI_CR2_RXDMAEN;
+	__HAL_SPI_ENABLE(hspi);
+
+	return BSP_OK;
+}
+
+/**
+  * @brief  Stop reception started with bsp_spi_rx_dma_start().
+  * @param  dev_num: SPI dev num.
+  */
+void bsp_spi_rx_dma_stop(bsp_dev_spi_t dev_num)
+{
+	SPI_HandleTypeDef* hspi;
+	spi_rx_dma_t* rx;
+
+	hspi = &spi_handle[dev_num];
+	rx = &spi_rx_dma[dev_num];
+
+	if(rx->dma == NULL)
+		return;
+
+	hspi->Instance->CR2 &= ~SPI_CR2_RXDMAEN;
+	dmaStreamDisable(rx->dma);
+	dmaStreamRelease(rx->dma);
+	rx->dma = NULL;
+
+	__HAL_SPI_DISABLE(hspi);
+	hspi->Instance->CR1 &= ~SPI_CR1_RXONLY;
+	__HAL_SPI_ENABLE(hspi);
+}
+
+/**
+  * @brief  Total number of bytes received since bsp_spi_rx_dma_start(),
+  *         modulo 2^32. Position in buffer is count & (size - 1).
+  *         Can be called from thread or IRQ.
+  * @param  dev_num: SPI dev num.
+  * @retval Number of bytes received.
+  */
+uint32_t bsp_spi_rx_dma_count(bsp_dev_spi_t dev_num)
+{
+	spi_rx_dma_t* rx;
+	syssts_t sts;
+	uint32_t laps, ndtr, isr;
+
+	rx = &spi_rx_dma[dev_num];
+
+	sts = chSysGetStatusAndLockX();
+	laps = rx->laps;
+	ndtr = dmaStreamGetTransactionSize(rx->dma);
+	/* LISR/HISR registers are located 2 words before LIFCR/HIFCR */
+	isr = *(rx->dma->ifcr - 2) >> rx->dma->ishift;
+	/*
+	 * Buffer wrapped but DMA IRQ not yet served (locked or called from
+	 * a higher priority IRQ), NDTR was read after reload.
+	 */
+	if((isr & STM32_DMA_ISR_TCIF) && ndtr > (rx->size / 2))
+		laps++;
+	chSysRestoreStatusX(sts);
+
+	return (laps * rx->size) + (rx->size - ndtr);
+}
+
+/**
+  * @brief  Restart slave byte framing: the next received bit is the MSB
+  *         (or LSB) of a new byte. Shall be called while CS is inactive.
+  * @param  dev_num: SPI dev num.
+  */
+void bsp_spi_slave_resync(bsp_dev_spi_t dev_num)
+{
+	SPI_TypeDef* spi;
+
+	spi = spi_handle[dev_num].Instance;
+	spi->CR1 &= ~SPI_CR1_SPE;
+	spi->CR1 |= SPI_CR1_SPE;
+}
+
+/**
+  * @brief  Configure Chip Select pin as input (sniffer).
+  * @param  dev_num: SPI dev num.
+  */
+void bsp_spi_cs_input(bsp_dev_spi_t dev_num)
+{
+	GPIO_InitTypeDef GPIO_InitStructure;
+
+	GPIO_InitStructure.Mode = GPIO_MODE_INPUT;
+	GPIO_InitStructure.Pull  = GPIO_PULLUP;
+	GPIO_InitStructure.Speed = GPIO_SPEED_HIGH;
+	if(dev_num == BSP_DEV_SPI1) {
+		GPIO_InitStructure.Pin = BSP_SPI1_NSS_PIN;
+		HAL_GPIO_Init(BSP_SPI1_NSS_PORT, &GPIO_InitStructure);
+	} else { /* SPI2 */
+		GPIO_InitStructure.Pin = BSP_SPI2_NSS_PIN;
+		HAL_GPIO_Init(BSP_SPI2_NSS_PORT, &GPIO_InitStructure);
+	}
+}
+
+/* RX DMA end of transfer (or error), wake up bsp_spi_dma_wait() */
+static void spi_dma_irq(void* p, uint32_t flags)
+{
+	spi_dma_t* dma = (spi_dma_t*)p;
+
+	if(flags & (STM32_DMA_ISR_TCIF | STM32_DMA_ISR_TEIF)) {
+		chSysLockFromISR();
+		chBSemSignalI(&dma->done);
+		chSysUnlockFromISR();
+	}
+}
+
+/**
+  * @brief  Start a full duplex transfer with DMA, bsp_spi_dma_wait() shall
+  *         be called before any other SPI access.
+  *         Buffers shall be DMA capable (not in CCM).
+  * @param  dev_num: SPI dev num.
+  * @param  tx_data: Data to send, NULL to send 0xFF.
+  * @param  rx_data: Data received, NULL to discard received data.
+  * @param  nb_data: Number of data to send & receive (max 65535).
+  * @retval status: BSP_ERROR if a DMA stream is used.
+  */
+bsp_status_t bsp_spi_dma_start(bsp_dev_spi_t dev_num, const uint8_t* tx_data, uint8_t* rx_data, uint16_t nb_data)
+{
+	SPI_HandleTypeDef* hspi;
+	spi_dma_t* dma;
+	uint32_t rx_mode, tx_mode, irq_prio;
+
+	hspi = &spi_handle[dev_num];
+	dma = &spi_dma[dev_num];
+
+	if(nb_data == 0)
+		return BSP_ERROR;
+
+	if(dev_num == BSP_DEV_SPI1) {
+		dma->rx = STM32_DMA_STREAM(STM32_SPI_SPI1_RX_DMA_STREAM);
+		dma->tx = STM32_DMA_STREAM(STM32_SPI_SPI1_TX_DMA_STREAM);
+		rx_mode = STM32_DMA_CR_CHSEL(SPI1_RX_DMA_CHANNEL) |
+			  STM32_DMA_CR_PL(STM32_SPI_SPI1_DMA_PRIORITY);
+		tx_mode = STM32_DMA_CR_CHSEL(SPI1_TX_DMA_CHANNEL) |
+			  STM32_DMA_CR_PL(STM32_SPI_SPI1_DMA_PRIORITY);
+		irq_prio = STM32_SPI_SPI1_IRQ_PRIORITY;
+	} else { /* SPI2 */
+		dma->rx = STM32_DMA_STREAM(STM32_SPI_SPI2_RX_DMA_STREAM);
+		dma->tx = STM32_DMA_STREAM(STM32_SPI_SPI2_TX_DMA_STREAM);
+		rx_mode = STM32_DMA_CR_CHSEL(SPI2_RX_DMA_CHANNEL) |
+			  STM32_DMA_CR_PL(STM32_SPI_SPI2_DMA_PRIORITY);
+		tx_mode = STM32_DMA_CR_CHSEL(SPI2_TX_DMA_CHANNEL) |
+			  STM32_DMA_CR_PL(STM32_SPI_SPI2_DMA_PRIORITY);
+		irq_prio = STM32_SPI_SPI2_IRQ_PRIORITY;
+	}
+
+	/* End of transfer signaled by RX DMA IRQ */
+	chBSemObjectInit(&dma->done, TRUE);
+	if(dmaStreamAllocate(dma->rx, irq_prio, spi_dma_irq, dma)) {
+		dma->rx = NULL;
+		return BSP_ERROR;
+	}
+	if(dmaStreamAllocate(dma->tx, irq_prio, NULL, NULL)) {
+		dmaStreamRelease(dma->rx);
+		dma->rx = NULL;
+		return BSP_ERROR;
+	}
+
+	/* Flush data received before (OVR is cleared by DR then SR read) */
+	(void)hspi->Instance->DR;
+	(void)hspi->Instance->SR;
+
+	dmaStreamSetPeripheral(dma->rx, &hspi->Instance->DR);
+	if(rx_data != NULL) {
+		dmaStreamSetMemory0(dma->rx, rx_data);
+		rx_mode |= STM32_DMA_CR_MINC;
+	} else {
+		dmaStreamSetMemory0(dma->rx, &spi_dma_rx_dummy);
+	}
+	dmaStreamSetTransactionSize(dma->rx, nb_data);
+	dmaStreamSetMode(dma->rx, rx_mode | STM32_DMA_CR_DIR_P2M |
+			 STM32_DMA_CR_PSIZE_BYTE | STM32_DMA_CR_MSIZE_BYTE |
+			 STM32_DMA_CR_TCIE | STM32_DMA_CR_TEIE);
+
+	dmaStreamSetPeripheral(dma->tx, &hspi->Instance->DR);
+	if(tx_data != NULL) {
+		dmaStreamSetMemory0(dma->tx, tx_data);
+		tx_mode |= STM32_DMA_CR_MINC;
+	} else {
+		dmaStreamSetMemory0(dma->tx, &spi_dma_tx_dummy);
+	}
+	dmaStreamSetTransactionSize(dma->tx, nb_data);
+	dmaStreamSetMode(dma->tx, tx_mode | STM32_DMA_CR_DIR_M2P |
+			 STM32_DMA_CR_PSIZE_BYTE | STM32_DMA_CR_MSIZE_BYTE);
+
+	dmaStreamEnable(dma->rx);
+	dmaStreamEnable(dma->tx);
+	/* RX request enabled first, no byte can be missed */
+	hspi->Instance->CR2 |= SPI_CR2_RXDMAEN;
+	hspi->Instance->CR2 |= SPI_CR2_TXDMAEN;
+
+	return BSP_OK;
+}
+
+/**
+  * @brief  Wait end of transfer started with bsp_spi_dma_start(),
+  *         calling thread sleeps until RX DMA end of transfer IRQ.
+  * @param  dev_num: SPI dev num.
+  * @retval status: BSP_TIMEOUT if transfer is not finished after 1s.
+  */
+bsp_status_t bsp_spi_dma_wait(bsp_dev_spi_t dev_num)
+{
+	SPI_HandleTypeDef* hspi;
+	spi_dma_t* dma;
+	bsp_status_t status;
+
+	hspi = &spi_handle[dev_num];
+	dma = &spi_dma[dev_num];
+
+	if(dma->rx == NULL)
+		return BSP_ERROR;
+
+	status = BSP_OK;
+	/* Last byte received, SPI is idle */
+	if(chBSemWaitTimeout(&dma->done, MS2ST(SPIx_DMA_TIMEOUT_MS)) != MSG_OK ||
+	   dmaStreamGetTransactionSize(dma->rx) > 0)
+		status = BSP_TIMEOUT;
+
+	hspi->Instance->CR2 &= ~(SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+	dmaStreamDisable(dma->tx);
+	dmaStreamDisable(dma->rx);
+	dmaStreamRelease(dma->tx);
+	dmaStreamRelease(dma->rx);
+	dma->rx = NULL;
+	dma->tx = NULL;
+
+	if(status != BSP_OK)
+		spi_error(dev_num);
+	return status;
+}
+
+/**
+  * @brief  Full duplex transfer with DMA in blocking mode.
+  * @param  dev_num: SPI dev num.
+  * @param  tx_data: Data to send, NULL to send 0xFF.
+  * @param  rx_data: Data received, NULL to discard received data.
+  * @param  nb_data: Number of data to send & receive.
+  * @retval status of the transfer.
+  */
+bsp_status_t bsp_spi_write_read_dma(bsp_dev_spi_t dev_num, const uint8_t* tx_data, uint8_t* rx_data, uint32_t nb_data)
+{
+	bsp_status_t status;
+	uint32_t chunk;
+
+	while(nb_data > 0) {
+		chunk = (nb_data > 0xFFFF) ? 0xFFFF : nb_data;
+		status = bsp_spi_dma_start(dev_num, tx_data, rx_data, chunk);
+		if(status != BSP_OK)
+			return status;
+		status = bsp_spi_dma_wait(dev_num);
+		if(status != BSP_OK)
+			return status;
+		if(tx_data != NULL)
+			tx_data += chunk;
+		if(rx_data != NULL)
+			rx_data += chunk;
+		nb_data -= chunk;
+	}
+	return BSP_OK;
+}
@@ -36,4 +36,16 @@ bsp_status_t bsp_spi_write_u8(bsp_dev_spi_t dev_num, uint8_t* tx_data, uint8_t n
 bsp_status_t bsp_spi_read_u8(bsp_dev_spi_t dev_num, uint8_t* rx_data, uint8_t nb_data);
 bsp_status_t bsp_spi_write_read_u8(bsp_dev_spi_t dev_num, uint8_t* tx_data, uint8_t* rx_data, uint8_t nb_data);
 
+/* Full duplex DMA transfer, buffers shall not be in CCM */
+bsp_status_t bsp_spi_dma_start(bsp_dev_spi_t dev_num, const uint8_t* tx_data, uint8_t* rx_data, uint16_t nb_data);
+bsp_status_t bsp_spi_dma_wait(bsp_dev_spi_t dev_num);
+bsp_status_t bsp_spi_write_read_dma(bsp_dev_spi_t dev_num, const uint8_t* tx_data, uint8_t* rx_data, uint32_t nb_data);
+
+/* Slave mode circular DMA reception (sniffer) */
+bsp_status_t bsp_spi_rx_dma_start(bsp_dev_spi_t dev_num, uint8_t* rx_buf, uint32_t size);
+void bsp_spi_rx_dma_stop(bsp_dev_spi_t dev_num);
+uint32_t bsp_spi_rx_dma_count(bsp_dev_spi_t dev_num);
+void bsp_spi_slave_resync(bsp_dev_spi_t dev_num);
+void bsp_spi_cs_input(bsp_dev_spi_t dev_num);
+
 #endif /* _BSP_SPI_H_ */
@@ -220,7 +220,7 @@ bsp_status_t bsp_uart_deinit(bsp_dev_uart_t dev_num)
   * @param  nb_data: Number of data to send.
   * @retval status of the transfer.
   */
-bsp_status_t bsp_uart_write_u8(bsp_dev_uart_t dev_num, uint8_t* tx_data, uint8_t nb_data)
+bsp_status_t bsp_uart_write_u8(bsp_dev_uart_t dev_num, uint8_t* tx_data, uint16_t nb_data)
 {
 	UART_HandleTypeDef* huart;
 	huart = &uart_handle[dev_num];
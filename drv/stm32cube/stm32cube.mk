@@ -18,6 +18,7 @@ STM32CUBESRC = ./drv/stm32cube/stm32f4xx_hal_msp.c \
               ./drv/stm32cube/bsp_spi.c \
               ./drv/stm32cube/bsp_uart.c \
               ./drv/stm32cube/bsp_rng.c \
+              ./drv/stm32cube/bsp_crc.c \
               ./drv/stm32cube/bsp_can.c \
               ./drv/stm32cube/bsp_freq.c
 
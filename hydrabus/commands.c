@@ -142,6 +142,29 @@ t_token_dict tl_dict[] = {
 	{ T_SCRIPT, "script" },
 	{ T_FILE, "filename" },
 	{ T_ONEWIRE, "1-wire" },
+	{ T_EEPROM, "eeprom" },
+	{ T_ADDRESS, "address" },
+	{ T_ADDRESS_WIDTH, "address-width" },
+	{ T_PAGE_SIZE, "page-size" },
+	{ T_SIZE, "size" },
+	{ T_OFFSET, "offset" },
+	{ T_DUAL, "dual" },
+	{ T_STATS, "stats" },
+	{ T_ISOTP, "isotp" },
+	{ T_RX_ID, "rx-id" },
+	{ T_BLOCK_SIZE, "block-size" },
+	{ T_STMIN, "stmin" },
+	{ T_REPLAY, "replay" },
+	{ T_FUZZ, "fuzz" },
+	{ T_FLOOD, "flood" },
+	{ T_ID_MASK, "id-mask" },
+	{ T_FLASH, "flash" },
+	{ T_VERIFY, "verify" },
+	{ T_CRC, "crc" },
+	{ T_POLY, "poly" },
+	{ T_PCAPNG, "pcapng" },
+	{ T_TRACE_USB2, "trace-usb2" },
+	{ T_TYPEB, "typeb" },
 
 	{ T_LEFT_SQ, "[" },
 	{ T_RIGHT_SQ, "]" },
@@ -279,22 +302,42 @@ t_token tokens_mode_nfc_sniff[] = {
 		T_TRACE_UART1,
 		.help = "Output realtime sniff trace on UART1(PA9@8.4Mbauds 8N1)"
 	},
+	{
+		T_TRACE_USB2,
+		.help = "Output realtime sniff trace on USB2"
+	},
 	{
 		T_BIN,
-		.help = "Force binary sniff trace(UART1 only)"
+		.help = "Force binary sniff trace(UART1 or USB2)"
 	},
 	{
 		T_RAW,
-		.help = "Enable binary raw sniff trace(ISO14443A/B)(UART1 only)"
+		.help = "Enable binary raw sniff trace(ISO14443A/B)(UART1 or USB2)"
 	},
 	{
 		T_PARITY,
-		.help = "Add parity bit information in binary sniff trace(UART1 only)"
+		.help = "Add parity bit information in binary sniff trace(UART1 or USB2)"
 	},
 	{
 		T_FRAME_TIME,
 		.help = "Add start/end frame timestamp(in CPU cycles)"
 	},
+	{
+		T_PCAPNG,
+		.help = "Store sniff trace in PCAPNG format(Wireshark) on microSD"
+	},
+	{
+		T_CONTINUOUS,
+		.help = "Write sniff trace continuously on microSD(ASCII only)"
+	},
+	{
+		T_TYPEB,
+		.help = "Sniff ISO14443B 106kbps"
+	},
+	{
+		T_VICINITY,
+		.help = "Sniff ISO15693 (VCD 1 out of 4, VICC 26kbps one subcarrier)"
+	},
 	{ }
 };
 
@@ -329,7 +372,7 @@ t_token tokens_mode_nfc_sniff[] = {
 	{\
 		T_SNIFF,\
 		.subtokens = tokens_mode_nfc_sniff,\
-		.help = "Sniff (default ISO14443A see options for more details)"\
+		.help = "Sniff (default ISO14443A, see options for ISO14443B/ISO15693)"\
 	},\
 	{\
 		T_EMUL_MIFARE,\
@@ -479,6 +522,88 @@ t_token tokens_uart[] = {
 		.help = "Bus bitrate"\
 	},
 
+t_token tokens_mode_can_stats[] = {
+	{
+		T_PERIOD,
+		.arg_type = T_ARG_UINT,
+		.help = "Statistics print period (msec, default 1000)"
+	},
+	{ }
+};
+
+t_token tokens_mode_can_isotp[] = {
+	{
+		T_RX_ID,
+		.arg_type = T_ARG_UINT,
+		.help = "Response ID (default ID + 8)"
+	},
+	{
+		T_BLOCK_SIZE,
+		.arg_type = T_ARG_UINT,
+		.help = "Block size sent in flow control (default 0)"
+	},
+	{
+		T_STMIN,
+		.arg_type = T_ARG_UINT,
+		.help = "Separation time sent in flow control (default 0)"
+	},
+	{
+		T_ARG_UINT,
+		.help = "Request byte"
+	},
+	{
+		T_ARG_STRING,
+		.help = "Request string"
+	},
+	{ }
+};
+
+t_token tokens_mode_can_replay[] = {
+	{
+		T_FILE,
+		.arg_type = T_ARG_STRING,
+		.help = "microSD trace filename (BBIO CAN stream format)"
+	},
+	{
+		T_FREQUENCY,
+		.arg_type = T_ARG_UINT,
+		.help = "Fixed rate in frames/s (default trace timing)"
+	},
+	{
+		T_FLOOD,
+		.help = "Send frames back to back"
+	},
+	{
+		T_RNG,
+		.help = "Randomize payloads"
+	},
+	{
+		T_ID_MASK,
+		.arg_type = T_ARG_UINT,
+		.help = "Randomize ID bits set in mask"
+	},
+	{ }
+};
+
+t_token tokens_mode_can_fuzz[] = {
+	{
+		T_SAMPLES,
+		.arg_type = T_ARG_UINT,
+		.help = "Number of frames (default until stopped)"
+	},
+	{
+		T_FREQUENCY,
+		.arg_type = T_ARG_UINT,
+		.help = "Fixed rate in frames/s (default back to back)"
+	},
+	{
+		T_ID_MASK,
+		.arg_type = T_ARG_UINT,
+		.help = "Randomize ID bits set in mask"
+	},
+	{ }
+};
+
 t_token tokens_mode_can[] = {
 	{
 		T_SHOW,
@@ -496,6 +621,30 @@ t_token tokens_mode_can[] = {
 		T_CONTINUOUS,
 		.help = "Read continuously"
 	},
+	{
+		T_DUAL,
+		.help = "Read continuously CAN1 and CAN2 simultaneously"
+	},
+	{
+		T_STATS,
+		.subtokens = tokens_mode_can_stats,
+		.help = "Bus load and per ID statistics"
+	},
+	{
+		T_ISOTP,
+		.subtokens = tokens_mode_can_isotp,
+		.help = "Send ISO-TP request and read response"
+	},
+	{
+		T_REPLAY,
+		.subtokens = tokens_mode_can_replay,
+		.help = "Replay microSD trace"
+	},
+	{
+		T_FUZZ,
+		.subtokens = tokens_mode_can_fuzz,
+		.help = "Send random frames with current ID"
+	},
 	{
 		T_WRITE,
 		.flags = T_FLAG_SUFFIX_TOKEN_DELIM_INT,
@@ -552,6 +701,61 @@ t_token tokens_can[] = {
 		.help = "Bus frequency"\
 	},
 
+t_token tokens_mode_i2c_eeprom[] = {
+	{
+		T_READ,
+		.help = "Dump EEPROM to microSD file"
+	},
+	{
+		T_WRITE,
+		.help = "Program EEPROM from microSD file"
+	},
+	{
+		T_VERIFY,
+		.help = "Compare EEPROM with microSD file, show mismatching ranges"
+	},
+	{
+		T_CRC,
+		.help = "Show CRC-32 of EEPROM content"
+	},
+	{
+		T_POLY,
+		.arg_type = T_ARG_UINT,
+		.help = "CRC-32 reflected polynomial (default 0xEDB88320)"
+	},
+	{
+		T_FILE,
+		.arg_type = T_ARG_STRING,
+		.help = "microSD filename"
+	},
+	{
+		T_ADDRESS,
+		.arg_type = T_ARG_UINT,
+		.help = "7bits device address (default 0x50)"
+	},
+	{
+		T_ADDRESS_WIDTH,
+		.arg_type = T_ARG_UINT,
+		.help = "Memory address bytes 1/2/3 (default 2)"
+	},
+	{
+		T_PAGE_SIZE,
+		.arg_type = T_ARG_UINT,
+		.help = "Page size in bytes (default 32)"
+	},
+	{
+		T_OFFSET,
+		.arg_type = T_ARG_UINT,
+		.help = "Start memory address (default 0)"
+	},
+	{
+		T_SIZE,
+		.arg_type = T_ARG_UINT,
+		.help = "Number of bytes (default file size for write/verify)"
+	},
+	{ }
+};
+
 t_token tokens_mode_i2c[] = {
 	{
 		T_SHOW,
@@ -564,6 +768,11 @@ t_token tokens_mode_i2c[] = {
 		T_SCAN,
 		.help = "Scan for connected devices"
 	},
+	{
+		T_EEPROM,
+		.subtokens = tokens_mode_i2c_eeprom,
+		.help = "24Cxx EEPROM dump/program/verify with microSD file"
+	},
 	{
 		T_START,
 		.help = "Start"
@@ -658,6 +867,54 @@ t_token tokens_i2c[] = {
 	{ T_LSB_FIRST, \
 		.help = "Send/receive LSB first" },
 
+t_token tokens_mode_spi_flash[] = {
+	{
+		T_ID,
+		.help = "Show JEDEC ID and SFDP parameters"
+	},
+	{
+		T_READ,
+		.help = "Dump flash to microSD file"
+	},
+	{
+		T_ERASE,
+		.help = "Erase flash (default whole chip)"
+	},
+	{
+		T_WRITE,
+		.help = "Program flash from microSD file (erase first)"
+	},
+	{
+		T_VERIFY,
+		.help = "Compare flash with microSD file, show mismatching ranges"
+	},
+	{
+		T_CRC,
+		.help = "Show CRC-32 of flash content"
+	},
+	{
+		T_POLY,
+		.arg_type = T_ARG_UINT,
+		.help = "CRC-32 reflected polynomial (default 0xEDB88320)"
+	},
+	{
+		T_FILE,
+		.arg_type = T_ARG_STRING,
+		.help = "microSD filename"
+	},
+	{
+		T_OFFSET,
+		.arg_type = T_ARG_UINT,
+		.help = "Start address (default 0)"
+	},
+	{
+		T_SIZE,
+		.arg_type = T_ARG_UINT,
+		.help = "Number of bytes (default chip size or file size)"
+	},
+	{ }
+};
+
 t_token tokens_mode_spi[] = {
 	{
 		T_SHOW,
@@ -698,6 +955,15 @@ t_token tokens_mode_spi[] = {
 		T_CS_OFF,
 		.help = "Alias for \"chip-select off\""
 	},
+	{
+		T_SNIFF,
+		.help = "Sniff bus, MOSI PB5 MISO PC3 SCK PB3+PB10 CS PA15"
+	},
+	{
+		T_FLASH,
+		.subtokens = tokens_mode_spi_flash,
+		.help = "SPI NOR flash dump/erase/program/verify with microSD file"
+	},
 	/* BP commands */
 	{
 		T_LEFT_SQ,
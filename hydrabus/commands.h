@@ -135,6 +135,29 @@ enum {
 	T_SCRIPT,
 	T_FILE,
 	T_ONEWIRE,
+	T_EEPROM,
+	T_ADDRESS,
+	T_ADDRESS_WIDTH,
+	T_PAGE_SIZE,
+	T_SIZE,
+	T_OFFSET,
+	T_DUAL,
+	T_STATS,
+	T_ISOTP,
+	T_RX_ID,
+	T_BLOCK_SIZE,
+	T_STMIN,
+	T_REPLAY,
+	T_FUZZ,
+	T_FLOOD,
+	T_ID_MASK,
+	T_FLASH,
+	T_VERIFY,
+	T_CRC,
+	T_POLY,
+	T_PCAPNG,
+	T_TRACE_USB2,
+	T_TYPEB,
 
 	/* BP-compatible commands */
 	T_LEFT_SQ,
@@ -7,8 +7,12 @@ HYDRABUSSRC = hydrabus/hydrabus.c \
             hydrabus/gpio.c \
             hydrabus/hydrabus_mode.c \
             hydrabus/hydrabus_mode_spi.c \
+            hydrabus/hydrabus_spi_sniff.c \
+            hydrabus/hydrabus_spi_flash.c \
+            hydrabus/hydrabus_verify.c \
             hydrabus/hydrabus_mode_uart.c \
             hydrabus/hydrabus_mode_i2c.c \
+            hydrabus/hydrabus_i2c_eeprom.c \
             hydrabus/hydrabus_sump.c \
             hydrabus/hydrabus_mode_jtag.c \
             hydrabus/hydrabus_rng.c \
@@ -16,7 +20,11 @@ HYDRABUSSRC = hydrabus/hydrabus.c \
             hydrabus/hydrabus_mode_twowire.c \
             hydrabus/hydrabus_mode_threewire.c \
             hydrabus/hydrabus_mode_can.c \
+            hydrabus/hydrabus_can_isotp.c \
+            hydrabus/hydrabus_can_replay.c \
             hydrabus/hydrabus_bbio.c \
+            hydrabus/hydrabus_bbio_batch.c \
+            hydrabus/hydrabus_bbio_caps.c \
             hydrabus/hydrabus_bbio_spi.c \
             hydrabus/hydrabus_bbio_pin.c \
             hydrabus/hydrabus_bbio_can.c \
@@ -33,6 +33,7 @@
 #include "hydrabus_bbio_i2c.h"
 #include "hydrabus_bbio_rawwire.h"
 #include "hydrabus_bbio_onewire.h"
+#include "hydrabus_bbio_caps.h"
 
 int cmd_bbio(t_hydra_console *con)
 {
@@ -67,6 +68,9 @@ int cmd_bbio(t_hydra_console *con)
 			case BBIO_PIN:
 				bbio_mode_pin(con);
 				break;
+			case BBIO_CAPS:
+				bbio_caps(con);
+				break;
 			case BBIO_RESET_HW:
 				return TRUE;
 			default:
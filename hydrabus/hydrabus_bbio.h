@@ -41,6 +41,10 @@
 #define BBIO_VOLT	0b00010100
 #define BBIO_VOLT_CONT	0b00010101
 #define BBIO_FREQ	0b00010110
+#define BBIO_CAPS	0b00010111
+
+/* Max bytes written or read by write-read commands */
+#define BBIO_WRITE_READ_MAX	(4096)
 
 /*
  * SPI-specific commands
@@ -58,9 +62,19 @@
 #define BBIO_SPI_SET_SPEED	0b01100000
 #define BBIO_SPI_CONFIG		0b10000000
 #define BBIO_SPI_AVR		0b00000110
+#define BBIO_SPI_SNIFF_DMA	0b00000111
 #define BBIO_SPI_AVR_NULL	0b00000000
 #define BBIO_SPI_AVR_VERSION	0b00000001
 #define BBIO_SPI_AVR_READ	0b00000010
+#define BBIO_SPI_AVR_WRITE	0b00000011
+#define BBIO_SPI_FLASH		0b00001000
+#define BBIO_SPI_FLASH_PROBE	0b00000000
+#define BBIO_SPI_FLASH_READ	0b00000001
+#define BBIO_SPI_FLASH_ERASE	0b00000010
+#define BBIO_SPI_FLASH_WRITE	0b00000011
+#define BBIO_SPI_FLASH_VERIFY	0b00000100
+#define BBIO_SPI_FLASH_CRC	0b00000101
+#define BBIO_SPI_BATCH		0b00001100
 
 /*
  * I2C-specific commands
@@ -71,6 +85,10 @@
 #define BBIO_I2C_ACK_BIT	0b00000110
 #define BBIO_I2C_NACK_BIT	0b00000111
 #define BBIO_I2C_WRITE_READ	0b00001000
+#define BBIO_I2C_EEPROM_READ	0b00001001
+#define BBIO_I2C_EEPROM_WRITE	0b00001010
+#define BBIO_I2C_EEPROM_CRC	0b00001011
+#define BBIO_I2C_BATCH		0b00001100
 #define BBIO_I2C_START_SNIFF	0b00001111
 #define BBIO_I2C_BULK_WRITE	0b00010000
 #define BBIO_I2C_CONFIG_PERIPH	0b01000000
@@ -85,6 +103,10 @@
 #define BBIO_CAN_FILTER_ON	0b00000101
 #define BBIO_CAN_FILTER		0b00000110
 #define BBIO_CAN_WRITE		0b00001000
+#define BBIO_CAN_DUAL_SNIFF	0b00010000
+#define BBIO_CAN_STREAM		0b00010001
+#define BBIO_CAN_ISOTP		0b00010010
+#define BBIO_CAN_REPLAY		0b00010011
 #define BBIO_CAN_SET_SPEED	0b01100000
 
 /*
@@ -96,6 +118,8 @@
 #define BBIO_PIN_PULLUP		0b00000101
 #define BBIO_PIN_PULLDOWN	0b00000110
 #define BBIO_PIN_WRITE		0b00001000
+#define BBIO_PIN_WRITE_PORT	0b00001001
+#define BBIO_PIN_WAVE		0b00001010
 
 /*
  * UART-specific commands
@@ -103,6 +127,7 @@
 #define BBIO_UART_START_ECHO	0b00000010
 #define BBIO_UART_STOP_ECHO	0b00000011
 #define BBIO_UART_BAUD_RATE	0b00000111
+#define BBIO_UART_BATCH		0b00001100
 #define BBIO_UART_BRIDGE	0b00001111
 #define BBIO_UART_BULK_TRANSFER 0b00010000
 #define BBIO_UART_CONFIG_PERIPH	0b01000000
@@ -124,6 +149,7 @@
 #define BBIO_RAWWIRE_CLK_HIGH	0b00001011
 #define BBIO_RAWWIRE_DATA_LOW	0b00001100
 #define BBIO_RAWWIRE_DATA_HIGH	0b00001101
+#define BBIO_RAWWIRE_BATCH	0b00001110
 #define BBIO_RAWWIRE_BULK_TRANSFER 0b00010000
 #define BBIO_RAWWIRE_BULK_CLK	0b00100000
 #define BBIO_RAWWIRE_BULK_BIT	0b00110000
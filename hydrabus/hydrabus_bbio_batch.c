@@ -0,0 +1,237 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * BBIO command list: a sequence of mode primitives is uploaded and run
+ * in one request, read data is returned in one reply.
+ * Reply is status (0x01 OK, 0x00 error), read length (2) then data read
+ * until the first error.
+ * An invalid program is not executed, reply is 0x00 0x00 0x00.
+ */
+
+#include "common.h"
+#include "hydrabus_bbio_batch.h"
+
+typedef struct {
+	uint16_t start; /* Program index of first loop op */
+	uint16_t count; /* Remaining iterations */
+} bbio_batch_loop_t;
+
+static uint16_t get_u16(const uint8_t *buf)
+{
+	return (buf[0] << 8) | buf[1];
+}
+
+/* Returns the size of the op with its parameters, 0 if unknown */
+static uint16_t bbio_batch_op_size(const uint8_t *op)
+{
+	switch(op[0]) {
+	case BBIO_BATCH_SELECT:
+	case BBIO_BATCH_UNSELECT:
+	case BBIO_BATCH_END_LOOP:
+		return 1;
+	case BBIO_BATCH_READ:
+	case BBIO_BATCH_LOOP:
+		return 2;
+	case BBIO_BATCH_DELAY_US:
+	case BBIO_BATCH_DELAY_MS:
+		return 3;
+	case BBIO_BATCH_WRITE:
+	case BBIO_BATCH_WRITE_READ:
+		return 2 + op[1] + 1;
+	default:
+		return 0;
+	}
+}
+
+/* Checks program and returns number of bytes read, -1 if invalid */
+static int bbio_batch_check(const bbio_batch_ops_t *ops,
+			    const uint8_t *prog, uint16_t len)
+{
+	uint32_t rx[BBIO_BATCH_LOOP_DEPTH + 1];
+	uint8_t count[BBIO_BATCH_LOOP_DEPTH + 1];
+	uint16_t i, size;
+	int depth;
+
+	depth = 0;
+	rx[0] = 0;
+	for(i = 0; i < len; i += size) {
+		size = bbio_batch_op_size(&prog[i]);
+		if(size == 0 || i + size > len)
+			return -1;
+
+		switch(prog[i]) {
+		case BBIO_BATCH_SELECT:
+			if(ops->select == NULL)
+				return -1;
+			break;
+		case BBIO_BATCH_UNSELECT:
+			if(ops->unselect == NULL)
+				return -1;
+			break;
+		case BBIO_BATCH_WRITE:
+			if(ops->write == NULL)
+				return -1;
+			break;
+		case BBIO_BATCH_READ:
+			if(ops->read == NULL)
+				return -1;
+			rx[depth] += prog[i + 1] + 1;
+			break;
+		case BBIO_BATCH_WRITE_READ:
+			if(ops->write_read == NULL)
+				return -1;
+			rx[depth] += prog[i + 1] + 1;
+			break;
+		case BBIO_BATCH_LOOP:
+			if(depth == BBIO_BATCH_LOOP_DEPTH || prog[i + 1] == 0)
+				return -1;
+			depth++;
+			count[depth] = prog[i + 1];
+			rx[depth] = 0;
+			break;
+		case BBIO_BATCH_END_LOOP:
+			if(depth == 0)
+				return -1;
+			rx[depth - 1] += rx[depth] * count[depth];
+			depth--;
+			break;
+		}
+		if(rx[depth] > BBIO_BATCH_RX_MAX)
+			return -1;
+	}
+	if(depth != 0)
+		return -1;
+	return rx[0];
+}
+
+static bsp_status_t bbio_batch_run(const bbio_batch_ops_t *ops, void *ctx,
+				   uint8_t *prog, uint16_t len, uint8_t *rx,
+				   uint16_t *rx_len)
+{
+	bbio_batch_loop_t loop[BBIO_BATCH_LOOP_DEPTH];
+	bsp_status_t status;
+	uint16_t i, nb;
+	int depth;
+	bool selected;
+
+	status = BSP_OK;
+	depth = 0;
+	selected = FALSE;
+	*rx_len = 0;
+	i = 0;
+	while(i < len && status == BSP_OK) {
+		switch(prog[i]) {
+		case BBIO_BATCH_SELECT:
+			ops->select(ctx);
+			selected = TRUE;
+			break;
+		case BBIO_BATCH_UNSELECT:
+			ops->unselect(ctx);
+			selected = FALSE;
+			break;
+		case BBIO_BATCH_WRITE:
+			nb = prog[i + 1] + 1;
+			status = ops->write(ctx, &prog[i + 2], nb);
+			break;
+		case BBIO_BATCH_READ:
+			nb = prog[i + 1] + 1;
+			status = ops->read(ctx, &rx[*rx_len], nb);
+			if(status == BSP_OK)
+				*rx_len += nb;
+			break;
+		case BBIO_BATCH_WRITE_READ:
+			nb = prog[i + 1] + 1;
+			status = ops->write_read(ctx, &prog[i + 2], &rx[*rx_len], nb);
+			if(status == BSP_OK)
+				*rx_len += nb;
+			break;
+		case BBIO_BATCH_DELAY_US:
+			DelayUs(get_u16(&prog[i + 1]));
+			break;
+		case BBIO_BATCH_DELAY_MS:
+			chThdSleepMilliseconds(get_u16(&prog[i + 1]));
+			break;
+		case BBIO_BATCH_LOOP:
+			loop[depth].count = prog[i + 1];
+			loop[depth].start = i + 2;
+			depth++;
+			break;
+		case BBIO_BATCH_END_LOOP:
+			if(--loop[depth - 1].count > 0) {
+				if(USER_BUTTON) {
+					/* Aborted */
+					status = BSP_ERROR;
+					break;
+				}
+				i = loop[depth - 1].start;
+				continue;
+			}
+			depth--;
+			break;
+		}
+		i += bbio_batch_op_size(&prog[i]);
+	}
+	/* Release device if list stopped on error */
+	if(status != BSP_OK && selected)
+		ops->unselect(ctx);
+	return status;
+}
+
+/** \brief Receive and execute a command list.
+ *
+ * \param con t_hydra_console*: hydra console (BBIO channel).
+ * \param ops const bbio_batch_ops_t*: mode primitives.
+ * \param ctx void*: primitives context.
+ * \return void
+ *
+ */
+void bbio_batch(t_hydra_console *con, const bbio_batch_ops_t *ops, void *ctx)
+{
+	/* Program then reply header and read data */
+	uint8_t *prog = (uint8_t *)g_sbuf;
+	uint8_t *reply = (uint8_t *)g_sbuf + BBIO_BATCH_PROG_MAX;
+	uint8_t *rx = reply + 3;
+	uint16_t len, rx_len;
+	bsp_status_t status;
+
+	chnRead(con->sdu, reply, 2);
+	len = get_u16(reply);
+	if(len > BBIO_BATCH_PROG_MAX) {
+		/* Keep host in sync */
+		while(len > 0) {
+			rx_len = (len > BBIO_BATCH_PROG_MAX) ?
+				 BBIO_BATCH_PROG_MAX : len;
+			len -= chnRead(con->sdu, prog, rx_len);
+		}
+		cprint(con, "\x00\x00\x00", 3);
+		return;
+	}
+	chnRead(con->sdu, prog, len);
+
+	if(bbio_batch_check(ops, prog, len) < 0) {
+		cprint(con, "\x00\x00\x00", 3);
+		return;
+	}
+
+	status = bbio_batch_run(ops, ctx, prog, len, rx, &rx_len);
+	reply[0] = (status == BSP_OK) ? 1 : 0;
+	reply[1] = rx_len >> 8;
+	reply[2] = rx_len;
+	cprint(con, (char *)reply, 3 + rx_len);
+}
@@ -0,0 +1,58 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRABUS_BBIO_BATCH_H_
+#define _HYDRABUS_BBIO_BATCH_H_
+
+#include "common.h"
+#include "bsp.h"
+
+/*
+ * Command list, host sends the opcode, program length (2) then program.
+ * Multi-byte values are big endian, n is the number of bytes minus one.
+ */
+#define BBIO_BATCH_SELECT	0x01 /* CS low, I2C start */
+#define BBIO_BATCH_UNSELECT	0x02 /* CS high, I2C stop */
+#define BBIO_BATCH_WRITE	0x03 /* n, data (n+1) */
+#define BBIO_BATCH_READ		0x04 /* n, n+1 bytes added to reply */
+#define BBIO_BATCH_WRITE_READ	0x05 /* n, data (n+1), n+1 bytes added to reply */
+#define BBIO_BATCH_DELAY_US	0x06 /* delay (2) */
+#define BBIO_BATCH_DELAY_MS	0x07 /* delay (2) */
+#define BBIO_BATCH_LOOP		0x08 /* count (1, 1 to 255) */
+#define BBIO_BATCH_END_LOOP	0x09
+
+#define BBIO_BATCH_PROG_MAX	(4096)
+#define BBIO_BATCH_RX_MAX	(4096)
+#define BBIO_BATCH_LOOP_DEPTH	(4)
+
+/*
+ * Mode primitives, ctx is given to bbio_batch().
+ * An unsupported primitive is NULL, programs using it are rejected.
+ */
+typedef struct {
+	void (*select)(void *ctx);
+	void (*unselect)(void *ctx);
+	bsp_status_t (*write)(void *ctx, uint8_t *tx_data, uint16_t nb_data);
+	bsp_status_t (*read)(void *ctx, uint8_t *rx_data, uint16_t nb_data);
+	bsp_status_t (*write_read)(void *ctx, uint8_t *tx_data,
+				   uint8_t *rx_data, uint16_t nb_data);
+} bbio_batch_ops_t;
+
+void bbio_batch(t_hydra_console *con, const bbio_batch_ops_t *ops, void *ctx);
+
+#endif /* _HYDRABUS_BBIO_BATCH_H_ */
@@ -27,6 +27,36 @@
 #include "hydrabus_bbio.h"
 #include "hydrabus_bbio_can.h"
 #include "bsp_can.h"
+#include "hydrabus_can_isotp.h"
+#include "hydrabus_can_replay.h"
+
+#define BBIO_CAN_CYCLES_PER_US (STM32_SYSCLK / 1000000)
+#define BBIO_CAN_STREAM_BUF_SIZE (4096)
+/* Largest record: frame type(1) timestamp(4) id(4) flags(1) dlc(1) data(8) */
+#define BBIO_CAN_RECORD_MAX (19)
+/* Max time a record is kept before being sent to host */
+#define BBIO_CAN_STREAM_FLUSH_MS (10)
+
+/*
+ * Stream record types, all records start with type and timestamp in us (4)
+ * Frame: type = bus (0 CAN1, 1 CAN2), id(4) flags(1) dlc(1) data(dlc)
+ *        flags: bit0 extended ID, bit1 RTR, bit2 FIFO1
+ * Overflow: type = 0x80 | bus, total dropped(4) total HW overrun(4)
+ * End: type = 0xFF, total frames(4), sent when capture is stopped
+ */
+#define BBIO_CAN_REC_OVERFLOW	0x80
+#define BBIO_CAN_REC_END	0xFF
+
+static const uint32_t bbio_can_speeds[8] = {
+	2000000,
+	1000000,
+	500000,
+	250000,
+	125000,
+	100000,
+	50000,
+	40000,
+};
 
 static void print_raw_uint32(t_hydra_console *con, uint32_t num)
 {
@@ -36,6 +66,259 @@ static void print_raw_uint32(t_hydra_console *con, uint32_t num)
 		(num&0xFF));
 }
 
+static uint8_t *put_raw_uint32(uint8_t *out, uint32_t num)
+{
+	*out++ = num >> 24;
+	*out++ = num >> 16;
+	*out++ = num >> 8;
+	*out++ = num;
+	return out;
+}
+
+/* Return timestamp in us since capture start */
+static uint32_t bbio_can_time_us(uint32_t timestamp, uint64_t start)
+{
+	uint64_t now;
+
+	/*
+	 * Extend 32bits timestamp to 64bits, frames are always < 2^32 cycles old.
+	 * Time base is kept up to date by bbio_can_stream() idle loop.
+	 */
+	now = get_cyclecounter64();
+	return (now - (uint32_t)((uint32_t)now - timestamp) - start) / BBIO_CAN_CYCLES_PER_US;
+}
+
+/* Encode a frame record, return record length */
+static uint32_t bbio_can_record(uint8_t *out, bsp_can_rx_frame_t *frame, uint64_t start)
+{
+	uint8_t *p = out;
+	uint32_t i;
+
+	*p++ = frame->dev_num;
+	p = put_raw_uint32(p, bbio_can_time_us(frame->timestamp, start));
+	p = put_raw_uint32(p, frame->id);
+	*p++ = frame->flags;
+	*p++ = frame->dlc;
+	for(i = 0; i < frame->dlc && i < 8; i++)
+		*p++ = frame->data[i];
+	return p - out;
+}
+
+/* Encode an overflow record if frames were lost since last call */
+static uint32_t bbio_can_overflow(uint8_t *out, bsp_dev_can_t dev_num,
+				  uint32_t *lost, uint64_t start)
+{
+	bsp_can_rx_stats_t stats;
+	uint8_t *p = out;
+
+	bsp_can_rx_irq_get_stats(dev_num, &stats);
+	if(stats.dropped + stats.overrun == *lost)
+		return 0;
+	*lost = stats.dropped + stats.overrun;
+
+	*p++ = BBIO_CAN_REC_OVERFLOW | dev_num;
+	p = put_raw_uint32(p, bbio_can_time_us(get_cyclecounter(), start));
+	p = put_raw_uint32(p, stats.dropped);
+	p = put_raw_uint32(p, stats.overrun);
+	return p - out;
+}
+
+/*
+ * Stream received frames until any byte is received from host.
+ * Records are sent by large packets, at least every BBIO_CAN_STREAM_FLUSH_MS.
+ */
+static void bbio_can_stream(t_hydra_console *con, bool dual)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	uint8_t *out = (uint8_t *)g_sbuf;
+	uint8_t *p;
+	bsp_can_rx_frame_t *frame;
+	bsp_can_rx_stats_t stats;
+	uint32_t out_idx, frames, lost[BSP_DEV_CAN_END];
+	systime_t flush_time;
+	uint64_t start;
+	uint8_t c;
+	int i;
+
+	start = get_cyclecounter64();
+	lost[BSP_DEV_CAN1] = 0;
+	lost[BSP_DEV_CAN2] = 0;
+	flush_time = 0;
+	out_idx = 0;
+	while(!USER_BUTTON) {
+		if(out_idx == 0)
+			flush_time = chVTGetSystemTimeX() + MS2ST(BBIO_CAN_STREAM_FLUSH_MS);
+
+		for(i = 0; i < BSP_DEV_CAN_END; i++) {
+			if(dual || i == proto->dev_num)
+				out_idx += bbio_can_overflow(&out[out_idx], i, &lost[i], start);
+		}
+
+		frame = bsp_can_rx_irq_get_any();
+		if(frame != NULL) {
+			out_idx += bbio_can_record(&out[out_idx], frame, start);
+			bsp_can_rx_irq_release(frame->dev_num);
+		} else {
+			/* Track DWT wraps on silent bus (shall be done every < 25s) */
+			get_cyclecounter64();
+		}
+
+		if(out_idx > 0 &&
+		   (out_idx > (BBIO_CAN_STREAM_BUF_SIZE - 3 * BBIO_CAN_RECORD_MAX) ||
+		    (int32_t)(chVTGetSystemTimeX() - flush_time) >= 0)) {
+			cprint(con, (char *)out, out_idx);
+			out_idx = 0;
+		}
+
+		/* Any byte from host stop the capture, wait 1 tick when idle */
+		if(chnReadTimeout(con->sdu, &c, 1,
+				  (frame == NULL) ? 1 : TIME_IMMEDIATE) == 1)
+			break;
+	}
+
+	frames = 0;
+	for(i = 0; i < BSP_DEV_CAN_END; i++) {
+		if(dual || i == proto->dev_num) {
+			bsp_can_rx_irq_stop(i);
+			bsp_can_rx_irq_get_stats(i, &stats);
+			frames += stats.frames;
+		}
+	}
+	p = &out[out_idx];
+	*p++ = BBIO_CAN_REC_END;
+	p = put_raw_uint32(p, bbio_can_time_us(get_cyclecounter(), start));
+	p = put_raw_uint32(p, frames);
+	cprint(con, (char *)out, p - out);
+}
+
+/*
+ * Capture CAN1 and CAN2 simultaneously, frames are merged in timestamp order.
+ * Parameter: 1 byte, speed of the second controller (BBIO_CAN_SET_SPEED index).
+ * Reply 0x01 then stream records (see bbio_can_stream()).
+ */
+static void bbio_can_dual_sniff(t_hydra_console *con)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	bsp_dev_can_t other;
+	bsp_status_t status;
+	uint8_t speed;
+
+	chnRead(con->sdu, &speed, 1);
+
+	other = (proto->dev_num == BSP_DEV_CAN1) ? BSP_DEV_CAN2 : BSP_DEV_CAN1;
+	status = bsp_can_init(other, proto);
+	if(status == BSP_OK)
+		status = bsp_can_set_speed(other, bbio_can_speeds[speed & 0b111]);
+	if(status == BSP_OK)
+		status = bsp_can_init_filter(other, proto);
+	if(status == BSP_OK)
+		status = bsp_can_rx_irq_start(other);
+	if(status == BSP_OK)
+		status = bsp_can_rx_irq_start(proto->dev_num);
+	if(status != BSP_OK) {
+		bsp_can_rx_irq_stop(proto->dev_num);
+		bsp_can_deinit(other);
+		cprint(con, "\x00", 1);
+		return;
+	}
+	cprint(con, "\x01", 1);
+
+	bbio_can_stream(con, TRUE);
+
+	bsp_can_deinit(other);
+}
+
+/*
+ * ISO-TP request/response, frames are sent with current CAN ID.
+ * Host sends response ID(4) length(2) request(length), big endian.
+ * Reply is 0x01 length(2) response(length) or 0x00 on error.
+ */
+static void bbio_can_isotp(t_hydra_console *con, uint32_t can_id)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	uint8_t *tx_data = (uint8_t *)g_sbuf;
+	uint8_t *rx_data = (uint8_t *)g_sbuf + 4096;
+	uint8_t params[6];
+	uint32_t len, chunk;
+	can_isotp_t tp;
+	bsp_status_t status;
+
+	chnRead(con->sdu, params, 6);
+	tp.dev_num = proto->dev_num;
+	tp.tx_id = can_id;
+	tp.rx_id = (params[0] << 24) | (params[1] << 16) | (params[2] << 8) | params[3];
+	tp.block_size = 0;
+	tp.st_min = 0;
+	tp.padding = CAN_ISOTP_PADDING;
+	len = (params[4] << 8) | params[5];
+
+	if(len == 0 || len > CAN_ISOTP_SIZE_MAX) {
+		/* Drain request */
+		while(len > 0) {
+			chunk = (len > 4096) ? 4096 : len;
+			chnRead(con->sdu, rx_data, chunk);
+			len -= chunk;
+		}
+		cprint(con, "\x00", 1);
+		return;
+	}
+	chnRead(con->sdu, rx_data, len);
+
+	status = can_isotp_send(&tp, rx_data, len);
+	if(status == BSP_OK)
+		status = can_isotp_recv(&tp, tx_data + 3, CAN_ISOTP_SIZE_MAX, &len);
+	if(status != BSP_OK) {
+		cprint(con, "\x00", 1);
+		return;
+	}
+	tx_data[0] = 1;
+	tx_data[1] = len >> 8;
+	tx_data[2] = len & 0xFF;
+	cprint(con, (char *)tx_data, len + 3);
+}
+
+static uint32_t bbio_can_replay_read(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	if(nb == 0)
+		return 0;
+	return chnRead(((t_hydra_console *)ctx)->sdu, buf, nb);
+}
+
+/*
+ * Replay frames streamed by host with the same record format as
+ * BBIO_CAN_STREAM, until End record.
+ * Host sends options(1) rate(4) ID mask(4), big endian.
+ * options: bit0 back to back frames, bit1 random payloads.
+ * Rate is frames/s, 0 = records timing.
+ * Reply is 0x01 then at end 0x01 frames(4) late(4) or 0x00 on error.
+ */
+static void bbio_can_replay(t_hydra_console *con)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	bsp_can_tx_stats_t stats;
+	uint8_t params[9];
+	can_replay_t rp;
+
+	chnRead(con->sdu, params, 9);
+	rp.dev_num = proto->dev_num;
+	rp.flood = (params[0] & 0b01) ? TRUE : FALSE;
+	rp.random_data = (params[0] & 0b10) ? TRUE : FALSE;
+	rp.rate = (params[1] << 24) | (params[2] << 16) | (params[3] << 8) | params[4];
+	rp.id_mask = (params[5] << 24) | (params[6] << 16) | (params[7] << 8) | params[8];
+	rp.id = 0;
+	rp.count = 0;
+	cprint(con, "\x01", 1);
+
+	if(can_replay(&rp, bbio_can_replay_read, con) == BSP_OK) {
+		bsp_can_tx_sched_get_stats(&stats);
+		cprint(con, "\x01", 1);
+		print_raw_uint32(con, stats.frames);
+		print_raw_uint32(con, stats.late);
+	} else {
+		cprint(con, "\x00", 1);
+	}
+}
+
 static void bbio_mode_id(t_hydra_console *con)
 {
 	cprint(con, BBIO_CAN_HEADER, 4);
@@ -70,6 +353,23 @@ void bbio_mode_can(t_hydra_console *con)
 			case BBIO_MODE_ID:
 				bbio_mode_id(con);
 				break;
+			case BBIO_CAN_DUAL_SNIFF:
+				bbio_can_dual_sniff(con);
+				break;
+			case BBIO_CAN_STREAM:
+				if(bsp_can_rx_irq_start(proto->dev_num) == BSP_OK) {
+					cprint(con, "\x01", 1);
+					bbio_can_stream(con, FALSE);
+				} else {
+					cprint(con, "\x00", 1);
+				}
+				break;
+			case BBIO_CAN_ISOTP:
+				bbio_can_isotp(con, can_id);
+				break;
+			case BBIO_CAN_REPLAY:
+				bbio_can_replay(con);
+				break;
 			case BBIO_CAN_ID:
 				chnRead(con->sdu, rx_buff, 4);
 				can_id =  rx_buff[0] << 24;
@@ -165,32 +465,7 @@ void bbio_mode_can(t_hydra_console *con)
 					}
 
 				} else if((bbio_subcommand & BBIO_CAN_SET_SPEED) == BBIO_CAN_SET_SPEED) {
-					switch(bbio_subcommand & 0b111){
-					case 0:
-						proto->dev_speed = 2000000;
-						break;
-					case 1:
-						proto->dev_speed = 1000000;
-						break;
-					case 2:
-						proto->dev_speed = 500000;
-						break;
-					case 3:
-						proto->dev_speed = 250000;
-						break;
-					case 4:
-						proto->dev_speed = 125000;
-						break;
-					case 5:
-						proto->dev_speed = 100000;
-						break;
-					case 6:
-						proto->dev_speed = 50000;
-						break;
-					case 7:
-						proto->dev_speed = 40000;
-						break;
-					}
+					proto->dev_speed = bbio_can_speeds[bbio_subcommand & 0b111];
 					status = bsp_can_set_speed(proto->dev_num,
 								   proto->dev_speed);
 
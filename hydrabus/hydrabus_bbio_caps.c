@@ -0,0 +1,156 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * BBIO capabilities, lets host tools use the largest transfers and
+ * the extended opcodes of this firmware.
+ * Bus Pirate clients never send BBIO_CAPS and are not affected.
+ */
+
+#include "common.h"
+#include "hydrafw_version.hdr"
+#include "hydrabus_bbio.h"
+#include "hydrabus_bbio_batch.h"
+#include "hydrabus_bbio_caps.h"
+#include <string.h>
+
+/* Extended opcodes per mode, first byte is the mode */
+static const uint8_t bbio_caps_spi[] = {
+	BBIO_SPI, BBIO_SPI_AVR, BBIO_SPI_SNIFF_DMA, BBIO_SPI_FLASH,
+	BBIO_SPI_BATCH
+};
+static const uint8_t bbio_caps_i2c[] = {
+	BBIO_I2C, BBIO_I2C_EEPROM_READ, BBIO_I2C_EEPROM_WRITE,
+	BBIO_I2C_EEPROM_CRC, BBIO_I2C_BATCH
+};
+static const uint8_t bbio_caps_uart[] = {
+	BBIO_UART, BBIO_UART_BATCH
+};
+static const uint8_t bbio_caps_rawwire[] = {
+	BBIO_RAWWIRE, BBIO_RAWWIRE_BATCH
+};
+static const uint8_t bbio_caps_pin[] = {
+	BBIO_PIN, BBIO_PIN_WRITE_PORT, BBIO_PIN_WAVE
+};
+static const uint8_t bbio_caps_can[] = {
+	BBIO_CAN, BBIO_CAN_DUAL_SNIFF, BBIO_CAN_STREAM, BBIO_CAN_ISOTP,
+	BBIO_CAN_REPLAY
+};
+
+/* Frequencies of BBIO set speed indexes, 0 if index is not supported */
+static const uint32_t bbio_caps_i2c_clk[] = {
+	50000, 100000, 400000, 1000000
+};
+static const uint32_t bbio_caps_uart_clk[] = {
+	640, 1200, 2400, 4800, 9600, 19200, 31250, 38400, 57600, 0, 115200
+};
+static const uint32_t bbio_caps_rawwire_clk[] = {
+	5000, 50000, 100000, 1000000
+};
+
+static uint8_t *put_u32(uint8_t *out, uint32_t val)
+{
+	*out++ = val >> 24;
+	*out++ = val >> 16;
+	*out++ = val >> 8;
+	*out++ = val;
+	return out;
+}
+
+static uint8_t *put_record(uint8_t *out, uint8_t tag,
+			   const uint8_t *val, uint8_t len)
+{
+	*out++ = tag;
+	*out++ = len;
+	memcpy(out, val, len);
+	return out + len;
+}
+
+static uint8_t *put_clocks(uint8_t *out, uint8_t mode, uint8_t dev,
+			   const uint32_t *clk, int nb)
+{
+	int i;
+
+	*out++ = BBIO_CAPS_CLOCKS;
+	*out++ = 2 + nb * 4;
+	*out++ = mode;
+	*out++ = dev;
+	for(i = 0; i < nb; i++)
+		out = put_u32(out, clk[i]);
+	return out;
+}
+
+/** \brief Send firmware features and limits.
+ *
+ * \param con t_hydra_console*: hydra console (BBIO channel).
+ * \return void
+ *
+ */
+void bbio_caps(t_hydra_console *con)
+{
+	uint8_t *buf = (uint8_t *)g_sbuf;
+	uint8_t *p;
+	uint32_t clk[8];
+	int i;
+
+	/* Header and length are filled at the end */
+	p = buf + 6;
+	p = put_record(p, BBIO_CAPS_VERSION, (const uint8_t *)HYDRAFW_GIT_TAG,
+		       strlen(HYDRAFW_GIT_TAG));
+
+	*p++ = BBIO_CAPS_LIMITS;
+	*p++ = BBIO_CAPS_LIMIT_NB * 4;
+	p = put_u32(p, BBIO_WRITE_READ_MAX);
+	p = put_u32(p, 16);
+	p = put_u32(p, BBIO_BATCH_PROG_MAX);
+	p = put_u32(p, BBIO_BATCH_RX_MAX);
+	p = put_u32(p, BBIO_BATCH_LOOP_DEPTH);
+	p = put_u32(p, sizeof(g_sbuf));
+
+	p = put_record(p, BBIO_CAPS_OPCODES, bbio_caps_spi, sizeof(bbio_caps_spi));
+	p = put_record(p, BBIO_CAPS_OPCODES, bbio_caps_i2c, sizeof(bbio_caps_i2c));
+	p = put_record(p, BBIO_CAPS_OPCODES, bbio_caps_uart, sizeof(bbio_caps_uart));
+	p = put_record(p, BBIO_CAPS_OPCODES, bbio_caps_rawwire,
+		       sizeof(bbio_caps_rawwire));
+	p = put_record(p, BBIO_CAPS_OPCODES, bbio_caps_can, sizeof(bbio_caps_can));
+	p = put_record(p, BBIO_CAPS_OPCODES, bbio_caps_pin, sizeof(bbio_caps_pin));
+
+	/* SPI baudrate prescaler is 2^(8 - speed index) */
+	for(i = 0; i < 8; i++)
+		clk[i] = STM32_PCLK2 >> (8 - i);
+	p = put_clocks(p, BBIO_SPI, 1, clk, 8);
+	for(i = 0; i < 8; i++)
+		clk[i] = STM32_PCLK1 >> (8 - i);
+	p = put_clocks(p, BBIO_SPI, 2, clk, 8);
+	p = put_clocks(p, BBIO_I2C, 1, bbio_caps_i2c_clk,
+		       ARRAY_SIZE(bbio_caps_i2c_clk));
+	p = put_clocks(p, BBIO_UART, 1, bbio_caps_uart_clk,
+		       ARRAY_SIZE(bbio_caps_uart_clk));
+	p = put_clocks(p, BBIO_RAWWIRE, 1, bbio_caps_rawwire_clk,
+		       ARRAY_SIZE(bbio_caps_rawwire_clk));
+
+	*p++ = BBIO_CAPS_DMA;
+	*p++ = 4;
+	p = put_u32(p, BBIO_CAPS_DMA_SPI_FLASH | BBIO_CAPS_DMA_SPI_SNIFF |
+		    BBIO_CAPS_DMA_PIN_WAVE);
+
+	memcpy(buf, BBIO_CAPS_HEADER, 4);
+	buf[4] = (p - buf - 6) >> 8;
+	buf[5] = p - buf - 6;
+	cprint(con, (char *)buf, p - buf);
+}
@@ -0,0 +1,51 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRABUS_BBIO_CAPS_H_
+#define _HYDRABUS_BBIO_CAPS_H_
+
+#include "common.h"
+
+#define BBIO_CAPS_HEADER	"CAP1"
+
+/*
+ * Reply is BBIO_CAPS_HEADER, length (2) then records: tag, length (1),
+ * value. Multi-byte values are big endian, unknown tags shall be skipped.
+ */
+#define BBIO_CAPS_VERSION	0x01 /* Firmware version string */
+#define BBIO_CAPS_LIMITS	0x02 /* BBIO_CAPS_LIMIT_xxx values (4 bytes each) */
+#define BBIO_CAPS_OPCODES	0x03 /* Mode, extended opcodes supported */
+#define BBIO_CAPS_CLOCKS	0x04 /* Mode, device, speed index frequencies (4) */
+#define BBIO_CAPS_DMA		0x05 /* BBIO_CAPS_DMA_xxx flags (4) */
+
+/* Order of BBIO_CAPS_LIMITS values */
+#define BBIO_CAPS_LIMIT_WRITE_READ	0 /* Max write or read of write-read */
+#define BBIO_CAPS_LIMIT_BULK		1 /* Max bytes of bulk transfer */
+#define BBIO_CAPS_LIMIT_BATCH_PROG	2 /* Max command list length */
+#define BBIO_CAPS_LIMIT_BATCH_RX	3 /* Max command list read bytes */
+#define BBIO_CAPS_LIMIT_BATCH_LOOP	4 /* Max command list loop nesting */
+#define BBIO_CAPS_LIMIT_BUF		5 /* Shared buffer size */
+#define BBIO_CAPS_LIMIT_NB		6
+
+#define BBIO_CAPS_DMA_SPI_FLASH		(1 << 0) /* Full duplex SPI flash engine */
+#define BBIO_CAPS_DMA_SPI_SNIFF		(1 << 1) /* Circular DMA SPI sniffer */
+#define BBIO_CAPS_DMA_PIN_WAVE		(1 << 2) /* Timer paced port waveform */
+
+void bbio_caps(t_hydra_console *con);
+
+#endif /* _HYDRABUS_BBIO_CAPS_H_ */
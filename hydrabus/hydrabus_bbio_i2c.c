@@ -27,9 +27,94 @@
 #include "hydrabus_bbio.h"
 #include "hydrabus_bbio_i2c.h"
 #include "bsp_i2c.h"
+#include "bsp_i2c_conf.h"
+#include "hydrabus_i2c_eeprom.h"
+#include "hydrabus_verify.h"
+#include "hydrabus_bbio_batch.h"
 
 #define I2C_DEV_NUM (1)
 
+/*
+ * I2C sniffer edge capture.
+ * EXTI fires on SCL rising edge (data bit) and on both SDA edges (START/STOP),
+ * the callback only stores the SCL/SDA state in a ring buffer, decoding is
+ * done by the console thread so USB stalls never lose edges.
+ * Ring buffer use g_sbuf upper part (tx_data/rx_data are not used while sniffing).
+ */
+#define I2C_SNIFF_RING_SIZE (32768) /* Shall be a power of 2 */
+#define I2C_SNIFF_RING_MASK (I2C_SNIFF_RING_SIZE-1)
+#define I2C_SNIFF_OUT_SIZE (256)
+
+#define I2C_SNIFF_SCL_LINE (6) /* PB6 */
+#define I2C_SNIFF_SDA_LINE (7) /* PB7 */
+
+/* Event format (8bits) */
+#define I2C_SNIFF_EV_SCL (BIT0) /* SCL state */
+#define I2C_SNIFF_EV_SDA (BIT1) /* SDA state */
+#define I2C_SNIFF_EV_SCL_RISE (BIT7) /* Event triggered by SCL rising edge else by SDA edge */
+
+static uint8_t * const i2c_sniff_ring = (uint8_t *)g_sbuf + 8192;
+static volatile uint32_t i2c_sniff_head;
+static volatile uint32_t i2c_sniff_tail;
+static volatile uint32_t i2c_sniff_dropped;
+
+static void i2c_sniff_extcb(EXTDriver *extp, expchannel_t channel);
+
+static const EXTConfig i2c_sniff_extcfg = {
+	{
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_RISING_EDGE | EXT_CH_MODE_AUTOSTART | EXT_MODE_GPIOB, i2c_sniff_extcb}, /* EXTI6 SCL */
+		{EXT_CH_MODE_BOTH_EDGES | EXT_CH_MODE_AUTOSTART | EXT_MODE_GPIOB, i2c_sniff_extcb}, /* EXTI7 SDA */
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL}
+	}
+};
+
+/* Triggered on SCL rising edge or SDA edges, shall be as short as possible */
+static void i2c_sniff_extcb(EXTDriver *extp, expchannel_t channel)
+{
+	uint32_t idr, head;
+	uint8_t ev;
+
+	(void)extp;
+
+	idr = BSP_I2C1_SCL_SDA_GPIO_PORT->IDR;
+
+	ev = (channel == I2C_SNIFF_SCL_LINE) ? I2C_SNIFF_EV_SCL_RISE : 0;
+	if(idr & BSP_I2C1_SCL_PIN)
+		ev |= I2C_SNIFF_EV_SCL;
+	if(idr & BSP_I2C1_SDA_PIN)
+		ev |= I2C_SNIFF_EV_SDA;
+
+	head = i2c_sniff_head;
+	if((head - i2c_sniff_tail) >= I2C_SNIFF_RING_SIZE) {
+		/* Ring buffer full, edge lost */
+		i2c_sniff_dropped++;
+		return;
+	}
+	i2c_sniff_ring[head & I2C_SNIFF_RING_MASK] = ev;
+	__DMB();
+	i2c_sniff_head = head + 1;
+}
+
 void bbio_i2c_init_proto_default(t_hydra_console *con)
 {
 	mode_config_proto_t* proto = &con->mode->proto;
@@ -41,12 +126,267 @@ void bbio_i2c_init_proto_default(t_hydra_console *con)
 	proto->ack_pending = 0;
 }
 
+/*
+ * Passive I2C sniffer, output use Bus Pirate binary sniffer format:
+ * '[' START, ']' STOP, '\\' followed by data byte, '+' ACK, '-' NACK.
+ * Sniffer is stopped when any byte is received from host or UBTN is pressed.
+ */
 void bbio_i2c_sniff(t_hydra_console *con)
 {
-	(void)con;
-	/* TODO bbio_i2c_sniff code */
+	mode_config_proto_t* proto = &con->mode->proto;
+	uint8_t out[I2C_SNIFF_OUT_SIZE];
+	uint32_t out_idx, head, tail;
+	uint32_t nb_bits, data;
+	uint8_t ev, sda, sda_at_rise;
+	bool started;
+
+	/* Release SCL & SDA, sniffer never drives the bus */
+	bsp_i2c_init(proto->dev_num, proto);
+
+	i2c_sniff_head = 0;
+	i2c_sniff_tail = 0;
+	i2c_sniff_dropped = 0;
+
+	sda_at_rise = (gpio_get_pin(BSP_I2C1_SCL_SDA_GPIO_PORT, BSP_I2C1_SDA_PIN)) ? 1 : 0;
+	started = FALSE;
+	nb_bits = 0;
+	data = 0;
+	out_idx = 0;
+
+	extStart(&EXTD1, &i2c_sniff_extcfg);
+	cprint(con, "\x01", 1);
+
+	while(!USER_BUTTON) {
+		head = i2c_sniff_head;
+		tail = i2c_sniff_tail;
+
+		if(head == tail) {
+			if(out_idx > 0) {
+				cprint(con, (char *)out, out_idx);
+				out_idx = 0;
+			}
+			/* Any byte from host stop the sniffer */
+			if(chnReadTimeout(con->sdu, &ev, 1, 1) == 1)
+				break;
+			continue;
+		}
+
+		while(tail != head) {
+			ev = i2c_sniff_ring[tail & I2C_SNIFF_RING_MASK];
+			tail++;
+			sda = (ev & I2C_SNIFF_EV_SDA) ? 1 : 0;
+
+			if(ev & I2C_SNIFF_EV_SCL_RISE) {
+				/* Data bit sampled on SCL rising edge */
+				sda_at_rise = sda;
+				if(started == FALSE)
+					continue;
+				data = (data << 1) | sda;
+				nb_bits++;
+				if(nb_bits == 9) {
+					/* 8bits data + ACK/NACK */
+					out[out_idx++] = '\\';
+					out[out_idx++] = (data >> 1) & 0xFF;
+					out[out_idx++] = (data & 1) ? '-' : '+';
+					nb_bits = 0;
+					data = 0;
+				}
+			} else if((ev & I2C_SNIFF_EV_SCL) && (sda != sda_at_rise)) {
+				/*
+				 * SDA changed while SCL high since last SCL rising edge.
+				 * SDA edge with same level as sampled on SCL rising edge
+				 * means SDA changed before SCL rose (data setup) => ignored.
+				 */
+				if(sda == 0) {
+					/* START or Repeated START */
+					out[out_idx++] = '[';
+					started = TRUE;
+				} else {
+					/* STOP */
+					out[out_idx++] = ']';
+					started = FALSE;
+				}
+				sda_at_rise = sda;
+				nb_bits = 0;
+				data = 0;
+			}
+
+			if(out_idx > (I2C_SNIFF_OUT_SIZE - 4)) {
+				i2c_sniff_tail = tail;
+				cprint(con, (char *)out, out_idx);
+				out_idx = 0;
+			}
+		}
+		i2c_sniff_tail = tail;
+	}
+	extStop(&EXTD1);
+
+	if(out_idx > 0)
+		cprint(con, (char *)out, out_idx);
+
+	cprint(con, "\x01", 1);
+}
+
+typedef struct {
+	t_hydra_console *con;
+	uint32_t remaining; /* Bytes not yet transferred with host */
+} bbio_i2c_eeprom_ctx_t;
+
+static uint32_t bbio_i2c_eeprom_rx(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	bbio_i2c_eeprom_ctx_t *ee_ctx = (bbio_i2c_eeprom_ctx_t *)ctx;
+	uint32_t cnt;
+
+	cnt = chnRead(ee_ctx->con->sdu, buf, nb);
+	ee_ctx->remaining -= cnt;
+	return cnt;
+}
+
+static uint32_t bbio_i2c_eeprom_tx(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	bbio_i2c_eeprom_ctx_t *ee_ctx = (bbio_i2c_eeprom_ctx_t *)ctx;
+
+	cprint(ee_ctx->con, (char *)buf, nb);
+	ee_ctx->remaining -= nb;
+	return nb;
+}
+
+/*
+ * EEPROM read/program/CRC, parameters (12 bytes, big endian):
+ * device address, address width, page size (2), offset (4), length (4).
+ * Reply 0x01 if parameters are valid else 0x00.
+ * Read: length bytes are sent (padded with 0xFF on error) then status.
+ * Write: host sends length bytes, status is sent when all are consumed.
+ * CRC: 0x01 followed by CRC-32 (IEEE 802.3) of the range(4), or 0x00.
+ */
+static void bbio_i2c_eeprom(t_hydra_console *con, uint8_t cmd, uint8_t *buf)
+{
+	bbio_i2c_eeprom_ctx_t ctx;
+	i2c_eeprom_t ee;
+	verify_t v;
+	uint32_t offset, nb, crc;
+	uint8_t params[12];
+	bsp_status_t status;
+
+	chnRead(con->sdu, params, 12);
+	ee.dev_addr = params[0];
+	ee.addr_width = params[1];
+	ee.page_size = (params[2] << 8) | params[3];
+	offset = (params[4] << 24) | (params[5] << 16) | (params[6] << 8) | params[7];
+	nb = (params[8] << 24) | (params[9] << 16) | (params[10] << 8) | params[11];
+
+	if(i2c_eeprom_check(&ee) != BSP_OK) {
+		cprint(con, "\x00", 1);
+		return;
+	}
+	cprint(con, "\x01", 1);
+
+	if(cmd == BBIO_I2C_EEPROM_CRC) {
+		verify_init(&v, offset, VERIFY_CRC32_IEEE,
+			    NULL, NULL, NULL, NULL, NULL);
+		status = i2c_eeprom_read(&ee, offset, nb, verify_sink, &v, buf);
+		crc = verify_end(&v);
+		if(status != BSP_OK) {
+			cprint(con, "\x00", 1);
+			return;
+		}
+		params[0] = 1;
+		params[1] = crc >> 24;
+		params[2] = crc >> 16;
+		params[3] = crc >> 8;
+		params[4] = crc;
+		cprint(con, (char *)params, 5);
+		return;
+	}
+
+	ctx.con = con;
+	ctx.remaining = nb;
+	if(cmd == BBIO_I2C_EEPROM_READ) {
+		status = i2c_eeprom_read(&ee, offset, nb, bbio_i2c_eeprom_tx,
+					 &ctx, buf);
+		if(ctx.remaining > 0) {
+			/* Keep host in sync */
+			memset(buf, 0xFF, I2C_EEPROM_BUF_SIZE);
+			while(ctx.remaining > 0) {
+				nb = (ctx.remaining > I2C_EEPROM_BUF_SIZE) ?
+				     I2C_EEPROM_BUF_SIZE : ctx.remaining;
+				bbio_i2c_eeprom_tx(&ctx, buf, nb);
+			}
+		}
+	} else {
+		status = i2c_eeprom_write(&ee, offset, nb, bbio_i2c_eeprom_rx,
+					  &ctx, buf);
+		/* Drop data not programmed */
+		while(ctx.remaining > 0) {
+			nb = (ctx.remaining > I2C_EEPROM_BUF_SIZE) ?
+			     I2C_EEPROM_BUF_SIZE : ctx.remaining;
+			bbio_i2c_eeprom_rx(&ctx, buf, nb);
+		}
+	}
+
+	if(status == BSP_OK)
+		cprint(con, "\x01", 1);
+	else
+		cprint(con, "\x00", 1);
+}
+
+static void bbio_i2c_batch_start(void *ctx)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+
+	bsp_i2c_start(con->mode->proto.dev_num);
+}
+
+static void bbio_i2c_batch_stop(void *ctx)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+
+	bsp_i2c_stop(con->mode->proto.dev_num);
 }
 
+/* Fails on NACK */
+static bsp_status_t bbio_i2c_batch_write(void *ctx, uint8_t *tx_data,
+					 uint16_t nb_data)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+	mode_config_proto_t* proto = &con->mode->proto;
+	bool tx_ack_flag;
+	uint16_t i;
+
+	for(i = 0; i < nb_data; i++) {
+		if(bsp_i2c_master_write_u8(proto->dev_num, tx_data[i],
+					   &tx_ack_flag) != BSP_OK)
+			return BSP_ERROR;
+		if(tx_ack_flag != TRUE)
+			return BSP_ERROR;
+	}
+	return BSP_OK;
+}
+
+/* All bytes are ACKed except the last one */
+static bsp_status_t bbio_i2c_batch_read(void *ctx, uint8_t *rx_data,
+					uint16_t nb_data)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+	mode_config_proto_t* proto = &con->mode->proto;
+	uint16_t i;
+
+	for(i = 0; i < nb_data; i++) {
+		if(bsp_i2c_master_read_u8(proto->dev_num, &rx_data[i]) != BSP_OK)
+			return BSP_ERROR;
+		bsp_i2c_read_ack(proto->dev_num, i < (nb_data - 1));
+	}
+	return BSP_OK;
+}
+
+static const bbio_batch_ops_t bbio_i2c_batch_ops = {
+	.select = &bbio_i2c_batch_start,
+	.unselect = &bbio_i2c_batch_stop,
+	.write = &bbio_i2c_batch_write,
+	.read = &bbio_i2c_batch_read,
+	.write_read = NULL,
+};
+
 static void bbio_mode_id(t_hydra_console *con)
 {
 	cprint(con, BBIO_I2C_HEADER, 4);
@@ -100,11 +440,19 @@ void bbio_mode_i2c(t_hydra_console *con)
 			case BBIO_I2C_START_SNIFF:
 				bbio_i2c_sniff(con);
 				break;
+			case BBIO_I2C_EEPROM_READ:
+			case BBIO_I2C_EEPROM_WRITE:
+			case BBIO_I2C_EEPROM_CRC:
+				bbio_i2c_eeprom(con, bbio_subcommand, tx_data);
+				break;
+			case BBIO_I2C_BATCH:
+				bbio_batch(con, &bbio_i2c_batch_ops, con);
+				break;
 			case BBIO_I2C_WRITE_READ:
 				chnRead(con->sdu, rx_data, 4);
 				to_tx = (rx_data[0] << 8) + rx_data[1];
 				to_rx = (rx_data[2] << 8) + rx_data[3];
-				if ((to_tx > 4096) || (to_rx > 4096)) {
+				if ((to_tx > BBIO_WRITE_READ_MAX) || (to_rx > BBIO_WRITE_READ_MAX)) {
 					cprint(con, "\x00", 1);
 					break;
 				}
@@ -33,11 +33,73 @@ static void bbio_mode_id(t_hydra_console *con)
 	cprint(con, BBIO_PIN_HEADER, 4);
 }
 
+/*
+ * Host sends rate (4 bytes, periods per second), count (2 bytes) and
+ * count port states, input pins are sampled at half of each period.
+ * Reply is 0x01 and count input samples, 0x00 on error.
+ */
+static void bbio_pin_wave(t_hydra_console *con, const uint32_t *pin_mode)
+{
+	uint8_t *states = (uint8_t *)g_sbuf + BBIO_PIN_WAVE_STATES_OFFSET;
+	uint16_t *idr = (uint16_t *)(g_sbuf + BBIO_PIN_WAVE_IDR_OFFSET);
+	uint32_t *bsrr = (uint32_t *)g_sbuf;
+	uint8_t rx_data[6];
+	uint32_t rate, nb, i;
+	uint8_t out_mask;
+
+	chnRead(con->sdu, rx_data, 6);
+	rate = (rx_data[0] << 24) | (rx_data[1] << 16) |
+	       (rx_data[2] << 8) | rx_data[3];
+	nb = (rx_data[4] << 8) | rx_data[5];
+
+	if(nb > BBIO_PIN_WAVE_MAX) {
+		/* Drain announced states to stay in sync with host */
+		while(nb > 0) {
+			i = (nb > BBIO_PIN_WAVE_MAX) ? BBIO_PIN_WAVE_MAX : nb;
+			chnRead(con->sdu, states, i);
+			nb -= i;
+		}
+	}
+	if(nb == 0) {
+		cprint(con, "\x00", 1);
+		return;
+	}
+	chnRead(con->sdu, states, nb);
+	if(rate == 0 || rate > BSP_GPIO_WAVE_RATE_MAX) {
+		cprint(con, "\x00", 1);
+		return;
+	}
+
+	/* Input pins are never driven */
+	out_mask = 0;
+	for(i=0; i<8; i++){
+		if(pin_mode[i] != MODE_CONFIG_DEV_GPIO_IN){
+			out_mask |= 1 << i;
+		}
+	}
+	for(i=0; i<nb; i++){
+		bsrr[i] = (states[i] & out_mask) |
+			  ((~states[i] & out_mask) << 16);
+	}
+
+	if(bsp_gpio_port_wave(BSP_GPIO_PORTA, bsrr, idr, nb, rate) != BSP_OK) {
+		cprint(con, "\x00", 1);
+		return;
+	}
+
+	for(i=0; i<nb; i++){
+		states[i] = idr[i];
+	}
+	cprint(con, "\x01", 1);
+	cprint(con, (char *)states, nb);
+}
+
 void bbio_mode_pin(t_hydra_console *con)
 {
 	uint8_t bbio_subcommand;
 
 	uint8_t rx_buff, i, reconfig;
+	uint8_t rx_data[2];
 	uint16_t data;
 
 	uint32_t pin_mode[8];
@@ -109,15 +171,22 @@ void bbio_mode_pin(t_hydra_console *con)
 				break;
 			case BBIO_PIN_WRITE:
 				chnRead(con->sdu, &rx_buff, 1);
-				for(i=0; i<8; i++){
-					if((rx_buff>>i)&1){
-						bsp_gpio_set(BSP_GPIO_PORTA, i);
-					}else{
-						bsp_gpio_clr(BSP_GPIO_PORTA, i);
-					}
-				}
+				/* All pins change at the same time */
+				bsp_gpio_port_write(BSP_GPIO_PORTA, rx_buff,
+						    ~rx_buff & 0xff);
 				cprint(con, "\x01", 1);
 				break;
+			case BBIO_PIN_WRITE_PORT:
+				/* Mask, value: only pins in mask are changed */
+				chnRead(con->sdu, rx_data, 2);
+				bsp_gpio_port_write(BSP_GPIO_PORTA,
+						    rx_data[0] & rx_data[1],
+						    rx_data[0] & ~rx_data[1]);
+				cprint(con, "\x01", 1);
+				break;
+			case BBIO_PIN_WAVE:
+				bbio_pin_wave(con, pin_mode);
+				break;
 			}
 			if(reconfig == 1) {
 				for(i=0; i<8; i++){
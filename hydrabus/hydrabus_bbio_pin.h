@@ -18,4 +18,9 @@
 
 #define BBIO_PIN_HEADER		"PIN1"
 
+/* Max states of BBIO_PIN_WAVE, g_sbuf holds BSRR words, IDR samples and states */
+#define BBIO_PIN_WAVE_MAX		(8192)
+#define BBIO_PIN_WAVE_IDR_OFFSET	(BBIO_PIN_WAVE_MAX * 4)
+#define BBIO_PIN_WAVE_STATES_OFFSET	(BBIO_PIN_WAVE_IDR_OFFSET + BBIO_PIN_WAVE_MAX * 2)
+
 void bbio_mode_pin(t_hydra_console *con);
@@ -27,6 +27,7 @@
 #include "hydrabus_bbio_rawwire.h"
 #include "hydrabus_mode_twowire.h"
 #include "hydrabus_mode_threewire.h"
+#include "hydrabus_bbio_batch.h"
 
 
 const mode_rawwire_exec_t bbio_twowire = {
@@ -64,6 +65,41 @@ const mode_rawwire_exec_t bbio_threewire = {
 	.cleanup = &threewire_cleanup,
 };
 
+typedef struct {
+	t_hydra_console *con;
+	mode_rawwire_exec_t *mode;
+} bbio_rawwire_batch_t;
+
+static bsp_status_t bbio_rawwire_batch_write(void *ctx, uint8_t *tx_data,
+					     uint16_t nb_data)
+{
+	bbio_rawwire_batch_t *raw = (bbio_rawwire_batch_t *)ctx;
+	uint16_t i;
+
+	for(i = 0; i < nb_data; i++)
+		raw->mode->write_u8(raw->con, tx_data[i]);
+	return BSP_OK;
+}
+
+static bsp_status_t bbio_rawwire_batch_read(void *ctx, uint8_t *rx_data,
+					    uint16_t nb_data)
+{
+	bbio_rawwire_batch_t *raw = (bbio_rawwire_batch_t *)ctx;
+	uint16_t i;
+
+	for(i = 0; i < nb_data; i++)
+		rx_data[i] = raw->mode->read_u8(raw->con);
+	return BSP_OK;
+}
+
+static const bbio_batch_ops_t bbio_rawwire_batch_ops = {
+	.select = NULL,
+	.unselect = NULL,
+	.write = &bbio_rawwire_batch_write,
+	.read = &bbio_rawwire_batch_read,
+	.write_read = NULL,
+};
+
 static void bbio_mode_id(t_hydra_console *con)
 {
 	cprint(con, BBIO_RAWWIRE_HEADER, 4);
@@ -76,6 +112,10 @@ void bbio_mode_rawwire(t_hydra_console *con)
 	uint8_t data;
 	mode_rawwire_exec_t curmode = bbio_twowire;
 	mode_config_proto_t* proto = &con->mode->proto;
+	bbio_rawwire_batch_t batch;
+
+	batch.con = con;
+	batch.mode = &curmode;
 
 	curmode.init(con);
 	curmode.pin_init(con);
@@ -126,6 +166,9 @@ void bbio_mode_rawwire(t_hydra_console *con)
 				curmode.data_high();
 				cprint(con, "\x01", 1);
 				break;
+			case BBIO_RAWWIRE_BATCH:
+				bbio_batch(con, &bbio_rawwire_batch_ops, &batch);
+				break;
 			default:
 				if ((bbio_subcommand & BBIO_RAWWIRE_BULK_TRANSFER) == BBIO_RAWWIRE_BULK_TRANSFER) {
 					// data contains the number of bytes to
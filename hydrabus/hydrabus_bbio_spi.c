@@ -27,6 +27,49 @@
 #include "hydrabus_bbio.h"
 #include "hydrabus_bbio_spi.h"
 #include "bsp_spi.h"
+#include "hydrabus_spi_sniff.h"
+#include "hydrabus_spi_flash.h"
+#include "hydrabus_verify.h"
+#include "hydrabus_bbio_batch.h"
+
+#define BBIO_SPI_SNIFF_BUF_SIZE (4096)
+/* Max time a record is kept before being sent to host */
+#define BBIO_SPI_SNIFF_FLUSH_MS (10)
+
+/*
+ * DMA sniffer stream records, big endian
+ * CS low: 0x01
+ * CS high: 0x02
+ * Data: 0x03 len(2) MOSI(len) MISO(len)
+ * Overflow: 0x04 bytes lost(4)
+ * End: 0xFF bytes(4) bytes lost(4), sent when capture is stopped
+ */
+#define BBIO_SPI_REC_CS_LOW	0x01
+#define BBIO_SPI_REC_CS_HIGH	0x02
+#define BBIO_SPI_REC_DATA	0x03
+#define BBIO_SPI_REC_OVERFLOW	0x04
+#define BBIO_SPI_REC_END	0xFF
+
+/* AVR serial programming instructions, 4 bytes each */
+#define AVR_READ_LOW		0x20
+#define AVR_READ_HIGH		0x28
+#define AVR_LOAD_LOW		0x40
+#define AVR_LOAD_HIGH		0x48
+#define AVR_WRITE_PAGE		0x4C
+#define AVR_POLL_BUSY		0xF0
+/* Instructions of a whole request are sent in one transfer */
+#define BBIO_SPI_AVR_BUF_SIZE	(4 * BBIO_WRITE_READ_MAX)
+/* Word address is 16 bits */
+#define BBIO_SPI_AVR_WORDS	(0x10000)
+#define BBIO_SPI_AVR_PAGE_MAX	(512)
+#define BBIO_SPI_AVR_WRITE_TIMEOUT_MS (50)
+
+typedef struct {
+	t_hydra_console *con;
+	uint8_t *out;
+	uint32_t out_idx;
+	systime_t flush_time;
+} bbio_spi_sniff_t;
 
 void bbio_spi_init_proto_default(t_hydra_console *con)
 {
@@ -87,6 +130,439 @@ void bbio_spi_sniff(t_hydra_console *con)
 	status = bsp_spi_deinit(BSP_DEV_SPI2);
 }
 
+static uint8_t *put_raw_uint32(uint8_t *out, uint32_t num)
+{
+	*out++ = num >> 24;
+	*out++ = num >> 16;
+	*out++ = num >> 8;
+	*out++ = num;
+	return out;
+}
+
+/* Send records to host, return TRUE if any byte was received from host */
+static bool bbio_spi_sniff_flush(bbio_spi_sniff_t *s, systime_t timeout)
+{
+	uint8_t c;
+
+	if(s->out_idx > 0) {
+		cprint(s->con, (char *)s->out, s->out_idx);
+		s->out_idx = 0;
+	}
+	return chnReadTimeout(s->con->sdu, &c, 1, timeout) == 1;
+}
+
+static bool bbio_spi_sniff_sink(void *ctx, const spi_sniff_ev_t *ev)
+{
+	bbio_spi_sniff_t *s = (bbio_spi_sniff_t *)ctx;
+	uint8_t *p;
+
+	if(ev->type == SPI_SNIFF_EV_IDLE) {
+		if(s->out_idx > 0 &&
+		   (int32_t)(chVTGetSystemTimeX() - s->flush_time) < 0) {
+			chThdSleep(1);
+			return FALSE;
+		}
+		/* Any byte from host stop the capture, wait 1 tick when idle */
+		return bbio_spi_sniff_flush(s, 1);
+	}
+
+	if(s->out_idx + 3 + 2 * ev->len > BBIO_SPI_SNIFF_BUF_SIZE) {
+		if(bbio_spi_sniff_flush(s, TIME_IMMEDIATE))
+			return TRUE;
+	}
+	if(s->out_idx == 0)
+		s->flush_time = chVTGetSystemTimeX() + MS2ST(BBIO_SPI_SNIFF_FLUSH_MS);
+
+	p = &s->out[s->out_idx];
+	switch(ev->type) {
+	case SPI_SNIFF_EV_CS_LOW:
+		*p++ = BBIO_SPI_REC_CS_LOW;
+		break;
+	case SPI_SNIFF_EV_CS_HIGH:
+		*p++ = BBIO_SPI_REC_CS_HIGH;
+		break;
+	case SPI_SNIFF_EV_DATA:
+		*p++ = BBIO_SPI_REC_DATA;
+		*p++ = ev->len >> 8;
+		*p++ = ev->len;
+		memcpy(p, ev->mosi, ev->len);
+		p += ev->len;
+		memcpy(p, ev->miso, ev->len);
+		p += ev->len;
+		break;
+	case SPI_SNIFF_EV_OVERFLOW:
+		*p++ = BBIO_SPI_REC_OVERFLOW;
+		p = put_raw_uint32(p, ev->len);
+		break;
+	default:
+		break;
+	}
+	s->out_idx = p - s->out;
+
+	if((int32_t)(chVTGetSystemTimeX() - s->flush_time) >= 0)
+		return bbio_spi_sniff_flush(s, TIME_IMMEDIATE);
+	return FALSE;
+}
+
+/*
+ * Sniff with DMA, MOSI on SPI1 and MISO on SPI2 (received on SPI2 MOSI pin),
+ * CS on PA15. Reply 0x01 then stream records until any byte is received
+ * from host, or 0x00 on error.
+ */
+static void bbio_spi_sniff_dma(t_hydra_console *con)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	spi_sniff_stats_t stats;
+	bbio_spi_sniff_t s;
+	bsp_status_t status;
+	uint8_t *p;
+
+	/* Records use g_sbuf lower part, upper part is used by the sniffer */
+	s.con = con;
+	s.out = (uint8_t *)g_sbuf;
+	/* Status is sent with first records */
+	s.out[0] = 1;
+	s.out_idx = 1;
+	s.flush_time = chVTGetSystemTimeX();
+
+	status = spi_sniff(proto, bbio_spi_sniff_sink, &s, &stats);
+	if(status != BSP_OK) {
+		cprint(con, "\x00", 1);
+		return;
+	}
+
+	p = &s.out[s.out_idx];
+	*p++ = BBIO_SPI_REC_END;
+	p = put_raw_uint32(p, stats.bytes);
+	p = put_raw_uint32(p, stats.lost);
+	cprint(con, (char *)s.out, p - s.out);
+}
+
+typedef struct {
+	t_hydra_console *con;
+	uint32_t remaining; /* Bytes not yet transferred with host */
+} bbio_spi_flash_ctx_t;
+
+static uint32_t bbio_spi_flash_rx(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	bbio_spi_flash_ctx_t *fl_ctx = (bbio_spi_flash_ctx_t *)ctx;
+	uint32_t cnt;
+
+	cnt = chnRead(fl_ctx->con->sdu, buf, nb);
+	fl_ctx->remaining -= cnt;
+	return cnt;
+}
+
+static uint32_t bbio_spi_flash_tx(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	bbio_spi_flash_ctx_t *fl_ctx = (bbio_spi_flash_ctx_t *)ctx;
+
+	cprint(fl_ctx->con, (char *)buf, nb);
+	fl_ctx->remaining -= nb;
+	return nb;
+}
+
+/*
+ * SPI NOR flash, sub-command (1 byte) then:
+ * Probe: reply 0x01 JEDEC ID(3) SFDP(1) size(4) page size(4)
+ *        smallest erase size(4), or 0x00 if no flash is detected.
+ * Read/Erase/Write/Verify/CRC: offset(4) length(4), big endian.
+ * Reply 0x01 if flash is detected and range is valid else 0x00.
+ * Read: length bytes are sent (padded with 0xFF on error) then status.
+ * Erase: status is sent when done.
+ * Write/Verify: host sends length bytes, status is sent when all are
+ * consumed, verify failure is 0x00 followed by first mismatch address(4).
+ * CRC: 0x01 followed by CRC-32 (IEEE 802.3) of the range(4), or 0x00.
+ */
+static void bbio_spi_flash(t_hydra_console *con)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	uint8_t *buf = (uint8_t *)g_sbuf;
+	bbio_spi_flash_ctx_t ctx;
+	spi_flash_t fl;
+	verify_t v;
+	uint32_t offset, nb, mismatch, crc;
+	uint8_t cmd, params[8], *p;
+	bsp_status_t status;
+
+	chnRead(con->sdu, &cmd, 1);
+	offset = 0;
+	nb = 0;
+	if(cmd != BBIO_SPI_FLASH_PROBE) {
+		chnRead(con->sdu, params, 8);
+		offset = (params[0] << 24) | (params[1] << 16) | (params[2] << 8) | params[3];
+		nb = (params[4] << 24) | (params[5] << 16) | (params[6] << 8) | params[7];
+	}
+
+	status = spi_flash_probe(&fl, proto->dev_num);
+	if(status != BSP_OK || cmd > BBIO_SPI_FLASH_CRC ||
+	   offset > fl.size || nb > fl.size - offset) {
+		cprint(con, "\x00", 1);
+		/* Keep host in sync */
+		ctx.con = con;
+		ctx.remaining = nb;
+		while((cmd == BBIO_SPI_FLASH_WRITE || cmd == BBIO_SPI_FLASH_VERIFY) &&
+		      ctx.remaining > 0) {
+			bbio_spi_flash_rx(&ctx, buf, (ctx.remaining > SPI_FLASH_BUF_SIZE) ?
+					  SPI_FLASH_BUF_SIZE : ctx.remaining);
+		}
+		return;
+	}
+
+	if(cmd == BBIO_SPI_FLASH_PROBE) {
+		p = buf;
+		*p++ = 1;
+		*p++ = fl.id[0];
+		*p++ = fl.id[1];
+		*p++ = fl.id[2];
+		*p++ = fl.sfdp;
+		p = put_raw_uint32(p, fl.size);
+		p = put_raw_uint32(p, fl.page_size);
+		p = put_raw_uint32(p, fl.erase[0].size);
+		cprint(con, (char *)buf, p - buf);
+		return;
+	}
+	cprint(con, "\x01", 1);
+
+	ctx.con = con;
+	ctx.remaining = nb;
+	mismatch = 0xFFFFFFFF;
+	crc = 0;
+	switch(cmd) {
+	case BBIO_SPI_FLASH_READ:
+		status = spi_flash_read(&fl, offset, nb, bbio_spi_flash_tx,
+					&ctx, buf);
+		if(ctx.remaining > 0) {
+			memset(buf, 0xFF, SPI_FLASH_BUF_SIZE);
+			while(ctx.remaining > 0) {
+				nb = (ctx.remaining > SPI_FLASH_BUF_SIZE) ?
+				     SPI_FLASH_BUF_SIZE : ctx.remaining;
+				bbio_spi_flash_tx(&ctx, buf, nb);
+			}
+		}
+		break;
+	case BBIO_SPI_FLASH_ERASE:
+		status = spi_flash_erase(&fl, offset, nb);
+		break;
+	case BBIO_SPI_FLASH_WRITE:
+	case BBIO_SPI_FLASH_VERIFY:
+		if(cmd == BBIO_SPI_FLASH_WRITE)
+			status = spi_flash_write(&fl, offset, nb,
+						 bbio_spi_flash_rx, &ctx, buf);
+		else
+			status = spi_flash_verify(&fl, offset, nb,
+						  bbio_spi_flash_rx, &ctx, buf,
+						  &mismatch);
+		/* Drop data not processed */
+		while(ctx.remaining > 0) {
+			nb = (ctx.remaining > SPI_FLASH_BUF_SIZE) ?
+			     SPI_FLASH_BUF_SIZE : ctx.remaining;
+			bbio_spi_flash_rx(&ctx, buf, nb);
+		}
+		break;
+	case BBIO_SPI_FLASH_CRC:
+		verify_init(&v, offset, VERIFY_CRC32_IEEE,
+			    NULL, NULL, NULL, NULL, NULL);
+		status = spi_flash_read(&fl, offset, nb, verify_sink, &v, buf);
+		crc = verify_end(&v);
+		break;
+	}
+
+	if(status == BSP_OK && cmd == BBIO_SPI_FLASH_CRC) {
+		p = buf;
+		*p++ = 1;
+		p = put_raw_uint32(p, crc);
+		cprint(con, (char *)buf, p - buf);
+	} else if(status == BSP_OK) {
+		cprint(con, "\x01", 1);
+	} else if(cmd == BBIO_SPI_FLASH_VERIFY) {
+		p = buf;
+		*p++ = 0;
+		p = put_raw_uint32(p, mismatch);
+		cprint(con, (char *)buf, p - buf);
+	} else {
+		cprint(con, "\x00", 1);
+	}
+}
+
+static void bbio_spi_avr_params(t_hydra_console *con, uint32_t *addr,
+			       uint32_t *nb)
+{
+	uint8_t params[8];
+
+	chnRead(con->sdu, params, 8);
+	*addr = (params[0] << 24) | (params[1] << 16) | (params[2] << 8) | params[3];
+	*nb = (params[4] << 24) | (params[5] << 16) | (params[6] << 8) | params[7];
+}
+
+/*
+ * AVR flash read: word address(4) length(4), big endian.
+ * Reply 0x01 and length bytes (0xFF on SPI error), or 0x00 if range
+ * is invalid. Read instructions of all bytes are sent in one transfer.
+ */
+static void bbio_spi_avr_read(t_hydra_console *con)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	uint8_t *tx = (uint8_t *)g_sbuf;
+	uint8_t *rx = (uint8_t *)g_sbuf + BBIO_SPI_AVR_BUF_SIZE;
+	uint32_t addr, nb, word, i;
+
+	bbio_spi_avr_params(con, &addr, &nb);
+	if(nb > BBIO_WRITE_READ_MAX || addr > BBIO_SPI_AVR_WORDS ||
+	   (nb + 1) / 2 > BBIO_SPI_AVR_WORDS - addr) {
+		cprint(con, "\x00", 1);
+		return;
+	}
+	cprint(con, "\x01", 1);
+
+	/* Low byte then high byte of each word */
+	for(i = 0; i < nb; i++) {
+		word = addr + i / 2;
+		tx[i * 4] = (i & 1) ? AVR_READ_HIGH : AVR_READ_LOW;
+		tx[i * 4 + 1] = word >> 8;
+		tx[i * 4 + 2] = word;
+		tx[i * 4 + 3] = 0;
+	}
+	if(bsp_spi_write_read_dma(proto->dev_num, tx, rx, nb * 4) == BSP_OK) {
+		/* Data is the last byte of each instruction */
+		for(i = 0; i < nb; i++)
+			rx[i] = rx[i * 4 + 3];
+	} else {
+		memset(rx, 0xFF, nb);
+	}
+	cprint(con, (char *)rx, nb);
+}
+
+static bsp_status_t bbio_spi_avr_wait(bsp_dev_spi_t dev_num)
+{
+	uint8_t tx[4] = { AVR_POLL_BUSY, 0, 0, 0 };
+	uint8_t rx[4];
+	systime_t start;
+
+	start = chVTGetSystemTime();
+	while(1) {
+		if(bsp_spi_write_read_u8(dev_num, tx, rx, 4) != BSP_OK)
+			return BSP_ERROR;
+		if((rx[3] & 1) == 0)
+			return BSP_OK;
+		if((chVTGetSystemTime() - start) > MS2ST(BBIO_SPI_AVR_WRITE_TIMEOUT_MS))
+			return BSP_TIMEOUT;
+		chThdSleepMilliseconds(1);
+	}
+}
+
+/*
+ * AVR flash page write: word address(4) length(4), big endian, then
+ * length bytes. Length shall be even and data shall not cross a page.
+ * Reply 0x01 when page is written, 0x00 on error. Page load and write
+ * instructions are sent in one transfer, then busy flag is polled.
+ */
+static void bbio_spi_avr_write(t_hydra_console *con)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	uint8_t *tx = (uint8_t *)g_sbuf;
+	uint8_t *rx = (uint8_t *)g_sbuf + BBIO_SPI_AVR_BUF_SIZE;
+	uint8_t *data = (uint8_t *)g_sbuf + 2 * BBIO_SPI_AVR_BUF_SIZE;
+	uint32_t addr, nb, i, cnt;
+	uint8_t *p;
+
+	bbio_spi_avr_params(con, &addr, &nb);
+	if(nb == 0 || (nb & 1) || nb > BBIO_SPI_AVR_PAGE_MAX ||
+	   addr > BBIO_SPI_AVR_WORDS || nb / 2 > BBIO_SPI_AVR_WORDS - addr) {
+		/* Keep host in sync */
+		while(nb > 0) {
+			cnt = (nb > BBIO_SPI_AVR_BUF_SIZE) ? BBIO_SPI_AVR_BUF_SIZE : nb;
+			chnRead(con->sdu, data, cnt);
+			nb -= cnt;
+		}
+		cprint(con, "\x00", 1);
+		return;
+	}
+	chnRead(con->sdu, data, nb);
+
+	p = tx;
+	for(i = 0; i < nb; i++) {
+		*p++ = (i & 1) ? AVR_LOAD_HIGH : AVR_LOAD_LOW;
+		*p++ = 0;
+		*p++ = addr + i / 2;
+		*p++ = data[i];
+	}
+	*p++ = AVR_WRITE_PAGE;
+	*p++ = addr >> 8;
+	*p++ = addr;
+	*p++ = 0;
+
+	if(bsp_spi_write_read_dma(proto->dev_num, tx, rx, p - tx) == BSP_OK &&
+	   bbio_spi_avr_wait(proto->dev_num) == BSP_OK) {
+		cprint(con, "\x01", 1);
+	} else {
+		cprint(con, "\x00", 1);
+	}
+}
+
+static void bbio_spi_batch_select(void *ctx)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+
+	bsp_spi_select(con->mode->proto.dev_num);
+}
+
+static void bbio_spi_batch_unselect(void *ctx)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+
+	bsp_spi_unselect(con->mode->proto.dev_num);
+}
+
+/* tx_data or rx_data can be NULL, transfers are split in 255 bytes */
+static bsp_status_t bbio_spi_batch_write_read(void *ctx, uint8_t *tx_data,
+					      uint8_t *rx_data, uint16_t nb_data)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+	mode_config_proto_t* proto = &con->mode->proto;
+	bsp_status_t status;
+	uint8_t nb;
+
+	status = BSP_OK;
+	while(nb_data > 0 && status == BSP_OK) {
+		nb = (nb_data > 255) ? 255 : nb_data;
+		if(tx_data == NULL) {
+			status = bsp_spi_read_u8(proto->dev_num, rx_data, nb);
+		} else if(rx_data == NULL) {
+			status = bsp_spi_write_u8(proto->dev_num, tx_data, nb);
+		} else {
+			status = bsp_spi_write_read_u8(proto->dev_num, tx_data,
+						       rx_data, nb);
+		}
+		if(tx_data != NULL)
+			tx_data += nb;
+		if(rx_data != NULL)
+			rx_data += nb;
+		nb_data -= nb;
+	}
+	return status;
+}
+
+static bsp_status_t bbio_spi_batch_write(void *ctx, uint8_t *tx_data,
+					 uint16_t nb_data)
+{
+	return bbio_spi_batch_write_read(ctx, tx_data, NULL, nb_data);
+}
+
+static bsp_status_t bbio_spi_batch_read(void *ctx, uint8_t *rx_data,
+					uint16_t nb_data)
+{
+	return bbio_spi_batch_write_read(ctx, NULL, rx_data, nb_data);
+}
+
+static const bbio_batch_ops_t bbio_spi_batch_ops = {
+	.select = &bbio_spi_batch_select,
+	.unselect = &bbio_spi_batch_unselect,
+	.write = &bbio_spi_batch_write,
+	.read = &bbio_spi_batch_read,
+	.write_read = &bbio_spi_batch_write_read,
+};
+
 static void bbio_mode_id(t_hydra_console *con)
 {
 	cprint(con, BBIO_SPI_HEADER, 4);
@@ -129,12 +605,21 @@ void bbio_mode_spi(t_hydra_console *con)
 			case BBIO_SPI_SNIFF_CS_HIGH:
 				bbio_spi_sniff(con);
 				break;
+			case BBIO_SPI_SNIFF_DMA:
+				bbio_spi_sniff_dma(con);
+				break;
+			case BBIO_SPI_FLASH:
+				bbio_spi_flash(con);
+				break;
+			case BBIO_SPI_BATCH:
+				bbio_batch(con, &bbio_spi_batch_ops, con);
+				break;
 			case BBIO_SPI_WRITE_READ:
 			case BBIO_SPI_WRITE_READ_NCS:
 				chnRead(con->sdu, rx_data, 4);
 				to_tx = (rx_data[0] << 8) + rx_data[1];
 				to_rx = (rx_data[2] << 8) + rx_data[3];
-				if ((to_tx > 4096) || (to_rx > 4096)) {
+				if ((to_tx > BBIO_WRITE_READ_MAX) || (to_rx > BBIO_WRITE_READ_MAX)) {
 					cprint(con, "\x00", 1);
 					break;
 				}
@@ -192,56 +677,10 @@ void bbio_mode_spi(t_hydra_console *con)
 					cprint(con, "\x01\x00\x01", 3);
 					break;
 				case BBIO_SPI_AVR_READ:
-					// to_tx contains the base address
-					chnRead(con->sdu, rx_data, 4);
-					to_tx =(rx_data[0]<<24) + (rx_data[1]<<16);
-					to_tx +=(rx_data[2]<<8) + rx_data[3];
-					// to_tx contains the number of bytes to
-					// read
-					chnRead(con->sdu, rx_data, 4);
-					to_rx =(rx_data[0]<<24) + (rx_data[1]<<16);
-					to_rx +=(rx_data[2]<<8) + rx_data[3];
-
-					if ((to_tx > 4096) || (to_rx > 4096) ||
-					    (to_tx + to_rx > 4096)) {
-						cprint(con, "\x00", 1);
-						break;
-					}
-
-					cprint(con, "\x01", 1);
-
-					for(i=to_tx; to_rx>0; i++) {
-						// Fetch low byte
-						data = 0x20;
-						bsp_spi_write_u8(proto->dev_num,
-								 &data, 1);
-						data = i>>8;
-						bsp_spi_write_u8(proto->dev_num,
-								 &data, 1);
-						data = i&0xff;
-						bsp_spi_write_u8(proto->dev_num,
-								 &data, 1);
-						bsp_spi_read_u8(proto->dev_num,
-								&data, 1);
-						cprint(con, (char *)&data, 1);
-						to_rx--;
-
-						if(to_rx == 0) break;
-
-						data = 0x28;
-						bsp_spi_write_u8(proto->dev_num,
-								 &data, 1);
-						data = i>>8;
-						bsp_spi_write_u8(proto->dev_num,
-								 &data, 1);
-						data = i&0xff;
-						bsp_spi_write_u8(proto->dev_num,
-								 &data, 1);
-						bsp_spi_read_u8(proto->dev_num,
-								&data, 1);
-						cprint(con, (char *)&data, 1);
-						to_rx--;
-					}
+					bbio_spi_avr_read(con);
+					break;
+				case BBIO_SPI_AVR_WRITE:
+					bbio_spi_avr_write(con);
 					break;
 				default:
 					cprint(con, "\x00", 1);
@@ -27,6 +27,7 @@
 #include "hydrabus_bbio.h"
 #include "hydrabus_bbio_uart.h"
 #include "bsp_uart.h"
+#include "hydrabus_bbio_batch.h"
 
 void bbio_uart_init_proto_default(t_hydra_console *con)
 {
@@ -61,6 +62,49 @@ msg_t uart_reader_thread (void *arg)
 	return (msg_t)1;
 }
 
+/* Transfers are split in 255 bytes */
+static bsp_status_t bbio_uart_batch_write(void *ctx, uint8_t *tx_data,
+					  uint16_t nb_data)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+	mode_config_proto_t* proto = &con->mode->proto;
+	uint8_t nb;
+
+	while(nb_data > 0) {
+		nb = (nb_data > 255) ? 255 : nb_data;
+		if(bsp_uart_write_u8(proto->dev_num, tx_data, nb) != BSP_OK)
+			return BSP_ERROR;
+		tx_data += nb;
+		nb_data -= nb;
+	}
+	return BSP_OK;
+}
+
+static bsp_status_t bbio_uart_batch_read(void *ctx, uint8_t *rx_data,
+					 uint16_t nb_data)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+	mode_config_proto_t* proto = &con->mode->proto;
+	uint8_t nb;
+
+	while(nb_data > 0) {
+		nb = (nb_data > 255) ? 255 : nb_data;
+		if(bsp_uart_read_u8(proto->dev_num, rx_data, nb) != BSP_OK)
+			return BSP_ERROR;
+		rx_data += nb;
+		nb_data -= nb;
+	}
+	return BSP_OK;
+}
+
+static const bbio_batch_ops_t bbio_uart_batch_ops = {
+	.select = NULL,
+	.unselect = NULL,
+	.write = &bbio_uart_batch_write,
+	.read = &bbio_uart_batch_read,
+	.write_read = NULL,
+};
+
 static void bbio_mode_id(t_hydra_console *con)
 {
 	cprint(con, BBIO_UART_HEADER, 4);
@@ -107,6 +151,9 @@ void bbio_mode_uart(t_hydra_console *con)
 				}
 				cprint(con, "\x01", 1);
 				break;
+			case BBIO_UART_BATCH:
+				bbio_batch(con, &bbio_uart_batch_ops, con);
+				break;
 			case BBIO_UART_BAUD_RATE:
 				/* Not implemented */
 				cprint(con, "\x00", 1);
@@ -0,0 +1,335 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * ISO 15765-2 (ISO-TP) transport layer on top of bsp_can_write/bsp_can_read.
+ * Only normal addressing with classic CAN frames is supported.
+ * Separation time between Consecutive Frames is measured from the end of
+ * transmission of the previous frame with the DWT cycle counter, the thread
+ * sleeps while far from the deadline and spins for the last part.
+ */
+
+#include "hydrabus_can_isotp.h"
+#include <string.h>
+
+#define ISOTP_PCI_SF (0x00) /* Single Frame */
+#define ISOTP_PCI_FF (0x10) /* First Frame */
+#define ISOTP_PCI_CF (0x20) /* Consecutive Frame */
+#define ISOTP_PCI_FC (0x30) /* Flow Control */
+#define ISOTP_PCI_MASK (0xF0)
+
+#define ISOTP_FC_CTS (0) /* Continue To Send */
+#define ISOTP_FC_WAIT (1)
+#define ISOTP_FC_OVFLW (2)
+
+#define ISOTP_CYCLES_PER_MS (STM32_SYSCLK / 1000)
+/* Below this remaining time, busy wait on cycle counter */
+#define ISOTP_SPIN_CYCLES (2 * ISOTP_CYCLES_PER_MS)
+
+/** \brief Convert STmin parameter to DWT cycles.
+ *
+ * \param st_min uint8_t: STmin from Flow Control frame.
+ * \return uint32_t: separation time in cycles.
+ *
+ */
+static uint32_t isotp_stmin_cycles(uint8_t st_min)
+{
+	if(st_min <= 0x7F)
+		return st_min * ISOTP_CYCLES_PER_MS;
+	/* 0xF1 to 0xF9 are 100us to 900us */
+	if(st_min >= 0xF1 && st_min <= 0xF9)
+		return (st_min - 0xF0) * (ISOTP_CYCLES_PER_MS / 10);
+	/* Reserved values shall be handled as 127ms */
+	return 0x7F * ISOTP_CYCLES_PER_MS;
+}
+
+static void isotp_wait_cycles(uint32_t start, uint32_t cycles)
+{
+	uint32_t elapsed;
+
+	while((elapsed = get_cyclecounter() - start) < cycles) {
+		if(cycles - elapsed > ISOTP_SPIN_CYCLES)
+			chThdSleepMilliseconds(1);
+	}
+}
+
+/** \brief Send one frame padded to 8 bytes.
+ *
+ * \param isotp const can_isotp_t*: ISO-TP parameters.
+ * \param tx_msg CanTxMsgTypeDef*: frame with Data[0..len-1] set.
+ * \param len uint8_t: number of meaningful bytes.
+ * \return bsp_status_t: status of the transfer.
+ *
+ */
+static bsp_status_t isotp_write(const can_isotp_t *isotp,
+				CanTxMsgTypeDef *tx_msg, uint8_t len)
+{
+	if(isotp->tx_id <= 0x7FF) {
+		tx_msg->StdId = isotp->tx_id;
+		tx_msg->IDE = CAN_ID_STD;
+	} else {
+		tx_msg->ExtId = isotp->tx_id;
+		tx_msg->IDE = CAN_ID_EXT;
+	}
+	tx_msg->RTR = CAN_RTR_DATA;
+	memset(&tx_msg->Data[len], isotp->padding, 8 - len);
+	tx_msg->DLC = 8;
+
+	return bsp_can_write(isotp->dev_num, tx_msg);
+}
+
+/** \brief Wait next data frame received with rx_id, other frames are ignored.
+ *
+ * \param isotp const can_isotp_t*: ISO-TP parameters.
+ * \param rx_msg CanRxMsgTypeDef*: received frame.
+ * \return bsp_status_t: BSP_OK or BSP_TIMEOUT.
+ *
+ */
+static bsp_status_t isotp_read(const can_isotp_t *isotp, CanRxMsgTypeDef *rx_msg)
+{
+	systime_t start;
+	uint32_t id;
+	bsp_status_t status;
+
+	start = chVTGetSystemTime();
+	do {
+		if(!bsp_can_rxne(isotp->dev_num)) {
+			/*
+			 * Yield 1 tick (100us), shorter than 3 frames at 1Mbps so
+			 * the 3 hardware FIFO mailboxes cannot overflow.
+			 */
+			chThdSleep(1);
+			continue;
+		}
+
+		status = bsp_can_read(isotp->dev_num, rx_msg);
+		if(status != BSP_OK)
+			return status;
+
+		id = (rx_msg->IDE == CAN_ID_STD) ? rx_msg->StdId : rx_msg->ExtId;
+		if(id == isotp->rx_id && rx_msg->RTR == CAN_RTR_DATA &&
+		   rx_msg->DLC > 0)
+			return BSP_OK;
+	} while((chVTGetSystemTime() - start) < MS2ST(CAN_ISOTP_TIMEOUT_MS));
+
+	return BSP_TIMEOUT;
+}
+
+static bsp_status_t isotp_send_fc(const can_isotp_t *isotp, uint8_t flow_status)
+{
+	CanTxMsgTypeDef tx_msg;
+
+	tx_msg.Data[0] = ISOTP_PCI_FC | flow_status;
+	tx_msg.Data[1] = isotp->block_size;
+	tx_msg.Data[2] = isotp->st_min;
+	return isotp_write(isotp, &tx_msg, 3);
+}
+
+/** \brief Wait Flow Control Continue To Send from receiver.
+ *
+ * \param isotp const can_isotp_t*: ISO-TP parameters.
+ * \param block_size uint8_t*: BS requested by receiver.
+ * \param st_min uint32_t*: STmin requested by receiver in cycles.
+ * \return bsp_status_t: BSP_OK on CTS, BSP_ERROR on overflow or invalid
+ * flow status, BSP_TIMEOUT.
+ *
+ */
+static bsp_status_t isotp_wait_fc(const can_isotp_t *isotp,
+				  uint8_t *block_size, uint32_t *st_min)
+{
+	CanRxMsgTypeDef rx_msg;
+	bsp_status_t status;
+	int wft;
+
+	wft = 0;
+	while(1) {
+		status = isotp_read(isotp, &rx_msg);
+		if(status != BSP_OK)
+			return status;
+
+		/* Unexpected frames are ignored */
+		if((rx_msg.Data[0] & ISOTP_PCI_MASK) != ISOTP_PCI_FC || rx_msg.DLC < 3)
+			continue;
+
+		switch(rx_msg.Data[0] & 0x0F) {
+		case ISOTP_FC_CTS:
+			*block_size = rx_msg.Data[1];
+			*st_min = isotp_stmin_cycles(rx_msg.Data[2]);
+			return BSP_OK;
+		case ISOTP_FC_WAIT:
+			if(++wft > CAN_ISOTP_WFT_MAX)
+				return BSP_TIMEOUT;
+			break;
+		default:
+			return BSP_ERROR;
+		}
+	}
+}
+
+/** \brief Send a message, segmented if it does not fit in a Single Frame.
+ *
+ * \param isotp const can_isotp_t*: ISO-TP parameters.
+ * \param data const uint8_t*: message.
+ * \param len uint32_t: message length 1 to CAN_ISOTP_SIZE_MAX.
+ * \return bsp_status_t: status of the transfer.
+ *
+ */
+bsp_status_t can_isotp_send(const can_isotp_t *isotp,
+			    const uint8_t *data, uint32_t len)
+{
+	CanTxMsgTypeDef tx_msg;
+	bsp_status_t status;
+	uint32_t pos, chunk, st_min, last;
+	uint8_t sn, bs, block;
+
+	if(len == 0 || len > CAN_ISOTP_SIZE_MAX)
+		return BSP_ERROR;
+
+	if(len <= 7) {
+		tx_msg.Data[0] = ISOTP_PCI_SF | len;
+		memcpy(&tx_msg.Data[1], data, len);
+		return isotp_write(isotp, &tx_msg, len + 1);
+	}
+
+	tx_msg.Data[0] = ISOTP_PCI_FF | (len >> 8);
+	tx_msg.Data[1] = len & 0xFF;
+	memcpy(&tx_msg.Data[2], data, 6);
+	status = isotp_write(isotp, &tx_msg, 8);
+	if(status != BSP_OK)
+		return status;
+
+	pos = 6;
+	sn = 1;
+	while(pos < len) {
+		status = isotp_wait_fc(isotp, &bs, &st_min);
+		if(status != BSP_OK)
+			return status;
+
+		/* First Consecutive Frame of a block is sent without delay */
+		block = 0;
+		last = get_cyclecounter() - st_min;
+		do {
+			isotp_wait_cycles(last, st_min);
+
+			chunk = len - pos;
+			if(chunk > 7)
+				chunk = 7;
+			tx_msg.Data[0] = ISOTP_PCI_CF | (sn & 0x0F);
+			memcpy(&tx_msg.Data[1], &data[pos], chunk);
+			status = isotp_write(isotp, &tx_msg, chunk + 1);
+			if(status != BSP_OK)
+				return status;
+			last = get_cyclecounter();
+
+			pos += chunk;
+			sn++;
+			block++;
+		} while(pos < len && (bs == 0 || block < bs));
+	}
+	return BSP_OK;
+}
+
+/** \brief Receive a message, Flow Control is sent for segmented messages.
+ *
+ * \param isotp const can_isotp_t*: ISO-TP parameters.
+ * \param data uint8_t*: reassembled message.
+ * \param size uint32_t: size of data buffer.
+ * \param len uint32_t*: received message length.
+ * \return bsp_status_t: status of the transfer, BSP_ERROR on sequence
+ * error or message larger than buffer.
+ *
+ */
+bsp_status_t can_isotp_recv(const can_isotp_t *isotp,
+			    uint8_t *data, uint32_t size, uint32_t *len)
+{
+	CanRxMsgTypeDef rx_msg;
+	bsp_status_t status;
+	uint32_t msg_len, pos, chunk;
+	uint8_t sn, block;
+
+	*len = 0;
+	while(1) {
+		status = isotp_read(isotp, &rx_msg);
+		if(status != BSP_OK)
+			return status;
+
+		switch(rx_msg.Data[0] & ISOTP_PCI_MASK) {
+		case ISOTP_PCI_SF:
+			msg_len = rx_msg.Data[0] & 0x0F;
+			if(msg_len == 0 || msg_len + 1 > rx_msg.DLC)
+				continue;
+			if(msg_len > size)
+				return BSP_ERROR;
+			memcpy(data, &rx_msg.Data[1], msg_len);
+			*len = msg_len;
+			return BSP_OK;
+		case ISOTP_PCI_FF:
+			if(rx_msg.DLC < 8)
+				continue;
+			msg_len = ((rx_msg.Data[0] & 0x0F) << 8) | rx_msg.Data[1];
+			if(msg_len < 8)
+				continue;
+			break;
+		default:
+			/* Ignore frames until start of a message */
+			continue;
+		}
+		break;
+	}
+
+	if(msg_len > size) {
+		isotp_send_fc(isotp, ISOTP_FC_OVFLW);
+		return BSP_ERROR;
+	}
+	memcpy(data, &rx_msg.Data[2], 6);
+	status = isotp_send_fc(isotp, ISOTP_FC_CTS);
+	if(status != BSP_OK)
+		return status;
+
+	pos = 6;
+	sn = 1;
+	block = 0;
+	while(pos < msg_len) {
+		status = isotp_read(isotp, &rx_msg);
+		if(status != BSP_OK)
+			return status;
+		if((rx_msg.Data[0] & ISOTP_PCI_MASK) != ISOTP_PCI_CF)
+			continue;
+		if((rx_msg.Data[0] & 0x0F) != (sn & 0x0F))
+			return BSP_ERROR;
+
+		chunk = msg_len - pos;
+		if(chunk > 7)
+			chunk = 7;
+		if(chunk + 1 > rx_msg.DLC)
+			return BSP_ERROR;
+		memcpy(&data[pos], &rx_msg.Data[1], chunk);
+		pos += chunk;
+		sn++;
+
+		if(isotp->block_size != 0 && ++block == isotp->block_size &&
+		   pos < msg_len) {
+			block = 0;
+			status = isotp_send_fc(isotp, ISOTP_FC_CTS);
+			if(status != BSP_OK)
+				return status;
+		}
+	}
+	*len = msg_len;
+	return BSP_OK;
+}
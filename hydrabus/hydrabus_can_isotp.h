@@ -0,0 +1,49 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRABUS_CAN_ISOTP_H_
+#define _HYDRABUS_CAN_ISOTP_H_
+
+#include "common.h"
+#include "bsp.h"
+#include "bsp_can.h"
+
+/* Max message size with 12bits First Frame length */
+#define CAN_ISOTP_SIZE_MAX (4095)
+/* N_Bs / N_Cr timeout (wait for Flow Control / Consecutive Frame) */
+#define CAN_ISOTP_TIMEOUT_MS (1000)
+/* Max number of consecutive Flow Control WAIT accepted */
+#define CAN_ISOTP_WFT_MAX (16)
+/* Default frame padding byte */
+#define CAN_ISOTP_PADDING (0xCC)
+
+typedef struct {
+	bsp_dev_can_t dev_num;
+	uint32_t tx_id; /* ID of frames sent */
+	uint32_t rx_id; /* ID of frames received (Flow Control and response) */
+	uint8_t block_size; /* BS sent in our Flow Control, 0 = no limit */
+	uint8_t st_min; /* STmin sent in our Flow Control */
+	uint8_t padding; /* Frames are padded to 8 bytes with this value */
+} can_isotp_t;
+
+bsp_status_t can_isotp_send(const can_isotp_t *isotp,
+			    const uint8_t *data, uint32_t len);
+bsp_status_t can_isotp_recv(const can_isotp_t *isotp,
+			    uint8_t *data, uint32_t size, uint32_t *len);
+
+#endif /* _HYDRABUS_CAN_ISOTP_H_ */
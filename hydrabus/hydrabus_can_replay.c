@@ -0,0 +1,232 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * CAN trace replay and fuzzing.
+ * Frames are queued to the bsp_can scheduled transmission, the timer
+ * interrupt loads them in TX mailboxes at the original inter-frame time
+ * (or fixed rate), the caller thread only has to keep the queue filled.
+ */
+
+#include "hydrabus_can_replay.h"
+#include "bsp_rng.h"
+
+#define CAN_REPLAY_TICKS_PER_US (BSP_CAN_TX_CLOCK / 1000000)
+/* End of replay, max time without any frame sent */
+#define CAN_REPLAY_DRAIN_TIMEOUT_MS (100)
+
+/* Get a free slot in TX queue, wait while it is full */
+static bsp_can_tx_frame_t *can_replay_slot(void)
+{
+	bsp_can_tx_frame_t *frame;
+
+	while((frame = bsp_can_tx_sched_get()) == NULL) {
+		if(USER_BUTTON)
+			return NULL;
+		chThdSleepMilliseconds(1);
+	}
+	return frame;
+}
+
+/* Wait end of transmission of queued frames */
+static void can_replay_drain(void)
+{
+	uint32_t pending, prev;
+	systime_t start;
+
+	prev = bsp_can_tx_sched_pending();
+	start = chVTGetSystemTime();
+	while((pending = bsp_can_tx_sched_pending()) > 0 && !USER_BUTTON) {
+		if(pending != prev) {
+			prev = pending;
+			start = chVTGetSystemTime();
+		} else if((chVTGetSystemTime() - start) > MS2ST(CAN_REPLAY_DRAIN_TIMEOUT_MS)) {
+			/* No ACK on the bus */
+			break;
+		}
+		chThdSleepMilliseconds(1);
+	}
+}
+
+static uint32_t can_replay_fixed_delay(const can_replay_t *replay)
+{
+	if(replay->flood || replay->rate == 0)
+		return 0;
+	return BSP_CAN_TX_CLOCK / replay->rate;
+}
+
+static void can_replay_random_data(bsp_can_tx_frame_t *frame)
+{
+	uint32_t rnd;
+
+	rnd = bsp_rng_read();
+	frame->data[0] = rnd;
+	frame->data[1] = rnd >> 8;
+	frame->data[2] = rnd >> 16;
+	frame->data[3] = rnd >> 24;
+	rnd = bsp_rng_read();
+	frame->data[4] = rnd;
+	frame->data[5] = rnd >> 8;
+	frame->data[6] = rnd >> 16;
+	frame->data[7] = rnd >> 24;
+}
+
+static void can_replay_random_id(bsp_can_tx_frame_t *frame, uint32_t id_mask)
+{
+	frame->id ^= bsp_rng_read() & id_mask;
+	frame->id &= (frame->flags & BSP_CAN_RX_FLAG_EXT) ? 0x1FFFFFFF : 0x7FF;
+}
+
+static void can_replay_mutate(const can_replay_t *replay, bsp_can_tx_frame_t *frame)
+{
+	if(replay->id_mask != 0)
+		can_replay_random_id(frame, replay->id_mask);
+	if(replay->random_data)
+		can_replay_random_data(frame);
+}
+
+static uint32_t get_be32(const uint8_t *buf)
+{
+	return (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+/** \brief Replay a trace with original timing, fixed rate or back to back.
+ *
+ * \param replay const can_replay_t*: replay parameters.
+ * \param source can_replay_io_t: called to read trace records.
+ * \param ctx void*: source context.
+ * \return bsp_status_t: BSP_OK at end of trace or when source stops,
+ * BSP_ERROR on invalid record or if device is not initialized.
+ *
+ */
+bsp_status_t can_replay(const can_replay_t *replay,
+			can_replay_io_t source, void *ctx)
+{
+	bsp_can_tx_frame_t *frame;
+	bsp_status_t status;
+	uint8_t rec[13];
+	uint32_t ts, prev_ts, fixed_delay;
+	uint64_t delay;
+	bool first;
+
+	status = bsp_can_tx_sched_start(replay->dev_num);
+	if(status != BSP_OK)
+		return status;
+	if(replay->random_data || replay->id_mask != 0)
+		bsp_rng_init();
+
+	fixed_delay = can_replay_fixed_delay(replay);
+	first = TRUE;
+	prev_ts = 0;
+	while(1) {
+		/* Record type and timestamp */
+		if(source(ctx, rec, 5) != 5)
+			break;
+		ts = get_be32(&rec[1]);
+
+		if(rec[0] == CAN_REPLAY_REC_END) {
+			source(ctx, rec, 4);
+			break;
+		}
+		if(rec[0] & CAN_REPLAY_REC_OVERFLOW) {
+			if(source(ctx, rec, 8) != 8)
+				break;
+			continue;
+		}
+
+		frame = can_replay_slot();
+		if(frame == NULL)
+			break;
+		if(source(ctx, rec, 6) != 6)
+			break;
+		frame->id = get_be32(rec);
+		frame->flags = rec[4] & (BSP_CAN_RX_FLAG_EXT | BSP_CAN_RX_FLAG_RTR);
+		frame->dlc = rec[5];
+		if(frame->dlc > 8) {
+			status = BSP_ERROR;
+			break;
+		}
+		if(source(ctx, frame->data, frame->dlc) != frame->dlc)
+			break;
+
+		if(replay->rate != 0 || replay->flood) {
+			frame->delay = first ? 0 : fixed_delay;
+		} else {
+			delay = first ? 0 : (uint64_t)(ts - prev_ts) * CAN_REPLAY_TICKS_PER_US;
+			frame->delay = (delay > BSP_CAN_TX_DELAY_MAX) ?
+				       BSP_CAN_TX_DELAY_MAX : delay;
+		}
+		prev_ts = ts;
+		first = FALSE;
+
+		can_replay_mutate(replay, frame);
+		bsp_can_tx_sched_commit();
+	}
+
+	if(status == BSP_OK)
+		can_replay_drain();
+	bsp_can_tx_sched_stop();
+	if(replay->random_data || replay->id_mask != 0)
+		bsp_rng_deinit();
+	return status;
+}
+
+/** \brief Send random frames, ID is replay->id with id_mask bits randomized,
+ * DLC and payload are random.
+ *
+ * \param replay const can_replay_t*: fuzz parameters.
+ * \param stop can_replay_stop_t: called between frames, NULL if unused.
+ * \param ctx void*: stop context.
+ * \return bsp_status_t: status of the start.
+ *
+ */
+bsp_status_t can_fuzz(const can_replay_t *replay,
+		      can_replay_stop_t stop, void *ctx)
+{
+	bsp_can_tx_frame_t *frame;
+	bsp_status_t status;
+	uint32_t i, delay;
+
+	status = bsp_can_tx_sched_start(replay->dev_num);
+	if(status != BSP_OK)
+		return status;
+	bsp_rng_init();
+
+	delay = can_replay_fixed_delay(replay);
+	for(i = 0; replay->count == 0 || i < replay->count; i++) {
+		if(stop != NULL && stop(ctx))
+			break;
+		frame = can_replay_slot();
+		if(frame == NULL)
+			break;
+
+		frame->delay = (i == 0) ? 0 : delay;
+		frame->id = replay->id;
+		frame->flags = (replay->id > 0x7FF) ? BSP_CAN_RX_FLAG_EXT : 0;
+		frame->dlc = bsp_rng_read() % 9;
+		can_replay_random_data(frame);
+		if(replay->id_mask != 0)
+			can_replay_random_id(frame, replay->id_mask);
+		bsp_can_tx_sched_commit();
+	}
+
+	can_replay_drain();
+	bsp_can_tx_sched_stop();
+	bsp_rng_deinit();
+	return BSP_OK;
+}
@@ -0,0 +1,59 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRABUS_CAN_REPLAY_H_
+#define _HYDRABUS_CAN_REPLAY_H_
+
+#include "common.h"
+#include "bsp.h"
+#include "bsp_can.h"
+
+/*
+ * Trace records, same format as BBIO CAN stream, big endian:
+ * Frame: bus(1) timestamp us(4) id(4) flags(1) dlc(1) data(dlc)
+ *        flags: bit0 extended ID, bit1 RTR
+ * Overflow: 0x80 | bus(1) timestamp us(4) dropped(4) overrun(4), ignored
+ * End: 0xFF(1) timestamp us(4) frames(4), stops the replay
+ */
+#define CAN_REPLAY_REC_OVERFLOW	0x80
+#define CAN_REPLAY_REC_END	0xFF
+
+typedef struct {
+	bsp_dev_can_t dev_num;
+	uint32_t rate; /* Fixed rate in frames/s, 0 = trace timing */
+	bool flood; /* Frames back to back, TX mailboxes kept full */
+	bool random_data; /* Randomize payload with hardware RNG */
+	uint32_t id_mask; /* ID bits randomized with hardware RNG */
+	uint32_t id; /* Fuzz: base ID */
+	uint32_t count; /* Fuzz: number of frames, 0 = until stopped */
+} can_replay_t;
+
+/*
+ * Trace source callback.
+ * Shall read exactly nb bytes and return nb or a value < nb to stop.
+ */
+typedef uint32_t (*can_replay_io_t)(void *ctx, uint8_t *buf, uint32_t nb);
+/* Fuzz stop callback, return TRUE to stop */
+typedef bool (*can_replay_stop_t)(void *ctx);
+
+bsp_status_t can_replay(const can_replay_t *replay,
+			can_replay_io_t source, void *ctx);
+bsp_status_t can_fuzz(const can_replay_t *replay,
+		      can_replay_stop_t stop, void *ctx);
+
+#endif /* _HYDRABUS_CAN_REPLAY_H_ */
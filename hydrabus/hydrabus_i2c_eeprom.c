@@ -0,0 +1,264 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * 24Cxx like I2C EEPROM read/program engine.
+ * Memory address bytes which do not fit in addr_width are sent in the
+ * device address low bits (24C04/08/16 A8-A10, 24CM01/02 A16-A17).
+ * Writes are split on page boundaries, the next page is fetched from the
+ * data source while the EEPROM performs its internal write cycle, end of
+ * write cycle is detected by ACK polling.
+ */
+
+#include "hydrabus_i2c_eeprom.h"
+#include "bsp_i2c.h"
+
+#define I2C_EEPROM_DEV (BSP_DEV_I2C1)
+
+/* Size of memory area addressed by one device address */
+#define block_size(eeprom) (1UL << (8 * (eeprom)->addr_width))
+
+static uint8_t i2c_eeprom_dev_addr(const i2c_eeprom_t *eeprom, uint32_t mem_addr)
+{
+	uint8_t dev;
+
+	dev = eeprom->dev_addr;
+	dev |= (mem_addr >> (8 * eeprom->addr_width)) & 0x07;
+	return dev;
+}
+
+/** \brief Send START, device address in write mode and memory address.
+ *
+ * \param eeprom const i2c_eeprom_t*: EEPROM parameters.
+ * \param mem_addr uint32_t: memory address.
+ * \return bsp_status_t: BSP_OK if all bytes are ACKed else BSP_ERROR.
+ *
+ */
+static bsp_status_t i2c_eeprom_set_addr(const i2c_eeprom_t *eeprom, uint32_t mem_addr)
+{
+	int i;
+	bool ack;
+
+	bsp_i2c_start(I2C_EEPROM_DEV);
+	bsp_i2c_master_write_u8(I2C_EEPROM_DEV,
+				i2c_eeprom_dev_addr(eeprom, mem_addr) << 1, &ack);
+	if(ack != TRUE)
+		return BSP_ERROR;
+
+	for(i = eeprom->addr_width - 1; i >= 0; i--) {
+		bsp_i2c_master_write_u8(I2C_EEPROM_DEV, (mem_addr >> (8 * i)) & 0xFF, &ack);
+		if(ack != TRUE)
+			return BSP_ERROR;
+	}
+	return BSP_OK;
+}
+
+/** \brief Wait end of write cycle using ACK polling.
+ *
+ * \param eeprom const i2c_eeprom_t*: EEPROM parameters.
+ * \param mem_addr uint32_t: memory address of the last written page.
+ * \return bsp_status_t: BSP_OK when device ACK or BSP_TIMEOUT.
+ *
+ */
+static bsp_status_t i2c_eeprom_ack_poll(const i2c_eeprom_t *eeprom, uint32_t mem_addr)
+{
+	systime_t start;
+	uint8_t dev;
+	bool ack;
+
+	dev = i2c_eeprom_dev_addr(eeprom, mem_addr) << 1;
+	start = chVTGetSystemTime();
+	do {
+		bsp_i2c_start(I2C_EEPROM_DEV);
+		bsp_i2c_master_write_u8(I2C_EEPROM_DEV, dev, &ack);
+		bsp_i2c_stop(I2C_EEPROM_DEV);
+		if(ack == TRUE)
+			return BSP_OK;
+	} while((chVTGetSystemTime() - start) < MS2ST(I2C_EEPROM_POLL_TIMEOUT_MS));
+
+	return BSP_TIMEOUT;
+}
+
+/** \brief Check EEPROM parameters.
+ *
+ * \param eeprom const i2c_eeprom_t*: EEPROM parameters.
+ * \return bsp_status_t: BSP_OK if parameters are valid else BSP_ERROR.
+ *
+ */
+bsp_status_t i2c_eeprom_check(const i2c_eeprom_t *eeprom)
+{
+	if(eeprom->dev_addr > 0x7F)
+		return BSP_ERROR;
+	if(eeprom->addr_width < 1 || eeprom->addr_width > I2C_EEPROM_ADDR_WIDTH_MAX)
+		return BSP_ERROR;
+	if(eeprom->page_size == 0 || eeprom->page_size > I2C_EEPROM_PAGE_SIZE_MAX)
+		return BSP_ERROR;
+	return BSP_OK;
+}
+
+/** \brief Read EEPROM content using sequential reads.
+ *
+ * \param eeprom const i2c_eeprom_t*: EEPROM parameters.
+ * \param offset uint32_t: start memory address.
+ * \param nb uint32_t: number of bytes to read.
+ * \param sink i2c_eeprom_io_t: called for each chunk of data read.
+ * \param ctx void*: sink context.
+ * \param buf uint8_t*: work buffer of I2C_EEPROM_BUF_SIZE bytes.
+ * \return bsp_status_t: status of the transfer.
+ *
+ */
+bsp_status_t i2c_eeprom_read(const i2c_eeprom_t *eeprom,
+			     uint32_t offset, uint32_t nb,
+			     i2c_eeprom_io_t sink, void *ctx, uint8_t *buf)
+{
+	uint32_t i, chunk, seq_end;
+	bool ack, ack_pending;
+
+	if(i2c_eeprom_check(eeprom) != BSP_OK)
+		return BSP_ERROR;
+
+	ack_pending = FALSE;
+	seq_end = offset;
+	while(nb > 0) {
+		if(offset == seq_end) {
+			/* Sequential read shall not cross device address block */
+			seq_end = (offset | (block_size(eeprom) - 1)) + 1;
+			if(seq_end - offset > nb)
+				seq_end = offset + nb;
+
+			if(i2c_eeprom_set_addr(eeprom, offset) != BSP_OK) {
+				bsp_i2c_stop(I2C_EEPROM_DEV);
+				return BSP_ERROR;
+			}
+			/* Repeated START in read mode */
+			bsp_i2c_start(I2C_EEPROM_DEV);
+			bsp_i2c_master_write_u8(I2C_EEPROM_DEV,
+						(i2c_eeprom_dev_addr(eeprom, offset) << 1) | 1, &ack);
+			if(ack != TRUE) {
+				bsp_i2c_stop(I2C_EEPROM_DEV);
+				return BSP_ERROR;
+			}
+		}
+
+		chunk = seq_end - offset;
+		if(chunk > I2C_EEPROM_BUF_SIZE)
+			chunk = I2C_EEPROM_BUF_SIZE;
+
+		/*
+		 * ACK of a byte is only sent before reading the next one, so the
+		 * last byte read before STOP is always NACKed.
+		 */
+		for(i = 0; i < chunk; i++) {
+			if(ack_pending)
+				bsp_i2c_read_ack(I2C_EEPROM_DEV, TRUE);
+			bsp_i2c_master_read_u8(I2C_EEPROM_DEV, &buf[i]);
+			ack_pending = TRUE;
+		}
+		offset += chunk;
+		nb -= chunk;
+		if(offset == seq_end) {
+			/* NACK last byte of the sequential read */
+			bsp_i2c_read_ack(I2C_EEPROM_DEV, FALSE);
+			bsp_i2c_stop(I2C_EEPROM_DEV);
+			ack_pending = FALSE;
+		}
+
+		if(sink(ctx, buf, chunk) != chunk) {
+			if(ack_pending) {
+				bsp_i2c_read_ack(I2C_EEPROM_DEV, FALSE);
+				bsp_i2c_stop(I2C_EEPROM_DEV);
+			}
+			return BSP_ERROR;
+		}
+	}
+	return BSP_OK;
+}
+
+/** \brief Program EEPROM using page writes and ACK polling.
+ *
+ * \param eeprom const i2c_eeprom_t*: EEPROM parameters.
+ * \param offset uint32_t: start memory address.
+ * \param nb uint32_t: number of bytes to write.
+ * \param source i2c_eeprom_io_t: called to fetch each page of data.
+ * \param ctx void*: source context.
+ * \param buf uint8_t*: work buffer of I2C_EEPROM_BUF_SIZE bytes.
+ * \return bsp_status_t: status of the transfer.
+ *
+ */
+bsp_status_t i2c_eeprom_write(const i2c_eeprom_t *eeprom,
+			      uint32_t offset, uint32_t nb,
+			      i2c_eeprom_io_t source, void *ctx, uint8_t *buf)
+{
+	uint8_t *page[2];
+	uint32_t i, len, next_len, cur;
+	bsp_status_t status;
+	bool ack;
+
+	if(i2c_eeprom_check(eeprom) != BSP_OK)
+		return BSP_ERROR;
+	if(nb == 0)
+		return BSP_OK;
+
+	page[0] = buf;
+	page[1] = buf + I2C_EEPROM_PAGE_SIZE_MAX;
+	cur = 0;
+
+	len = eeprom->page_size - (offset % eeprom->page_size);
+	if(len > nb)
+		len = nb;
+	if(source(ctx, page[cur], len) != len)
+		return BSP_ERROR;
+
+	while(nb > 0) {
+		status = i2c_eeprom_set_addr(eeprom, offset);
+		if(status == BSP_OK) {
+			for(i = 0; i < len; i++) {
+				bsp_i2c_master_write_u8(I2C_EEPROM_DEV, page[cur][i], &ack);
+				if(ack != TRUE) {
+					status = BSP_ERROR;
+					break;
+				}
+			}
+		}
+		/* STOP starts the internal write cycle */
+		bsp_i2c_stop(I2C_EEPROM_DEV);
+		if(status != BSP_OK)
+			return status;
+
+		offset += len;
+		nb -= len;
+
+		/* Stage next page while the EEPROM is busy */
+		next_len = 0;
+		if(nb > 0) {
+			next_len = (nb > eeprom->page_size) ? eeprom->page_size : nb;
+			if(source(ctx, page[cur ^ 1], next_len) != next_len) {
+				i2c_eeprom_ack_poll(eeprom, offset - len);
+				return BSP_ERROR;
+			}
+		}
+
+		status = i2c_eeprom_ack_poll(eeprom, offset - len);
+		if(status != BSP_OK)
+			return status;
+
+		cur ^= 1;
+		len = next_len;
+	}
+	return BSP_OK;
+}
@@ -0,0 +1,52 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRABUS_I2C_EEPROM_H_
+#define _HYDRABUS_I2C_EEPROM_H_
+
+#include "common.h"
+#include "bsp.h"
+
+#define I2C_EEPROM_PAGE_SIZE_MAX (256)
+/* Work buffer: 2 pages for write double buffering, whole buffer for read */
+#define I2C_EEPROM_BUF_SIZE (2 * I2C_EEPROM_PAGE_SIZE_MAX)
+#define I2C_EEPROM_ADDR_WIDTH_MAX (3)
+/* Write cycle time is max 5ms/10ms on 24Cxx, keep a safe margin */
+#define I2C_EEPROM_POLL_TIMEOUT_MS (50)
+
+typedef struct {
+	uint8_t dev_addr; /* 7bits device address (0x50 for 24Cxx) */
+	uint8_t addr_width; /* Memory address bytes 1 to 3 */
+	uint16_t page_size; /* Page write buffer size in bytes */
+} i2c_eeprom_t;
+
+/*
+ * Data source (write) or sink (read) callback.
+ * Shall transfer exactly nb bytes and return nb or a value < nb on error.
+ */
+typedef uint32_t (*i2c_eeprom_io_t)(void *ctx, uint8_t *buf, uint32_t nb);
+
+bsp_status_t i2c_eeprom_check(const i2c_eeprom_t *eeprom);
+bsp_status_t i2c_eeprom_read(const i2c_eeprom_t *eeprom,
+			     uint32_t offset, uint32_t nb,
+			     i2c_eeprom_io_t sink, void *ctx, uint8_t *buf);
+bsp_status_t i2c_eeprom_write(const i2c_eeprom_t *eeprom,
+			      uint32_t offset, uint32_t nb,
+			      i2c_eeprom_io_t source, void *ctx, uint8_t *buf);
+
+#endif /* _HYDRABUS_I2C_EEPROM_H_ */
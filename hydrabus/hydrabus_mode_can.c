@@ -21,12 +21,50 @@
 #include "bsp_gpio.h"
 #include "bsp_can.h"
 #include "hydrabus_mode_can.h"
+#include "hydrabus_can_isotp.h"
+#include "hydrabus_can_replay.h"
+#include "microsd.h"
+#include "ff.h"
 #include "stm32f4xx_hal.h"
+#include <stdio.h>
 #include <string.h>
 
 static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos);
 static int show(t_hydra_console *con, t_tokenline_parsed *p);
 static uint32_t read(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data);
+static void continuous(t_hydra_console *con, bool dual);
+static void stats(t_hydra_console *con, uint32_t period);
+static int isotp(t_hydra_console *con, t_tokenline_parsed *p, int token_pos);
+static int replay(t_hydra_console *con, t_tokenline_parsed *p, int token_pos,
+		  bool fuzz);
+
+#define CAN_CYCLES_PER_US (STM32_SYSCLK / 1000000)
+#define CAN_RX_OUT_SIZE (512)
+#define CAN_RX_LINE_MAX (80)
+
+/* Per ID statistics, open addressing hash table */
+#define CAN_STATS_BITS (8)
+#define CAN_STATS_SIZE (1 << CAN_STATS_BITS)
+#define CAN_STATS_MASK (CAN_STATS_SIZE-1)
+#define CAN_STATS_KEY_EMPTY (0xFFFFFFFF)
+#define CAN_STATS_KEY_EXT (1UL << 31)
+#define CAN_STATS_PERIOD_DEFAULT (1000) /* ms */
+
+typedef struct {
+	uint32_t key; /* CAN ID | CAN_STATS_KEY_EXT, CAN_STATS_KEY_EMPTY if unused */
+	uint32_t count;
+	uint32_t prev_count; /* count at last print */
+	uint32_t last_ts; /* DWT cycles */
+	uint32_t min; /* Inter-arrival time in cycles */
+	uint32_t max;
+	uint64_t sum;
+	uint8_t dlc;
+} can_stats_entry_t;
+
+/* CCM = .ram4, only accessed by CPU */
+static can_stats_entry_t can_stats[CAN_STATS_SIZE] __attribute__ ((section(".ram4")));
+static volatile uint32_t can_stats_bits; /* Nominal bits received (without stuff bits) */
+static volatile uint32_t can_stats_untracked; /* Frames not counted, table full */
 
 static can_config config[2];
 
@@ -131,6 +169,7 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 				cprintf(con, str_bsp_init_err, bsp_status);
 				return t;
 			}
+			config[proto->dev_num].speed = proto->dev_speed;
 			cprintf(con, "Speed: %d bps\r\n", proto->dev_speed);
 			break;
 		case T_FILTER:
@@ -166,9 +205,26 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 			cprintf(con, "ID set to %d\r\n", config[proto->dev_num].can_id);
 			break;
 		case T_CONTINUOUS:
-			while(!USER_BUTTON) {
-				read(con, NULL, 0);
+			continuous(con, FALSE);
+			break;
+		case T_DUAL:
+			continuous(con, TRUE);
+			break;
+		case T_STATS:
+			arg_int = CAN_STATS_PERIOD_DEFAULT;
+			if(p->tokens[t+1] == T_PERIOD) {
+				t += 3;
+				memcpy(&arg_int, p->buf + p->tokens[t], sizeof(int));
 			}
+			stats(con, arg_int > 0 ? arg_int : CAN_STATS_PERIOD_DEFAULT);
+			break;
+		case T_ISOTP:
+			t += isotp(con, p, t + 1);
+			break;
+		case T_REPLAY:
+		case T_FUZZ:
+			t += replay(con, p, t + 1, p->tokens[t] == T_FUZZ);
+			break;
 		default:
 			return t - token_pos;
 		}
@@ -270,6 +326,590 @@ static uint32_t read(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data)
 	return status;
 }
 
+/* Return frame timestamp in cycles since capture start */
+static uint64_t can_frame_time(uint32_t timestamp, uint64_t start)
+{
+	uint64_t now;
+
+	/*
+	 * Frames are processed quickly, age is always < 2^32 cycles.
+	 * Time base is kept up to date by the reader idle loop.
+	 */
+	now = get_cyclecounter64();
+	return (now - (uint32_t)((uint32_t)now - timestamp)) - start;
+}
+
+static uint32_t can_format_frame(char *out, bsp_can_rx_frame_t *frame,
+				 uint64_t start, bool dual)
+{
+	uint64_t us;
+	uint32_t i, len;
+
+	us = can_frame_time(frame->timestamp, start) / CAN_CYCLES_PER_US;
+	len = 0;
+	if(dual)
+		len = snprintf(out, CAN_RX_LINE_MAX, "CAN%d ", frame->dev_num + 1);
+	len += snprintf(out + len, CAN_RX_LINE_MAX, "%lu.%06lu %s: %02lX DLC: %02X RTR: %02X DATA: ",
+			(uint32_t)(us / 1000000), (uint32_t)(us % 1000000),
+			(frame->flags & BSP_CAN_RX_FLAG_EXT) ? "EID" : "SID",
+			frame->id, frame->dlc,
+			(frame->flags & BSP_CAN_RX_FLAG_RTR) ? CAN_RTR_REMOTE : CAN_RTR_DATA);
+	for(i = 0; i < frame->dlc && i < 8; i++)
+		len += snprintf(out + len, 3, "%02X", frame->data[i]);
+	out[len++] = '\r';
+	out[len++] = '\n';
+	return len;
+}
+
+typedef struct {
+	t_hydra_console *con;
+	bool dual;
+} can_reader_t;
+
+/*
+ * Format frames received by interrupt and print them by batch.
+ * In dual mode CAN1 & CAN2 frames are merged in timestamp order.
+ */
+static msg_t can_reader_thread(void *arg)
+{
+	can_reader_t *reader = arg;
+	t_hydra_console *con = reader->con;
+	bsp_can_rx_frame_t *frame;
+	char out[CAN_RX_OUT_SIZE];
+	uint32_t out_idx;
+	uint64_t start;
+
+	chRegSetThreadName("CAN reader");
+
+	start = get_cyclecounter64();
+	out_idx = 0;
+	while(!chThdShouldTerminateX()) {
+		frame = bsp_can_rx_irq_get_any();
+		if(frame == NULL) {
+			if(out_idx > 0) {
+				cprint(con, out, out_idx);
+				out_idx = 0;
+			}
+			/* Track DWT wraps on silent bus (shall be done every < 25s) */
+			get_cyclecounter64();
+			chThdSleepMilliseconds(1);
+			continue;
+		}
+		out_idx += can_format_frame(&out[out_idx], frame, start, reader->dual);
+		bsp_can_rx_irq_release(frame->dev_num);
+
+		if(out_idx > (CAN_RX_OUT_SIZE - CAN_RX_LINE_MAX)) {
+			cprint(con, out, out_idx);
+			out_idx = 0;
+		}
+	}
+	if(out_idx > 0)
+		cprint(con, out, out_idx);
+
+	chThdExit((msg_t)1);
+	return (msg_t)1;
+}
+
+/* Init the controller not selected in the mode with its own speed & filter */
+static bsp_status_t can_init_other(t_hydra_console *con, bsp_dev_can_t dev_num)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	bsp_status_t status;
+
+	status = bsp_can_init(dev_num, proto);
+	if(status != BSP_OK)
+		return status;
+
+	status = bsp_can_set_speed(dev_num, config[dev_num].speed ?
+				   config[dev_num].speed : proto->dev_speed);
+	if(status != BSP_OK)
+		return status;
+
+	if (config[dev_num].filter_id_low != 0 || config[dev_num].filter_id_high != 0) {
+		status = bsp_can_set_filter(dev_num, proto,
+					    config[dev_num].filter_id_low,
+					    config[dev_num].filter_id_high);
+	} else {
+		status = bsp_can_init_filter(dev_num, proto);
+	}
+	return status;
+}
+
+static void continuous(t_hydra_console *con, bool dual)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	bsp_can_rx_stats_t stats;
+	bsp_dev_can_t other;
+	bsp_status_t status;
+	can_reader_t reader;
+	thread_t *rthread;
+	uint8_t c;
+	int i;
+
+	other = (proto->dev_num == BSP_DEV_CAN1) ? BSP_DEV_CAN2 : BSP_DEV_CAN1;
+	if(dual) {
+		status = can_init_other(con, other);
+		if(status == BSP_OK)
+			status = bsp_can_rx_irq_start(other);
+		if(status != BSP_OK) {
+			cprintf(con, str_bsp_init_err, status);
+			bsp_can_deinit(other);
+			return;
+		}
+		cprintf(con, "CAN%d: %d bps CAN%d: %d bps\r\n",
+			proto->dev_num + 1, proto->dev_speed,
+			other + 1, bsp_can_get_speed(other));
+	}
+
+	if(bsp_can_rx_irq_start(proto->dev_num) != BSP_OK) {
+		cprintf(con, "CAN%d not initialized\r\n", proto->dev_num + 1);
+		if(dual)
+			bsp_can_deinit(other);
+		return;
+	}
+
+	reader.con = con;
+	reader.dual = dual;
+	rthread = chThdCreateFromHeap(NULL, CONSOLE_WA_SIZE, "can_reader",
+				      NORMALPRIO, (tfunc_t)can_reader_thread, &reader);
+	if(rthread != NULL) {
+		/* Stop on UBTN or any key */
+		while(!USER_BUTTON) {
+			if(chnReadTimeout(con->sdu, &c, 1, MS2ST(10)) == 1)
+				break;
+		}
+		chThdTerminate(rthread);
+		chThdWait(rthread);
+	} else {
+		cprintf(con, "Not enough memory\r\n");
+	}
+
+	bsp_can_rx_irq_stop(proto->dev_num);
+	if(dual) {
+		bsp_can_rx_irq_stop(other);
+		bsp_can_deinit(other);
+	}
+
+	for(i = 0; i < BSP_DEV_CAN_END; i++) {
+		if(!dual && i != proto->dev_num)
+			continue;
+		bsp_can_rx_irq_get_stats(i, &stats);
+		cprintf(con, "CAN%d Frames: %lu Dropped: %lu HW overrun: %lu\r\n",
+			i + 1, stats.frames, stats.dropped, stats.overrun);
+	}
+}
+
+static can_stats_entry_t *can_stats_lookup(uint32_t key)
+{
+	can_stats_entry_t *entry;
+	uint32_t i, n;
+
+	/* Fibonacci hashing */
+	i = (key * 2654435761UL) >> (32 - CAN_STATS_BITS);
+	for(n = 0; n < CAN_STATS_SIZE; n++) {
+		entry = &can_stats[i];
+		if(entry->key == key)
+			return entry;
+		if(entry->key == CAN_STATS_KEY_EMPTY) {
+			entry->count = 0;
+			entry->prev_count = 0;
+			entry->min = 0xFFFFFFFF;
+			entry->max = 0;
+			entry->sum = 0;
+			entry->key = key;
+			return entry;
+		}
+		i = (i + 1) & CAN_STATS_MASK;
+	}
+	return NULL;
+}
+
+static void can_stats_update(bsp_can_rx_frame_t *frame)
+{
+	can_stats_entry_t *entry;
+	uint32_t key, delta, dlc;
+
+	dlc = (frame->dlc > 8) ? 8 : frame->dlc;
+	if(frame->flags & BSP_CAN_RX_FLAG_EXT) {
+		key = frame->id | CAN_STATS_KEY_EXT;
+		can_stats_bits += 67;
+	} else {
+		key = frame->id;
+		can_stats_bits += 47;
+	}
+	if(!(frame->flags & BSP_CAN_RX_FLAG_RTR))
+		can_stats_bits += 8 * dlc;
+
+	entry = can_stats_lookup(key);
+	if(entry == NULL) {
+		can_stats_untracked++;
+		return;
+	}
+	if(entry->count > 0) {
+		delta = frame->timestamp - entry->last_ts;
+		if(delta < entry->min)
+			entry->min = delta;
+		if(delta > entry->max)
+			entry->max = delta;
+		entry->sum += delta;
+	}
+	entry->last_ts = frame->timestamp;
+	entry->dlc = dlc;
+	entry->count++;
+}
+
+/* Update statistics with frames received by interrupt */
+static msg_t can_stats_thread(void *arg)
+{
+	bsp_can_rx_frame_t *frame;
+
+	(void)arg;
+	chRegSetThreadName("CAN stats");
+
+	while(!chThdShouldTerminateX()) {
+		frame = bsp_can_rx_irq_get_any();
+		if(frame == NULL) {
+			chThdSleepMilliseconds(1);
+			continue;
+		}
+		can_stats_update(frame);
+		bsp_can_rx_irq_release(frame->dev_num);
+	}
+	chThdExit((msg_t)1);
+	return (msg_t)1;
+}
+
+static void can_stats_print(t_hydra_console *con, uint32_t elapsed_ms,
+			    uint32_t *prev_bits)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	uint16_t sorted[CAN_STATS_SIZE];
+	can_stats_entry_t *entry;
+	bsp_can_rx_stats_t rx;
+	uint32_t bits, load, rate, mean, min;
+	int i, j, nb;
+
+	if(elapsed_ms == 0)
+		elapsed_ms = 1;
+
+	bits = can_stats_bits;
+	/* Load in 1/1000 */
+	load = ((uint64_t)(bits - *prev_bits) * 1000 * 1000) /
+	       ((uint64_t)proto->dev_speed * elapsed_ms);
+	*prev_bits = bits;
+
+	bsp_can_rx_irq_get_stats(proto->dev_num, &rx);
+	cprintf(con, "\r\nLoad: %lu.%lu%% Frames: %lu Errors: %lu TEC: %d REC: %d\r\n",
+		load / 10, load % 10, rx.frames, rx.errors, rx.tec, rx.rec);
+	cprintf(con, "Dropped: %lu HW overrun: %lu Untracked: %lu\r\n",
+		rx.dropped, rx.overrun, can_stats_untracked);
+
+	/* Sort used entries by ID */
+	nb = 0;
+	for(i = 0; i < CAN_STATS_SIZE; i++) {
+		if(can_stats[i].key == CAN_STATS_KEY_EMPTY)
+			continue;
+		for(j = nb; j > 0 && can_stats[sorted[j-1]].key > can_stats[i].key; j--)
+			sorted[j] = sorted[j-1];
+		sorted[j] = i;
+		nb++;
+	}
+
+	cprintf(con, "     ID       Count  Rate/s DLC   Min(us)  Mean(us)   Max(us)\r\n");
+	for(i = 0; i < nb; i++) {
+		entry = &can_stats[sorted[i]];
+		rate = ((entry->count - entry->prev_count) * 1000) / elapsed_ms;
+		entry->prev_count = entry->count;
+		mean = 0;
+		min = 0;
+		if(entry->count > 1) {
+			mean = entry->sum / (entry->count - 1);
+			min = entry->min;
+		}
+		cprintf(con, "%s %08lX %7lu %7lu %3d %9lu %9lu %9lu\r\n",
+			(entry->key & CAN_STATS_KEY_EXT) ? "EID" : "SID",
+			entry->key & ~CAN_STATS_KEY_EXT, entry->count, rate,
+			entry->dlc, min / CAN_CYCLES_PER_US,
+			mean / CAN_CYCLES_PER_US,
+			entry->max / CAN_CYCLES_PER_US);
+	}
+}
+
+static void stats(t_hydra_console *con, uint32_t period)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	systime_t last_print, now;
+	uint32_t prev_bits;
+	thread_t *sthread;
+	uint8_t c;
+	int i;
+
+	for(i = 0; i < CAN_STATS_SIZE; i++)
+		can_stats[i].key = CAN_STATS_KEY_EMPTY;
+	can_stats_bits = 0;
+	can_stats_untracked = 0;
+	prev_bits = 0;
+
+	if(bsp_can_rx_irq_start(proto->dev_num) != BSP_OK) {
+		cprintf(con, "CAN%d not initialized\r\n", proto->dev_num + 1);
+		return;
+	}
+	/* Higher priority than console to never fall behind while printing */
+	sthread = chThdCreateFromHeap(NULL, CONSOLE_WA_SIZE, "can_stats",
+				      NORMALPRIO + 1, (tfunc_t)can_stats_thread, NULL);
+	if(sthread == NULL) {
+		bsp_can_rx_irq_stop(proto->dev_num);
+		cprintf(con, "Not enough memory\r\n");
+		return;
+	}
+
+	/* Stop on UBTN or any key */
+	last_print = chVTGetSystemTime();
+	while(!USER_BUTTON) {
+		if(chnReadTimeout(con->sdu, &c, 1, MS2ST(10)) == 1)
+			break;
+		now = chVTGetSystemTime();
+		if((now - last_print) >= MS2ST(period)) {
+			can_stats_print(con, ST2MS(now - last_print), &prev_bits);
+			last_print = now;
+		}
+	}
+
+	chThdTerminate(sthread);
+	chThdWait(sthread);
+	bsp_can_rx_irq_stop(proto->dev_num);
+
+	now = chVTGetSystemTime();
+	can_stats_print(con, ST2MS(now - last_print), &prev_bits);
+}
+
+/* Send ISO-TP request from command line and print the response */
+static int isotp(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	can_isotp_t tp;
+	uint8_t *rx_data = (uint8_t *)g_sbuf;
+	uint32_t arg_u32, len, i;
+	int t, str_offset;
+	bool rx_id_set;
+	char *str;
+	bsp_status_t status;
+
+	tp.dev_num = proto->dev_num;
+	tp.tx_id = config[proto->dev_num].can_id;
+	tp.block_size = 0;
+	tp.st_min = 0;
+	tp.padding = CAN_ISOTP_PADDING;
+	rx_id_set = FALSE;
+	len = 0;
+
+	for (t = token_pos; p->tokens[t]; t++) {
+		switch (p->tokens[t]) {
+		case T_RX_ID:
+		case T_BLOCK_SIZE:
+		case T_STMIN:
+			memcpy(&arg_u32, p->buf + p->tokens[t + 2], sizeof(uint32_t));
+			switch (p->tokens[t]) {
+			case T_RX_ID:
+				tp.rx_id = arg_u32;
+				rx_id_set = TRUE;
+				break;
+			case T_BLOCK_SIZE:
+				if (arg_u32 > 0xff) {
+					cprintf(con, "Block size must be 0 to 255.\r\n");
+					return t - token_pos;
+				}
+				tp.block_size = arg_u32;
+				break;
+			case T_STMIN:
+				/* 0x80-0xF0 and 0xFA-0xFF are reserved (ISO 15765-2) */
+				if (arg_u32 > 0xf9 ||
+				    (arg_u32 > 0x7f && arg_u32 < 0xf1)) {
+					cprintf(con, "STmin must be 0x00-0x7F or 0xF1-0xF9.\r\n");
+					return t - token_pos;
+				}
+				tp.st_min = arg_u32;
+				break;
+			}
+			t += 2;
+			break;
+		case T_ARG_UINT:
+			memcpy(&arg_u32, p->buf + p->tokens[++t], sizeof(uint32_t));
+			if (arg_u32 > 0xff) {
+				cprintf(con, "Please specify one byte at a time.\r\n");
+				return t - token_pos;
+			}
+			if (len < sizeof(proto->buffer_tx))
+				proto->buffer_tx[len++] = arg_u32;
+			break;
+		case T_ARG_STRING:
+			memcpy(&str_offset, &p->tokens[++t], sizeof(int));
+			str = p->buf + str_offset;
+			while (*str != '\0' && len < sizeof(proto->buffer_tx))
+				proto->buffer_tx[len++] = *str++;
+			break;
+		}
+	}
+
+	if (len == 0) {
+		cprintf(con, "Request data is mandatory.\r\n");
+		return t - token_pos;
+	}
+	/* OBD-II / UDS convention, response ID is request ID + 8 */
+	if (!rx_id_set)
+		tp.rx_id = tp.tx_id + 8;
+
+	status = can_isotp_send(&tp, proto->buffer_tx, len);
+	if (status != BSP_OK) {
+		cprintf(con, "ISO-TP send error %d\r\n", status);
+		return t - token_pos;
+	}
+	status = can_isotp_recv(&tp, rx_data, CAN_ISOTP_SIZE_MAX, &len);
+	if (status != BSP_OK) {
+		cprintf(con, "ISO-TP receive error %d\r\n", status);
+		return t - token_pos;
+	}
+
+	cprintf(con, "Response 0x%X: %d bytes\r\n", tp.rx_id, len);
+	/* print_hex() size is 8bits, print by blocks of 15 lines */
+	for (i = 0; i < len; i += 240)
+		print_hex(con, &rx_data[i], (len - i) > 240 ? 240 : (len - i));
+
+	return t - token_pos;
+}
+
+typedef struct {
+	t_hydra_console *con;
+	FIL *fp;
+} can_replay_ctx_t;
+
+/* Stop replay or fuzz on any key */
+static bool can_replay_stop(void *ctx)
+{
+	can_replay_ctx_t *rctx = ctx;
+	uint8_t c;
+
+	return chnReadTimeout(rctx->con->sdu, &c, 1, TIME_IMMEDIATE) == 1;
+}
+
+static uint32_t can_replay_file_read(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	can_replay_ctx_t *rctx = ctx;
+	UINT cnt;
+
+	if(nb == 0)
+		return 0;
+	if(can_replay_stop(ctx))
+		return 0;
+	if(f_read(rctx->fp, buf, nb, &cnt) != FR_OK)
+		return 0;
+	return cnt;
+}
+
+/*
+ * replay: send frames of a microSD trace (BBIO CAN stream format)
+ * fuzz: send random frames with current ID
+ */
+static int replay(t_hydra_console *con, t_tokenline_parsed *p, int token_pos,
+		  bool fuzz)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	can_replay_t rp;
+	can_replay_ctx_t rctx;
+	bsp_can_tx_stats_t stats;
+	filename_t sd_file;
+	uint32_t arg_u32;
+	int t, str_offset;
+	bsp_status_t status;
+	systime_t start;
+	FRESULT err;
+	FIL fp;
+
+	rp.dev_num = proto->dev_num;
+	rp.rate = 0;
+	rp.flood = FALSE;
+	rp.random_data = FALSE;
+	rp.id_mask = 0;
+	rp.id = config[proto->dev_num].can_id;
+	rp.count = 0;
+	sd_file.filename[0] = 0;
+
+	for (t = token_pos; p->tokens[t]; t++) {
+		switch (p->tokens[t]) {
+		case T_FILE:
+			t += 2;
+			memcpy(&str_offset, &p->tokens[t], sizeof(int));
+			snprintf(sd_file.filename, FILENAME_SIZE, "0:%s", p->buf + str_offset);
+			break;
+		case T_FLOOD:
+			rp.flood = TRUE;
+			break;
+		case T_RNG:
+			rp.random_data = TRUE;
+			break;
+		case T_FREQUENCY:
+		case T_SAMPLES:
+		case T_ID_MASK:
+			memcpy(&arg_u32, p->buf + p->tokens[t + 2], sizeof(uint32_t));
+			switch (p->tokens[t]) {
+			case T_FREQUENCY:
+				rp.rate = arg_u32;
+				break;
+			case T_SAMPLES:
+				rp.count = arg_u32;
+				break;
+			case T_ID_MASK:
+				rp.id_mask = arg_u32;
+				break;
+			}
+			t += 2;
+			break;
+		}
+	}
+
+	rctx.con = con;
+	rctx.fp = &fp;
+	if (!fuzz) {
+		if (sd_file.filename[0] == 0) {
+			cprintf(con, "filename is mandatory.\r\n");
+			return t - token_pos;
+		}
+		if (!is_fs_ready()) {
+			if(mount() != 0) {
+				cprintf(con, "Mount failed.\r\n");
+				return t - token_pos;
+			}
+		}
+		err = f_open(&fp, sd_file.filename, FA_READ | FA_OPEN_EXISTING);
+		if (err != FR_OK) {
+			cprintf(con, "Failed to open file %s: error %d.\r\n",
+				sd_file.filename, err);
+			return t - token_pos;
+		}
+	}
+
+	cprintf(con, "Interrupt by pressing user button or any key.\r\n");
+	start = chVTGetSystemTime();
+	if (!fuzz) {
+		status = can_replay(&rp, can_replay_file_read, &rctx);
+		f_close(&fp);
+	} else {
+		status = can_fuzz(&rp, can_replay_stop, &rctx);
+	}
+	start = chVTGetSystemTime() - start;
+
+	if (status != BSP_OK) {
+		cprintf(con, "CAN%d %s error %d\r\n", proto->dev_num + 1,
+			fuzz ? "fuzz" : "replay", status);
+		return t - token_pos;
+	}
+	bsp_can_tx_sched_get_stats(&stats);
+	cprintf(con, "Frames: %lu Late: %lu in %lu ms\r\n",
+		stats.frames, stats.late, (uint32_t)ST2MS(start));
+
+	return t - token_pos;
+}
+
 static void cleanup(t_hydra_console *con)
 {
 	mode_config_proto_t* proto = &con->mode->proto;
@@ -28,5 +28,6 @@ typedef struct {
 	uint32_t can_id;
 	uint32_t filter_id_low;
 	uint32_t filter_id_high;
+	uint32_t speed; /* 0 means default speed */
 } can_config;
 
@@ -18,13 +18,19 @@
  */
 
 #include "hydrabus_mode_i2c.h"
+#include "hydrabus_i2c_eeprom.h"
+#include "hydrabus_verify.h"
 #include "bsp_i2c.h"
+#include "microsd.h"
+#include "ff.h"
+#include <stdio.h>
 #include <string.h>
 
 static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos);
 static int show(t_hydra_console *con, t_tokenline_parsed *p);
 static void scan(t_hydra_console *con, t_tokenline_parsed *p);
 static uint32_t dump(t_hydra_console *con, uint8_t *rx_data, uint32_t nb_data);
+static int eeprom(t_hydra_console *con, t_tokenline_parsed *p, int token_pos);
 
 #define I2C_DEV_NUM (1)
 
@@ -40,6 +46,8 @@ static const char* str_i2c_nack_br = { "NACK\r\n" };
 
 static const char* str_bsp_init_err= { "bsp_i2c_init() error %d\r\n" };
 
+static uint8_t eeprom_buf[I2C_EEPROM_BUF_SIZE];
+
 #define SPEED_NB (4)
 static uint32_t speeds[SPEED_NB] = {
 	50000,
@@ -152,6 +160,9 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 		case T_SCAN:
 			scan(con, p);
 			break;
+		case T_EEPROM:
+			t += eeprom(con, p, t + 1);
+			break;
 		case T_HD:
 			/* Integer parameter. */
 			if (p->tokens[t + 1] == T_ARG_TOKEN_SUFFIX_INT) {
@@ -351,6 +362,195 @@ static void scan(t_hydra_console *con, t_tokenline_parsed *p)
 		cprintf(con, "No devices found.\r\n");
 }
 
+static uint32_t eeprom_file_read(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	UINT cnt;
+
+	if(f_read((FIL *)ctx, buf, nb, &cnt) != FR_OK)
+		return 0;
+	return cnt;
+}
+
+static uint32_t eeprom_file_write(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	UINT cnt;
+
+	if(f_write((FIL *)ctx, buf, nb, &cnt) != FR_OK)
+		return 0;
+	return cnt;
+}
+
+static void eeprom_range(void *ctx, uint32_t index, uint32_t start, uint32_t len)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+
+	if(index < VERIFY_RANGES_SHOW_MAX)
+		cprintf(con, "Mismatch 0x%06lX-0x%06lX (%lu bytes)\r\n",
+			start, start + len - 1, len);
+	else if(index == VERIFY_RANGES_SHOW_MAX)
+		cprintf(con, "...\r\n");
+}
+
+static int eeprom(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	i2c_eeprom_t ee;
+	verify_t v;
+	filename_t sd_file;
+	uint32_t arg_u32, offset, size, start, poly, crc;
+	int t, action, str_offset;
+	bsp_status_t status;
+	FRESULT err;
+	FIL fp;
+
+	ee.dev_addr = 0x50;
+	ee.addr_width = 2;
+	ee.page_size = 32;
+	offset = 0;
+	size = 0;
+	action = 0;
+	poly = VERIFY_CRC32_IEEE;
+	sd_file.filename[0] = 0;
+
+	for (t = token_pos; p->tokens[t]; t++) {
+		switch (p->tokens[t]) {
+		case T_READ:
+		case T_WRITE:
+		case T_VERIFY:
+		case T_CRC:
+			action = p->tokens[t];
+			break;
+		case T_FILE:
+			t += 2;
+			memcpy(&str_offset, &p->tokens[t], sizeof(int));
+			snprintf(sd_file.filename, FILENAME_SIZE, "0:%s", p->buf + str_offset);
+			break;
+		case T_ADDRESS:
+		case T_ADDRESS_WIDTH:
+		case T_PAGE_SIZE:
+		case T_OFFSET:
+		case T_SIZE:
+		case T_POLY:
+			memcpy(&arg_u32, p->buf + p->tokens[t + 2], sizeof(uint32_t));
+			switch (p->tokens[t]) {
+			case T_ADDRESS:
+				ee.dev_addr = arg_u32;
+				break;
+			case T_ADDRESS_WIDTH:
+				ee.addr_width = arg_u32;
+				break;
+			case T_PAGE_SIZE:
+				ee.page_size = arg_u32;
+				break;
+			case T_OFFSET:
+				offset = arg_u32;
+				break;
+			case T_SIZE:
+				size = arg_u32;
+				break;
+			case T_POLY:
+				poly = arg_u32;
+				break;
+			}
+			t += 2;
+			break;
+		}
+	}
+
+	if(action == 0 || (action != T_CRC && sd_file.filename[0] == 0)) {
+		cprintf(con, "read, write, verify or crc and filename are mandatory.\r\n");
+		return t - token_pos;
+	}
+	if(poly == 0) {
+		cprintf(con, "Invalid polynomial.\r\n");
+		return t - token_pos;
+	}
+	if(i2c_eeprom_check(&ee) != BSP_OK) {
+		cprintf(con, "Invalid address, address-width or page-size (max %d).\r\n",
+			I2C_EEPROM_PAGE_SIZE_MAX);
+		return t - token_pos;
+	}
+	if((action == T_READ || action == T_CRC) && size == 0) {
+		cprintf(con, "size is mandatory for read and crc.\r\n");
+		return t - token_pos;
+	}
+
+	if(action != T_CRC) {
+		if (!is_fs_ready()) {
+			if(mount() != 0) {
+				cprintf(con, "Mount failed.\r\n");
+				return t - token_pos;
+			}
+		}
+
+		if(action == T_READ)
+			err = f_open(&fp, sd_file.filename, FA_WRITE | FA_CREATE_ALWAYS);
+		else
+			err = f_open(&fp, sd_file.filename, FA_READ | FA_OPEN_EXISTING);
+		if (err != FR_OK) {
+			cprintf(con, "Failed to open file %s: error %d.\r\n",
+				sd_file.filename, err);
+			return t - token_pos;
+		}
+		if(action != T_READ && (size == 0 || size > fp.fsize))
+			size = fp.fsize;
+	}
+
+	if(proto->ack_pending) {
+		bsp_i2c_read_ack(I2C_DEV_NUM, FALSE);
+		bsp_i2c_stop(I2C_DEV_NUM);
+		proto->ack_pending = 0;
+	}
+
+	crc = 0;
+	start = chVTGetSystemTime();
+	switch(action) {
+	case T_READ:
+		status = i2c_eeprom_read(&ee, offset, size, eeprom_file_write,
+					 &fp, eeprom_buf);
+		break;
+	case T_WRITE:
+		status = i2c_eeprom_write(&ee, offset, size, eeprom_file_read,
+					  &fp, eeprom_buf);
+		break;
+	default:
+		/* Reference chunks are read in g_sbuf */
+		if(action == T_VERIFY)
+			verify_init(&v, offset, poly, eeprom_file_read, &fp,
+				    g_sbuf, eeprom_range, con);
+		else
+			verify_init(&v, offset, poly, NULL, NULL, NULL, NULL, NULL);
+		status = i2c_eeprom_read(&ee, offset, size, verify_sink,
+					 &v, eeprom_buf);
+		crc = verify_end(&v);
+		break;
+	}
+	start = chVTGetSystemTime() - start;
+	if(action != T_CRC)
+		f_close(&fp);
+
+	if(status != BSP_OK) {
+		cprintf(con, "EEPROM %s error %d.\r\n",
+			(action == T_WRITE) ? "write" : "read", status);
+		return t - token_pos;
+	}
+
+	cprintf(con, "%s %lu bytes in %lu ms.\r\n",
+		(action == T_WRITE) ? "Written" : "Read",
+		size, (uint32_t)ST2MS(start));
+	if(action == T_VERIFY || action == T_CRC)
+		cprintf(con, "CRC-32 (poly 0x%08lX): 0x%08lX\r\n", poly, crc);
+	if(action == T_VERIFY) {
+		if(v.mismatch == 0)
+			cprintf(con, "Verify OK.\r\n");
+		else
+			cprintf(con, "Verify failed: %lu bytes in %lu ranges.\r\n",
+				v.mismatch, v.ranges);
+	}
+
+	return t - token_pos;
+}
+
 static const char *get_prompt(t_hydra_console *con)
 {
 	(void)con;
@@ -19,13 +19,21 @@
 
 #include "hydrabus_mode_spi.h"
 #include "bsp_spi.h"
+#include "hydrabus_spi_sniff.h"
+#include "hydrabus_spi_flash.h"
+#include "hydrabus_verify.h"
 #include "hydranfc.h"
 #include "common.h"
+#include "microsd.h"
+#include "ff.h"
+#include <stdio.h>
 #include <string.h>
 
 static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos);
 static int show(t_hydra_console *con, t_tokenline_parsed *p);
 static uint32_t dump(t_hydra_console *con, uint8_t *rx_data, uint32_t nb_data);
+static void sniff(t_hydra_console *con);
+static int flash(t_hydra_console *con, t_tokenline_parsed *p, int token_pos);
 
 static const char* str_pins_spi1= {
 	"CS:   PA15\r\nSCK:  PB3\r\nMISO: PB4\r\nMOSI: PB5\r\n"
@@ -256,6 +264,12 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 			}
 			dump(con, proto->buffer_rx, arg_u32);
 			break;
+		case T_SNIFF:
+			sniff(con);
+			break;
+		case T_FLASH:
+			t += flash(con, p, t + 1);
+			break;
 		default:
 			return t - token_pos;
 		}
@@ -264,6 +278,305 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 	return t - token_pos;
 }
 
+/* Bytes displayed per transaction and direction */
+#define SNIFF_PRINT_MAX (16)
+
+typedef struct {
+	t_hydra_console *con;
+	uint32_t len;
+	uint8_t mosi[SNIFF_PRINT_MAX];
+	uint8_t miso[SNIFF_PRINT_MAX];
+} sniff_print_t;
+
+static void sniff_print_line(sniff_print_t *sp, const char *name, uint8_t *data)
+{
+	char line[8 + 3 * SNIFF_PRINT_MAX + 24];
+	uint32_t i, nb, pos;
+
+	nb = (sp->len > SNIFF_PRINT_MAX) ? SNIFF_PRINT_MAX : sp->len;
+	pos = snprintf(line, sizeof(line), "%s:", name);
+	for (i = 0; i < nb; i++)
+		pos += snprintf(&line[pos], sizeof(line) - pos, " %02X", data[i]);
+	if (sp->len > nb)
+		snprintf(&line[pos], sizeof(line) - pos, " ... (%lu bytes)", sp->len);
+	cprintf(sp->con, "%s\r\n", line);
+}
+
+static void sniff_print(sniff_print_t *sp)
+{
+	if (sp->len == 0)
+		return;
+	sniff_print_line(sp, "MOSI", sp->mosi);
+	sniff_print_line(sp, "MISO", sp->miso);
+	cprintf(sp->con, "\r\n");
+	sp->len = 0;
+}
+
+/* Print first bytes of each transaction, data without CS is printed when idle */
+static bool sniff_sink(void *ctx, const spi_sniff_ev_t *ev)
+{
+	sniff_print_t *sp = (sniff_print_t *)ctx;
+	uint32_t nb;
+	uint8_t c;
+
+	switch (ev->type) {
+	case SPI_SNIFF_EV_DATA:
+		if (sp->len < SNIFF_PRINT_MAX) {
+			nb = SNIFF_PRINT_MAX - sp->len;
+			if (nb > ev->len)
+				nb = ev->len;
+			memcpy(&sp->mosi[sp->len], ev->mosi, nb);
+			memcpy(&sp->miso[sp->len], ev->miso, nb);
+		}
+		sp->len += ev->len;
+		break;
+	case SPI_SNIFF_EV_CS_LOW:
+	case SPI_SNIFF_EV_CS_HIGH:
+		sniff_print(sp);
+		break;
+	case SPI_SNIFF_EV_OVERFLOW:
+		sniff_print(sp);
+		cprintf(sp->con, "Overflow, %lu bytes lost\r\n", ev->len);
+		break;
+	case SPI_SNIFF_EV_IDLE:
+		if (bsp_spi_get_cs(BSP_DEV_SPI1))
+			sniff_print(sp);
+		/* Stop on any key, wait 1 tick */
+		return chnReadTimeout(sp->con->sdu, &c, 1, 1) == 1;
+	}
+	return FALSE;
+}
+
+static void sniff(t_hydra_console *con)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	spi_sniff_stats_t stats;
+	sniff_print_t sp;
+	bsp_status_t status;
+
+	cprintf(con, "MOSI: PB5 MISO: PC3 SCK: PB3 and PB10 CS: PA15\r\n");
+	cprintf(con, "Interrupt by pressing user button or any key.\r\n");
+
+	sp.con = con;
+	sp.len = 0;
+	status = spi_sniff(proto, sniff_sink, &sp, &stats);
+	if (status != BSP_OK) {
+		cprintf(con, str_bsp_init_err, status);
+		return;
+	}
+	sniff_print(&sp);
+	cprintf(con, "Bytes: %lu Lost: %lu CS edges lost: %lu\r\n",
+		stats.bytes, stats.lost, stats.markers_lost);
+}
+
+static uint32_t flash_file_read(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	UINT cnt;
+
+	if (f_read((FIL *)ctx, buf, nb, &cnt) != FR_OK)
+		return 0;
+	return cnt;
+}
+
+static uint32_t flash_file_write(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	UINT cnt;
+
+	if (f_write((FIL *)ctx, buf, nb, &cnt) != FR_OK)
+		return 0;
+	return cnt;
+}
+
+static void flash_range(void *ctx, uint32_t index, uint32_t start, uint32_t len)
+{
+	t_hydra_console *con = (t_hydra_console *)ctx;
+
+	if (index < VERIFY_RANGES_SHOW_MAX)
+		cprintf(con, "Mismatch 0x%08lX-0x%08lX (%lu bytes)\r\n",
+			start, start + len - 1, len);
+	else if (index == VERIFY_RANGES_SHOW_MAX)
+		cprintf(con, "...\r\n");
+}
+
+static void flash_show(t_hydra_console *con, spi_flash_t *fl)
+{
+	int i;
+
+	cprintf(con, "JEDEC ID: 0x%02X 0x%02X 0x%02X\r\n",
+		fl->id[0], fl->id[1], fl->id[2]);
+	cprintf(con, "Parameters from %s\r\n", fl->sfdp ? "SFDP" : "JEDEC ID");
+	cprintf(con, "Size: %lu bytes, page: %lu bytes, %d address bytes\r\n",
+		fl->size, fl->page_size, fl->addr_bytes);
+	cprintf(con, "Read command: 0x%02X\r\n", fl->read_cmd);
+	for (i = 0; i < SPI_FLASH_ERASE_TYPES; i++) {
+		if (fl->erase[i].size == 0)
+			continue;
+		cprintf(con, "Erase %lu bytes: 0x%02X\r\n",
+			fl->erase[i].size, fl->erase[i].cmd);
+	}
+}
+
+static int flash(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
+{
+	mode_config_proto_t* proto = &con->mode->proto;
+	spi_flash_t fl;
+	verify_t v;
+	filename_t sd_file;
+	uint32_t arg_u32, offset, size, start, poly, crc;
+	int t, action, str_offset;
+	bool has_size;
+	bsp_status_t status;
+	FRESULT err;
+	FIL fp;
+
+	offset = 0;
+	size = 0;
+	has_size = FALSE;
+	action = 0;
+	poly = VERIFY_CRC32_IEEE;
+	sd_file.filename[0] = 0;
+
+	for (t = token_pos; p->tokens[t]; t++) {
+		switch (p->tokens[t]) {
+		case T_ID:
+		case T_READ:
+		case T_ERASE:
+		case T_WRITE:
+		case T_VERIFY:
+		case T_CRC:
+			action = p->tokens[t];
+			break;
+		case T_FILE:
+			t += 2;
+			memcpy(&str_offset, &p->tokens[t], sizeof(int));
+			snprintf(sd_file.filename, FILENAME_SIZE, "0:%s", p->buf + str_offset);
+			break;
+		case T_OFFSET:
+		case T_SIZE:
+		case T_POLY:
+			memcpy(&arg_u32, p->buf + p->tokens[t + 2], sizeof(uint32_t));
+			if (p->tokens[t] == T_OFFSET) {
+				offset = arg_u32;
+			} else if (p->tokens[t] == T_SIZE) {
+				size = arg_u32;
+				has_size = TRUE;
+			} else {
+				poly = arg_u32;
+			}
+			t += 2;
+			break;
+		}
+	}
+
+	if (action == 0) {
+		cprintf(con, "id, read, erase, write, verify or crc is mandatory.\r\n");
+		return t - token_pos;
+	}
+	if (action != T_ID && action != T_ERASE && action != T_CRC &&
+	    sd_file.filename[0] == 0) {
+		cprintf(con, "filename is mandatory.\r\n");
+		return t - token_pos;
+	}
+	if (poly == 0) {
+		cprintf(con, "Invalid polynomial.\r\n");
+		return t - token_pos;
+	}
+	if (proto->dev_mode != DEV_SPI_MASTER) {
+		cprintf(con, "SPI shall be in master mode.\r\n");
+		return t - token_pos;
+	}
+
+	status = spi_flash_probe(&fl, proto->dev_num);
+	if (status != BSP_OK) {
+		cprintf(con, "No SPI flash detected (JEDEC ID 0x%02X 0x%02X 0x%02X).\r\n",
+			fl.id[0], fl.id[1], fl.id[2]);
+		return t - token_pos;
+	}
+	if (action == T_ID) {
+		flash_show(con, &fl);
+		return t - token_pos;
+	}
+	if (offset >= fl.size) {
+		cprintf(con, "Offset beyond flash size (%lu bytes).\r\n", fl.size);
+		return t - token_pos;
+	}
+	if (!has_size || size > fl.size - offset)
+		size = fl.size - offset;
+
+	if (action != T_ERASE && action != T_CRC) {
+		if (!is_fs_ready()) {
+			if (mount() != 0) {
+				cprintf(con, "Mount failed.\r\n");
+				return t - token_pos;
+			}
+		}
+		if (action == T_READ)
+			err = f_open(&fp, sd_file.filename, FA_WRITE | FA_CREATE_ALWAYS);
+		else
+			err = f_open(&fp, sd_file.filename, FA_READ | FA_OPEN_EXISTING);
+		if (err != FR_OK) {
+			cprintf(con, "Failed to open file %s: error %d.\r\n",
+				sd_file.filename, err);
+			return t - token_pos;
+		}
+		if (action != T_READ && size > fp.fsize)
+			size = fp.fsize;
+	}
+
+	crc = 0;
+	start = chVTGetSystemTime();
+	switch (action) {
+	case T_READ:
+		status = spi_flash_read(&fl, offset, size, flash_file_write,
+					&fp, g_sbuf);
+		break;
+	case T_ERASE:
+		status = spi_flash_erase(&fl, offset, size);
+		break;
+	case T_WRITE:
+		status = spi_flash_write(&fl, offset, size, flash_file_read,
+					 &fp, g_sbuf);
+		break;
+	case T_VERIFY:
+	case T_CRC:
+		/* Flash chunks are in g_sbuf, reference chunks after them */
+		if (action == T_VERIFY)
+			verify_init(&v, offset, poly, flash_file_read, &fp,
+				    g_sbuf + SPI_FLASH_BUF_SIZE, flash_range, con);
+		else
+			verify_init(&v, offset, poly, NULL, NULL, NULL, NULL, NULL);
+		status = spi_flash_read(&fl, offset, size, verify_sink, &v, g_sbuf);
+		crc = verify_end(&v);
+		break;
+	}
+	start = chVTGetSystemTime() - start;
+	if (action != T_ERASE && action != T_CRC)
+		f_close(&fp);
+
+	if (status != BSP_OK) {
+		if (action == T_ERASE)
+			cprintf(con, "Erase error %d (offset and size shall be %lu bytes aligned).\r\n",
+				status, fl.erase[0].size);
+		else
+			cprintf(con, "Flash error %d.\r\n", status);
+		return t - token_pos;
+	}
+
+	cprintf(con, "%lu bytes done in %lu ms.\r\n",
+		size, (uint32_t)ST2MS(start));
+	if (action == T_VERIFY || action == T_CRC)
+		cprintf(con, "CRC-32 (poly 0x%08lX): 0x%08lX\r\n", poly, crc);
+	if (action == T_VERIFY) {
+		if (v.mismatch == 0)
+			cprintf(con, "Verify OK.\r\n");
+		else
+			cprintf(con, "Verify failed: %lu bytes in %lu ranges.\r\n",
+				v.mismatch, v.ranges);
+	}
+
+	return t - token_pos;
+}
+
 static void start(t_hydra_console *con)
 {
 	mode_config_proto_t* proto = &con->mode->proto;
@@ -0,0 +1,603 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * SPI NOR flash read/erase/program/verify engine.
+ * Geometry and erase commands are read from SFDP (JESD216) when available,
+ * else guessed from JEDEC ID capacity byte.
+ * Commands and addresses are sent with polled transfers, data is moved with
+ * DMA: reads are double buffered (next chunk is received while the previous
+ * one is given to the sink), writes fetch the next page from the data source
+ * while the flash is busy programming the current one.
+ */
+
+#include "hydrabus_spi_flash.h"
+#include <string.h>
+
+#define CMD_WREN (0x06)
+#define CMD_RDSR (0x05)
+#define CMD_RDID (0x9F)
+#define CMD_RDSFDP (0x5A)
+#define CMD_READ (0x03)
+#define CMD_FAST_READ (0x0B)
+#define CMD_PP (0x02)
+#define CMD_SE (0x20) /* 4KB sector erase */
+#define CMD_BE (0xD8) /* 64KB block erase */
+#define CMD_CE (0xC7) /* Chip erase */
+#define CMD_EN4B (0xB7)
+#define CMD_EX4B (0xE9)
+
+#define SR_WIP (BIT0)
+#define SR_WEL (BIT1)
+
+/* Size addressable with 3 bytes */
+#define SPI_FLASH_3B_SIZE (16 * 1024 * 1024)
+
+/** \brief Select flash and send command, address and dummy bytes.
+ * Chip select is left active.
+ *
+ * \param flash const spi_flash_t*: flash parameters.
+ * \param cmd uint8_t: command.
+ * \param addr uint32_t: address.
+ * \param addr_bytes uint8_t: number of address bytes (0 to 4).
+ * \param dummy uint8_t: number of dummy bytes (0 to 8).
+ * \return bsp_status_t: status of the transfer.
+ *
+ */
+static bsp_status_t spi_flash_cmd(const spi_flash_t *flash, uint8_t cmd,
+				  uint32_t addr, uint8_t addr_bytes, uint8_t dummy)
+{
+	uint8_t hdr[1 + 4 + 8];
+	int i, n;
+
+	n = 0;
+	hdr[n++] = cmd;
+	for(i = addr_bytes - 1; i >= 0; i--)
+		hdr[n++] = (addr >> (8 * i)) & 0xFF;
+	for(i = 0; i < dummy; i++)
+		hdr[n++] = 0xFF;
+
+	bsp_spi_select(flash->dev_num);
+	return bsp_spi_write_u8(flash->dev_num, hdr, n);
+}
+
+/* Command without address nor data */
+static bsp_status_t spi_flash_cmd_only(const spi_flash_t *flash, uint8_t cmd)
+{
+	bsp_status_t status;
+
+	status = spi_flash_cmd(flash, cmd, 0, 0, 0);
+	bsp_spi_unselect(flash->dev_num);
+	return status;
+}
+
+static bsp_status_t spi_flash_read_reg(const spi_flash_t *flash, uint8_t cmd,
+				       uint8_t *data, uint8_t nb)
+{
+	bsp_status_t status;
+
+	status = spi_flash_cmd(flash, cmd, 0, 0, 0);
+	if(status == BSP_OK)
+		status = bsp_spi_read_u8(flash->dev_num, data, nb);
+	bsp_spi_unselect(flash->dev_num);
+	return status;
+}
+
+/** \brief Wait end of program or erase by polling WIP bit.
+ *
+ * \param flash const spi_flash_t*: flash parameters.
+ * \param timeout_ms uint32_t: max busy time.
+ * \return bsp_status_t: BSP_OK when ready or BSP_TIMEOUT.
+ *
+ */
+static bsp_status_t spi_flash_wait(const spi_flash_t *flash, uint32_t timeout_ms)
+{
+	bsp_status_t status;
+	systime_t start;
+	uint8_t sr;
+
+	start = chVTGetSystemTime();
+	while(1) {
+		status = spi_flash_read_reg(flash, CMD_RDSR, &sr, 1);
+		if(status != BSP_OK)
+			return status;
+		if(!(sr & SR_WIP))
+			return BSP_OK;
+		if((chVTGetSystemTime() - start) > MS2ST(timeout_ms))
+			return BSP_TIMEOUT;
+		/* Erase takes ms to s, do not hog the CPU */
+		if(timeout_ms > SPI_FLASH_PROGRAM_TIMEOUT_MS)
+			chThdSleepMilliseconds(1);
+	}
+}
+
+/* Write enable, fails if flash is write protected */
+static bsp_status_t spi_flash_write_enable(const spi_flash_t *flash)
+{
+	bsp_status_t status;
+	uint8_t sr;
+
+	status = spi_flash_cmd_only(flash, CMD_WREN);
+	if(status == BSP_OK)
+		status = spi_flash_read_reg(flash, CMD_RDSR, &sr, 1);
+	if(status == BSP_OK && !(sr & SR_WEL))
+		status = BSP_ERROR;
+	return status;
+}
+
+/* Enter 4-byte address mode on flash larger than 16MB */
+static bsp_status_t spi_flash_begin(const spi_flash_t *flash)
+{
+	bsp_status_t status;
+
+	if(flash->addr_bytes != 4)
+		return BSP_OK;
+	/* Some devices require write enable before EN4B */
+	status = spi_flash_cmd_only(flash, CMD_WREN);
+	if(status == BSP_OK)
+		status = spi_flash_cmd_only(flash, CMD_EN4B);
+	return status;
+}
+
+static void spi_flash_end(const spi_flash_t *flash)
+{
+	if(flash->addr_bytes == 4)
+		spi_flash_cmd_only(flash, CMD_EX4B);
+}
+
+static bsp_status_t spi_flash_check_range(const spi_flash_t *flash,
+					  uint32_t offset, uint32_t nb)
+{
+	if(offset > flash->size || nb > flash->size - offset)
+		return BSP_ERROR;
+	return BSP_OK;
+}
+
+static bsp_status_t spi_flash_sfdp_read(const spi_flash_t *flash, uint32_t addr,
+					uint8_t *data, uint8_t nb)
+{
+	bsp_status_t status;
+
+	status = spi_flash_cmd(flash, CMD_RDSFDP, addr, 3, 1);
+	if(status == BSP_OK)
+		status = bsp_spi_read_u8(flash->dev_num, data, nb);
+	bsp_spi_unselect(flash->dev_num);
+	return status;
+}
+
+/** \brief Read geometry from SFDP Basic Flash Parameter Table.
+ *
+ * \param flash spi_flash_t*: updated with SFDP parameters.
+ * \return bsp_status_t: BSP_ERROR if SFDP is not supported.
+ *
+ */
+static bsp_status_t spi_flash_sfdp(spi_flash_t *flash)
+{
+	spi_flash_erase_t erase[SPI_FLASH_ERASE_TYPES], tmp;
+	uint8_t hdr[16], raw[11 * 4];
+	uint32_t dw[11], ptr, len, density, n;
+	int i, j, k;
+
+	/* SFDP header and first parameter header */
+	if(spi_flash_sfdp_read(flash, 0, hdr, sizeof(hdr)) != BSP_OK)
+		return BSP_ERROR;
+	if(memcmp(hdr, "SFDP", 4) != 0)
+		return BSP_ERROR;
+	/* First parameter header shall be the Basic Flash Parameter Table */
+	if(hdr[8] != 0x00)
+		return BSP_ERROR;
+	len = hdr[11];
+	ptr = hdr[12] | (hdr[13] << 8) | (hdr[14] << 16);
+	if(len < 9)
+		return BSP_ERROR;
+	if(len > 11)
+		len = 11;
+
+	if(spi_flash_sfdp_read(flash, ptr, raw, len * 4) != BSP_OK)
+		return BSP_ERROR;
+	for(i = 0; i < (int)len; i++) {
+		dw[i] = raw[4 * i] | (raw[4 * i + 1] << 8) |
+			(raw[4 * i + 2] << 16) | (raw[4 * i + 3] << 24);
+	}
+
+	/* DWORD 2: density in bits */
+	density = dw[1];
+	if(density & 0x80000000) {
+		n = density & 0x7FFFFFFF;
+		if(n < 3 || n > 34)
+			return BSP_ERROR;
+		flash->size = 1UL << (n - 3);
+	} else {
+		flash->size = (density >> 3) + 1;
+	}
+
+	/* DWORD 8 and 9: erase types, size is 2^N */
+	k = 0;
+	for(i = 0; i < SPI_FLASH_ERASE_TYPES; i++) {
+		n = (dw[7 + i / 2] >> (16 * (i & 1))) & 0xFFFF;
+		if((n & 0xFF) == 0 || (n & 0xFF) > 31)
+			continue;
+		erase[k].size = 1UL << (n & 0xFF);
+		erase[k].cmd = n >> 8;
+		k++;
+	}
+	/* Sort by size */
+	for(i = 1; i < k; i++) {
+		tmp = erase[i];
+		for(j = i; j > 0 && erase[j - 1].size > tmp.size; j--)
+			erase[j] = erase[j - 1];
+		erase[j] = tmp;
+	}
+	if(k == 0 && (dw[0] & 0x03) == 0x01) {
+		/* DWORD 1: 4KB erase */
+		erase[0].size = 4096;
+		erase[0].cmd = (dw[0] >> 8) & 0xFF;
+		k = 1;
+	}
+	if(k > 0) {
+		memset(flash->erase, 0, sizeof(flash->erase));
+		memcpy(flash->erase, erase, k * sizeof(spi_flash_erase_t));
+	}
+
+	/* DWORD 11 (JESD216A): page size is 2^N */
+	if(len >= 11 && ((dw[10] >> 4) & 0x0F) != 0)
+		flash->page_size = 1UL << ((dw[10] >> 4) & 0x0F);
+
+	/* Fast Read 1-1-1 is mandatory on SFDP devices */
+	flash->read_cmd = CMD_FAST_READ;
+	flash->read_dummy = 1;
+	flash->sfdp = TRUE;
+	return BSP_OK;
+}
+
+/** \brief Read JEDEC ID and flash parameters.
+ *
+ * \param flash spi_flash_t*: flash parameters.
+ * \param dev_num bsp_dev_spi_t: SPI device (master mode).
+ * \return bsp_status_t: BSP_ERROR if no flash is detected or size is unknown.
+ *
+ */
+bsp_status_t spi_flash_probe(spi_flash_t *flash, bsp_dev_spi_t dev_num)
+{
+	bsp_status_t status;
+	uint8_t cap;
+
+	memset(flash, 0, sizeof(spi_flash_t));
+	flash->dev_num = dev_num;
+
+	status = spi_flash_read_reg(flash, CMD_RDID, flash->id, 3);
+	if(status != BSP_OK)
+		return status;
+	if((flash->id[0] == 0x00 || flash->id[0] == 0xFF) &&
+	   flash->id[1] == flash->id[0] && flash->id[2] == flash->id[0])
+		return BSP_ERROR;
+
+	/* Defaults used without SFDP, capacity byte is log2(size) on most devices */
+	cap = flash->id[2];
+	if(cap >= 0x10 && cap <= 0x1F)
+		flash->size = 1UL << cap;
+	else if(cap >= 0x20 && cap <= 0x22) /* Micron 512Mb to 2Gb */
+		flash->size = 1UL << (cap - 6);
+	flash->page_size = 256;
+	flash->read_cmd = CMD_READ;
+	flash->read_dummy = 0;
+	flash->erase[0].cmd = CMD_SE;
+	flash->erase[0].size = 4096;
+	flash->erase[1].cmd = CMD_BE;
+	flash->erase[1].size = 65536;
+
+	spi_flash_sfdp(flash);
+
+	if(flash->size == 0 || flash->page_size > SPI_FLASH_PAGE_SIZE_MAX)
+		return BSP_ERROR;
+	flash->addr_bytes = (flash->size > SPI_FLASH_3B_SIZE) ? 4 : 3;
+	return BSP_OK;
+}
+
+/** \brief Read flash content, data is received with DMA by chunks of
+ * SPI_FLASH_CHUNK bytes.
+ *
+ * \param flash const spi_flash_t*: flash parameters.
+ * \param offset uint32_t: start address.
+ * \param nb uint32_t: number of bytes to read.
+ * \param sink spi_flash_io_t: called for each chunk of data read.
+ * \param ctx void*: sink context.
+ * \param buf uint8_t*: DMA capable work buffer of SPI_FLASH_BUF_SIZE bytes.
+ * \return bsp_status_t: status of the transfer.
+ *
+ */
+bsp_status_t spi_flash_read(const spi_flash_t *flash,
+			    uint32_t offset, uint32_t nb,
+			    spi_flash_io_t sink, void *ctx, uint8_t *buf)
+{
+	uint8_t *chunk[2];
+	uint32_t len, next_len;
+	bsp_status_t status;
+	int cur;
+
+	if(spi_flash_check_range(flash, offset, nb) != BSP_OK)
+		return BSP_ERROR;
+	if(nb == 0)
+		return BSP_OK;
+
+	chunk[0] = buf;
+	chunk[1] = buf + SPI_FLASH_CHUNK;
+	cur = 0;
+
+	status = spi_flash_begin(flash);
+	if(status != BSP_OK)
+		return status;
+
+	/* One read command for the whole range, CS stays low between chunks */
+	status = spi_flash_cmd(flash, flash->read_cmd, offset,
+			       flash->addr_bytes, flash->read_dummy);
+	len = (nb > SPI_FLASH_CHUNK) ? SPI_FLASH_CHUNK : nb;
+	if(status == BSP_OK)
+		status = bsp_spi_dma_start(flash->dev_num, NULL, chunk[cur], len);
+
+	while(status == BSP_OK) {
+		status = bsp_spi_dma_wait(flash->dev_num);
+		if(status != BSP_OK)
+			break;
+		nb -= len;
+
+		/* Receive next chunk while this one is processed */
+		next_len = (nb > SPI_FLASH_CHUNK) ? SPI_FLASH_CHUNK : nb;
+		if(next_len > 0) {
+			status = bsp_spi_dma_start(flash->dev_num, NULL,
+						   chunk[cur ^ 1], next_len);
+			if(status != BSP_OK)
+				break;
+		}
+
+		if(sink(ctx, chunk[cur], len) != len) {
+			if(next_len > 0)
+				bsp_spi_dma_wait(flash->dev_num);
+			status = BSP_ERROR;
+			break;
+		}
+		if(next_len == 0)
+			break;
+		cur ^= 1;
+		len = next_len;
+	}
+	bsp_spi_unselect(flash->dev_num);
+
+	spi_flash_end(flash);
+	return status;
+}
+
+/** \brief Erase a range, the largest erase type aligned on the current
+ * address and fitting in the remaining range is used.
+ * Chip erase is used for the whole flash.
+ *
+ * \param flash const spi_flash_t*: flash parameters.
+ * \param offset uint32_t: start address, aligned on smallest erase size.
+ * \param nb uint32_t: number of bytes, multiple of smallest erase size.
+ * \return bsp_status_t: status of the erase.
+ *
+ */
+bsp_status_t spi_flash_erase(const spi_flash_t *flash,
+			     uint32_t offset, uint32_t nb)
+{
+	const spi_flash_erase_t *er;
+	bsp_status_t status;
+	int i;
+
+	if(spi_flash_check_range(flash, offset, nb) != BSP_OK)
+		return BSP_ERROR;
+	if(flash->erase[0].size == 0 ||
+	   (offset % flash->erase[0].size) != 0 ||
+	   (nb % flash->erase[0].size) != 0)
+		return BSP_ERROR;
+
+	status = spi_flash_begin(flash);
+	if(status != BSP_OK)
+		return status;
+
+	if(offset == 0 && nb == flash->size) {
+		status = spi_flash_write_enable(flash);
+		if(status == BSP_OK)
+			status = spi_flash_cmd_only(flash, CMD_CE);
+		if(status == BSP_OK)
+			status = spi_flash_wait(flash, SPI_FLASH_CHIP_ERASE_TIMEOUT_MS);
+		nb = 0;
+	}
+
+	while(nb > 0 && status == BSP_OK) {
+		er = &flash->erase[0];
+		for(i = SPI_FLASH_ERASE_TYPES - 1; i > 0; i--) {
+			if(flash->erase[i].size != 0 &&
+			   (offset % flash->erase[i].size) == 0 &&
+			   nb >= flash->erase[i].size) {
+				er = &flash->erase[i];
+				break;
+			}
+		}
+
+		status = spi_flash_write_enable(flash);
+		if(status != BSP_OK)
+			break;
+		status = spi_flash_cmd(flash, er->cmd, offset, flash->addr_bytes, 0);
+		bsp_spi_unselect(flash->dev_num);
+		if(status != BSP_OK)
+			break;
+		status = spi_flash_wait(flash, SPI_FLASH_ERASE_TIMEOUT_MS);
+
+		offset += er->size;
+		nb -= er->size;
+	}
+
+	spi_flash_end(flash);
+	return status;
+}
+
+static bool spi_flash_blank(const uint8_t *data, uint32_t nb)
+{
+	uint32_t i;
+
+	for(i = 0; i < nb; i++) {
+		if(data[i] != 0xFF)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/** \brief Program flash (shall be erased) using page program.
+ * Pages with only 0xFF are skipped.
+ *
+ * \param flash const spi_flash_t*: flash parameters.
+ * \param offset uint32_t: start address.
+ * \param nb uint32_t: number of bytes to write.
+ * \param source spi_flash_io_t: called to fetch each page of data.
+ * \param ctx void*: source context.
+ * \param buf uint8_t*: DMA capable work buffer of SPI_FLASH_BUF_SIZE bytes.
+ * \return bsp_status_t: status of the transfer.
+ *
+ */
+bsp_status_t spi_flash_write(const spi_flash_t *flash,
+			     uint32_t offset, uint32_t nb,
+			     spi_flash_io_t source, void *ctx, uint8_t *buf)
+{
+	uint8_t *page[2];
+	uint32_t len, next_len;
+	bsp_status_t status;
+	bool busy;
+	int cur;
+
+	if(spi_flash_check_range(flash, offset, nb) != BSP_OK)
+		return BSP_ERROR;
+	if(nb == 0)
+		return BSP_OK;
+
+	page[0] = buf;
+	page[1] = buf + SPI_FLASH_PAGE_SIZE_MAX;
+	cur = 0;
+
+	len = flash->page_size - (offset % flash->page_size);
+	if(len > nb)
+		len = nb;
+	if(source(ctx, page[cur], len) != len)
+		return BSP_ERROR;
+
+	status = spi_flash_begin(flash);
+	while(nb > 0 && status == BSP_OK) {
+		busy = !spi_flash_blank(page[cur], len);
+		if(busy) {
+			status = spi_flash_write_enable(flash);
+			if(status == BSP_OK)
+				status = spi_flash_cmd(flash, CMD_PP, offset,
+						       flash->addr_bytes, 0);
+			if(status == BSP_OK)
+				status = bsp_spi_write_read_dma(flash->dev_num,
+								page[cur], NULL, len);
+			/* CS rising edge starts the internal program cycle */
+			bsp_spi_unselect(flash->dev_num);
+			if(status != BSP_OK)
+				break;
+		}
+		offset += len;
+		nb -= len;
+
+		/* Stage next page while the flash is busy */
+		next_len = 0;
+		if(nb > 0) {
+			next_len = (nb > flash->page_size) ? flash->page_size : nb;
+			if(source(ctx, page[cur ^ 1], next_len) != next_len) {
+				if(busy)
+					spi_flash_wait(flash, SPI_FLASH_PROGRAM_TIMEOUT_MS);
+				status = BSP_ERROR;
+				break;
+			}
+		}
+
+		if(busy)
+			status = spi_flash_wait(flash, SPI_FLASH_PROGRAM_TIMEOUT_MS);
+
+		cur ^= 1;
+		len = next_len;
+	}
+
+	spi_flash_end(flash);
+	return status;
+}
+
+/** \brief Compare flash content with data from source.
+ * Reference data is fetched while the flash is read with DMA.
+ *
+ * \param flash const spi_flash_t*: flash parameters.
+ * \param offset uint32_t: start address.
+ * \param nb uint32_t: number of bytes to compare.
+ * \param source spi_flash_io_t: called to fetch reference data.
+ * \param ctx void*: source context.
+ * \param buf uint8_t*: DMA capable work buffer of SPI_FLASH_BUF_SIZE bytes.
+ * \param mismatch uint32_t*: address of first difference.
+ * \return bsp_status_t: BSP_OK if identical, BSP_ERROR on difference (mismatch
+ * is set) or transfer error (mismatch is 0xFFFFFFFF).
+ *
+ */
+bsp_status_t spi_flash_verify(const spi_flash_t *flash,
+			      uint32_t offset, uint32_t nb,
+			      spi_flash_io_t source, void *ctx, uint8_t *buf,
+			      uint32_t *mismatch)
+{
+	uint8_t *data, *ref;
+	uint32_t i, len;
+	bsp_status_t status;
+
+	*mismatch = 0xFFFFFFFF;
+	if(spi_flash_check_range(flash, offset, nb) != BSP_OK)
+		return BSP_ERROR;
+
+	data = buf;
+	ref = buf + SPI_FLASH_CHUNK;
+
+	status = spi_flash_begin(flash);
+	if(status != BSP_OK)
+		return status;
+	status = spi_flash_cmd(flash, flash->read_cmd, offset,
+			       flash->addr_bytes, flash->read_dummy);
+
+	while(nb > 0 && status == BSP_OK) {
+		len = (nb > SPI_FLASH_CHUNK) ? SPI_FLASH_CHUNK : nb;
+		status = bsp_spi_dma_start(flash->dev_num, NULL, data, len);
+		if(status != BSP_OK)
+			break;
+		if(source(ctx, ref, len) != len) {
+			bsp_spi_dma_wait(flash->dev_num);
+			status = BSP_ERROR;
+			break;
+		}
+		status = bsp_spi_dma_wait(flash->dev_num);
+		if(status != BSP_OK)
+			break;
+
+		if(memcmp(data, ref, len) != 0) {
+			for(i = 0; data[i] == ref[i]; i++);
+			*mismatch = offset + i;
+			status = BSP_ERROR;
+			break;
+		}
+		offset += len;
+		nb -= len;
+	}
+	bsp_spi_unselect(flash->dev_num);
+
+	spi_flash_end(flash);
+	return status;
+}
@@ -0,0 +1,74 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRABUS_SPI_FLASH_H_
+#define _HYDRABUS_SPI_FLASH_H_
+
+#include "common.h"
+#include "bsp.h"
+#include "bsp_spi.h"
+
+/* DMA transfer size, work buffer is 2 chunks (double buffering) */
+#define SPI_FLASH_CHUNK (16384)
+#define SPI_FLASH_BUF_SIZE (2 * SPI_FLASH_CHUNK)
+#define SPI_FLASH_PAGE_SIZE_MAX (SPI_FLASH_CHUNK)
+#define SPI_FLASH_ERASE_TYPES (4)
+
+/* Max busy time */
+#define SPI_FLASH_PROGRAM_TIMEOUT_MS (50)
+#define SPI_FLASH_ERASE_TIMEOUT_MS (5000)
+#define SPI_FLASH_CHIP_ERASE_TIMEOUT_MS (400000)
+
+typedef struct {
+	uint8_t cmd;
+	uint32_t size; /* 0 = unused */
+} spi_flash_erase_t;
+
+typedef struct {
+	bsp_dev_spi_t dev_num;
+	uint8_t id[3]; /* JEDEC manufacturer, memory type, capacity */
+	bool sfdp; /* Parameters read from SFDP else guessed from JEDEC ID */
+	uint32_t size; /* Bytes */
+	uint32_t page_size;
+	uint8_t addr_bytes; /* 3 or 4 (enter 4-byte address mode) */
+	uint8_t read_cmd;
+	uint8_t read_dummy; /* Dummy bytes after address */
+	spi_flash_erase_t erase[SPI_FLASH_ERASE_TYPES]; /* Smallest first */
+} spi_flash_t;
+
+/*
+ * Data source (write/verify) or sink (read) callback.
+ * Shall transfer exactly nb bytes and return nb or a value < nb on error.
+ */
+typedef uint32_t (*spi_flash_io_t)(void *ctx, uint8_t *buf, uint32_t nb);
+
+bsp_status_t spi_flash_probe(spi_flash_t *flash, bsp_dev_spi_t dev_num);
+bsp_status_t spi_flash_read(const spi_flash_t *flash,
+			    uint32_t offset, uint32_t nb,
+			    spi_flash_io_t sink, void *ctx, uint8_t *buf);
+bsp_status_t spi_flash_erase(const spi_flash_t *flash,
+			     uint32_t offset, uint32_t nb);
+bsp_status_t spi_flash_write(const spi_flash_t *flash,
+			     uint32_t offset, uint32_t nb,
+			     spi_flash_io_t source, void *ctx, uint8_t *buf);
+bsp_status_t spi_flash_verify(const spi_flash_t *flash,
+			      uint32_t offset, uint32_t nb,
+			      spi_flash_io_t source, void *ctx, uint8_t *buf,
+			      uint32_t *mismatch);
+
+#endif /* _HYDRABUS_SPI_FLASH_H_ */
@@ -0,0 +1,342 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Passive SPI sniffer.
+ * SPI1 (MOSI) and SPI2 (MISO) are both slaves in receive only mode, each one
+ * fills a circular buffer with DMA so no byte is handled by the CPU.
+ * CS edges are caught by EXTI, the interrupt records DMA positions of both
+ * directions in a marker ring, the thread splits received data in
+ * transactions from these markers.
+ */
+
+#include "hydrabus_spi_sniff.h"
+#include "bsp_spi.h"
+
+#define SPI_SNIFF_RING_MASK (SPI_SNIFF_RING_SIZE-1)
+#define SPI_SNIFF_MARKERS_MASK (SPI_SNIFF_MARKERS-1)
+/*
+ * Data is considered lost when DMA is less than this number of bytes behind
+ * the reader, a chunk being processed could be overwritten.
+ */
+#define SPI_SNIFF_MARGIN (4096)
+
+typedef struct {
+	uint32_t mosi; /* DMA position of SPI1 at CS edge */
+	uint32_t miso; /* DMA position of SPI2 at CS edge */
+	uint32_t cs; /* CS level after edge */
+} spi_sniff_marker_t;
+
+/* Buffers use g_sbuf upper part, lower part is free for the sink */
+static uint8_t * const spi_sniff_mosi = (uint8_t *)g_sbuf + 16384;
+static uint8_t * const spi_sniff_miso = (uint8_t *)g_sbuf + 32768;
+static spi_sniff_marker_t * const spi_sniff_markers = (spi_sniff_marker_t *)(g_sbuf + 49152);
+static volatile uint32_t spi_sniff_marker_head;
+static volatile uint32_t spi_sniff_marker_tail;
+static volatile uint32_t spi_sniff_markers_lost;
+static uint32_t spi_sniff_cs;
+
+static void spi_sniff_extcb(EXTDriver *extp, expchannel_t channel);
+
+static const EXTConfig spi_sniff_extcfg = {
+	{
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_BOTH_EDGES | EXT_CH_MODE_AUTOSTART | EXT_MODE_GPIOA, spi_sniff_extcb}, /* EXTI15 CS PA15 */
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL},
+		{EXT_CH_MODE_DISABLED, NULL}
+	}
+};
+
+static void spi_sniff_marker_add(uint32_t mosi, uint32_t miso, uint32_t cs)
+{
+	spi_sniff_marker_t *m;
+	uint32_t head;
+
+	head = spi_sniff_marker_head;
+	if((head - spi_sniff_marker_tail) >= SPI_SNIFF_MARKERS) {
+		spi_sniff_markers_lost++;
+		return;
+	}
+	m = &spi_sniff_markers[head & SPI_SNIFF_MARKERS_MASK];
+	m->mosi = mosi;
+	m->miso = miso;
+	m->cs = cs;
+	__DMB();
+	spi_sniff_marker_head = head + 1;
+}
+
+/* Triggered on CS edges, EXTI has higher priority than SPI DMA IRQ */
+static void spi_sniff_extcb(EXTDriver *extp, expchannel_t channel)
+{
+	uint32_t mosi, miso, cs;
+
+	(void)extp;
+	(void)channel;
+
+	mosi = bsp_spi_rx_dma_count(BSP_DEV_SPI1);
+	miso = bsp_spi_rx_dma_count(BSP_DEV_SPI2);
+	cs = bsp_spi_get_cs(BSP_DEV_SPI1) ? 1 : 0;
+
+	/*
+	 * Pulse shorter than interrupt latency, the 2 edges are seen as one,
+	 * insert the missing one.
+	 */
+	if(cs == spi_sniff_cs)
+		spi_sniff_marker_add(mosi, miso, !cs);
+	spi_sniff_marker_add(mosi, miso, cs);
+	spi_sniff_cs = cs;
+
+	/*
+	 * Bus idle, restart byte framing in case of glitch on SCK.
+	 * Not done on falling edge, first bits could already be received.
+	 */
+	if(cs) {
+		bsp_spi_slave_resync(BSP_DEV_SPI1);
+		bsp_spi_slave_resync(BSP_DEV_SPI2);
+	}
+}
+
+/* a - b with wrap around, positive if a is after b */
+static int32_t pos_diff(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b);
+}
+
+static uint32_t pos_min(uint32_t a, uint32_t b)
+{
+	return (pos_diff(a, b) < 0) ? a : b;
+}
+
+/* Number of contiguous bytes from pos before end of ring, max len */
+static uint32_t ring_contig(uint32_t pos, uint32_t len)
+{
+	uint32_t room;
+
+	room = SPI_SNIFF_RING_SIZE - (pos & SPI_SNIFF_RING_MASK);
+	return (len < room) ? len : room;
+}
+
+typedef struct {
+	spi_sniff_sink_t sink;
+	void *ctx;
+	spi_sniff_stats_t *stats;
+	uint32_t mosi_rd;
+	uint32_t miso_rd;
+} spi_sniff_t;
+
+/** \brief Deliver data up to DMA positions mosi_end/miso_end.
+ *
+ * \param s spi_sniff_t*: sniffer state.
+ * \param mosi_end uint32_t: MOSI end position.
+ * \param miso_end uint32_t: MISO end position.
+ * \param done bool*: set if some data was delivered.
+ * \return bool: TRUE if sink requested stop.
+ *
+ */
+static bool spi_sniff_data(spi_sniff_t *s, uint32_t mosi_end, uint32_t miso_end,
+			   bool *done)
+{
+	spi_sniff_ev_t ev;
+	int32_t mosi_len, miso_len;
+	uint32_t len, chunk;
+
+	mosi_len = pos_diff(mosi_end, s->mosi_rd);
+	miso_len = pos_diff(miso_end, s->miso_rd);
+	if(mosi_len <= 0 || miso_len <= 0)
+		return FALSE;
+	len = (mosi_len < miso_len) ? mosi_len : miso_len;
+
+	ev.type = SPI_SNIFF_EV_DATA;
+	while(len > 0) {
+		chunk = ring_contig(s->mosi_rd, len);
+		chunk = ring_contig(s->miso_rd, chunk);
+		if(chunk > SPI_SNIFF_CHUNK_MAX)
+			chunk = SPI_SNIFF_CHUNK_MAX;
+
+		ev.mosi = &spi_sniff_mosi[s->mosi_rd & SPI_SNIFF_RING_MASK];
+		ev.miso = &spi_sniff_miso[s->miso_rd & SPI_SNIFF_RING_MASK];
+		ev.len = chunk;
+		s->mosi_rd += chunk;
+		s->miso_rd += chunk;
+		s->stats->bytes += chunk;
+		len -= chunk;
+		*done = TRUE;
+		if(s->sink(s->ctx, &ev))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* Skip data about to be overwritten by DMA */
+static bool spi_sniff_overflow(spi_sniff_t *s, uint32_t mosi_wr, uint32_t miso_wr)
+{
+	spi_sniff_ev_t ev;
+	uint32_t lost;
+
+	if(pos_diff(mosi_wr, s->mosi_rd) <= (SPI_SNIFF_RING_SIZE - SPI_SNIFF_MARGIN) &&
+	   pos_diff(miso_wr, s->miso_rd) <= (SPI_SNIFF_RING_SIZE - SPI_SNIFF_MARGIN))
+		return FALSE;
+
+	lost = pos_diff(mosi_wr, s->mosi_rd);
+	if(pos_diff(miso_wr, s->miso_rd) > (int32_t)lost)
+		lost = pos_diff(miso_wr, s->miso_rd);
+	s->mosi_rd = mosi_wr;
+	s->miso_rd = miso_wr;
+	s->stats->lost += lost;
+
+	ev.type = SPI_SNIFF_EV_OVERFLOW;
+	ev.mosi = NULL;
+	ev.miso = NULL;
+	ev.len = lost;
+	return s->sink(s->ctx, &ev);
+}
+
+/** \brief Sniff SPI bus until sink returns TRUE or UBTN is pressed.
+ * SPI1 and SPI2 are reconfigured as slaves with proto polarity, phase and
+ * bit order, proto->dev_num is initialized again with proto at end.
+ *
+ * \param proto mode_config_proto_t*: SPI parameters.
+ * \param sink spi_sniff_sink_t: called for each event.
+ * \param ctx void*: sink context.
+ * \param stats spi_sniff_stats_t*: capture statistics.
+ * \return bsp_status_t: BSP_OK or init error.
+ *
+ */
+bsp_status_t spi_sniff(mode_config_proto_t *proto, spi_sniff_sink_t sink,
+		       void *ctx, spi_sniff_stats_t *stats)
+{
+	spi_sniff_t s;
+	spi_sniff_ev_t ev;
+	spi_sniff_marker_t *m;
+	bsp_status_t status;
+	uint32_t mosi_wr, miso_wr, mosi_end, miso_end, tail;
+	long dev_mode;
+	bool done, stop;
+
+	stats->bytes = 0;
+	stats->lost = 0;
+	stats->markers_lost = 0;
+
+	dev_mode = proto->dev_mode;
+	proto->dev_mode = DEV_SPI_SLAVE;
+	status = bsp_spi_init(BSP_DEV_SPI1, proto);
+	if(status == BSP_OK)
+		status = bsp_spi_init(BSP_DEV_SPI2, proto);
+	if(status == BSP_OK) {
+		bsp_spi_cs_input(BSP_DEV_SPI1);
+		status = bsp_spi_rx_dma_start(BSP_DEV_SPI1, spi_sniff_mosi, SPI_SNIFF_RING_SIZE);
+	}
+	if(status == BSP_OK)
+		status = bsp_spi_rx_dma_start(BSP_DEV_SPI2, spi_sniff_miso, SPI_SNIFF_RING_SIZE);
+
+	if(status == BSP_OK) {
+		s.sink = sink;
+		s.ctx = ctx;
+		s.stats = stats;
+		s.mosi_rd = 0;
+		s.miso_rd = 0;
+		spi_sniff_marker_head = 0;
+		spi_sniff_marker_tail = 0;
+		spi_sniff_markers_lost = 0;
+		spi_sniff_cs = bsp_spi_get_cs(BSP_DEV_SPI1) ? 1 : 0;
+		extStart(&EXTD1, &spi_sniff_extcfg);
+
+		stop = FALSE;
+		while(!stop && !USER_BUTTON) {
+			/*
+			 * DMA positions shall be read before markers, a marker
+			 * added after has positions after mosi_wr/miso_wr.
+			 */
+			mosi_wr = bsp_spi_rx_dma_count(BSP_DEV_SPI1);
+			miso_wr = bsp_spi_rx_dma_count(BSP_DEV_SPI2);
+			__DMB();
+			tail = spi_sniff_marker_tail;
+			m = NULL;
+			if(tail != spi_sniff_marker_head)
+				m = &spi_sniff_markers[tail & SPI_SNIFF_MARKERS_MASK];
+
+			stop = spi_sniff_overflow(&s, mosi_wr, miso_wr);
+			if(stop)
+				break;
+
+			mosi_end = mosi_wr;
+			miso_end = miso_wr;
+			if(m != NULL) {
+				mosi_end = pos_min(m->mosi, mosi_wr);
+				miso_end = pos_min(m->miso, miso_wr);
+			}
+			done = FALSE;
+			stop = spi_sniff_data(&s, mosi_end, miso_end, &done);
+			if(stop)
+				break;
+
+			if(m != NULL && pos_diff(m->mosi, mosi_wr) <= 0 &&
+			   pos_diff(m->miso, miso_wr) <= 0) {
+				/* Bytes received by only one side are dropped */
+				if(pos_diff(m->mosi, s.mosi_rd) > 0)
+					s.mosi_rd = m->mosi;
+				if(pos_diff(m->miso, s.miso_rd) > 0)
+					s.miso_rd = m->miso;
+				ev.type = m->cs ? SPI_SNIFF_EV_CS_HIGH : SPI_SNIFF_EV_CS_LOW;
+				ev.mosi = NULL;
+				ev.miso = NULL;
+				ev.len = 0;
+				__DMB();
+				spi_sniff_marker_tail = tail + 1;
+				stop = sink(ctx, &ev);
+				continue;
+			}
+
+			if(!done) {
+				ev.type = SPI_SNIFF_EV_IDLE;
+				ev.mosi = NULL;
+				ev.miso = NULL;
+				ev.len = 0;
+				stop = sink(ctx, &ev);
+			}
+		}
+		extStop(&EXTD1);
+		stats->markers_lost = spi_sniff_markers_lost;
+	}
+
+	bsp_spi_deinit(BSP_DEV_SPI1);
+	bsp_spi_deinit(BSP_DEV_SPI2);
+	proto->dev_mode = dev_mode;
+	bsp_spi_init(proto->dev_num, proto);
+
+	return status;
+}
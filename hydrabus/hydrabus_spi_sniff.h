@@ -0,0 +1,64 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRABUS_SPI_SNIFF_H_
+#define _HYDRABUS_SPI_SNIFF_H_
+
+#include "common.h"
+#include "bsp.h"
+#include "mode_config.h"
+
+/*
+ * Wiring: bus SCK to PB3 (SPI1) and PB10 (SPI2), bus CS to PA15,
+ * bus MOSI to PB5 (SPI1 MOSI), bus MISO to PC3 (SPI2 MOSI).
+ */
+/* DMA buffer per direction, shall be a power of 2 */
+#define SPI_SNIFF_RING_SIZE (16384)
+/* CS edges not yet processed, shall be a power of 2 */
+#define SPI_SNIFF_MARKERS (512)
+/* Max bytes per direction in one SPI_SNIFF_EV_DATA event */
+#define SPI_SNIFF_CHUNK_MAX (1024)
+
+typedef enum {
+	SPI_SNIFF_EV_IDLE = 0, /* Nothing to process, sink can flush its output */
+	SPI_SNIFF_EV_CS_LOW,
+	SPI_SNIFF_EV_CS_HIGH,
+	SPI_SNIFF_EV_DATA,
+	SPI_SNIFF_EV_OVERFLOW /* Data lost, len is the number of bytes lost */
+} spi_sniff_ev_type_t;
+
+typedef struct {
+	spi_sniff_ev_type_t type;
+	const uint8_t *mosi;
+	const uint8_t *miso;
+	uint32_t len;
+} spi_sniff_ev_t;
+
+typedef struct {
+	uint32_t bytes; /* Bytes delivered per direction */
+	uint32_t lost; /* Bytes lost on overflow */
+	uint32_t markers_lost; /* CS edges lost */
+} spi_sniff_stats_t;
+
+/* Event callback, return TRUE to stop the sniffer */
+typedef bool (*spi_sniff_sink_t)(void *ctx, const spi_sniff_ev_t *ev);
+
+bsp_status_t spi_sniff(mode_config_proto_t *proto, spi_sniff_sink_t sink,
+		       void *ctx, spi_sniff_stats_t *stats);
+
+#endif /* _HYDRABUS_SPI_SNIFF_H_ */
@@ -0,0 +1,232 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * On the fly checksum and comparison of data read from a device.
+ * verify_sink() is given as sink to the dump engines (SPI flash, I2C
+ * EEPROM), so only the checksum or the mismatching ranges have to be
+ * reported instead of the whole image.
+ */
+
+#include "hydrabus_verify.h"
+#include "bsp_crc.h"
+#include <string.h>
+
+/* Table of the last software polynomial used */
+static uint32_t verify_crc_table[256];
+static uint32_t verify_crc_table_poly;
+
+static uint32_t verify_crc_bitwise(uint32_t crc, uint32_t poly, uint8_t data)
+{
+	int i;
+
+	crc ^= data;
+	for(i = 0; i < 8; i++)
+		crc = (crc >> 1) ^ ((crc & 1) ? poly : 0);
+	return crc;
+}
+
+static void verify_crc_make_table(uint32_t poly)
+{
+	int i;
+
+	if(verify_crc_table_poly == poly)
+		return;
+	for(i = 0; i < 256; i++)
+		verify_crc_table[i] = verify_crc_bitwise(0, poly, i);
+	verify_crc_table_poly = poly;
+}
+
+/** \brief Start a CRC-32 computation.
+ *
+ * \param crc verify_crc_t*: CRC context.
+ * \param poly uint32_t: reflected polynomial, VERIFY_CRC32_IEEE uses the
+ * CRC unit.
+ * \return void
+ *
+ */
+void verify_crc_init(verify_crc_t *crc, uint32_t poly)
+{
+	crc->poly = poly;
+	crc->crc = 0xFFFFFFFF;
+	crc->tail_len = 0;
+	crc->hw = (poly == VERIFY_CRC32_IEEE);
+	if(crc->hw) {
+		bsp_crc_init();
+	} else {
+		verify_crc_make_table(poly);
+	}
+}
+
+/** \brief Accumulate data in CRC.
+ *
+ * \param crc verify_crc_t*: CRC context.
+ * \param buf const uint8_t*: data.
+ * \param nb uint32_t: number of bytes.
+ * \return void
+ *
+ */
+void verify_crc_update(verify_crc_t *crc, const uint8_t *buf, uint32_t nb)
+{
+	uint32_t val, n;
+
+	if(!crc->hw) {
+		val = crc->crc;
+		while(nb--)
+			val = (val >> 8) ^ verify_crc_table[(val ^ *buf++) & 0xFF];
+		crc->crc = val;
+		return;
+	}
+
+	/* CRC unit only processes words, keep remaining bytes for next call */
+	if(crc->tail_len > 0) {
+		n = 4 - crc->tail_len;
+		if(n > nb)
+			n = nb;
+		memcpy(&crc->tail[crc->tail_len], buf, n);
+		crc->tail_len += n;
+		buf += n;
+		nb -= n;
+		if(crc->tail_len < 4)
+			return;
+		bsp_crc_update_reflected(crc->tail, 1);
+		crc->tail_len = 0;
+	}
+	bsp_crc_update_reflected(buf, nb / 4);
+	crc->tail_len = nb & 3;
+	memcpy(crc->tail, buf + (nb & ~3), crc->tail_len);
+}
+
+/** \brief End CRC computation.
+ *
+ * \param crc verify_crc_t*: CRC context.
+ * \return uint32_t: CRC-32.
+ *
+ */
+uint32_t verify_crc_final(verify_crc_t *crc)
+{
+	uint32_t val;
+	int i;
+
+	if(crc->hw) {
+		/* CRC unit register is the bit reversed software register */
+		val = __RBIT(bsp_crc_get());
+		for(i = 0; i < crc->tail_len; i++)
+			val = verify_crc_bitwise(val, crc->poly, crc->tail[i]);
+		crc->tail_len = 0;
+		crc->crc = val;
+		bsp_crc_deinit();
+		crc->hw = FALSE;
+	}
+	return ~crc->crc;
+}
+
+/** \brief Start verification of a device range.
+ *
+ * \param v verify_t*: verify context, given as ctx to verify_sink().
+ * \param offset uint32_t: device offset of the first byte.
+ * \param poly uint32_t: CRC-32 reflected polynomial.
+ * \param ref verify_io_t: reference data source, NULL for checksum only.
+ * \param ref_ctx void*: reference source context.
+ * \param ref_buf uint8_t*: reference buffer, as large as the device chunks.
+ * \param range verify_range_t: mismatching range callback, can be NULL.
+ * \param range_ctx void*: range callback context.
+ * \return void
+ *
+ */
+void verify_init(verify_t *v, uint32_t offset, uint32_t poly,
+		 verify_io_t ref, void *ref_ctx, uint8_t *ref_buf,
+		 verify_range_t range, void *range_ctx)
+{
+	verify_crc_init(&v->crc, poly);
+	v->offset = offset;
+	v->ref = ref;
+	v->ref_ctx = ref_ctx;
+	v->ref_buf = ref_buf;
+	v->range = range;
+	v->range_ctx = range_ctx;
+	v->in_range = FALSE;
+	v->range_start = 0;
+	v->ranges = 0;
+	v->mismatch = 0;
+}
+
+static void verify_close_range(verify_t *v, uint32_t end)
+{
+	v->in_range = FALSE;
+	if(v->range != NULL)
+		v->range(v->range_ctx, v->ranges, v->range_start,
+			 end - v->range_start);
+	v->ranges++;
+}
+
+static void verify_compare(verify_t *v, const uint8_t *buf, uint32_t nb)
+{
+	const uint8_t *ref = v->ref_buf;
+	uint32_t i;
+
+	if(!v->in_range && memcmp(buf, ref, nb) == 0)
+		return;
+
+	for(i = 0; i < nb; i++) {
+		if(buf[i] != ref[i]) {
+			v->mismatch++;
+			if(!v->in_range) {
+				v->in_range = TRUE;
+				v->range_start = v->offset + i;
+			}
+		} else if(v->in_range) {
+			verify_close_range(v, v->offset + i);
+		}
+	}
+}
+
+/** \brief Device data sink, accumulates CRC and compares with reference.
+ *
+ * \param ctx void*: verify_t context.
+ * \param buf uint8_t*: data read from the device.
+ * \param nb uint32_t: number of bytes.
+ * \return uint32_t: nb, 0 if reference can not be read.
+ *
+ */
+uint32_t verify_sink(void *ctx, uint8_t *buf, uint32_t nb)
+{
+	verify_t *v = (verify_t *)ctx;
+
+	verify_crc_update(&v->crc, buf, nb);
+	if(v->ref != NULL) {
+		if(v->ref(v->ref_ctx, v->ref_buf, nb) != nb)
+			return 0;
+		verify_compare(v, buf, nb);
+	}
+	v->offset += nb;
+	return nb;
+}
+
+/** \brief End verification, reports the last mismatching range.
+ *
+ * \param v verify_t*: verify context.
+ * \return uint32_t: CRC-32 of the device data.
+ *
+ */
+uint32_t verify_end(verify_t *v)
+{
+	if(v->in_range)
+		verify_close_range(v, v->offset);
+	return verify_crc_final(&v->crc);
+}
@@ -0,0 +1,73 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRABUS_VERIFY_H_
+#define _HYDRABUS_VERIFY_H_
+
+#include "common.h"
+
+/*
+ * CRC-32 with reflected polynomial, initial value and final XOR 0xFFFFFFFF.
+ * IEEE 802.3 (zlib, crc32 command) uses the STM32 CRC unit, other
+ * polynomials (ex: 0x82F63B78 CRC-32C) use a table driven software CRC.
+ */
+#define VERIFY_CRC32_IEEE (0xEDB88320)
+/* Mismatching ranges printed on the console */
+#define VERIFY_RANGES_SHOW_MAX (32)
+
+typedef struct {
+	uint32_t poly; /* Reflected polynomial */
+	uint32_t crc; /* Software CRC register */
+	bool hw; /* Words are processed by the CRC unit */
+	uint8_t tail[4]; /* CRC unit: bytes waiting to complete a word */
+	uint8_t tail_len;
+} verify_crc_t;
+
+/* Same as device sinks: shall return nb or a value < nb on error */
+typedef uint32_t (*verify_io_t)(void *ctx, uint8_t *buf, uint32_t nb);
+/* Called for each mismatching range (index from 0), device offsets */
+typedef void (*verify_range_t)(void *ctx, uint32_t index,
+			       uint32_t start, uint32_t len);
+
+typedef struct {
+	verify_crc_t crc;
+	uint32_t offset; /* Device offset of next byte */
+	/* Reference, ref is NULL for checksum only */
+	verify_io_t ref;
+	void *ref_ctx;
+	uint8_t *ref_buf; /* Shall hold the largest chunk given to the sink */
+	verify_range_t range;
+	void *range_ctx;
+	/* Results */
+	uint32_t range_start;
+	bool in_range;
+	uint32_t ranges;
+	uint32_t mismatch; /* Mismatching bytes */
+} verify_t;
+
+void verify_crc_init(verify_crc_t *crc, uint32_t poly);
+void verify_crc_update(verify_crc_t *crc, const uint8_t *buf, uint32_t nb);
+uint32_t verify_crc_final(verify_crc_t *crc);
+
+void verify_init(verify_t *v, uint32_t offset, uint32_t poly,
+		 verify_io_t ref, void *ref_ctx, uint8_t *ref_buf,
+		 verify_range_t range, void *range_ctx);
+uint32_t verify_sink(void *ctx, uint8_t *buf, uint32_t nb);
+uint32_t verify_end(verify_t *v);
+
+#endif /* _HYDRABUS_VERIFY_H_ */
@@ -0,0 +1,1112 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2014-2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host decoder of HydraNFC binary sniffer traces ("sniff bin raw" output).
+ * Raw frames (1 byte per 9.44us word, downsampled by 4) are expanded to
+ * words and decoded with the firmware ISO14443A/B decoders
+ * (hydranfc_cmd_sniff_decoder.c).
+ *
+ * hydranfc_sniff_decode <trace.bin>
+ *	Decode trace and print one annotated frame per line.
+ * hydranfc_sniff_decode -b <nb_loops> <trace.bin>
+ *	Benchmark, decode trace nb_loops times and print throughput.
+ * hydranfc_sniff_decode -g <capture> <trace.bin>
+ *	Write a synthetic capture (see gen_captures[]), frames are built
+ *	as the firmware raw sniffer does from a sample stream.
+ * hydranfc_sniff_decode -t
+ *	Check firmware decoders with frames built from vectors[] input
+ *	bytes (ISO14443A/B and ISO15693, both directions).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hydranfc_cmd_sniff_iso14443.h"
+#include "hydranfc_cmd_sniff_downsampling.h"
+#include "hydranfc_cmd_sniff_decoder.h"
+
+/* See hydranfc_cmd_sniff.c */
+#define PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP (BIT3)
+#define PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP (BIT4)
+#define PROTOCOL_OPTIONS_PARITY (BIT5)
+#define PROTOCOL_OPTIONS_FRAME_STATUS (BIT7)
+#define PROTOCOL_MODULATION_14443AB_RAW_848KBPS (3)
+#define FRAME_HEADER_SIZE (4)
+
+#define CRC_A_INIT (0x6363)
+#define CRC_B_INIT (0xFFFF)
+#define CRC_B_RESIDUE (0xF0B8)
+#define CRC_POLY (0x8408)
+
+#define FRAME_MAX (SNIFF_DECODER_FRAME_MAX)
+/* One output line */
+#define OUT_LINE_MAX (64 + FRAME_MAX * 3)
+
+static uint16_t crc_table[256];
+
+static void crc_table_init(void)
+{
+	uint32_t v, i, crc;
+
+	for (v = 0; v < 256; v++) {
+		crc = v;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 1) ? (crc >> 1) ^ CRC_POLY : (crc >> 1);
+		crc_table[v] = crc;
+	}
+}
+
+static uint32_t crc16(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+		crc = (crc >> 8) ^ crc_table[(crc ^ data[i]) & 0xFF];
+	return crc;
+}
+
+static uint32_t odd_parity(uint8_t data)
+{
+	data ^= data >> 4;
+	data ^= data >> 2;
+	data ^= data >> 1;
+	return ~data & 1;
+}
+
+/* Decoded frame */
+typedef struct {
+	const char *dir; /* "RDR", "TAG" or "UNK" */
+	char type; /* 'A', 'B', 'V' (ISO15693) or '?' */
+	uint32_t len;
+	uint32_t nb_bits; /* Bits of last byte (8 if complete) */
+	uint8_t data[FRAME_MAX];
+	int parity_err;
+	int has_parity;
+} frame_t;
+
+/* Each downsampled bit is 4 samples */
+static uint32_t ds_to_word(uint8_t ds)
+{
+	uint32_t i, w = 0;
+
+	for (i = 0; i < 8; i++)
+		w = (w << 4) | ((ds & (0x80 >> i)) ? 0xF : 0);
+	return w;
+}
+
+static sniff_14443a_tables_t a_tables;
+
+static void frame_from_decoder(frame_t *f, const sniff_decoder_t *d)
+{
+	memset(f, 0, sizeof(*f));
+	f->dir = (d->dir == SNIFF_DECODER_DIR_PCD) ? "RDR" : "TAG";
+	if (d->type == SNIFF_DECODER_14443A)
+		f->type = 'A';
+	else if (d->type == SNIFF_DECODER_14443B)
+		f->type = 'B';
+	else
+		f->type = 'V';
+	f->len = d->len;
+	f->nb_bits = d->last_bits;
+	memcpy(f->data, d->frame, d->len);
+	f->has_parity = (d->type == SNIFF_DECODER_14443A);
+	f->parity_err = d->parity_err;
+}
+
+/*
+ * ISO14443A with firmware decoder (hydranfc_sniff_14443A()), frame with
+ * unknown start bit is decoded only after a PICC frame decoded with d
+ * (Miller resync). Return 0 if frame is not decoded.
+ * Field keeps last level after raw frame, so last word is repeated until
+ * end of frame is seen.
+ */
+static int decode_14443a(sniff_decoder_t *d, frame_t *f, const uint8_t *ds, uint32_t nb)
+{
+	uint32_t i;
+
+	sniff_14443a_start(d, &a_tables, ds_to_word(ds[0]));
+	for (i = 1; i < nb + 2; i++) {
+		if (sniff_14443a_word(d, ds_to_word(ds[(i < nb) ? i : nb - 1])) ==
+		    SNIFF_DECODER_END)
+			break;
+	}
+	if (d->state == 0 || d->len == 0)
+		return 0;
+	frame_from_decoder(f, d);
+	return 1;
+}
+
+/* ISO14443B PCD (NRZ-L), BPSK phase is lost by downsampling so PICC
+ * frames are not decoded. Return 0 if frame is not decoded. */
+static int decode_14443b(sniff_decoder_t *d, frame_t *f, const uint8_t *ds, uint32_t nb)
+{
+	uint32_t i;
+
+	/* Skip unmodulated carrier before SOF */
+	for (i = 0; i < nb && ds[i] == 0xFF; i++)
+		;
+	if (i == nb)
+		return 0;
+	sniff_14443b_start(d, ds_to_word(ds[i]));
+	for (i++; i < nb; i++) {
+		if (sniff_14443b_word(d, ds_to_word(ds[i])) == SNIFF_DECODER_END)
+			break;
+	}
+	if (d->dir != SNIFF_DECODER_DIR_PCD || d->len == 0)
+		return 0;
+	frame_from_decoder(f, d);
+	return 1;
+}
+
+static void frame_init_unknown(frame_t *f, const char *dir, const uint8_t *data, uint32_t nb)
+{
+	memset(f, 0, sizeof(*f));
+	f->dir = dir;
+	f->type = '?';
+	f->len = (nb < FRAME_MAX) ? nb : FRAME_MAX;
+	f->nb_bits = 8;
+	memcpy(f->data, data, f->len);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static char *put_status(char *p, const frame_t *f)
+{
+	uint32_t crc;
+	const char *par, *crc_str;
+
+	if (f->type == '?')
+		return p;
+
+	if (!f->has_parity)
+		par = "--";
+	else
+		par = f->parity_err ? "KO" : "OK";
+
+	if (f->len < 3 || f->nb_bits != 8) {
+		crc_str = "--";
+	} else {
+		if (f->type == 'A')
+			crc = crc16(CRC_A_INIT, f->data, f->len) == 0;
+		else
+			crc = crc16(CRC_B_INIT, f->data, f->len) == CRC_B_RESIDUE;
+		crc_str = crc ? "OK" : "KO";
+	}
+	return p + sprintf(p, "\tPAR:%s CRC:%s", par, crc_str);
+}
+
+/* Frame of binary trace */
+typedef struct {
+	uint32_t options;
+	uint32_t modulation;
+	uint32_t sof;
+	uint32_t eof;
+	const uint8_t *data;
+	uint32_t nb;
+} raw_frame_t;
+
+/*
+ * Raw sniffer cuts frames after 2 words without edge, so ISO14443B PCD
+ * frames (NRZ-L, SOF/EOF are 10 etu without edge) are split in
+ * fragments. Fragments less than B_GAP_MAX words apart are joined
+ * (needs start and end of frame timestamps), gap is filled with last
+ * level.
+ */
+#define B_GAP_MAX (16)
+#define B_GROUP_FRAMES (64)
+#define B_GROUP_SIZE (B_GROUP_FRAMES * 64)
+/* DWT timestamps @168MHz, 1 word = 32 samples @3.39MHz */
+#define CYCLES_PER_WORD (32 * 168.0 / 3.39)
+
+typedef struct {
+	FILE *out;
+	long nb_frames;
+	sniff_decoder_t dec; /* Decoder of last printed frame */
+	raw_frame_t group[B_GROUP_FRAMES];
+	uint32_t nb_group;
+	uint8_t ds[B_GROUP_SIZE];
+} decode_ctx_t;
+
+static void print_frame(decode_ctx_t *ctx, const frame_t *f, const raw_frame_t *first,
+			const raw_frame_t *last)
+{
+	char line[OUT_LINE_MAX];
+	char *p;
+	uint32_t i;
+
+	ctx->nb_frames++;
+
+	p = line;
+	if (first->options & PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP)
+		p += sprintf(p, "%08X", first->sof);
+	else
+		p += sprintf(p, "--------");
+	p += sprintf(p, "\t%s\t%c\t", f->dir, f->type);
+	for (i = 0; i < f->len; i++)
+		p += sprintf(p, (i + 1 < f->len) ? "%02X " : "%02X", f->data[i]);
+	p = put_status(p, f);
+	if ((first->options & PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP) &&
+	    (last->options & PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP))
+		p += sprintf(p, "\t%08X", last->eof - first->sof);
+	if (ctx->out)
+		fprintf(ctx->out, "%s\n", line);
+}
+
+static uint32_t gap_words(const raw_frame_t *prev, const raw_frame_t *next)
+{
+	return (uint32_t)((next->sof - prev->eof) / CYCLES_PER_WORD + 0.5);
+}
+
+static int group_can_join(const decode_ctx_t *ctx, const raw_frame_t *r)
+{
+	const raw_frame_t *last;
+
+	if (ctx->nb_group == 0)
+		return 1;
+	last = &ctx->group[ctx->nb_group - 1];
+	return ctx->nb_group < B_GROUP_FRAMES &&
+	       (last->options & PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP) &&
+	       (r->options & PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP) &&
+	       gap_words(last, r) <= B_GAP_MAX;
+}
+
+static void group_flush(decode_ctx_t *ctx)
+{
+	sniff_decoder_t d;
+	frame_t f;
+	const raw_frame_t *r;
+	uint32_t i, nb, gap;
+	uint8_t level;
+
+	if (ctx->nb_group == 0)
+		return;
+
+	/* Join fragments */
+	nb = 0;
+	for (i = 0; i < ctx->nb_group; i++) {
+		r = &ctx->group[i];
+		if (i > 0 && r->nb) {
+			/*
+			 * Gap keeps last level, except the last word: sniffer
+			 * does not see an edge in first word read after a
+			 * fragment, so it has the level before next fragment.
+			 */
+			gap = gap_words(&ctx->group[i - 1], r);
+			level = (ctx->ds[nb - 1] & 1) ? 0xFF : 0x00;
+			while (gap > 1 && nb < B_GROUP_SIZE) {
+				ctx->ds[nb++] = level;
+				gap--;
+			}
+			if (gap && nb < B_GROUP_SIZE)
+				ctx->ds[nb++] = (r->data[0] & 0x80) ? 0x00 : 0xFF;
+		}
+		if (nb + r->nb > B_GROUP_SIZE)
+			break;
+		memcpy(&ctx->ds[nb], r->data, r->nb);
+		nb += r->nb;
+	}
+
+	if (decode_14443b(&d, &f, ctx->ds, nb)) {
+		ctx->dec = d;
+		print_frame(ctx, &f, &ctx->group[0], &ctx->group[ctx->nb_group - 1]);
+	} else {
+		for (i = 0; i < ctx->nb_group; i++) {
+			r = &ctx->group[i];
+			if (!decode_14443a(&ctx->dec, &f, r->data, r->nb))
+				frame_init_unknown(&f, "UNK", r->data, r->nb);
+			print_frame(ctx, &f, r, r);
+		}
+	}
+	ctx->nb_group = 0;
+}
+
+static void decode_frame(decode_ctx_t *ctx, const raw_frame_t *r)
+{
+	frame_t f;
+	uint32_t proto;
+
+	/* Decoded frames are only dumped */
+	if (r->modulation != PROTOCOL_MODULATION_14443AB_RAW_848KBPS) {
+		group_flush(ctx);
+		frame_init_unknown(&f, "BIN", r->data, r->nb);
+		print_frame(ctx, &f, r, r);
+		return;
+	}
+	if (r->nb == 0)
+		return;
+
+	proto = detected_protocol[r->data[0]];
+	if (proto == MILLER_MODIFIED_106KHZ || proto == MANCHESTER_106KHZ) {
+		group_flush(ctx);
+		if (!decode_14443a(&ctx->dec, &f, r->data, r->nb))
+			frame_init_unknown(&f, "UNK", r->data, r->nb);
+		print_frame(ctx, &f, r, r);
+		return;
+	}
+
+	if (!group_can_join(ctx, r))
+		group_flush(ctx);
+	ctx->group[ctx->nb_group++] = *r;
+}
+
+/* Decode a binary trace, output is sent to ctx->out (if not NULL).
+ * Return number of frames or -1 on format error */
+static long decode_trace(decode_ctx_t *ctx, const uint8_t *buf, size_t size)
+{
+	raw_frame_t r;
+	size_t pos;
+	uint32_t frame_size;
+
+	ctx->nb_frames = 0;
+	memset(&ctx->dec, 0, sizeof(ctx->dec));
+	ctx->nb_group = 0;
+
+	pos = 0;
+	while (pos + FRAME_HEADER_SIZE <= size) {
+		r.options = buf[pos];
+		r.modulation = buf[pos + 1];
+		frame_size = buf[pos + 2] | (buf[pos + 3] << 8);
+		if (frame_size < FRAME_HEADER_SIZE || pos + frame_size > size)
+			return -1;
+
+		r.data = &buf[pos + FRAME_HEADER_SIZE];
+		r.nb = frame_size - FRAME_HEADER_SIZE;
+		r.sof = 0;
+		r.eof = 0;
+		if (r.options & PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP) {
+			if (r.nb < 4)
+				return -1;
+			r.sof = get_le32(r.data);
+			r.data += 4;
+			r.nb -= 4;
+		}
+		if (r.options & PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP) {
+			if (r.nb < 4)
+				return -1;
+			r.eof = get_le32(&r.data[r.nb - 4]);
+			r.nb -= 4;
+		}
+		pos += frame_size;
+
+		decode_frame(ctx, &r);
+	}
+	group_flush(ctx);
+	if (pos != size)
+		return -1;
+	return ctx->nb_frames;
+}
+
+static uint8_t *read_file(const char *name, size_t *size)
+{
+	FILE *f;
+	uint8_t *buf;
+	long len;
+
+	f = fopen(name, "rb");
+	if (f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(len > 0 ? len : 1);
+	if (buf == NULL || fread(buf, 1, len, f) != (size_t)len) {
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	*size = len;
+	return buf;
+}
+
+static int benchmark(decode_ctx_t *ctx, const uint8_t *buf, size_t size, long nb_loops)
+{
+	struct timespec start, end;
+	double secs;
+	long i, nb_frames = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nb_loops; i++)
+		nb_frames += decode_trace(ctx, buf, size);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	if (secs <= 0)
+		secs = 1e-9;
+	printf("%ld frames, %.1f MB in %.3f s => %.2f MB/s (%.0f frames/s)\n",
+	       nb_frames, (double)size * nb_loops / 1e6, secs,
+	       (double)size * nb_loops / 1e6 / secs, nb_frames / secs);
+	return 0;
+}
+
+/*
+ * Synthetic captures: sample stream @3.39MHz (1 = energy) built from
+ * ISO14443 codings, then cut in DMA words and framed like
+ * hydranfc_sniff_14443AB_bin_raw() does.
+ */
+#define GEN_MAX_SAMPLES (1 << 20)
+#define GEN_IDLE_WORDS (40) /* Between frames */
+#define GEN_START_SAMPLES (8 * 32 + 13) /* Frames are not aligned on DMA words */
+#define GEN_CYCLES_PER_SAMPLE (168.0 / 3.39)
+
+typedef struct {
+	uint8_t *samples;
+	uint32_t nb;
+} gen_t;
+
+static void gen_put(gen_t *g, uint32_t val, uint32_t nb)
+{
+	while (nb-- && g->nb < GEN_MAX_SAMPLES)
+		g->samples[g->nb++] = val;
+}
+
+/* 848kHz subcarrier, starts with energy (1100) */
+static void gen_subcarrier(gen_t *g, uint32_t nb)
+{
+	uint32_t i;
+
+	for (i = 0; i < nb; i++)
+		gen_put(g, (i & 3) < 2, 1);
+}
+
+static void gen_idle(gen_t *g, uint32_t level, uint32_t nb_words)
+{
+	gen_put(g, level, nb_words * 32);
+}
+
+/* Modified Miller, 8 samples (2.36us) pause */
+static void gen_miller_seq(gen_t *g, char seq)
+{
+	switch (seq) {
+	case 'X':
+		gen_put(g, 1, 16);
+		gen_put(g, 0, 8);
+		gen_put(g, 1, 8);
+		break;
+	case 'Y':
+		gen_put(g, 1, 32);
+		break;
+	case 'Z':
+		gen_put(g, 0, 8);
+		gen_put(g, 1, 24);
+		break;
+	}
+}
+
+static void gen_14443a_bits(uint8_t *bits, uint32_t *nb_bits, const uint8_t *data,
+			    uint32_t len, uint32_t last_bits)
+{
+	uint32_t i, b, n;
+
+	*nb_bits = 0;
+	for (i = 0; i < len; i++) {
+		n = (i + 1 == len) ? last_bits : 8;
+		for (b = 0; b < n; b++)
+			bits[(*nb_bits)++] = (data[i] >> b) & 1;
+		if (n == 8)
+			bits[(*nb_bits)++] = odd_parity(data[i]);
+	}
+}
+
+static void gen_14443a_pcd(gen_t *g, const uint8_t *data, uint32_t len, uint32_t last_bits)
+{
+	uint8_t bits[FRAME_MAX * 9];
+	uint32_t nb_bits, i, prev;
+
+	gen_14443a_bits(bits, &nb_bits, data, len, last_bits);
+	gen_miller_seq(g, 'Z');
+	prev = 0;
+	for (i = 0; i < nb_bits; i++) {
+		if (bits[i])
+			gen_miller_seq(g, 'X');
+		else
+			gen_miller_seq(g, prev ? 'Y' : 'Z');
+		prev = bits[i];
+	}
+	/* EOF: logic 0 then Y */
+	gen_miller_seq(g, prev ? 'Y' : 'Z');
+	gen_miller_seq(g, 'Y');
+	gen_idle(g, 1, GEN_IDLE_WORDS);
+}
+
+/* Manchester with OOK subcarrier */
+static void gen_14443a_picc(gen_t *g, const uint8_t *data, uint32_t len)
+{
+	uint8_t bits[FRAME_MAX * 9];
+	uint32_t nb_bits, i;
+
+	gen_14443a_bits(bits, &nb_bits, data, len, 8);
+	/* SOF is logic 1 */
+	gen_subcarrier(g, 16);
+	gen_put(g, 0, 16);
+	for (i = 0; i < nb_bits; i++) {
+		if (bits[i]) {
+			gen_subcarrier(g, 16);
+			gen_put(g, 0, 16);
+		} else {
+			gen_put(g, 0, 16);
+			gen_subcarrier(g, 16);
+		}
+	}
+	gen_idle(g, 0, GEN_IDLE_WORDS);
+}
+
+/* NRZ-L, 1 etu = 32 samples, 10% ASK seen as 0, egt samples after each
+ * character */
+static void gen_14443b_pcd(gen_t *g, const uint8_t *data, uint32_t len, uint32_t egt)
+{
+	uint32_t i, b;
+
+	gen_put(g, 0, 10 * 32);
+	gen_put(g, 1, 2 * 32);
+	for (i = 0; i < len; i++) {
+		gen_put(g, 0, 32);
+		for (b = 0; b < 8; b++)
+			gen_put(g, (data[i] >> b) & 1, 32);
+		gen_put(g, 1, 32 + egt);
+	}
+	gen_put(g, 0, 10 * 32);
+	gen_idle(g, 1, GEN_IDLE_WORDS);
+}
+
+/* BPSK 848kHz subcarrier from sample start, logic 1 keeps phase of TR1 */
+static void gen_bpsk(gen_t *g, uint32_t start, uint32_t bit, uint32_t nb)
+{
+	while (nb--)
+		gen_put(g, (((g->nb - start) & 3) < 2) == bit, 1);
+}
+
+/* TR1 of tr1 samples (multiple of 4), SOF, characters without EGT, EOF */
+static void gen_14443b_picc(gen_t *g, const uint8_t *data, uint32_t len, uint32_t tr1)
+{
+	uint32_t start, i, b;
+
+	start = g->nb;
+	gen_bpsk(g, start, 1, tr1);
+	gen_bpsk(g, start, 0, 10 * 32);
+	gen_bpsk(g, start, 1, 2 * 32);
+	for (i = 0; i < len; i++) {
+		gen_bpsk(g, start, 0, 32);
+		for (b = 0; b < 8; b++)
+			gen_bpsk(g, start, (data[i] >> b) & 1, 32);
+		gen_bpsk(g, start, 1, 32);
+	}
+	gen_bpsk(g, start, 0, 10 * 32);
+	gen_idle(g, 0, GEN_IDLE_WORDS);
+}
+
+/* VCD 1 out of 4, 8 periods of 1 word per symbol, pause (0) in period */
+static void gen_15693_vcd_symbol(gen_t *g, uint32_t pause)
+{
+	uint32_t i;
+
+	for (i = 0; i < 8; i++)
+		gen_put(g, i != pause, 32);
+}
+
+/* SOF pauses in periods 0 and 5, 2 bits per symbol (LSB first) with
+ * pause in period 2*v+1, EOF pause in period 1 */
+static void gen_15693_vcd(gen_t *g, const uint8_t *data, uint32_t len)
+{
+	uint32_t i, b;
+
+	gen_put(g, 0, 32);
+	gen_put(g, 1, 4 * 32);
+	gen_put(g, 0, 32);
+	gen_put(g, 1, 2 * 32);
+	for (i = 0; i < len; i++) {
+		for (b = 0; b < 8; b += 2)
+			gen_15693_vcd_symbol(g, 2 * ((data[i] >> b) & 3) + 1);
+	}
+	gen_15693_vcd_symbol(g, 1);
+	gen_idle(g, 1, GEN_IDLE_WORDS);
+}
+
+/* 423.75kHz subcarrier (8 samples per cycle), nb_words words */
+static void gen_subcarrier_424(gen_t *g, uint32_t nb_words)
+{
+	uint32_t i;
+
+	for (i = 0; i < nb_words * 32; i++)
+		gen_put(g, (i & 7) < 4, 1);
+}
+
+/* VICC Manchester, one subcarrier high data rate, 4 words per bit */
+static void gen_15693_vicc_bit(gen_t *g, uint32_t bit)
+{
+	if (bit) {
+		gen_idle(g, 0, 2);
+		gen_subcarrier_424(g, 2);
+	} else {
+		gen_subcarrier_424(g, 2);
+		gen_idle(g, 0, 2);
+	}
+}
+
+/* SOF: 24 subcarrier cycles then logic 1, EOF: logic 0 then 24 cycles */
+static void gen_15693_vicc(gen_t *g, const uint8_t *data, uint32_t len)
+{
+	uint32_t i, b;
+
+	gen_subcarrier_424(g, 6);
+	gen_15693_vicc_bit(g, 1);
+	for (i = 0; i < len; i++) {
+		for (b = 0; b < 8; b++)
+			gen_15693_vicc_bit(g, (data[i] >> b) & 1);
+	}
+	gen_15693_vicc_bit(g, 0);
+	gen_subcarrier_424(g, 6);
+	gen_idle(g, 0, GEN_IDLE_WORDS);
+}
+
+static uint8_t gen_ds(uint32_t w)
+{
+	return (downsample_4x[w >> 24] << 6) | (downsample_4x[(w >> 16) & 0xFF] << 4) |
+	       (downsample_4x[(w >> 8) & 0xFF] << 2) | downsample_4x[w & 0xFF];
+}
+
+static void gen_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* Cut sample stream in DMA words (MSB first), NULL if out of memory */
+static uint32_t *gen_words(const gen_t *g, uint32_t *nb_words)
+{
+	uint32_t *words, k, i;
+
+	*nb_words = g->nb / 32;
+	words = calloc(*nb_words + 1, sizeof(uint32_t));
+	if (words == NULL)
+		return NULL;
+	for (k = 0; k < *nb_words; k++)
+		for (i = 0; i < 32; i++)
+			words[k] = (words[k] << 1) | g->samples[k * 32 + i];
+	return words;
+}
+
+/* Same framing as hydranfc_sniff_14443AB_bin_raw() main loop */
+static int gen_write(const gen_t *g, uint8_t options, FILE *out)
+{
+	static uint8_t frame[65536];
+	uint32_t *words, nb_words, k, pos, lsh, rsh, u, old, old_bit, f, cnt;
+
+	words = gen_words(g, &nb_words);
+	if (words == NULL)
+		return -1;
+
+	k = 0;
+	while (k < nb_words) {
+		u = words[k++];
+		old_bit = u & 1;
+		old = u;
+		while (k < nb_words) {
+			u = words[k++];
+			if (u != old)
+				break;
+			old_bit = u & 1;
+		}
+		if (u == old || k + 1 >= nb_words)
+			break;
+
+		pos = FRAME_HEADER_SIZE;
+		lsh = __builtin_clz(old_bit ? ~u : u);
+		rsh = 32 - lsh;
+		f = u << lsh;
+		u = words[k++];
+		if (options & PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP) {
+			gen_le32(&frame[pos], k * 32 * GEN_CYCLES_PER_SAMPLE);
+			pos += 4;
+		}
+		f |= (rsh < 32) ? u >> rsh : 0;
+		frame[pos++] = gen_ds(f);
+
+		old = f;
+		cnt = 0;
+		while (k < nb_words) {
+			f = (lsh < 32) ? u << lsh : 0;
+			u = words[k++];
+			f |= (rsh < 32) ? u >> rsh : 0;
+			if (u != old) {
+				old = u;
+				cnt = 0;
+			} else if (u == 0xFFFFFFFF || u == 0) {
+				if (++cnt > 1)
+					break;
+			} else {
+				cnt = 0;
+			}
+			frame[pos++] = gen_ds(f);
+			if (pos > sizeof(frame) - 8)
+				break;
+		}
+		if (options & PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP) {
+			gen_le32(&frame[pos], k * 32 * GEN_CYCLES_PER_SAMPLE);
+			pos += 4;
+		}
+		frame[0] = options;
+		frame[1] = PROTOCOL_MODULATION_14443AB_RAW_848KBPS;
+		frame[2] = pos;
+		frame[3] = pos >> 8;
+		fwrite(frame, 1, pos, out);
+	}
+	free(words);
+	return 0;
+}
+
+static const uint8_t reqa[] = { 0x26 };
+static const uint8_t atqa[] = { 0x04, 0x00 };
+static const uint8_t anticoll[] = { 0x93, 0x20 };
+static const uint8_t uid[] = { 0x01, 0x02, 0x03, 0x04, 0x04 };
+static const uint8_t select_uid[] = { 0x93, 0x70, 0x01, 0x02, 0x03, 0x04, 0x04, 0x00, 0x00 };
+static const uint8_t sak[] = { 0x08, 0x00, 0x00 };
+static const uint8_t hlta[] = { 0x50, 0x00, 0x57, 0xCD };
+static const uint8_t reqb[] = { 0x05, 0x00, 0x08, 0x39, 0x73 };
+static const uint8_t attrib[] = { 0x1D, 0x11, 0x22, 0x33, 0x44, 0x00, 0x08, 0x01, 0x00, 0x00, 0x00 };
+static const uint8_t atqb[] = { 0x50, 0x11, 0x22, 0x33, 0x44, 0x00, 0x00, 0x00, 0x00,
+				0x00, 0x71, 0x85, 0x00, 0x00 };
+static const uint8_t inventory[] = { 0x26, 0x01, 0x00, 0x00, 0x00 };
+static const uint8_t inventory_resp[] = { 0x00, 0x00, 0x08, 0x07, 0x06, 0x05,
+					  0x04, 0x03, 0x02, 0xE0, 0x00, 0x00 };
+
+/* Append CRC_A/CRC_B to a frame with 2 free bytes */
+static void gen_crc(uint8_t *data, uint32_t len, uint32_t init, uint32_t xor)
+{
+	uint32_t crc;
+
+	crc = crc16(init, data, len - 2) ^ xor;
+	data[len - 2] = crc;
+	data[len - 1] = crc >> 8;
+}
+
+static void gen_14443a(gen_t *g)
+{
+	uint8_t buf[16];
+
+	gen_put(g, 1, GEN_START_SAMPLES);
+	gen_14443a_pcd(g, reqa, sizeof(reqa), 7);
+	gen_14443a_picc(g, atqa, sizeof(atqa));
+	gen_14443a_pcd(g, anticoll, sizeof(anticoll), 8);
+	gen_14443a_picc(g, uid, sizeof(uid));
+	memcpy(buf, select_uid, sizeof(select_uid));
+	gen_crc(buf, sizeof(select_uid), CRC_A_INIT, 0);
+	gen_14443a_pcd(g, buf, sizeof(select_uid), 8);
+	memcpy(buf, sak, sizeof(sak));
+	gen_crc(buf, sizeof(sak), CRC_A_INIT, 0);
+	gen_14443a_picc(g, buf, sizeof(sak));
+	/* Corrupted CRC */
+	buf[0] ^= 0x01;
+	gen_14443a_picc(g, buf, sizeof(sak));
+	gen_14443a_pcd(g, hlta, sizeof(hlta), 8);
+}
+
+static void gen_14443b(gen_t *g)
+{
+	uint8_t buf[16];
+
+	gen_put(g, 1, GEN_START_SAMPLES);
+	gen_14443b_pcd(g, reqb, sizeof(reqb), 0);
+	/* PICC answer, BPSK is not decoded from raw trace */
+	gen_subcarrier(g, 32 * 30);
+	gen_idle(g, 0, GEN_IDLE_WORDS);
+	gen_idle(g, 1, 8);
+	memcpy(buf, attrib, sizeof(attrib));
+	gen_crc(buf, sizeof(attrib), CRC_B_INIT, 0xFFFF);
+	gen_14443b_pcd(g, buf, sizeof(attrib), 0);
+	buf[3] ^= 0x80;
+	gen_14443b_pcd(g, buf, sizeof(attrib), 0);
+}
+
+static const struct {
+	const char *name;
+	uint8_t options;
+	void (*gen)(gen_t *g);
+} gen_captures[] = {
+	{ "14443a", PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP |
+		    PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP, gen_14443a },
+	{ "14443a-notime", 0, gen_14443a },
+	{ "14443b", PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP |
+		    PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP, gen_14443b },
+};
+
+static int generate(const char *name, const char *filename)
+{
+	gen_t g;
+	FILE *out;
+	uint32_t i;
+	int ret;
+
+	for (i = 0; i < sizeof(gen_captures) / sizeof(gen_captures[0]); i++) {
+		if (strcmp(name, gen_captures[i].name) == 0)
+			break;
+	}
+	if (i == sizeof(gen_captures) / sizeof(gen_captures[0])) {
+		fprintf(stderr, "Unknown capture %s\n", name);
+		return 1;
+	}
+
+	g.samples = malloc(GEN_MAX_SAMPLES);
+	if (g.samples == NULL)
+		return 1;
+	g.nb = 0;
+	gen_captures[i].gen(&g);
+
+	out = fopen(filename, "wb");
+	if (out == NULL) {
+		perror(filename);
+		free(g.samples);
+		return 1;
+	}
+	ret = gen_write(&g, gen_captures[i].options, out);
+	fclose(out);
+	free(g.samples);
+	return ret ? 1 : 0;
+}
+
+/*
+ * Decoder vectors: sample stream of one frame built from input bytes
+ * (CRC appended by gen_crc()), decoded word by word as firmware
+ * sniff_decoded() does, and compared with input bytes, so expected output
+ * does not depend on decoders.
+ */
+#define VEC_CRC_NONE (0)
+#define VEC_CRC_A (1)
+#define VEC_CRC_B (2) /* Also ISO15693 CRC */
+
+typedef struct {
+	const char *name;
+	uint32_t type; /* SNIFF_DECODER_xxx */
+	uint32_t dir; /* SNIFF_DECODER_DIR_xxx */
+	const uint8_t *data;
+	uint32_t len;
+	uint32_t crc; /* VEC_CRC_xxx, last 2 bytes of data are replaced */
+	uint32_t last_bits; /* ISO14443A PCD short frame */
+	uint32_t param; /* ISO14443B PCD EGT/PICC TR1 in samples */
+} vector_t;
+
+static const vector_t vectors[] = {
+	{ "14443a-pcd-reqa", SNIFF_DECODER_14443A, SNIFF_DECODER_DIR_PCD,
+	  reqa, sizeof(reqa), VEC_CRC_NONE, 7, 0 },
+	{ "14443a-pcd-select", SNIFF_DECODER_14443A, SNIFF_DECODER_DIR_PCD,
+	  select_uid, sizeof(select_uid), VEC_CRC_A, 8, 0 },
+	{ "14443a-picc-sak", SNIFF_DECODER_14443A, SNIFF_DECODER_DIR_PICC,
+	  sak, sizeof(sak), VEC_CRC_A, 8, 0 },
+	{ "14443b-pcd-reqb", SNIFF_DECODER_14443B, SNIFF_DECODER_DIR_PCD,
+	  reqb, sizeof(reqb), VEC_CRC_NONE, 8, 0 },
+	{ "14443b-pcd-attrib-egt", SNIFF_DECODER_14443B, SNIFF_DECODER_DIR_PCD,
+	  attrib, sizeof(attrib), VEC_CRC_B, 8, 70 },
+	{ "14443b-picc-atqb", SNIFF_DECODER_14443B, SNIFF_DECODER_DIR_PICC,
+	  atqb, sizeof(atqb), VEC_CRC_B, 8, 10 * 32 },
+	{ "14443b-picc-atqb-tr1", SNIFF_DECODER_14443B, SNIFF_DECODER_DIR_PICC,
+	  atqb, sizeof(atqb), VEC_CRC_B, 8, 12 * 32 + 8 },
+	{ "15693-vcd-inventory", SNIFF_DECODER_15693, SNIFF_DECODER_DIR_PCD,
+	  inventory, sizeof(inventory), VEC_CRC_B, 8, 0 },
+	{ "15693-vicc-inventory", SNIFF_DECODER_15693, SNIFF_DECODER_DIR_PICC,
+	  inventory_resp, sizeof(inventory_resp), VEC_CRC_B, 8, 0 },
+};
+
+static void vector_gen(gen_t *g, const vector_t *v, const uint8_t *data)
+{
+	uint32_t pcd = (v->dir == SNIFF_DECODER_DIR_PCD);
+
+	/* Field (PCD) or no subcarrier (PICC) before frame */
+	gen_put(g, pcd, GEN_START_SAMPLES);
+	if (v->type == SNIFF_DECODER_14443A && pcd)
+		gen_14443a_pcd(g, data, v->len, v->last_bits);
+	else if (v->type == SNIFF_DECODER_14443A)
+		gen_14443a_picc(g, data, v->len);
+	else if (v->type == SNIFF_DECODER_14443B && pcd)
+		gen_14443b_pcd(g, data, v->len, v->param);
+	else if (v->type == SNIFF_DECODER_14443B)
+		gen_14443b_picc(g, data, v->len, v->param);
+	else if (pcd)
+		gen_15693_vcd(g, data, v->len);
+	else
+		gen_15693_vicc(g, data, v->len);
+}
+
+/* Decode first frame of sample stream as sniff_decoded(), words are
+ * aligned on first edge. Return 0 if no frame */
+static int vector_decode(const gen_t *g, uint32_t type, sniff_decoder_t *d)
+{
+	uint32_t *words, nb_words, k, u, old, old_bit, lsh, f, ret;
+
+	words = gen_words(g, &nb_words);
+	if (words == NULL || nb_words < 2) {
+		free(words);
+		return 0;
+	}
+
+	k = 0;
+	u = words[k++];
+	old = u;
+	old_bit = u & 1;
+	while (k < nb_words - 1 && (u = words[k++]) == old)
+		old_bit = u & 1;
+	if (u == old) {
+		free(words);
+		return 0;
+	}
+
+	lsh = __builtin_clz(old_bit ? ~u : u);
+	f = u << lsh;
+	u = words[k++];
+	f |= lsh ? u >> (32 - lsh) : 0;
+	memset(d, 0, sizeof(*d));
+	if (type == SNIFF_DECODER_15693)
+		sniff_15693_start(d, f);
+	else if (type == SNIFF_DECODER_14443B)
+		sniff_14443b_start(d, f);
+	else
+		sniff_14443a_start(d, &a_tables, f);
+
+	do {
+		f = u << lsh;
+		u = words[k++];
+		f |= lsh ? u >> (32 - lsh) : 0;
+		if (type == SNIFF_DECODER_15693)
+			ret = sniff_15693_word(d, f);
+		else if (type == SNIFF_DECODER_14443B)
+			ret = sniff_14443b_word(d, f);
+		else
+			ret = sniff_14443a_word(d, f);
+	} while (ret == SNIFF_DECODER_CONTINUE && k < nb_words);
+	free(words);
+	return 1;
+}
+
+/* Print one line per vector, return number of failed vectors */
+static int test_vectors(void)
+{
+	static decode_ctx_t ctx;
+	static const raw_frame_t no_time;
+	const vector_t *v;
+	sniff_decoder_t d;
+	uint8_t data[FRAME_MAX];
+	frame_t f;
+	gen_t g;
+	uint32_t i, last_bits;
+	int ok, nb_fail = 0;
+
+	g.samples = malloc(GEN_MAX_SAMPLES);
+	if (g.samples == NULL)
+		return 1;
+	ctx.out = stdout;
+
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		v = &vectors[i];
+		memcpy(data, v->data, v->len);
+		if (v->crc == VEC_CRC_A)
+			gen_crc(data, v->len, CRC_A_INIT, 0);
+		else if (v->crc == VEC_CRC_B)
+			gen_crc(data, v->len, CRC_B_INIT, 0xFFFF);
+
+		g.nb = 0;
+		vector_gen(&g, v, data);
+		/* Miller Modified EOF (logic 0) ends a short frame with a 0 bit */
+		last_bits = v->last_bits;
+		if (v->type == SNIFF_DECODER_14443A && v->dir == SNIFF_DECODER_DIR_PCD &&
+		    last_bits < 8)
+			last_bits++;
+		ok = vector_decode(&g, v->type, &d) &&
+		     d.type == v->type && d.dir == v->dir &&
+		     d.len == v->len && memcmp(d.frame, data, v->len) == 0 &&
+		     d.last_bits == last_bits;
+		if (v->type == SNIFF_DECODER_14443A)
+			ok = ok && !d.parity_err;
+		else
+			ok = ok && d.eof;
+
+		printf("%s %s\n", v->name, ok ? "OK" : "FAIL");
+		if (!ok) {
+			nb_fail++;
+			frame_from_decoder(&f, &d);
+			print_frame(&ctx, &f, &no_time, &no_time);
+		}
+	}
+	free(g.samples);
+	return nb_fail;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s <trace.bin>\n"
+		"       %s -b <nb_loops> <trace.bin>\n"
+		"       %s -g <capture> <trace.bin>\n"
+		"       %s -t\n",
+		prog, prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+	static decode_ctx_t ctx;
+	uint8_t *buf;
+	size_t size;
+	long nb_loops;
+	int ret;
+
+	crc_table_init();
+	sniff_14443a_tables_init(&a_tables);
+
+	if (argc == 4 && strcmp(argv[1], "-g") == 0)
+		return generate(argv[2], argv[3]);
+	if (argc == 2 && strcmp(argv[1], "-t") == 0)
+		return test_vectors() ? 1 : 0;
+
+	if (argc == 2) {
+		nb_loops = 0;
+	} else if (argc == 4 && strcmp(argv[1], "-b") == 0) {
+		nb_loops = strtol(argv[2], NULL, 0);
+		if (nb_loops <= 0) {
+			usage(argv[0]);
+			return 1;
+		}
+	} else {
+		usage(argv[0]);
+		return 1;
+	}
+
+	buf = read_file(argv[argc - 1], &size);
+	if (buf == NULL) {
+		perror(argv[argc - 1]);
+		return 1;
+	}
+
+	if (nb_loops) {
+		ctx.out = NULL;
+		ret = benchmark(&ctx, buf, size, nb_loops);
+	} else if (ctx.out = stdout, decode_trace(&ctx, buf, size) < 0) {
+		fprintf(stderr, "%s: invalid trace\n", argv[argc - 1]);
+		ret = 1;
+	} else {
+		ret = 0;
+	}
+	free(buf);
+	return ret;
+}
@@ -36,8 +36,6 @@ static int show(t_hydra_console *con, t_tokenline_parsed *p);
 
 static thread_t *key_sniff_thread = NULL;
 static volatile int irq_count;
-volatile int irq;
-volatile int irq_end_rx;
 
 #define NFC_TX_RAWDATA_BUF_SIZE (64)
 unsigned char nfc_tx_rawdata_buf[NFC_TX_RAWDATA_BUF_SIZE+1];
@@ -125,7 +123,11 @@ static void extcb1(EXTDriver *extp, expchannel_t channel)
 		trf7970a_irq_fn();
 
 	irq_count++;
-	irq = 1;
+
+	/* Wake up Trf797x_transceive_xxx() */
+	chSysLockFromISR();
+	Trf797xIrqSignalI();
+	chSysUnlockFromISR();
 }
 
 static bool hydranfc_test_shield(void)
@@ -314,7 +316,7 @@ THD_FUNCTION(key_sniff, arg)
 			}
 
 			D2_ON;
-			hydranfc_sniff_14443A(NULL, TRUE, FALSE, FALSE);
+			hydranfc_sniff_14443A(NULL, TRUE, FALSE, SNIFF_TRACE_NONE);
 			D2_OFF;
 		}
 
@@ -337,6 +339,18 @@ THD_FUNCTION(key_sniff, arg)
 #define MIFARE_CL2_MAX (5)
 void hydranfc_scan_iso14443A(t_hydranfc_scan_iso14443A *data)
 {
+	static const trf797x_reg_t iso14443A_regs[] = {
+		/*
+		 * Write Modulator and SYS_CLK Control Register (0x09) (13.56Mhz SYS_CLK
+		 * and default Clock 13.56Mhz))
+		 */
+		{ MODULATOR_CONTROL, 0x31 },
+		/*
+		 * Configure Mode ISO Control Register (0x01) to 0x88 (ISO14443A RX bit
+		 * rate, 106 kbps) and no RX CRC (CRC is not present in the response))
+		 */
+		{ ISO_CONTROL, 0x88 },
+	};
 	uint8_t data_buf[MIFARE_DATA_MAX];
 	uint8_t CL1_buf[MIFARE_CL1_MAX];
 	uint8_t CL2_buf[MIFARE_CL2_MAX];
@@ -356,21 +370,7 @@ void hydranfc_scan_iso14443A(t_hydranfc_scan_iso14443A *data)
 	Trf797xInitialSettings();
 	Trf797xResetFIFO();
 
-	/*
-	 * Write Modulator and SYS_CLK Control Register (0x09) (13.56Mhz SYS_CLK
-	 * and default Clock 13.56Mhz))
-	 */
-	data_buf[0] = MODULATOR_CONTROL;
-	data_buf[1] = 0x31;
-	Trf797xWriteSingle(data_buf, 2);
-
-	/*
-	 * Configure Mode ISO Control Register (0x01) to 0x88 (ISO14443A RX bit
-	 * rate, 106 kbps) and no RX CRC (CRC is not present in the response))
-	 */
-	data_buf[0] = ISO_CONTROL;
-	data_buf[1] = 0x88;
-	Trf797xWriteSingle(data_buf, 2);
+	Trf797xWriteRegs(iso14443A_regs, ARRAY_SIZE(iso14443A_regs));
 
 	/*
 		data_buf[0] = ISO_CONTROL;
@@ -769,6 +769,12 @@ int hydranfc_read_mifare_ul(t_hydra_console *con, char* filename)
 
 void hydranfc_scan_vicinity(t_hydra_console *con)
 {
+	static const trf797x_reg_t vicinity_regs[] = {
+		/* Write Modulator and SYS_CLK Control Register (0x09) (13.56Mhz SYS_CLK and default Clock 13.56Mhz)) */
+		{ MODULATOR_CONTROL, 0x31 },
+		/* Configure Mode ISO Control Register (0x01) to 0x02 (ISO15693 high bit rate, one subcarrier, 1 out of 4) */
+		{ ISO_CONTROL, 0x02 },
+	};
 	static uint8_t data_buf[VICINITY_UID_MAX];
 	uint8_t fifo_size;
 	int i;
@@ -780,15 +786,7 @@ void hydranfc_scan_vicinity(t_hydra_console *con)
 	Trf797xInitialSettings();
 	Trf797xResetFIFO();
 
-	/* Write Modulator and SYS_CLK Control Register (0x09) (13.56Mhz SYS_CLK and default Clock 13.56Mhz)) */
-	data_buf[0] = MODULATOR_CONTROL;
-	data_buf[1] = 0x31;
-	Trf797xWriteSingle(data_buf, 2);
-
-	/* Configure Mode ISO Control Register (0x01) to 0x02 (ISO15693 high bit rate, one subcarrier, 1 out of 4) */
-	data_buf[0] = ISO_CONTROL;
-	data_buf[1] = 0x02;
-	Trf797xWriteSingle(data_buf, 2);
+	Trf797xWriteRegs(vicinity_regs, ARRAY_SIZE(vicinity_regs));
 
 	/* Configure Test Settings 1 to BIT6/0x40 => MOD Pin becomes receiver subcarrier output (Digital Output for RX/TX) */
 	/*
@@ -862,10 +860,15 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 	filename_t sd_file;
 	int str_offset;
 	bool sniff_trace_uart1;
+	bool sniff_trace_usb2;
 	bool sniff_raw;
 	bool sniff_bin;
 	bool sniff_frame_time;
 	bool sniff_parity;
+	bool sniff_pcapng;
+	bool sniff_typeb;
+	bool sniff_vicinity;
+	sniff_trace_t trace;
 
 	if(p->tokens[token_pos] == T_SD)
 	{
@@ -879,10 +882,14 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 	extStart(&EXTD1, &extcfg);
 
 	sniff_trace_uart1 = FALSE;
+	sniff_trace_usb2 = FALSE;
 	sniff_raw = FALSE;
 	sniff_bin = FALSE;
 	sniff_frame_time = FALSE;
 	sniff_parity = FALSE;
+	sniff_pcapng = FALSE;
+	sniff_typeb = FALSE;
+	sniff_vicinity = FALSE;
 	action = 0;
 	period = 1000;
 	continuous = FALSE;
@@ -899,6 +906,11 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 
 		case T_VICINITY:
 			proto->dev_function = NFC_VICINITY;
+			sniff_vicinity = TRUE;
+			break;
+
+		case T_TYPEB:
+			sniff_typeb = TRUE;
 			break;
 
 		case T_PERIOD:
@@ -937,6 +949,10 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 			sniff_trace_uart1 = TRUE;
 			break;
 
+		case T_TRACE_USB2:
+			sniff_trace_usb2 = TRUE;
+			break;
+
 		case T_FRAME_TIME:
 			sniff_frame_time = TRUE;
 			break;
@@ -953,6 +969,10 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 			sniff_raw = TRUE;
 			break;
 
+		case T_PCAPNG:
+			sniff_pcapng = TRUE;
+			break;
+
 		case T_SNIFF:
 			action = p->tokens[t];
 			break;
@@ -1010,23 +1030,46 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 		break;
 
 	case T_SNIFF:
-		if(sniff_bin)
+		if(sniff_typeb || sniff_vicinity)
+		{
+			/* Sniffer ISO14443B or ISO15693 decoded frames */
+			if(sniff_bin)
+				trace = sniff_trace_usb2 ? SNIFF_TRACE_USB2 : SNIFF_TRACE_UART1;
+			else if(sniff_trace_uart1)
+				trace = SNIFF_TRACE_UART1;
+			else if(sniff_trace_usb2)
+				trace = SNIFF_TRACE_USB2;
+			else if(continuous)
+				trace = SNIFF_TRACE_SD;
+			else
+				trace = SNIFF_TRACE_NONE;
+			if(sniff_vicinity)
+				hydranfc_sniff_15693(con, sniff_frame_time, sniff_bin, trace);
+			else
+				hydranfc_sniff_14443B(con, sniff_frame_time, sniff_bin, trace);
+		}else if(sniff_pcapng)
+		{
+			/* Sniffer PCAPNG on microSD */
+			hydranfc_sniff_14443A_pcapng(con);
+		}else if(sniff_bin)
 		{
+			trace = sniff_trace_usb2 ? SNIFF_TRACE_USB2 : SNIFF_TRACE_UART1;
 			if(sniff_raw)
 			{
-				/* Sniffer Binary RAW UART1 only */
-				hydranfc_sniff_14443AB_bin_raw(con, sniff_frame_time, sniff_frame_time);
+				/* Sniffer Binary RAW UART1 or USB2 */
+				hydranfc_sniff_14443AB_bin_raw(con, sniff_frame_time, sniff_frame_time, trace);
 			}else
 			{
-				/* Sniffer Binary UART1 only */
-				hydranfc_sniff_14443A_bin(con, sniff_frame_time, sniff_frame_time, sniff_parity);
+				/* Sniffer Binary UART1 or USB2 */
+				hydranfc_sniff_14443A_bin(con, sniff_frame_time, sniff_frame_time, sniff_parity, trace);
 			}
 		}else
 		{
 			if(sniff_raw)
 			{
-				/* Sniffer Binary RAW UART1 only */
-				hydranfc_sniff_14443AB_bin_raw(con, sniff_frame_time, sniff_frame_time);
+				/* Sniffer Binary RAW UART1 or USB2 */
+				trace = sniff_trace_usb2 ? SNIFF_TRACE_USB2 : SNIFF_TRACE_UART1;
+				hydranfc_sniff_14443AB_bin_raw(con, sniff_frame_time, sniff_frame_time, trace);
 			}else
 			{
 				/* Sniffer ASCII */
@@ -1034,10 +1077,18 @@ static int exec(t_hydra_console *con, t_tokenline_parsed *p, int token_pos)
 				{
 					if(sniff_frame_time)
 						cprintf(con, "frame-time disabled for trace-uart1 in ASCII\r\n");
-					hydranfc_sniff_14443A(con, FALSE, FALSE, TRUE);
+					if(continuous)
+						cprintf(con, "continuous disabled for trace-uart1 in ASCII\r\n");
+					hydranfc_sniff_14443A(con, FALSE, FALSE, SNIFF_TRACE_UART1);
 				}else
 				{
-					hydranfc_sniff_14443A(con, sniff_frame_time, sniff_frame_time, FALSE);
+					if(sniff_trace_usb2)
+						trace = SNIFF_TRACE_USB2;
+					else if(continuous)
+						trace = SNIFF_TRACE_SD;
+					else
+						trace = SNIFF_TRACE_NONE;
+					hydranfc_sniff_14443A(con, sniff_frame_time, sniff_frame_time, trace);
 				}
 			}
 		}
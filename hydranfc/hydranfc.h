@@ -71,9 +71,20 @@ void hydranfc_scan_iso14443A(t_hydranfc_scan_iso14443A *data);
 void hydranfc_scan_mifare(t_hydra_console *con);
 void hydranfc_scan_vicinity(t_hydra_console *con);
 
-void hydranfc_sniff_14443A(t_hydra_console *con, bool start_of_frame, bool end_of_frame, bool sniff_trace_uart1);
-void hydranfc_sniff_14443A_bin(t_hydra_console *con, bool start_of_frame, bool end_of_frame, bool parity);
-void hydranfc_sniff_14443AB_bin_raw(t_hydra_console *con, bool start_of_frame, bool end_of_frame);
+/* Sniffer trace output */
+typedef enum {
+	SNIFF_TRACE_NONE = 0, /* Saved on microSD when sniffer is stopped */
+	SNIFF_TRACE_UART1, /* Each frame written on UART1 */
+	SNIFF_TRACE_USB2, /* Each frame queued to USB2 writer thread */
+	SNIFF_TRACE_SD, /* Written continuously on microSD */
+} sniff_trace_t;
+
+void hydranfc_sniff_14443A(t_hydra_console *con, bool start_of_frame, bool end_of_frame, sniff_trace_t trace);
+void hydranfc_sniff_14443A_bin(t_hydra_console *con, bool start_of_frame, bool end_of_frame, bool parity, sniff_trace_t trace);
+void hydranfc_sniff_14443AB_bin_raw(t_hydra_console *con, bool start_of_frame, bool end_of_frame, sniff_trace_t trace);
+void hydranfc_sniff_14443A_pcapng(t_hydra_console *con);
+void hydranfc_sniff_14443B(t_hydra_console *con, bool frame_time, bool bin, sniff_trace_t trace);
+void hydranfc_sniff_15693(t_hydra_console *con, bool frame_time, bool bin, sniff_trace_t trace);
 
 void hydranfc_emul_mifare(t_hydra_console *con, uint32_t mifare_uid);
 
@@ -3,6 +3,10 @@ HYDRANFCSRC = hydranfc/hydranfc.c \
               hydranfc/hydranfc_cmd_sniff.c \
               hydranfc/hydranfc_cmd_sniff_downsampling.c \
               hydranfc/hydranfc_cmd_sniff_iso14443.c \
+              hydranfc/hydranfc_cmd_sniff_fused.c \
+              hydranfc/hydranfc_cmd_sniff_pcapng.c \
+              hydranfc/hydranfc_cmd_sniff_usb.c \
+              hydranfc/hydranfc_cmd_sniff_decoder.c \
               hydranfc_emul_14443a_sdd.c \
               hydranfc_emul_mifare.c \
               hydranfc_emul_mf_ultralight.c
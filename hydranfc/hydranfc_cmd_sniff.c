@@ -28,13 +28,13 @@
 #include "types.h"
 
 #include "hydranfc.h"
-#include "hydranfc_cmd_sniff_iso14443.h"
-#include "hydranfc_cmd_sniff_downsampling.h"
+#include "hydranfc_cmd_sniff_pcapng.h"
+#include "hydranfc_cmd_sniff_usb.h"
+#include "hydranfc_cmd_sniff_decoder.h"
 
 #include "common.h"
 #include "microsd.h"
 #include "ff.h"
-#include "utils.h"	/* bytes_to_num */
 #include "bsp_uart.h"
 
 /* Disable D4 & TST output pin (used only for debug purpose) */
@@ -53,11 +53,28 @@
 // Statistics/debug info on time spent to write data on UART
 //#define STAT_UART_WRITE
 
+// Lock kernel during sniff, when disabled other threads can run while
+// sniffing and the DMA ring absorbs decoding pauses up to its duration
+#define SNIFF_KERNEL_LOCK
+
+#ifdef SNIFF_KERNEL_LOCK
+/* Kernel is not locked when trace is sent by USB2 or microSD writer thread */
+static bool sniff_kernel_lock;
+#define sniff_lock() do { if (sniff_kernel_lock) chSysLock(); } while (0)
+#define sniff_unlock() do { if (sniff_kernel_lock) chSysUnlock(); } while (0)
+#define sniff_set_kernel_lock(lock) (sniff_kernel_lock = (lock))
+#else
+#define sniff_set_kernel_lock(lock)
+#define sniff_lock()
+#define sniff_unlock()
+#endif
+
 #define PROTOCOL_OPTIONS_VERSION (0) /* Versions reserved on 3bits BIT0 to BIT2 */
 #define PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP (BIT3) /* Include 32bits start of frame timestamp(1/168MHz increment) at start of each frame */
 #define PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP (BIT4) /* Include 32bits end of frame timestamp(1/168MHz increment) at end of each frame */
 #define PROTOCOL_OPTIONS_PARITY (BIT5) /* Include an additional byte with parity(0 or 1) after each data byte */
 #define PROTOCOL_OPTIONS_RAW (BIT6) /* Raw Data (modulation not decoded) */
+#define PROTOCOL_OPTIONS_FRAME_STATUS (BIT7) /* Include an additional byte with frame status(PROTOCOL_FRAME_STATUS_XXX) after data bytes */
 /*
  For option PROTOCOL_OPTIONS_RAW
  - Each output byte(8bits) shall represent 1 bit data TypeA or TypeB @106kbps with following Modulation & Bit Coding:
@@ -68,10 +85,21 @@
  - Note when this option is set PROTOCOL_OPTIONS_PARITY is ignored as in raw mode we have everything ...
 */
 
+#define PROTOCOL_FRAME_STATUS_PARITY_ERROR (BIT0) /* At least one data byte with wrong odd parity */
+#define PROTOCOL_FRAME_STATUS_CRC_OK (BIT1) /* CRC_A of frame is valid (last 2 bytes) */
+#define PROTOCOL_FRAME_STATUS_NO_CRC (BIT2) /* Frame is too short to include a CRC_A */
+#define PROTOCOL_FRAME_STATUS_NO_PARITY (BIT3) /* No parity bit (ISO14443B/ISO15693), CRC is CRC_B/ISO15693 CRC */
+#define PROTOCOL_FRAME_STATUS_NO_EOF (BIT4) /* Frame ended without valid EOF (ISO14443B/ISO15693) */
+#define PROTOCOL_FRAME_STATUS_SAMPLES_LOST (BIT5) /* Samples lost (DMA ring overrun) since previous frame */
+
 #define PROTOCOL_MODULATION_UNKNOWN (0)
 #define PROTOCOL_MODULATION_TYPEA_MILLER_MODIFIED_106KBPS (1) // MILLER MODIFIED = PCD / Readed
 #define PROTOCOL_MODULATION_TYPEA_MANCHESTER_106KBPS (2) // MILLER MODIFIED = PICC / Tag
 #define PROTOCOL_MODULATION_14443AB_RAW_848KBPS (3) // 14443A or B RAW 848KHz
+#define PROTOCOL_MODULATION_TYPEB_NRZ_106KBPS (4) // NRZ-L = PCD / Reader
+#define PROTOCOL_MODULATION_TYPEB_BPSK_106KBPS (5) // BPSK NRZ-L = PICC / Tag
+#define PROTOCOL_MODULATION_15693_1_OUT_OF_4 (6) // 1 out of 4 = VCD / Reader
+#define PROTOCOL_MODULATION_15693_MANCHESTER_26KBPS (7) // Manchester one subcarrier = VICC / Tag
 
 typedef struct {
 	uint8_t protocol_options; /* See define PROTOCOL_OPTIONS_XXX */
@@ -83,14 +111,56 @@ typedef struct {
 /* INIT_NFC_PROTOCOL */
 typedef enum {
 	ISO14443A = 0,
-	ISO14443B
+	ISO14443B,
+	ISO15693
 } INIT_NFC_PROTOCOL;
 
 filename_t write_filename;
 
 #define TRF7970_DATA_SIZE (384)
-#define SPI_RX_DMA_SIZE (4)
-uint8_t spi_rx_dma_buf[2][SPI_RX_DMA_SIZE+12] __attribute__ ((aligned (16)));
+/*
+ * SPI1 RX circular DMA ring, 32bits words (LSB is first byte received).
+ * 8KB = 2048 words = ~19ms of samples @3.39MHz, shall be a power of 2.
+ */
+#define SNIFF_DMA_RING_WORDS (2048)
+#define SNIFF_DMA_RING_SIZE (SNIFF_DMA_RING_WORDS * 4)
+#define SNIFF_DMA_RING_FLAGS (STM32_DMA_ISR_HTIF | STM32_DMA_ISR_TCIF)
+#define SNIFF_DMA_RING_MARGIN (2) /* Words, see sniff_ring_sync() */
+static uint32_t sniff_dma_ring[SNIFF_DMA_RING_WORDS] __attribute__ ((aligned (16)));
+static uint32_t sniff_ring_rd; /* Next word to decode */
+static uint32_t sniff_ring_wr; /* Words received at last DMA sync */
+static uint32_t sniff_ring_batch; /* Words received at previous DMA sync */
+static uint32_t sniff_ring_overruns; /* Number of DMA ring overruns (words lost) */
+static bool sniff_ring_lost; /* Overrun or frame dropped since last frame status */
+
+/*
+ * Continuous sniff to microSD, frames are written in one half of g_sbuf
+ * while a writer thread appends the other half to the file, so capture is
+ * never paused by microSD writes.
+ * At start of frame when writer is idle, complete sectors of current half are
+ * handed to writer and remaining bytes are moved to start of other half
+ * (file position stay sector aligned).
+ * When writer is late and current half is full, frames are dropped and next
+ * written frame is flagged LOST.
+ * File is pre-allocated to avoid cluster allocation during capture.
+ */
+#define SNIFF_SD_HALF (NB_SBUFFER / 2)
+#define SNIFF_SD_PREALLOC (16 * 1024 * 1024)
+/* Minimum size handed to writer (multi-block write) */
+#define SNIFF_SD_BATCH (8 * MMCSD_BLOCK_SIZE)
+/* Worst case decoded frame size (ASCII frame of SNIFF_DECODER_FRAME_MAX
+ * bytes), room is checked before writing it to microSD or USB2 */
+#define SNIFF_DECODED_FRAME_MAX (64 + SNIFF_DECODER_FRAME_MAX * 3)
+static FIL sniff_sd_file;
+static uint32_t sniff_sd_size; /* Bytes written in file */
+static bool sniff_sd_error;
+static THD_WORKING_AREA(sniff_sd_mem, 1024);
+static thread_t *sniff_sd_thread;
+static BSEMAPHORE_DECL(sniff_sd_sem, TRUE); /* Signaled when a block is queued */
+static uint32_t sniff_sd_wr_pos; /* Queued block offset in g_sbuf */
+static volatile uint32_t sniff_sd_wr_size; /* Queued block size, 0 when writer is idle */
+static uint32_t sniff_sd_half; /* Half used by sniffer */
+static uint32_t sniff_sd_lost_frames;
 uint8_t htoa[16] = {'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
 uint8_t tmp_buf[16];
 uint8_t irq_no;
@@ -115,6 +185,73 @@ static const SPIConfig spi1cfg = {
 #define CountLeadingZero(x) (__CLZ(x))
 #define SWAP32(x) (__REV(x))
 
+/* CCM = .ram4, only accessed by CPU (no wait state in sniffer loops) */
+static sniff_14443a_tables_t sniff_tables __attribute__ ((section(".ram4")));
+/* CRC_A, CRC_B and ISO15693 CRC use same polynomial */
+#define SNIFF_CRC_POLY (0x8408) /* x^16 + x^12 + x^5 + 1 reflected */
+#define SNIFF_CRC_A_INIT (0x6363)
+#define SNIFF_CRC_A_RESIDUE (0x0000)
+/* CRC_B and ISO15693 CRC (init 0xFFFF, CRC is complemented) */
+#define SNIFF_CRC_B_INIT (0xFFFF)
+#define SNIFF_CRC_B_RESIDUE (0xF0B8)
+static uint16_t sniff_crc[256] __attribute__ ((section(".ram4")));
+static bool sniff_tables_ready;
+
+static void sniff_tables_init(void)
+{
+	uint32_t v, i, crc;
+
+	if(sniff_tables_ready)
+		return;
+	sniff_14443a_tables_init(&sniff_tables);
+	for(v = 0; v < 256; v++) {
+		crc = v;
+		for(i = 0; i < 8; i++)
+			crc = (crc & 1) ? (crc >> 1) ^ SNIFF_CRC_POLY : (crc >> 1);
+		sniff_crc[v] = crc;
+	}
+	sniff_tables_ready = TRUE;
+}
+
+/* Return PROTOCOL_FRAME_STATUS_SAMPLES_LOST if DMA ring overrun since previous call */
+__attribute__ ((always_inline)) static inline
+uint8_t sniff_frame_lost_status(void)
+{
+	if(!sniff_ring_lost)
+		return 0;
+	sniff_ring_lost = FALSE;
+	return PROTOCOL_FRAME_STATUS_SAMPLES_LOST;
+}
+
+/* Return PROTOCOL_FRAME_STATUS_XXX of a decoded frame, CRC_A/CRC_B is
+ * checked over complete bytes (last 2 bytes are CRC) */
+static uint8_t sniff_decoded_frame_status(const sniff_decoder_t *d)
+{
+	uint32_t i, crc, residue;
+	uint8_t status = sniff_frame_lost_status();
+
+	if(d->type == SNIFF_DECODER_14443A) {
+		if(d->parity_err)
+			status |= PROTOCOL_FRAME_STATUS_PARITY_ERROR;
+		crc = SNIFF_CRC_A_INIT;
+		residue = SNIFF_CRC_A_RESIDUE;
+	} else {
+		status |= PROTOCOL_FRAME_STATUS_NO_PARITY;
+		if(!d->eof)
+			status |= PROTOCOL_FRAME_STATUS_NO_EOF;
+		crc = SNIFF_CRC_B_INIT;
+		residue = SNIFF_CRC_B_RESIDUE;
+	}
+	if(d->len < 3 || d->last_bits != 8)
+		return status | PROTOCOL_FRAME_STATUS_NO_CRC;
+
+	for(i = 0; i < d->len; i++)
+		crc = (crc >> 8) ^ sniff_crc[(crc ^ d->frame[i]) & 0xFF];
+	if(crc == residue)
+		status |= PROTOCOL_FRAME_STATUS_CRC_OK;
+	return status;
+}
+
 uint8_t* sniffer_get_buffer(void)
 {
 	return &g_sbuf[0];
@@ -132,24 +269,26 @@ uint32_t sniffer_get_size(void)
 
 void initSPI1(void)
 {
-	uint32_t i;
-
 	/* Clear buffer */
-	for(i=0; i<SPI_RX_DMA_SIZE; i++) {
-		spi_rx_dma_buf[0][i]=0;
-		spi_rx_dma_buf[1][i]=0;
-	}
+	memset(sniff_dma_ring, 0, sizeof(sniff_dma_ring));
+	sniff_ring_rd = 0;
+	sniff_ring_wr = 0;
+	sniff_ring_batch = 0;
+	sniff_ring_overruns = 0;
+	sniff_ring_lost = FALSE;
 
 	/*
 	* Initializes the SPI driver 1.
 	*/
 	spiSlaveStart(&SPID1, &spi1cfg);
-	/* SPI DMA Start using double buffer */
-	dmaStreamSetMemory0(SPID1.dmarx, spi_rx_dma_buf[0]);
-	dmaStreamSetMemory1(SPID1.dmarx, spi_rx_dma_buf[1]);
-	dmaStreamSetTransactionSize(SPID1.dmarx, SPI_RX_DMA_SIZE);
-	dmaStreamSetMode(SPID1.dmarx, SPID1.rxdmamode | STM32_DMA_CR_MINC |
-			 STM32_DMA_CR_EN);
+	/* SPI DMA Start using circular buffer, DMA position is polled (no IRQ) */
+	dmaStreamSetMemory0(SPID1.dmarx, sniff_dma_ring);
+	dmaStreamSetTransactionSize(SPID1.dmarx, SNIFF_DMA_RING_SIZE);
+	dmaStreamSetMode(SPID1.dmarx, (SPID1.rxdmamode &
+			 ~(STM32_DMA_CR_DBM | STM32_DMA_CR_HTIE | STM32_DMA_CR_TCIE)) |
+			 STM32_DMA_CR_MINC | STM32_DMA_CR_CIRC | STM32_DMA_CR_EN);
+	/* HT/TC flags are only used to detect ring overrun */
+	*SPID1.dmarx->ifcr = SNIFF_DMA_RING_FLAGS << SPID1.dmarx->ishift;
 }
 
 void tprint_str(const char *data, uint32_t size)
@@ -209,12 +348,20 @@ void deinitUART1_sniff(void)
 void terminate_sniff_nfc(void)
 {
 	spiStop(&SPID1);
+	if(sniff_ring_overruns > 0)
+		tprintf("DMA ring overrun %ld times (samples lost)\r\n", sniff_ring_overruns);
 }
 
 static void init_sniff_nfc(INIT_NFC_PROTOCOL iso_proto)
 {
+	trf797x_reg_t regs[6];
+
+	sniff_set_kernel_lock(TRUE);
 	tprintf("TRF7970A chipset init start\r\n");
 
+	/* Decode tables in CCM */
+	sniff_tables_init();
+
 	/* Init TRF797x */
 	Trf797xResetFIFO();
 	Trf797xInitialSettings();
@@ -223,47 +370,49 @@ static void init_sniff_nfc(INIT_NFC_PROTOCOL iso_proto)
 	/* Configure NFC chipset as ISO14443B (works with ISO14443A too) */
 
 	/* Configure Chip Status Register (0x00) to 0x21 (RF output active, 5v operations) */
-	tmp_buf[0] = CHIP_STATE_CONTROL;
-	tmp_buf[1] = 0x21;
-	Trf797xWriteSingle(tmp_buf, 2);
+	regs[0].reg = CHIP_STATE_CONTROL;
+	regs[0].value = 0x21;
 
-	/* Configure Mode ISO Control Register (0x01) to 0x25 (NFC Card Emulation, Type B) */
-	tmp_buf[0] = ISO_CONTROL;
+	regs[1].reg = ISO_CONTROL;
 	/* Default configure Mode ISO Control Register (0x01) to 0x24 (NFC Card Emulation, Type A) */
-	tmp_buf[1] = 0x24;
+	regs[1].value = 0x24;
 	if(iso_proto == ISO14443A)
 	{
 		/* Configure Mode ISO Control Register (0x01) to 0x24 (NFC Card Emulation, Type A) */
-		tmp_buf[1] = 0x24;
+		regs[1].value = 0x24;
 	}else if(iso_proto == ISO14443B)
 	{
 		/* Configure Mode ISO Control Register (0x01) to 0x25 (NFC Card Emulation, Type B) */
-		tmp_buf[1] = 0x25;
+		regs[1].value = 0x25;
+	}else if(iso_proto == ISO15693)
+	{
+		/* Configure Mode ISO Control Register (0x01) to 0x02 (ISO15693 high bit rate 26.48kbps one subcarrier 1 out of 4) */
+		regs[1].value = 0x02;
 	}
-	Trf797xWriteSingle(tmp_buf, 2);
 
 	/* Write Modulator and SYS_CLK Control Register (0x09) (13.56Mhz SYS_CLK and default Clock 3.39Mhz)) */
-	tmp_buf[0] = MODULATOR_CONTROL;
-	tmp_buf[1] = 0x11; /* Freq 3.39Mhz */
-	Trf797xWriteSingle(tmp_buf, 2);
-
-	/* Configure Regulator to 0x87 (Auto & 5V) */
-	tmp_buf[0] = REGULATOR_CONTROL;
-	tmp_buf[1] = 0x87;
-	Trf797xWriteSingle(tmp_buf, 2);
+	regs[2].reg = MODULATOR_CONTROL;
+	regs[2].value = 0x11; /* Freq 3.39Mhz */
 
 	/* Configure RX Special Settings
 	* Bandpass 450 kHz to 1.5 MHz B5=1/Bandpass 100 kHz to 1.5 MHz=B4=1,
 	* Gain reduction for 5 dB(Can be changed) B2=1&B3=0
 	* AGC no limit B0=1 */
-	tmp_buf[0] = RX_SPECIAL_SETTINGS;
-	tmp_buf[1] = 0x35;
-	Trf797xWriteSingle(tmp_buf, 2);
+	regs[3].reg = RX_SPECIAL_SETTINGS;
+	regs[3].value = 0x35;
+	/* ISO15693 subcarrier is 423.75kHz => Bandpass 200 kHz to 900 kHz B6=1 */
+	if(iso_proto == ISO15693)
+		regs[3].value = 0x45;
+
+	/* Configure Regulator to 0x87 (Auto & 5V) */
+	regs[4].reg = REGULATOR_CONTROL;
+	regs[4].value = 0x87;
 
 	/* Configure Test Settings 1 to BIT6/0x40 => MOD Pin becomes receiver subcarrier output (Digital Output for RX/TX) => Used for Sniffer */
-	tmp_buf[0] = TEST_SETTINGS_1;
-	tmp_buf[1] = BIT6;
-	Trf797xWriteSingle(tmp_buf, 2);
+	regs[5].reg = TEST_SETTINGS_1;
+	regs[5].value = BIT6;
+
+	Trf797xWriteRegs(regs, ARRAY_SIZE(regs));
 
 	Trf797xStopDecoders(); /* Disable Receiver */
 	Trf797xRunDecoders(); /* Enable Receiver */
@@ -274,7 +423,7 @@ static void init_sniff_nfc(INIT_NFC_PROTOCOL iso_proto)
 
 	tmp_buf[0] = ISO_CONTROL;
 	Trf797xReadSingle(tmp_buf, 1);
-	tprintf("ISO Control Register(0x01) read=0x%.2lX (shall be 0x24 TypeA / 0x25 TypeB)\r\n", (uint32_t)tmp_buf[0]);
+	tprintf("ISO Control Register(0x01) read=0x%.2lX (shall be 0x24 TypeA / 0x25 TypeB / 0x02 ISO15693)\r\n", (uint32_t)tmp_buf[0]);
 
 	tmp_buf[0] = ISO_14443B_OPTIONS;
 	Trf797xReadSingle(tmp_buf, 1);
@@ -309,47 +458,103 @@ static void init_sniff_nfc(INIT_NFC_PROTOCOL iso_proto)
 }
 
 
-/* Wait DMA Buffer Swap and Read Data
-* size shall be less or equal to SPI_RX_DMA_SIZE
+/* Read next 32bits word from DMA ring.
+* DMA position is only read when all words received at previous sync
+* are decoded, so words are decoded in batches when decoding is late.
 *  */
+/* Complete words written by DMA */
+__attribute__ ((always_inline)) static inline uint32_t sniff_ring_dma_pos(void)
+{
+	return ((SNIFF_DMA_RING_SIZE - dmaStreamGetTransactionSize(SPID1.dmarx)) / 4) &
+	       (SNIFF_DMA_RING_WORDS - 1);
+}
+
+/* Read and clear DMA HT/TC flags (LISR/HISR are 2 words before LIFCR/HIFCR) */
+__attribute__ ((always_inline)) static inline uint32_t sniff_ring_dma_flags(void)
+{
+	uint32_t isr;
+
+	isr = (*(SPID1.dmarx->ifcr - 2) >> SPID1.dmarx->ishift) & SNIFF_DMA_RING_FLAGS;
+	*SPID1.dmarx->ifcr = isr << SPID1.dmarx->ishift;
+	return isr;
+}
+
+/* Return TRUE if ring position pos is in ]from, to] */
+__attribute__ ((always_inline)) static inline
+bool sniff_ring_crossed(uint32_t from, uint32_t to, uint32_t pos)
+{
+	return ((pos - from - 1) & (SNIFF_DMA_RING_WORDS - 1)) <
+	       ((to - from) & (SNIFF_DMA_RING_WORDS - 1));
+}
+
+/* Drop all received words (DMA resync) */
+static void sniff_ring_resync(void)
+{
+	sniff_ring_dma_flags();
+	sniff_ring_wr = sniff_ring_dma_pos();
+	sniff_ring_rd = sniff_ring_wr;
+	sniff_ring_batch = 0;
+}
+
+/*
+ * Read DMA position, all words of previous sync are decoded (rd == wr).
+ * Ring is overrun when DMA has written over words not decoded:
+ * - an HT/TC flag is set while half/end of ring is not between previous and
+ *   new position (DMA did a full turn), flags are read before position and
+ *   position is read after clear, so a flag set just after previous sync is
+ *   tolerated by SNIFF_DMA_RING_MARGIN words,
+ * - previous and new batches exceed ring size (words of previous batch were
+ *   overwritten while they were decoded).
+ * On overrun all received words are dropped (DMA resync).
+ */
+static void sniff_ring_sync(void)
+{
+	uint32_t flags, wr, from, batch;
+	bool lost;
+
+	flags = sniff_ring_dma_flags();
+	wr = sniff_ring_dma_pos();
+	batch = (wr - sniff_ring_wr) & (SNIFF_DMA_RING_WORDS - 1);
+	from = sniff_ring_wr - SNIFF_DMA_RING_MARGIN;
+
+	lost = (sniff_ring_batch + batch) >= SNIFF_DMA_RING_WORDS;
+	if((flags & STM32_DMA_ISR_HTIF) &&
+	   !sniff_ring_crossed(from, wr, SNIFF_DMA_RING_WORDS / 2))
+		lost = TRUE;
+	if((flags & STM32_DMA_ISR_TCIF) && !sniff_ring_crossed(from, wr, 0))
+		lost = TRUE;
+
+	if(lost) {
+		sniff_ring_overruns++;
+		sniff_ring_lost = TRUE;
+		sniff_ring_resync();
+		return;
+	}
+	sniff_ring_wr = wr;
+	sniff_ring_batch = batch;
+}
+
 __attribute__ ((always_inline)) static inline uint32_t WaitGetDMABuffer(void)
 {
-	static uint32_t buf_no=1; /* Init as Target1 */
-	uint32_t cr, new_buf_no;
 	uint32_t val_u32;
 
-	while (1) {
-		cr = (SPID1.dmarx->stream->CR);
-		if ( (cr&DMA_SxCR_CT)>0 ) {
-			/* Current DMA memory Target1 */
-			new_buf_no = 0; /* Read the Target0 */
-		} else {
-			/* Current DMA memory Target0 */
-			new_buf_no = 1; /* Read the Target1 */
-		}
-		if (new_buf_no != buf_no) {
-			buf_no = new_buf_no;
-			val_u32 = bytes_to_num(&spi_rx_dma_buf[buf_no][0], 4);
-			return( SWAP32(val_u32) ); /* Swap 32bits Data for Little Endian */
-		}
+	while (sniff_ring_rd == sniff_ring_wr) {
+		sniff_ring_sync();
 
 		if (K4_BUTTON || USER_BUTTON)
-			break; // ABORT
+			return 0; // ABORT
 	}
-	return 0;
+	val_u32 = sniff_dma_ring[sniff_ring_rd];
+	sniff_ring_rd = (sniff_ring_rd + 1) & (SNIFF_DMA_RING_WORDS - 1);
+	return val_u32;
 }
 
-/* Return 0 if OK else < 0 error code */
-int sniff_write_file(uint8_t* buffer, uint32_t size)
+/* Mount microSD and create new file nfc_sniff_N.ext
+ * Return 0 if OK else < 0 error code (microSD is unmounted) */
+static int sniff_create_file(FIL *file, const char *ext)
 {
 	uint32_t i;
 	FRESULT err;
-	FIL FileObject;
-	uint32_t bytes_written;
-
-	if (size == 0) {
-		return -1;
-	}
 
 	if (is_fs_ready()==FALSE) {
 		if (mount() != 0) {
@@ -362,36 +567,61 @@ int sniff_write_file(uint8_t* buffer, uint32_t size)
 		}
 	}
 
-	/* Save data in file */
 	for(i=0; i<999; i++) {
-		sprintf(write_filename.filename, "0:nfc_sniff_%ld.txt", i);
-		err = f_open(&FileObject, write_filename.filename, FA_WRITE | FA_CREATE_NEW);
+		sprintf(write_filename.filename, "0:nfc_sniff_%ld.%s", i, ext);
+		err = f_open(file, write_filename.filename, FA_WRITE | FA_CREATE_NEW);
 		if (err == FR_OK) {
 			break;
 		}
 	}
-	if (err == FR_OK) {
-		err = f_write(&FileObject, buffer, size, (void *)&bytes_written);
-		if (err != FR_OK) {
-			f_close(&FileObject);
-			umount();
-			return -3;
-		}
-
-		err = f_close(&FileObject);
-		if (err != FR_OK) {
-			umount();
-			return -4;
-		}
-	} else {
+	if (err != FR_OK) {
 		umount();
 		return -2;
 	}
+	return 0;
+}
+
+/* Return 0 if OK else < 0 error code */
+static int sniff_write_file_ext(uint8_t* buffer, uint32_t size, const char *ext)
+{
+	int ret;
+	FRESULT err;
+	FIL FileObject;
+	uint32_t bytes_written;
+
+	if (size == 0) {
+		return -1;
+	}
+
+	/* Save data in file */
+	ret = sniff_create_file(&FileObject, ext);
+	if (ret < 0) {
+		return ret;
+	}
+
+	err = f_write(&FileObject, buffer, size, (void *)&bytes_written);
+	if (err != FR_OK) {
+		f_close(&FileObject);
+		umount();
+		return -3;
+	}
+
+	err = f_close(&FileObject);
+	if (err != FR_OK) {
+		umount();
+		return -4;
+	}
 
 	umount();
 	return 0;
 }
 
+/* Return 0 if OK else < 0 error code */
+int sniff_write_file(uint8_t* buffer, uint32_t size)
+{
+	return sniff_write_file_ext(buffer, size, "txt");
+}
+
 /*
   Write sniffed data in file and display those data on Terminal if connected.
   In case of Write Error(No SDCard, Write error or no data) D5 LED blink quickly
@@ -400,8 +630,6 @@ int sniff_write_file(uint8_t* buffer, uint32_t size)
 void sniff_log(void)
 {
 	int i;
-	chSysUnlock();
-	terminate_sniff_nfc();
 	D4_OFF;
 	D5_OFF;
 
@@ -448,28 +676,161 @@ void sniff_log(void)
 	D5_OFF;
 }
 
-/* Save trace and return TRUE if sniff stopped by K4 or UBTN, else return FALSE/continue */
-__attribute__ ((always_inline)) static inline
-bool sniff_wait_data_change_or_exit(void)
+static void sniff_sd_write(uint8_t* buffer, uint32_t size)
 {
-	/* Wait until data change */
-	while (TRUE) {
-		u32_data = WaitGetDMABuffer();
-		/* Search for an edge/data */
-		if (old_u32_data != u32_data) {
-			break;
-		} else {
-			old_data_bit = (uint32_t)(u32_data&1);
-		}
+	UINT bytes_written;
 
-		if ( (K4_BUTTON) || (USER_BUTTON) ) {
-			sniff_log();
-			return TRUE;
-		}
+	if (sniff_sd_error || size == 0) {
+		return;
+	}
+	if (f_write(&sniff_sd_file, buffer, size, &bytes_written) != FR_OK ||
+	    bytes_written != size) {
+		sniff_sd_error = TRUE;
+		return;
+	}
+	sniff_sd_size += size;
+}
+
+static THD_FUNCTION(sniff_sd_writer, arg)
+{
+	(void)arg;
+
+	chRegSetThreadName("HydraNFC sniff-sd");
+	while (!chThdShouldTerminateX()) {
+		chBSemWait(&sniff_sd_sem);
+		if (sniff_sd_wr_size == 0)
+			continue;
+
+		D5_ON;
+		sniff_sd_write(&g_sbuf[sniff_sd_wr_pos], sniff_sd_wr_size);
+		D5_OFF;
+		sniff_sd_wr_size = 0;
+	}
+}
+
+/* Create and pre-allocate continuous sniff file and start writer thread,
+ * it runs above caller priority.
+ * Return 0 if OK else < 0 error code */
+static int sniff_sd_start(void)
+{
+	int ret;
+
+	ret = sniff_create_file(&sniff_sd_file, "txt");
+	if (ret < 0) {
+		return ret;
+	}
+
+	/* Expand file (allocate clusters) then rewind, card may be smaller */
+	if (f_lseek(&sniff_sd_file, SNIFF_SD_PREALLOC) != FR_OK ||
+	    f_lseek(&sniff_sd_file, 0) != FR_OK) {
+		f_close(&sniff_sd_file);
+		umount();
+		return -3;
+	}
+	sniff_sd_size = 0;
+	sniff_sd_error = FALSE;
+	sniff_sd_wr_pos = 0;
+	sniff_sd_wr_size = 0;
+	sniff_sd_half = 0;
+	sniff_sd_lost_frames = 0;
+
+	chBSemReset(&sniff_sd_sem, TRUE);
+	sniff_sd_thread = chThdCreateStatic(sniff_sd_mem, sizeof(sniff_sd_mem),
+					    chThdGetPriorityX() + 1,
+					    sniff_sd_writer, NULL);
+	return 0;
+}
+
+/* Start of current half of g_sbuf */
+static uint32_t sniff_sd_base(void)
+{
+	return sniff_sd_half * SNIFF_SD_HALF;
+}
+
+/* End of space available in g_sbuf for next frame */
+static uint32_t sniff_sd_limit(void)
+{
+	return sniff_sd_base() + SNIFF_SD_HALF;
+}
+
+/* Called before writing a frame, never blocks.
+ * Return FALSE if frame shall be dropped (current half is full and writer
+ * is still busy), next written frame is then flagged LOST. */
+static bool sniff_sd_frame_start(void)
+{
+	uint32_t base, size, rem;
+
+	base = sniff_sd_base();
+	size = (g_sbuf_idx - base) & ~(MMCSD_BLOCK_SIZE - 1);
+	if (sniff_sd_wr_size == 0 && size >= SNIFF_SD_BATCH) {
+		/* Complete sectors only, file position stay sector aligned */
+		rem = g_sbuf_idx - base - size;
+		sniff_sd_half ^= 1;
+		memcpy(&g_sbuf[sniff_sd_base()], &g_sbuf[base + size], rem);
+		g_sbuf_idx = sniff_sd_base() + rem;
+
+		sniff_sd_wr_pos = base;
+		sniff_sd_wr_size = size;
+		chBSemSignal(&sniff_sd_sem);
 	}
+
+	if (g_sbuf_idx + SNIFF_DECODED_FRAME_MAX <= sniff_sd_limit())
+		return TRUE;
+
+	sniff_sd_lost_frames++;
+	sniff_ring_lost = TRUE;
 	return FALSE;
 }
 
+/* Wait writer, stop it then write remaining data, truncate pre-allocated
+ * file and close it */
+static void sniff_sd_stop(void)
+{
+	int i;
+
+	while (sniff_sd_wr_size != 0)
+		chThdSleepMilliseconds(1);
+	chThdTerminate(sniff_sd_thread);
+	/* Wake up writer */
+	chBSemSignal(&sniff_sd_sem);
+	chThdWait(sniff_sd_thread);
+	sniff_sd_thread = NULL;
+
+	sniff_sd_write(&g_sbuf[sniff_sd_base()], g_sbuf_idx - sniff_sd_base());
+	g_sbuf_idx = 0;
+	if (f_truncate(&sniff_sd_file) != FR_OK) {
+		sniff_sd_error = TRUE;
+	}
+	if (f_close(&sniff_sd_file) != FR_OK) {
+		sniff_sd_error = TRUE;
+	}
+	umount();
+
+	tprintf("write_file %s size=%ld bytes\r\n",
+		&write_filename.filename[2], sniff_sd_size);
+	if (sniff_sd_lost_frames > 0)
+		tprintf("microSD trace lost %ld frames\r\n", sniff_sd_lost_frames);
+	if (sniff_sd_error) {
+		tprintf("write_file() error\r\n");
+		/* Error Red LED blink */
+		for(i=0; i<4; i++) {
+			D5_ON;
+			DelayUs(50000);
+			D5_OFF;
+			DelayUs(50000);
+		}
+	} else {
+		tprintf("write_file() OK\r\n");
+		/* All is OK Green LED bink */
+		for(i=0; i<4; i++) {
+			D4_ON;
+			DelayUs(50000);
+			D4_OFF;
+			DelayUs(50000);
+		}
+	}
+}
+
 /* Return TRUE/exit if sniff stopped by K4 or UBTN, else return FALSE/continue */
 __attribute__ ((always_inline)) static inline
 bool sniff_wait_data_change_or_exit_nolog(void)
@@ -477,6 +838,8 @@ bool sniff_wait_data_change_or_exit_nolog(void)
 	/* Wait until data change */
 	while (TRUE) {
 		u32_data = WaitGetDMABuffer();
+		/* Track DWT wraps on silent field (shall be done every < 25s) */
+		get_cyclecounter64();
 		/* Search for an edge/data */
 		if (old_u32_data != u32_data) {
 			break;
@@ -485,7 +848,7 @@ bool sniff_wait_data_change_or_exit_nolog(void)
 		}
 
 		if ( (K4_BUTTON) || (USER_BUTTON) ) {
-			chSysUnlock();
+			sniff_unlock();
 			terminate_sniff_nfc();
 			D4_OFF;
 			D5_OFF;
@@ -497,287 +860,141 @@ bool sniff_wait_data_change_or_exit_nolog(void)
 
 
 __attribute__ ((always_inline)) static inline
-void sniff_write_pcd(void)
+void sniff_write_frameduration(uint32_t timestamp_nb_cycles)
 {
-	/* Write output buffer 4 space (data format Miller Modified):
-	  It means Reader/Writer (PCD – Proximity Coupling Device)
-	*/
 	uint32_t i, nb_cycles;
 	uint8_t val;
 
 	i = g_sbuf_idx;
-	g_sbuf[i+0] = '\r';
-	g_sbuf[i+1] = '\n';
+	g_sbuf[i+0] = '\t';
 
-	nb_cycles = get_cyclecounter();
+	nb_cycles = timestamp_nb_cycles;
 	val = ((nb_cycles & 0xFF000000) >> 24);
-	g_sbuf[i+2] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+3] = htoa[(val & 0x0F)];
+	g_sbuf[i+1] = htoa[(val & 0xF0) >> 4];
+	g_sbuf[i+2] = htoa[(val & 0x0F)];
 	val = ((nb_cycles & 0x00FF0000) >> 16);
-	g_sbuf[i+4] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+5] = htoa[(val & 0x0F)];
+	g_sbuf[i+3] = htoa[(val & 0xF0) >> 4];
+	g_sbuf[i+4] = htoa[(val & 0x0F)];
 	val = ((nb_cycles & 0x0000FF00) >> 8);
-	g_sbuf[i+6] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+7] = htoa[(val & 0x0F)];
+	g_sbuf[i+5] = htoa[(val & 0xF0) >> 4];
+	g_sbuf[i+6] = htoa[(val & 0x0F)];
 	val = (nb_cycles & 0x000000FF);
-	g_sbuf[i+8] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+9] = htoa[(val & 0x0F)];
-	g_sbuf[i+10] = '\t';
+	g_sbuf[i+7] = htoa[(val & 0xF0) >> 4];
+	g_sbuf[i+8] = htoa[(val & 0x0F)];
 
-	g_sbuf[i+11] = 'R';
-	g_sbuf[i+12] = 'D';
-	g_sbuf[i+13] = 'R';
-	g_sbuf[i+14] = '\t';
-	g_sbuf_idx +=15;
+	g_sbuf_idx +=9;
 }
 
 __attribute__ ((always_inline)) static inline
-void sniff_write_picc(void)
+void sniff_write_8b_ASCII_HEX(uint8_t data, bool add_space)
 {
-	/* Write output buffer "TAG"+1 space (data format Manchester):
-	  It means TAG(PICC – Proximity Integrated Circuit Card)
-	*/
-	uint32_t i, nb_cycles;
-	uint8_t val;
+	uint32_t i;
 
 	i = g_sbuf_idx;
-	g_sbuf[i+0] = '\r';
-	g_sbuf[i+1] = '\n';
-
-	nb_cycles = get_cyclecounter();
-	val = ((nb_cycles & 0xFF000000) >> 24);
-	g_sbuf[i+2] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+3] = htoa[(val & 0x0F)];
-	val = ((nb_cycles & 0x00FF0000) >> 16);
-	g_sbuf[i+4] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+5] = htoa[(val & 0x0F)];
-	val = ((nb_cycles & 0x0000FF00) >> 8);
-	g_sbuf[i+6] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+7] = htoa[(val & 0x0F)];
-	val = (nb_cycles & 0x000000FF);
-	g_sbuf[i+8] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+9] = htoa[(val & 0x0F)];
-	g_sbuf[i+10] = '\t';
-
-	g_sbuf[i+11] = 'T';
-	g_sbuf[i+12] = 'A';
-	g_sbuf[i+13] = 'G';
-	g_sbuf[i+14] = '\t';
-	g_sbuf_idx +=15;
+	g_sbuf[i+0] = htoa[(data & 0xF0) >> 4];
+	g_sbuf[i+1] = htoa[(data & 0x0F)];
+	if (add_space == TRUE) {
+		g_sbuf[i+2] = ' ';
+		g_sbuf_idx +=3;
+	} else {
+		g_sbuf_idx +=2;
+	}
 }
 
+/* Write "\tPAR:xx CRC:xx" with OK, KO (error) or -- (no parity/CRC),
+ * followed by " LOST" if samples were lost before end of frame */
 __attribute__ ((always_inline)) static inline
-void sniff_write_unknown_protocol(uint8_t data)
+void sniff_write_frame_status(uint8_t status)
 {
-	/* Unknown Protocol */
-	/* TODO: Detect other coding */
-	// In Freq of 3.39MHz => 105.9375KHz on 8bits (each bit is 848KHz so 2bits=423.75KHz)
-	/*
-	  data  = (downsample_4x[(f_data>>24)])<<6;
-	  data |= (downsample_4x[((f_data&0x00FF0000)>>16)])<<4;
-	  data |= (downsample_4x[((f_data&0x0000FF00)>>8)])<<2;
-	  data |= (downsample_4x[(f_data&0x000000FF)]);
-	*/
-	uint32_t i, nb_cycles;
-	uint8_t val;
+	uint32_t i;
 
 	i = g_sbuf_idx;
-	g_sbuf[i+0] = '\r';
-	g_sbuf[i+1] = '\n';
-
-	nb_cycles = get_cyclecounter();
-	val = ((nb_cycles & 0xFF000000) >> 24);
-	g_sbuf[i+2] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+3] = htoa[(val & 0x0F)];
-	val = ((nb_cycles & 0x00FF0000) >> 16);
-	g_sbuf[i+4] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+5] = htoa[(val & 0x0F)];
-	val = ((nb_cycles & 0x0000FF00) >> 8);
-	g_sbuf[i+6] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+7] = htoa[(val & 0x0F)];
-	val = (nb_cycles & 0x000000FF);
-	g_sbuf[i+8] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+9] = htoa[(val & 0x0F)];
-	g_sbuf[i+10] = '\t';
-
-	g_sbuf[i+11] = 'U';
-	g_sbuf[i+12] = htoa[(data & 0xF0) >> 4];
-	g_sbuf[i+13] = htoa[(data & 0x0F)];
-	g_sbuf[i+14] = '\t';
-	g_sbuf_idx +=15;
+	memcpy(&g_sbuf[i], "\tPAR:OK CRC:OK", 14);
+	if(status & PROTOCOL_FRAME_STATUS_NO_PARITY) {
+		g_sbuf[i+5] = '-';
+		g_sbuf[i+6] = '-';
+	} else if(status & PROTOCOL_FRAME_STATUS_PARITY_ERROR) {
+		g_sbuf[i+5] = 'K';
+		g_sbuf[i+6] = 'O';
+	}
+	if(status & PROTOCOL_FRAME_STATUS_NO_CRC) {
+		g_sbuf[i+12] = '-';
+		g_sbuf[i+13] = '-';
+	} else if(!(status & PROTOCOL_FRAME_STATUS_CRC_OK)) {
+		g_sbuf[i+12] = 'K';
+		g_sbuf[i+13] = 'O';
+	}
+	g_sbuf_idx +=14;
+	if(status & PROTOCOL_FRAME_STATUS_SAMPLES_LOST) {
+		memcpy(&g_sbuf[g_sbuf_idx], " LOST", 5);
+		g_sbuf_idx +=5;
+	}
 }
 
 __attribute__ ((always_inline)) static inline
-void sniff_write_eof_protocol(uint32_t timestamp_nb_cycles)
+void sniff_write_bin_timestamp(uint32_t timestamp_nb_cycles)
 {
-	uint32_t i, nb_cycles;
-	uint8_t val;
-	uint8_t data_buf[1];
-	uint8_t data;
-
-	data_buf[0] = RSSI_LEVELS;
-	Trf797xReadSingle(data_buf, 1);
-	data = data_buf[0];
-
-	i = g_sbuf_idx;
-	g_sbuf[i+0] = '\r';
-	g_sbuf[i+1] = '\n';
-
-	nb_cycles = timestamp_nb_cycles;
-	val = ((nb_cycles & 0xFF000000) >> 24);
-	g_sbuf[i+2] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+3] = htoa[(val & 0x0F)];
-	val = ((nb_cycles & 0x00FF0000) >> 16);
-	g_sbuf[i+4] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+5] = htoa[(val & 0x0F)];
-	val = ((nb_cycles & 0x0000FF00) >> 8);
-	g_sbuf[i+6] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+7] = htoa[(val & 0x0F)];
-	val = (nb_cycles & 0x000000FF);
-	g_sbuf[i+8] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+9] = htoa[(val & 0x0F)];
-	g_sbuf[i+10] = '\t';
-
-	g_sbuf[i+11] = 'R';
-	g_sbuf[i+12] = htoa[(data & 0xF0) >> 4];
-	g_sbuf[i+13] = htoa[(data & 0x0F)];
-	g_sbuf[i+14] = '\t';
-
-	g_sbuf_idx +=15;
+	memcpy(&g_sbuf[g_sbuf_idx], (uint8_t*)&timestamp_nb_cycles, sizeof(uint32_t));
+	g_sbuf_idx +=4;
 }
 
 __attribute__ ((always_inline)) static inline
-void sniff_write_timestamp(uint32_t timestamp_nb_cycles)
+void sniff_write_bin_8b(uint8_t data)
 {
-	uint32_t i, nb_cycles;
-	uint8_t val;
-	uint8_t data_buf[1];
-	uint8_t data;
+	g_sbuf[g_sbuf_idx] = data;
+	g_sbuf_idx++;
+}
 
-	data_buf[0] = RSSI_LEVELS;
-	Trf797xReadSingle(data_buf, 1);
-	data = data_buf[0];
+/* Called before writing a frame with SNIFF_TRACE_USB2, never blocks.
+ * Return FALSE if frame shall be dropped (no room in g_sbuf), next written
+ * frame is then flagged LOST. */
+static bool sniff_usb_room(uint32_t size)
+{
+	if (sniff_usb_frame_start(size))
+		return TRUE;
 
-	i = g_sbuf_idx;
-	g_sbuf[i+0] = '\r';
-	g_sbuf[i+1] = '\n';
+	sniff_ring_lost = TRUE;
+	return FALSE;
+}
 
-	nb_cycles = timestamp_nb_cycles;
-	val = ((nb_cycles & 0xFF000000) >> 24);
-	g_sbuf[i+2] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+3] = htoa[(val & 0x0F)];
-	val = ((nb_cycles & 0x00FF0000) >> 16);
-	g_sbuf[i+4] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+5] = htoa[(val & 0x0F)];
-	val = ((nb_cycles & 0x0000FF00) >> 8);
-	g_sbuf[i+6] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+7] = htoa[(val & 0x0F)];
-	val = (nb_cycles & 0x000000FF);
-	g_sbuf[i+8] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+9] = htoa[(val & 0x0F)];
-	g_sbuf[i+10] = '\t';
-
-	g_sbuf[i+11] = 'R';
-	g_sbuf[i+12] = htoa[(data & 0xF0) >> 4];
-	g_sbuf[i+13] = htoa[(data & 0x0F)];
-	g_sbuf[i+14] = '\t';
-
-	g_sbuf_idx +=15;
-}
-
-__attribute__ ((always_inline)) static inline
-void sniff_write_frameduration(uint32_t timestamp_nb_cycles)
-{
-	uint32_t i, nb_cycles;
-	uint8_t val;
-
-	i = g_sbuf_idx;
-	g_sbuf[i+0] = '\t';
-
-	nb_cycles = timestamp_nb_cycles;
-	val = ((nb_cycles & 0xFF000000) >> 24);
-	g_sbuf[i+1] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+2] = htoa[(val & 0x0F)];
-	val = ((nb_cycles & 0x00FF0000) >> 16);
-	g_sbuf[i+3] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+4] = htoa[(val & 0x0F)];
-	val = ((nb_cycles & 0x0000FF00) >> 8);
-	g_sbuf[i+5] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+6] = htoa[(val & 0x0F)];
-	val = (nb_cycles & 0x000000FF);
-	g_sbuf[i+7] = htoa[(val & 0xF0) >> 4];
-	g_sbuf[i+8] = htoa[(val & 0x0F)];
-
-	g_sbuf_idx +=9;
-}
-
-__attribute__ ((always_inline)) static inline
-void sniff_write_8b_ASCII_HEX(uint8_t data, bool add_space)
-{
-	uint32_t i;
-
-	i = g_sbuf_idx;
-	g_sbuf[i+0] = htoa[(data & 0xF0) >> 4];
-	g_sbuf[i+1] = htoa[(data & 0x0F)];
-	if (add_space == TRUE) {
-		g_sbuf[i+2] = ' ';
-		g_sbuf_idx +=3;
-	} else {
-		g_sbuf_idx +=2;
-	}
-}
-
-__attribute__ ((always_inline)) static inline
-void sniff_write_Parity_ASCII(uint8_t data)
-{
-	uint32_t i;
-
-	i = g_sbuf_idx;
-	g_sbuf[i+0] = htoa[(data & 0x0F)];
-	g_sbuf[i+1] = ' ';
-	g_sbuf_idx +=2;
-}
-
-__attribute__ ((always_inline)) static inline
-void sniff_write_bin_timestamp(uint32_t timestamp_nb_cycles)
+/* Wait USB2 writer then stop it */
+static void sniff_usb_end(void)
 {
-	memcpy(&g_sbuf[g_sbuf_idx], (uint8_t*)&timestamp_nb_cycles, sizeof(uint32_t));
-	g_sbuf_idx +=4;
+	sniff_usb_stop();
+	tprintf("USB2 trace lost %ld bytes\r\n", sniff_usb_lost());
+	if (sniff_usb_lost_frames() > 0)
+		tprintf("USB2 trace lost %ld frames\r\n", sniff_usb_lost_frames());
 }
 
-__attribute__ ((always_inline)) static inline
-void sniff_write_bin_8b(uint8_t data)
-{
-	g_sbuf[g_sbuf_idx] = data;
-	g_sbuf_idx++;
-}
-
-void hydranfc_sniff_14443A(t_hydra_console *con, bool start_of_frame, bool end_of_frame, bool sniff_trace_uart1)
+/* Special raw data sniffer for ISO14443 TypeA or TypeB @106kbps with:
+ - Each output byte(8bits) shall represent 1 bit data TypeA or TypeB @106kbps with following Modulation & Bit Coding:
+   - PCD to PICC TypeA => Modulation 100% ASK, Bit Coding Modified Miller
+   - PICC to PCD TypeA => Modulation OOK, Bit Coding Manchester
+   - PCD to PICC TypeB => Modulation 10% ASK, Bit Coding NRZ
+   - PICC to PCD TypeB => Modulation BPSK, Bit Coding NRZ - L
+*/
+void hydranfc_sniff_14443AB_bin_raw(t_hydra_console *con, bool start_of_frame, bool end_of_frame, sniff_trace_t trace)
 {
 	(void)con;
-
-	uint8_t  ds_data, tmp_u8_data, tmp_u8_data_nb_bit;
+	sniff_14443a_bin_frame_header_t bin_frame_hdr;
+	uint32_t frame_base, buf_limit;
+	uint8_t  ds_data;
 	uint32_t f_data, lsh_bit, rsh_bit;
-	uint32_t rsh_miller_bit, lsh_miller_bit;
-	uint32_t protocol_found, old_protocol_found; /* 0=Unknown, 1=106kb Miller Modified, 2=106kb Manchester */
 	uint32_t old_data_counter;
-	uint32_t nb_data;
-	uint32_t uart_buf_pos;
-	uint32_t start_frame_cycles;
-	uint32_t total_frame_cycles;
+	bool truncated;
 #ifdef STAT_UART_WRITE
 	uint32_t uart_min;
 	uint32_t uart_max;
 	uint32_t uart_nb_loop;
 #endif
-	tprintf("sniff_14443A start\r\n");
+	tprintf("sniff_14443AB_bin_raw start\r\n");
 	tprintf("Abort/Exit by pressing K4 button\r\n");
-	init_sniff_nfc(ISO14443A);
+	init_sniff_nfc(ISO14443B);
 
-	if(sniff_trace_uart1)
+	if(trace == SNIFF_TRACE_UART1)
 		initUART1_sniff();
 
-	tprintf("Starting Sniffer ISO14443-A 106kbps ...\r\n");
+	tprintf("Starting bin raw sniffer ISO14443-A/B 106kbps\r\n");
 	/* Wait a bit in order to display all text */
 	chThdSleepMilliseconds(50);
 #ifdef STAT_UART_WRITE
@@ -785,13 +1002,23 @@ void hydranfc_sniff_14443A(t_hydra_console *con, bool start_of_frame, bool end_o
 	uart_max = 0;
 	uart_nb_loop = 0;
 #endif
-	uart_buf_pos = 0;
-	old_protocol_found = 0;
-	protocol_found = 0;
-	g_sbuf_idx = 0;
+
+	bin_frame_hdr.protocol_options = 0;
+	if(start_of_frame == true)
+		bin_frame_hdr.protocol_options |= PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP;
+	if(end_of_frame == true)
+		bin_frame_hdr.protocol_options |= PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP;
+
+	bin_frame_hdr.protocol_modulation = PROTOCOL_MODULATION_14443AB_RAW_848KBPS;
+
+	frame_base = 0;
+	buf_limit = NB_SBUFFER;
+	if(trace == SNIFF_TRACE_USB2)
+		sniff_usb_start();
 
 	/* Lock Kernel for sniffer */
-	chSysLock();
+	sniff_set_kernel_lock(trace != SNIFF_TRACE_USB2);
+	sniff_lock();
 
 	/* Main Loop */
 	while (TRUE) {
@@ -800,31 +1027,38 @@ void hydranfc_sniff_14443A(t_hydra_console *con, bool start_of_frame, bool end_o
 		irq_no = 0;
 
 		while (TRUE) {
+			/* Start of Frame Loop */
 			D4_OFF;
 			old_data_bit = 0;
 			f_data = 0;
+			if(trace == SNIFF_TRACE_USB2) {
+				frame_base = sniff_usb_pos();
+				buf_limit = sniff_usb_limit();
+			}
+			g_sbuf_idx = frame_base + sizeof(bin_frame_hdr);
 
 			u32_data = WaitGetDMABuffer();
 			old_data_bit = (uint32_t)(u32_data&1);
 			old_u32_data = u32_data;
 
 			/* Wait until data change or K4/UBTN is pressed to stop/exit */
-			if (sniff_wait_data_change_or_exit() == TRUE) {
+			if (sniff_wait_data_change_or_exit_nolog() == TRUE) {
 #ifdef STAT_UART_WRITE
 				tprintf("\r\nuart_nb_loop=%u uart_min=%u uart_max=%u\r\n", uart_nb_loop, uart_min, uart_max);
 #endif
 				/* Wait a bit in order to display all text */
 				chThdSleepMilliseconds(50);
-				if(sniff_trace_uart1)
+				if(trace == SNIFF_TRACE_UART1)
 					deinitUART1_sniff();
+				if(trace == SNIFF_TRACE_USB2)
+					sniff_usb_end();
 				return;
 			}
-
+			
 			/* Log All Data */
+			/* Start of Frame detected */
 			TST_ON;
 			D4_ON;
-			tmp_u8_data = 0;
-			tmp_u8_data_nb_bit = 0;
 
 			/* Search first edge bit position to synchronize stream */
 			/* Search an edge on each bit from MSB to LSB */
@@ -834,85 +1068,31 @@ void hydranfc_sniff_14443A(t_hydra_console *con, bool start_of_frame, bool end_o
 			lsh_bit = CountLeadingZero(lsh_bit);
 			rsh_bit = 32-lsh_bit;
 
-			rsh_miller_bit = 0;
-			lsh_miller_bit = 32-rsh_miller_bit;
-
 			/* Shift data */
 			f_data = u32_data<<lsh_bit;
 			/* Next Data */
 			TST_OFF;
 			u32_data = WaitGetDMABuffer();
 			if(start_of_frame == true)
-				start_frame_cycles = get_cyclecounter();
+				sniff_write_bin_timestamp(get_cyclecounter());
 			TST_ON;
 			f_data |= u32_data>>rsh_bit;
 
-			/* Todo: Better algorithm to recognize frequency using table and counting number of edge ...
-			              and finaly use majority voting for frequency */
 			// DownSampling by 4 (input 32bits output 8bits filtered)
 			// In Freq of 3.39MHz => 105.9375KHz on 8bits (each bit is 848KHz so 2bits=423.75KHz)
-			ds_data  = ((downsample_4x[(f_data>>24)])<<6) |
-				   ((downsample_4x[((f_data&0x00FF0000)>>16)])<<4) |
-				   ((downsample_4x[((f_data&0x0000FF00)>>8)])<<2) |
-				   (downsample_4x[(f_data&0x000000FF)]);
-
-			/* Todo: Find frequency by counting number of consecutive "1" & "0" or the reverse.
-			 * Example0: 1x"1" then 1x"0" => 3.39MHz/2 = Freq 1695KHz
-			 * Example1: 2x"1" then 2x"0" => 3.39MHz/4 = Freq 847.5KHz
-			 * Example2: 4x"1" then 4x"0" => 3.39MHz/8 = Freq 423.75KHz
-			 * Example3: 8x"1" then 8x"0" (8+8) => 3.39MHz/16 = Freq 211.875KHz
-			 * Example4: 16x"1" then 16x"0" (16+16) => 3.39MHz/32 = Freq 105.9375KHz
-			 * Example Miller Modified '0' @~106Khz: 00000000 00111111 11111111 11111111 => 10x"0" then 22x"1" (10+22=32) => 3.39MHz/32 = Freq 105.9375KHz
-			 **/
-			protocol_found = detected_protocol[ds_data];
-			switch(protocol_found) {
-			case MILLER_MODIFIED_106KHZ:
-				/* Miller Modified@~106Khz Start bit */
-				old_protocol_found = MILLER_MODIFIED_106KHZ;
-				sniff_write_pcd();
-				break;
-
-			case MANCHESTER_106KHZ:
-				/* Manchester@~106Khz Start bit */
-				old_protocol_found = MANCHESTER_106KHZ;
-				sniff_write_picc();
-				break;
+			ds_data = sniff_downsample_32b(&sniff_tables, f_data);
 
-			default:
-				/* If previous protocol was Manchester now it should be Miller Modified
-				  (it is a supposition and because Miller modified start after manchester)
-				*/
-				if ( MANCHESTER_106KHZ == old_protocol_found ) {
-					old_protocol_found = MILLER_MODIFIED_106KHZ;
-					protocol_found = MILLER_MODIFIED_106KHZ;
-					/* RE Synchronize bit stream to start of bit from (00000000) 11111111 to 00111111 (2 to 3 us at level 0 are not seen) */
-					/* Nota only first Miller Modified Word does not need this hack because it is well detected it start with (11111111) 00111111  */
-					// New Word
-					rsh_miller_bit = 15; /* Between 2 to 3.1us => 7 to 11bits => Average 9bits + 6bits(margin) =< 32-15 = 17 bit */
-					lsh_miller_bit = 32-rsh_miller_bit;
-					sniff_write_pcd();
-					/* Start Bit not included in data buffer */
-				} else {
-					old_protocol_found = MILLER_MODIFIED_106KHZ;
-					protocol_found = MILLER_MODIFIED_106KHZ;
-					/* RE Synchronize bit stream to start of bit from (00000000) 11111111 to 00111111 (2 to 3 us at level 0 are not seen) */
-					/* Nota only first Miller Modified Word does not need this hack because it is well detected it start with (11111111) 00111111  */
-					// New Word
-					rsh_miller_bit = 15; /* Between 2 to 3.1us => 7 to 11bits => Average 9bits + 6bits(margin) =< 32-15 = 17 bit */
-					lsh_miller_bit = 32-rsh_miller_bit;
-					sniff_write_unknown_protocol(ds_data);
-				}
-				break;
-			}
+			/* Write 8bits raw data */
+			sniff_write_bin_8b(ds_data);
 
 			/* Decode Data until end of frame detected */
 			old_u32_data = f_data;
 			old_data_counter = 0;
-			nb_data = 0;
+			truncated = FALSE;
 			while (1) {
 				if ( (K4_BUTTON) || (USER_BUTTON) ) {
 					if(end_of_frame == true)
-						total_frame_cycles = get_cyclecounter() - start_frame_cycles;
+						sniff_write_bin_timestamp(get_cyclecounter());
 					break;
 				}
 
@@ -938,7 +1118,7 @@ void hydranfc_sniff_14443A(t_hydra_console *con, bool start_of_frame, bool end_o
 						if (old_data_counter>1) {
 							/* No new data => End Of Frame detected => Wait new data & synchro */
 							if(end_of_frame == true)
-								total_frame_cycles = get_cyclecounter() - start_frame_cycles;
+								sniff_write_bin_timestamp(get_cyclecounter());
 							break;
 						}
 					} else {
@@ -946,582 +1126,468 @@ void hydranfc_sniff_14443A(t_hydra_console *con, bool start_of_frame, bool end_o
 					}
 				}
 
-				f_data = (f_data>>rsh_miller_bit)|(0xFFFFFFFF<<lsh_miller_bit);
 				// DownSampling by 4 (input 32bits output 8bits filtered)
 				// In Freq of 3.39MHz => 105.9375KHz on 8bits (each bit is 848KHz so 2bits=423.75KHz)
-				ds_data  = ((downsample_4x[(f_data>>24)])<<6) |
-					   ((downsample_4x[((f_data&0x00FF0000)>>16)])<<4) |
-					   ((downsample_4x[((f_data&0x0000FF00)>>8)])<<2) |
-					   (downsample_4x[(f_data&0x000000FF)]);
-
-				switch(protocol_found) {
-				case MILLER_MODIFIED_106KHZ:
-					if (tmp_u8_data_nb_bit < 8) {
-						tmp_u8_data |= (miller_modified_106kb[ds_data])<<tmp_u8_data_nb_bit;
-						tmp_u8_data_nb_bit++;
-					} else {
-						nb_data++;
-						tmp_u8_data_nb_bit=0;
-						/* Convert Hex to ASCII + Space */
-						sniff_write_8b_ASCII_HEX(tmp_u8_data, TRUE);
+				ds_data = sniff_downsample_32b(&sniff_tables, f_data);
 
-						tmp_u8_data=0; /* Parity bit discarded */
-					}
-					break;
-
-				case MANCHESTER_106KHZ:
-					if (tmp_u8_data_nb_bit < 8) {
-						tmp_u8_data |= (manchester_106kb[ds_data])<<tmp_u8_data_nb_bit;
-						tmp_u8_data_nb_bit++;
-					} else {
-						nb_data++;
-						tmp_u8_data_nb_bit=0;
-						/* Convert Hex to ASCII + Space */
-						sniff_write_8b_ASCII_HEX(tmp_u8_data, TRUE);
-
-						tmp_u8_data=0; /* Parity bit discarded */
-					}
-					break;
+				/* Write 8bits raw data */
+				sniff_write_bin_8b(ds_data);
 
-				default:
-					nb_data++;
-					/* Unknown protocol */
-					/* Convert Hex to ASCII */
-					sniff_write_8b_ASCII_HEX(ds_data, FALSE);
-					break;
-				}
 				/* For safety to avoid potential buffer overflow ... */
-				if (g_sbuf_idx >= NB_SBUFFER) {
-					g_sbuf_idx = NB_SBUFFER;
+				if (g_sbuf_idx >= buf_limit) {
+					g_sbuf_idx = buf_limit;
+					truncated = TRUE;
 				}
 			}
-
-			/* End of Frame detected check if incomplete byte (at least 4bit) is present to write it as output */
-			if (tmp_u8_data_nb_bit>3) {
-					nb_data++;
-					/* Convert Hex to ASCII + Space */
-					sniff_write_8b_ASCII_HEX(tmp_u8_data, FALSE);
+			/* End of Frame detected */
+			if(trace == SNIFF_TRACE_USB2 && truncated == TRUE) {
+				/* No room left in g_sbuf, frame is lost */
+				sniff_usb_frame_drop();
+				TST_OFF;
+				continue;
 			}
-			if(end_of_frame == true)
-				sniff_write_frameduration(total_frame_cycles);
-
-			if(sniff_trace_uart1)
-			{
-				uint32_t uart_buf_size;
-				uart_buf_size = (g_sbuf_idx - uart_buf_pos);
-				if (uart_buf_size > 0) {
 #ifdef STAT_UART_WRITE
-					uint32_t ticks;
-					ticks = get_cyclecounter();
+			{
+				uint32_t ticks;
+				ticks = get_cyclecounter();
 #endif
-					bsp_uart_write_u8(BSP_DEV_UART1, &g_sbuf[uart_buf_pos], uart_buf_size);
-					uart_buf_pos = g_sbuf_idx;
+				bin_frame_hdr.data_size = g_sbuf_idx - frame_base;
+				memcpy(&g_sbuf[frame_base], (uint8_t*)&bin_frame_hdr, sizeof(bin_frame_hdr));
+				if(trace == SNIFF_TRACE_USB2)
+					sniff_usb_frame_end(g_sbuf_idx);
+				else
+					bsp_uart_write_u8(BSP_DEV_UART1, &g_sbuf[0], g_sbuf_idx);
 #ifdef STAT_UART_WRITE
-					ticks = (get_cyclecounter() - ticks);
-					uart_nb_loop++;
+				ticks = (get_cyclecounter() - ticks);
+				uart_nb_loop++;
 
-					if(ticks < uart_min)
-						uart_min = ticks;
+				if(ticks < uart_min)
+					uart_min = ticks;
 
-					if(ticks > uart_max)
-						uart_max = ticks;
-#endif
-				}
-				/* For safety to avoid buffer overflow and restart buffer */
-				if (g_sbuf_idx >= NB_SBUFFER) {
-					g_sbuf_idx = 0;
-					uart_buf_pos = 0;
-				}
-			}else
-			{
-				/* For safety to avoid buffer overflow */
-				if (g_sbuf_idx >= NB_SBUFFER) {
-					g_sbuf_idx = NB_SBUFFER;
-				}
+				if(ticks > uart_max)
+					uart_max = ticks;
 			}
+#endif
 			TST_OFF;
 		}
 	} // Main While Loop
-
 }
 
-void hydranfc_sniff_14443A_bin(t_hydra_console *con, bool start_of_frame, bool end_of_frame, bool parity)
-{
-	(void)con;
-	sniff_14443a_bin_frame_header_t bin_frame_hdr;
-	uint8_t  ds_data, tmp_u8_data, tmp_u8_data_nb_bit;
-	uint32_t f_data, lsh_bit, rsh_bit;
-	uint32_t rsh_miller_bit, lsh_miller_bit;
-	uint32_t protocol_found, old_protocol_found; /* 0=Unknown, 1=106kb Miller Modified, 2=106kb Manchester */
-	uint32_t old_data_counter;
-#ifdef STAT_UART_WRITE
-	uint32_t uart_min;
-	uint32_t uart_max;
-	uint32_t uart_nb_loop;
-#endif
-	uint32_t nb_data;
-	uint32_t end_of_frame_cycles;
-
-	tprintf("sniff_14443A_bin start\r\n");
-	tprintf("Abort/Exit by pressing K4 button\r\n");
-	init_sniff_nfc(ISO14443A);
-
-	initUART1_sniff();
-
-	tprintf("Starting Sniffer ISO14443-A 106kbps ...\r\n");
-	/* Wait a bit in order to display all text */
-	chThdSleepMilliseconds(50);
-#ifdef STAT_UART_WRITE
-	uart_min = 0xFFFFFFFF;
-	uart_max = 0;
-	uart_nb_loop = 0;
-#endif
-	old_protocol_found = 0;
-	protocol_found = 0;
-
-	bin_frame_hdr.protocol_options = 0;
-	if(start_of_frame == true)
-		bin_frame_hdr.protocol_options |= PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP;
-	if(end_of_frame == true)
-		bin_frame_hdr.protocol_options |= PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP;
-	if(parity == true)
-		bin_frame_hdr.protocol_options |= PROTOCOL_OPTIONS_PARITY;
-
-	/* Lock Kernel for sniffer */
-	chSysLock();
 
-	/* Main Loop */
-	while (TRUE) {
-		lsh_bit = 0;
-		rsh_bit = 0;
-		irq_no = 0;
-
-		while (TRUE) {
-			/* Start of Frame Loop */
-			D4_OFF;
-			old_data_bit = 0;
-			f_data = 0;
-			g_sbuf_idx = sizeof(bin_frame_hdr);
-
-			u32_data = WaitGetDMABuffer();
-			old_data_bit = (uint32_t)(u32_data&1);
-			old_u32_data = u32_data;
+/* Decoded frame */
+static sniff_decoder_t sniff_dec;
+/* PROTOCOL_OPTIONS_XXX of decoded frames output */
+static uint8_t sniff_options;
 
-			/* Wait until data change or K4/UBTN is pressed to stop/exit */
-			if (sniff_wait_data_change_or_exit_nolog() == TRUE) {
-#ifdef STAT_UART_WRITE
-				tprintf("\r\nuart_nb_loop=%u uart_min=%u uart_max=%u\r\n", uart_nb_loop, uart_min, uart_max);
-#endif
-				/* Wait a bit in order to display all text */
-				chThdSleepMilliseconds(50);
-				deinitUART1_sniff();
-				return;
-			}
-
-			/* Log All Data */
-			TST_ON;
-			D4_ON;
-			tmp_u8_data = 0;
-			tmp_u8_data_nb_bit = 0;
-
-			/* Search first edge bit position to synchronize stream */
-			/* Search an edge on each bit from MSB to LSB */
-			/* Old bit = 1 so new bit will be 0 => 11111111 10000000 => 00000000 01111111 just need to reverse it to count leading zero */
-			/* Old bit = 0 so new bit will be 1 => 00000000 01111111 no need to reverse to count leading zero */
-			lsh_bit = old_data_bit ? (~u32_data) : u32_data;
-			lsh_bit = CountLeadingZero(lsh_bit);
-			rsh_bit = 32-lsh_bit;
-
-			rsh_miller_bit = 0;
-			lsh_miller_bit = 32-rsh_miller_bit;
-
-			/* Shift data */
-			f_data = u32_data<<lsh_bit;
-			/* Next Data */
-			TST_OFF;
-			u32_data = WaitGetDMABuffer();
-			if(start_of_frame == true)
-				sniff_write_bin_timestamp(get_cyclecounter());
-			TST_ON;
-			f_data |= u32_data>>rsh_bit;
+/* Output of decoded frames, see sniff_decoded() */
+typedef struct {
+	/* Called before capture, NULL if not used */
+	void (*start)(void);
+	/* Write frame at g_sbuf_idx, data are truncated to fit before limit */
+	void (*write)(const sniff_decoder_t *d, uint64_t start_cycles,
+		      uint64_t end_cycles, uint32_t limit);
+	/* Save g_sbuf when stopped with SNIFF_TRACE_NONE, NULL if not used */
+	void (*save)(void);
+} sniff_output_t;
+
+/* Write "\r\n" + start of frame timestamp + "\tRDR\t", "\tTAG\t" or
+ * "\tU" + ISO14443A unknown start bit + "\t" (15 bytes) */
+static void sniff_write_decoded_header(const sniff_decoder_t *d, uint32_t start_cycles)
+{
+	uint32_t i, nb_cycles;
 
-			/* Todo: Better algorithm to recognize frequency using table and counting number of edge ...
-			              and finaly use majority voting for frequency */
-			// DownSampling by 4 (input 32bits output 8bits filtered)
-			// In Freq of 3.39MHz => 105.9375KHz on 8bits (each bit is 848KHz so 2bits=423.75KHz)
-			ds_data  = ((downsample_4x[(f_data>>24)])<<6) |
-				   ((downsample_4x[((f_data&0x00FF0000)>>16)])<<4) |
-				   ((downsample_4x[((f_data&0x0000FF00)>>8)])<<2) |
-				   (downsample_4x[(f_data&0x000000FF)]);
-
-			/* Todo: Find frequency by counting number of consecutive "1" & "0" or the reverse.
-			 * Example0: 1x"1" then 1x"0" => 3.39MHz/2 = Freq 1695KHz
-			 * Example1: 2x"1" then 2x"0" => 3.39MHz/4 = Freq 847.5KHz
-			 * Example2: 4x"1" then 4x"0" => 3.39MHz/8 = Freq 423.75KHz
-			 * Example3: 8x"1" then 8x"0" (8+8) => 3.39MHz/16 = Freq 211.875KHz
-			 * Example4: 16x"1" then 16x"0" (16+16) => 3.39MHz/32 = Freq 105.9375KHz
-			 * Example Miller Modified '0' @~106Khz: 00000000 00111111 11111111 11111111 => 10x"0" then 22x"1" (10+22=32) => 3.39MHz/32 = Freq 105.9375KHz
-			 */
-			protocol_found = detected_protocol[ds_data];
-			switch(protocol_found) {
-			case MILLER_MODIFIED_106KHZ:
-				/* Miller Modified@~106Khz Start bit */
-				old_protocol_found = MILLER_MODIFIED_106KHZ;
-				bin_frame_hdr.protocol_modulation = PROTOCOL_MODULATION_TYPEA_MILLER_MODIFIED_106KBPS;
-				break;
+	i = g_sbuf_idx;
+	g_sbuf[i+0] = '\r';
+	g_sbuf[i+1] = '\n';
+	nb_cycles = start_cycles;
+	for (i = g_sbuf_idx + 9; i > g_sbuf_idx + 1; i--) {
+		g_sbuf[i] = htoa[nb_cycles & 0x0F];
+		nb_cycles >>= 4;
+	}
+	i = g_sbuf_idx;
+	g_sbuf[i+10] = '\t';
+	if (d->type == SNIFF_DECODER_14443A && d->state == 0) {
+		/* ISO14443A start bit not recognized */
+		g_sbuf[i+11] = 'U';
+		g_sbuf[i+12] = htoa[(d->start_ds & 0xF0) >> 4];
+		g_sbuf[i+13] = htoa[(d->start_ds & 0x0F)];
+		g_sbuf[i+14] = '\t';
+	} else if (d->dir == SNIFF_DECODER_DIR_PCD) {
+		memcpy(&g_sbuf[i+11], "RDR\t", 4);
+	} else {
+		memcpy(&g_sbuf[i+11], "TAG\t", 4);
+	}
+	g_sbuf_idx += 15;
+}
 
-			case MANCHESTER_106KHZ:
-				/* Manchester@~106Khz Start bit */
-				old_protocol_found = MANCHESTER_106KHZ;
-				bin_frame_hdr.protocol_modulation = PROTOCOL_MODULATION_TYPEA_MANCHESTER_106KBPS;
-				break;
+/* Write decoded frame in ASCII, data are truncated to fit before limit.
+ * ISO14443A complete bytes are followed by a space, ISO14443B/ISO15693
+ * bytes are separated by a space. */
+static void sniff_write_decoded_ascii(const sniff_decoder_t *d, uint64_t start_cycles,
+				      uint64_t end_cycles, uint32_t limit)
+{
+	uint32_t i, len;
+	bool add_space;
+
+	/* Header (15) + status (14 + 5) + frame duration (9) */
+	if (g_sbuf_idx + 15 + 19 + 9 > limit)
+		return;
+	len = (limit - g_sbuf_idx - 15 - 19 - 9) / 3;
+	if (len > d->len)
+		len = d->len;
+
+	sniff_write_decoded_header(d, start_cycles);
+	for (i = 0; i < len; i++) {
+		if (d->type == SNIFF_DECODER_14443A)
+			add_space = (i + 1) < d->len || d->last_bits == 8;
+		else
+			add_space = (i + 1) < len;
+		sniff_write_8b_ASCII_HEX(d->frame[i], add_space);
+	}
+	sniff_write_frame_status(sniff_decoded_frame_status(d));
+	if (sniff_options & PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP)
+		sniff_write_frameduration(end_cycles - start_cycles);
+}
 
-			default:
-				/* If previous protocol was Manchester now it should be Miller Modified
-				  (it is a supposition and because Miller modified start after manchester)
-				*/
-				if ( MANCHESTER_106KHZ == old_protocol_found ) {
-					old_protocol_found = MILLER_MODIFIED_106KHZ;
-					protocol_found = MILLER_MODIFIED_106KHZ;
-				  bin_frame_hdr.protocol_modulation = PROTOCOL_MODULATION_TYPEA_MILLER_MODIFIED_106KBPS;
-					/* RE Synchronize bit stream to start of bit from (00000000) 11111111 to 00111111 (2 to 3 us at level 0 are not seen) */
-					/* Nota only first Miller Modified Word does not need this hack because it is well detected it start with (11111111) 00111111  */
-					// New Word
-					rsh_miller_bit = 15; /* Between 2 to 3.1us => 7 to 11bits => Average 9bits + 6bits(margin) =< 32-15 = 17 bit */
-					lsh_miller_bit = 32-rsh_miller_bit;
-					sniff_write_pcd();
-					/* Start Bit not included in data buffer */
-				} else {
-					old_protocol_found = MILLER_MODIFIED_106KHZ;
-					protocol_found = MILLER_MODIFIED_106KHZ;
-				  bin_frame_hdr.protocol_modulation = PROTOCOL_MODULATION_TYPEA_MILLER_MODIFIED_106KBPS;
-					/* RE Synchronize bit stream to start of bit from (00000000) 11111111 to 00111111 (2 to 3 us at level 0 are not seen) */
-					/* Nota only first Miller Modified Word does not need this hack because it is well detected it start with (11111111) 00111111  */
-					// New Word
-					rsh_miller_bit = 15; /* Between 2 to 3.1us => 7 to 11bits => Average 9bits + 6bits(margin) =< 32-15 = 17 bit */
-					lsh_miller_bit = 32-rsh_miller_bit;
-					//sniff_write_unknown_protocol(ds_data);
-				}
-				break;
-			}
+/* Write decoded frame in binary (sniff_14443a_bin_frame_header_t format) */
+static void sniff_write_decoded_bin(const sniff_decoder_t *d, uint64_t start_cycles,
+				    uint64_t end_cycles, uint32_t limit)
+{
+	sniff_14443a_bin_frame_header_t bin_frame_hdr;
+	uint32_t frame_base, i, len, byte_size, marker;
+
+	bin_frame_hdr.protocol_options = sniff_options | PROTOCOL_OPTIONS_FRAME_STATUS;
+	if (d->type != SNIFF_DECODER_14443A)
+		bin_frame_hdr.protocol_options &= ~PROTOCOL_OPTIONS_PARITY;
+	byte_size = (bin_frame_hdr.protocol_options & PROTOCOL_OPTIONS_PARITY) ? 2 : 1;
+
+	/* ISO14443A reader frame resynchronized after a card frame starts with
+	 * an ASCII "RDR" header (15) */
+	marker = (d->type == SNIFF_DECODER_14443A && d->dir == SNIFF_DECODER_DIR_PCD &&
+		  d->state != 0 && d->shift != 0) ? 15 : 0;
+
+	/* Header + 2 timestamps + marker + status */
+	if (g_sbuf_idx + sizeof(bin_frame_hdr) + 4 + 4 + marker + 1 > limit)
+		return;
+	len = (limit - g_sbuf_idx - sizeof(bin_frame_hdr) - 4 - 4 - marker - 1) / byte_size;
+	if (len > d->len)
+		len = d->len;
+
+	switch (d->type) {
+	case SNIFF_DECODER_14443A:
+		bin_frame_hdr.protocol_modulation = (d->dir == SNIFF_DECODER_DIR_PCD) ?
+						    PROTOCOL_MODULATION_TYPEA_MILLER_MODIFIED_106KBPS :
+						    PROTOCOL_MODULATION_TYPEA_MANCHESTER_106KBPS;
+		break;
+	case SNIFF_DECODER_15693:
+		bin_frame_hdr.protocol_modulation = (d->dir == SNIFF_DECODER_DIR_PCD) ?
+						    PROTOCOL_MODULATION_15693_1_OUT_OF_4 :
+						    PROTOCOL_MODULATION_15693_MANCHESTER_26KBPS;
+		break;
+	default:
+		bin_frame_hdr.protocol_modulation = (d->dir == SNIFF_DECODER_DIR_PCD) ?
+						    PROTOCOL_MODULATION_TYPEB_NRZ_106KBPS :
+						    PROTOCOL_MODULATION_TYPEB_BPSK_106KBPS;
+		break;
+	}
 
-			/* Decode Data until end of frame detected */
-			old_u32_data = f_data;
-			old_data_counter = 0;
-			nb_data = 0;
-			while (1) {
-				if ( (K4_BUTTON) || (USER_BUTTON) ) {
-					if(end_of_frame == true)
-						end_of_frame_cycles = get_cyclecounter();
-					break;
-				}
+	frame_base = g_sbuf_idx;
+	g_sbuf_idx += sizeof(bin_frame_hdr);
+	if (sniff_options & PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP)
+		sniff_write_bin_timestamp(start_cycles);
+	if (marker != 0)
+		sniff_write_decoded_header(d, start_cycles);
+	if (byte_size == 2) {
+		for (i = 0; i < len; i++) {
+			sniff_write_bin_8b(d->frame[i]);
+			/* Incomplete last byte has no parity */
+			if ((i + 1) < d->len || d->last_bits == 8)
+				sniff_write_bin_8b(sniff_decoder_parity(d, i));
+		}
+	} else {
+		memcpy(&g_sbuf[g_sbuf_idx], d->frame, len);
+		g_sbuf_idx += len;
+	}
+	sniff_write_bin_8b(sniff_decoded_frame_status(d));
+	if (sniff_options & PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP)
+		sniff_write_bin_timestamp(end_cycles);
 
-				/* New Word */
-				f_data = u32_data<<lsh_bit;
+	bin_frame_hdr.data_size = g_sbuf_idx - frame_base;
+	memcpy(&g_sbuf[frame_base], (uint8_t*)&bin_frame_hdr, sizeof(bin_frame_hdr));
+}
 
-				/* Next Data */
-				TST_OFF;
-				u32_data = WaitGetDMABuffer();
-				TST_ON;
+/* PCAPNG trace (ISO 14443 link type, start of frame timestamp) */
+static pcapng_ts_t sniff_pcapng_ts;
+static uint32_t sniff_pcapng_frames;
+static bool sniff_pcapng_full;
 
-				f_data |= u32_data>>rsh_bit;
+static void sniff_pcapng_start(void)
+{
+	g_sbuf_idx = pcapng_write_header(g_sbuf, PCAPNG_LINKTYPE_ISO_14443);
+	pcapng_ts_init(&sniff_pcapng_ts, get_cyclecounter64());
+	sniff_pcapng_frames = 0;
+	sniff_pcapng_full = FALSE;
+}
 
-				/* In New Data 32bits */
-				if (u32_data != old_u32_data) {
-					old_u32_data = u32_data;
-					old_data_counter = 0;
-				} else {
-					old_u32_data = u32_data;
-					/* No new data */
-					if ( (u32_data==0xFFFFFFFF) || (u32_data==0x00000000) ) {
-						old_data_counter++;
-						if (old_data_counter>1) {
-							/* No new data => End Of Frame detected => Wait new data & synchro */
-							if(end_of_frame == true)
-								end_of_frame_cycles = get_cyclecounter();
-							break;
-						}
-					} else {
-						old_data_counter = 0;
-					}
-				}
+/* Write decoded ISO14443A frame as Enhanced Packet Block, parity/CRC check
+ * and incomplete last byte are epb_flags link-layer errors.
+ * Frame and next ones are dropped if it does not fit before limit. */
+static void sniff_write_decoded_pcapng(const sniff_decoder_t *d, uint64_t start_cycles,
+				       uint64_t end_cycles, uint32_t limit)
+{
+	uint32_t errors;
+	uint8_t status, event;
 
-				f_data = (f_data>>rsh_miller_bit)|(0xFFFFFFFF<<lsh_miller_bit);
-				// DownSampling by 4 (input 32bits output 8bits filtered)
-				// In Freq of 3.39MHz => 105.9375KHz on 8bits (each bit is 848KHz so 2bits=423.75KHz)
-				ds_data  = ((downsample_4x[(f_data>>24)])<<6) |
-					   ((downsample_4x[((f_data&0x00FF0000)>>16)])<<4) |
-					   ((downsample_4x[((f_data&0x0000FF00)>>8)])<<2) |
-					   (downsample_4x[(f_data&0x000000FF)]);
-
-				switch(protocol_found) {
-				case MILLER_MODIFIED_106KHZ:
-					if (tmp_u8_data_nb_bit < 8) {
-						tmp_u8_data |= (miller_modified_106kb[ds_data])<<tmp_u8_data_nb_bit;
-						tmp_u8_data_nb_bit++;
-					} else {
-						bin_frame_hdr.protocol_modulation = PROTOCOL_MODULATION_TYPEA_MILLER_MODIFIED_106KBPS;
-						nb_data++;
-						tmp_u8_data_nb_bit=0;
-						/* Write 8bits Data */
-						sniff_write_bin_8b(tmp_u8_data);
-						/* Write Parity */
-						if(parity == true)
-							sniff_write_bin_8b(miller_modified_106kb[ds_data]);
-
-						tmp_u8_data=0; /* Parity bit discarded */
-					}
-					break;
+	(void)end_cycles;
 
-				case MANCHESTER_106KHZ:
-					if (tmp_u8_data_nb_bit < 8) {
-						tmp_u8_data |= (manchester_106kb[ds_data])<<tmp_u8_data_nb_bit;
-						tmp_u8_data_nb_bit++;
-					} else {
-						bin_frame_hdr.protocol_modulation = PROTOCOL_MODULATION_TYPEA_MANCHESTER_106KBPS;
-						nb_data++;
-						tmp_u8_data_nb_bit=0;
-						/* Write 8bits Data */
-						sniff_write_bin_8b(tmp_u8_data);
-						/* Write Parity */
-						if(parity == true)
-							sniff_write_bin_8b(manchester_106kb[ds_data]);
-
-						tmp_u8_data=0; /* Parity bit discarded */
-					}
-					break;
+	if (sniff_pcapng_full || g_sbuf_idx + PCAPNG_ISO14443_HDR_SIZE + d->len +
+	    PCAPNG_ISO14443_TRAILER_MAX > limit) {
+		sniff_pcapng_full = TRUE;
+		return;
+	}
 
-				default:
-					bin_frame_hdr.protocol_modulation = PROTOCOL_MODULATION_UNKNOWN;
-					nb_data++;
-					/* Unknown protocol */
-					/* Write 8bits Data */
-					sniff_write_bin_8b(ds_data);
-					break;
-				}
-				/* For safety to avoid potential buffer overflow ... */
-				if (g_sbuf_idx >= NB_SBUFFER) {
-					g_sbuf_idx = NB_SBUFFER;
-				}
-			}
+	status = sniff_decoded_frame_status(d);
+	errors = 0;
+	if (status & PROTOCOL_FRAME_STATUS_PARITY_ERROR)
+		errors |= PCAPNG_EPB_FLAGS_ERR_SYMBOL;
+	if (!(status & (PROTOCOL_FRAME_STATUS_NO_CRC | PROTOCOL_FRAME_STATUS_CRC_OK)))
+		errors |= PCAPNG_EPB_FLAGS_ERR_CRC;
+	if (d->last_bits != 8)
+		errors |= PCAPNG_EPB_FLAGS_ERR_UNALIGNED;
+	event = (d->dir == SNIFF_DECODER_DIR_PCD) ? PCAPNG_ISO14443_EV_PCD_TO_PICC :
+						    PCAPNG_ISO14443_EV_PICC_TO_PCD;
+
+	memcpy(&g_sbuf[g_sbuf_idx + PCAPNG_ISO14443_HDR_SIZE], d->frame, d->len);
+	g_sbuf_idx += pcapng_iso14443_finish(&g_sbuf[g_sbuf_idx], &sniff_pcapng_ts,
+					     start_cycles, event, d->len, errors);
+	sniff_pcapng_frames++;
+}
 
-			/* End of Frame detected check if incomplete byte (at least 4bit) is present to write it as output */
-			timestamp_nb_cycles = get_cyclecounter();
-			if (tmp_u8_data_nb_bit>3) {
-					nb_data++;
-					/* Write 8bits Data */
-					sniff_write_bin_8b(tmp_u8_data);
-			}
-			if(end_of_frame == true)
-				sniff_write_bin_timestamp(end_of_frame_cycles);
+/* Write PCAPNG trace to microSD (nfc_sniff_N.pcapng) */
+static void sniff_pcapng_save(void)
+{
+	int err;
+
+	err = sniff_write_file_ext(g_sbuf, g_sbuf_idx, "pcapng");
+	write_file_get_last_filename(&write_filename);
+	tprintf("write_file %s %ld frames size=%ld bytes%s\r\n",
+		&write_filename.filename[2], sniff_pcapng_frames, g_sbuf_idx,
+		sniff_pcapng_full ? " (buffer full)" : "");
+	if (err < 0)
+		tprintf("write_file() error %d\r\n", err);
+	else
+		tprintf("write_file() OK\r\n");
+}
 
-			if ((nb_data > 0) && (g_sbuf_idx >  sizeof(bin_frame_hdr))) {
-#ifdef STAT_UART_WRITE
-				uint32_t ticks;
-				ticks = get_cyclecounter();
-#endif
-				bin_frame_hdr.data_size = g_sbuf_idx;
-				memcpy(&g_sbuf[0], (uint8_t*)&bin_frame_hdr, sizeof(bin_frame_hdr));
-				bsp_uart_write_u8(BSP_DEV_UART1, &g_sbuf[0], g_sbuf_idx);
-#ifdef STAT_UART_WRITE
-				ticks = (get_cyclecounter() - ticks);
-				uart_nb_loop++;
+static const sniff_output_t sniff_output_ascii = {
+	NULL, sniff_write_decoded_ascii, sniff_log
+};
 
-				if(ticks < uart_min)
-					uart_min = ticks;
+static const sniff_output_t sniff_output_bin = {
+	NULL, sniff_write_decoded_bin, NULL
+};
 
-				if(ticks > uart_max)
-					uart_max = ticks;
-#endif
-			}
-			TST_OFF;
-		}
-	} // Main While Loop
-}
+static const sniff_output_t sniff_output_pcapng = {
+	sniff_pcapng_start, sniff_write_decoded_pcapng, sniff_pcapng_save
+};
 
-/* Special raw data sniffer for ISO14443 TypeA or TypeB @106kbps with:
- - Each output byte(8bits) shall represent 1 bit data TypeA or TypeB @106kbps with following Modulation & Bit Coding:
-   - PCD to PICC TypeA => Modulation 100% ASK, Bit Coding Modified Miller
-   - PICC to PCD TypeA => Modulation OOK, Bit Coding Manchester
-   - PCD to PICC TypeB => Modulation 10% ASK, Bit Coding NRZ
-   - PICC to PCD TypeB => Modulation BPSK, Bit Coding NRZ - L
-*/
-void hydranfc_sniff_14443AB_bin_raw(t_hydra_console *con, bool start_of_frame, bool end_of_frame)
+/* Sniffer ISO14443A/ISO14443B 106kbps or ISO15693, frames are decoded word
+ * by word (see hydranfc_cmd_sniff_decoder.c) and written by out at end of
+ * frame.
+ * Binary output is only supported on UART1 or USB2, PCAPNG output with
+ * SNIFF_TRACE_NONE.
+ */
+static void sniff_decoded(INIT_NFC_PROTOCOL proto, const sniff_output_t *out,
+			  uint8_t options, sniff_trace_t trace)
 {
-	(void)con;
-	sniff_14443a_bin_frame_header_t bin_frame_hdr;
-	uint8_t  ds_data;
-	uint32_t f_data, lsh_bit, rsh_bit;
-	uint32_t old_data_counter;
-#ifdef STAT_UART_WRITE
-	uint32_t uart_min;
-	uint32_t uart_max;
-	uint32_t uart_nb_loop;
-#endif
-	tprintf("sniff_14443AB_bin_raw start\r\n");
+	sniff_decoder_t *d = &sniff_dec;
+	uint32_t f_data, lsh_bit, rsh_bit, ret;
+	uint64_t start_cycles, end_cycles;
+	uint32_t buf_limit;
+
 	tprintf("Abort/Exit by pressing K4 button\r\n");
-	init_sniff_nfc(ISO14443B);
+	if(trace == SNIFF_TRACE_SD) {
+		if(sniff_sd_start() < 0) {
+			tprintf("microSD file create error\r\n");
+			return;
+		}
+		tprintf("Continuous write to %s\r\n", &write_filename.filename[2]);
+	}
+	init_sniff_nfc(proto);
 
-	initUART1_sniff();
+	if(trace == SNIFF_TRACE_UART1)
+		initUART1_sniff();
 
-	tprintf("Starting bin raw sniffer ISO14443-A/B 106kbps\r\n");
+	if(proto == ISO15693)
+		tprintf("Starting Sniffer ISO15693 ...\r\n");
+	else if(proto == ISO14443B)
+		tprintf("Starting Sniffer ISO14443-B 106kbps ...\r\n");
+	else
+		tprintf("Starting Sniffer ISO14443-A 106kbps ...\r\n");
 	/* Wait a bit in order to display all text */
 	chThdSleepMilliseconds(50);
-#ifdef STAT_UART_WRITE
-	uart_min = 0xFFFFFFFF;
-	uart_max = 0;
-	uart_nb_loop = 0;
-#endif
 
-	bin_frame_hdr.protocol_options = 0;
-	if(start_of_frame == true)
-		bin_frame_hdr.protocol_options |= PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP;
-	if(end_of_frame == true)
-		bin_frame_hdr.protocol_options |= PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP;
-
-	bin_frame_hdr.protocol_modulation = PROTOCOL_MODULATION_14443AB_RAW_848KBPS;
+	sniff_options = options;
+	g_sbuf_idx = 0;
+	buf_limit = NB_SBUFFER;
+	if(trace == SNIFF_TRACE_USB2) {
+		sniff_usb_start();
+		g_sbuf_idx = sniff_usb_pos();
+		buf_limit = sniff_usb_limit();
+	}
+	if(out->start != NULL)
+		out->start();
 
-	/* Lock Kernel for sniffer */
-	chSysLock();
+	/* Lock Kernel for sniffer, except when a writer thread is used */
+	sniff_set_kernel_lock(trace != SNIFF_TRACE_USB2 && trace != SNIFF_TRACE_SD);
+	sniff_lock();
 
-	/* Main Loop */
 	while (TRUE) {
-		lsh_bit = 0;
-		rsh_bit = 0;
-		irq_no = 0;
-
-		while (TRUE) {
-			/* Start of Frame Loop */
-			D4_OFF;
-			old_data_bit = 0;
-			f_data = 0;
-			g_sbuf_idx = sizeof(bin_frame_hdr);
-
-			u32_data = WaitGetDMABuffer();
-			old_data_bit = (uint32_t)(u32_data&1);
-			old_u32_data = u32_data;
-
-			/* Wait until data change or K4/UBTN is pressed to stop/exit */
-			if (sniff_wait_data_change_or_exit_nolog() == TRUE) {
-#ifdef STAT_UART_WRITE
-				tprintf("\r\nuart_nb_loop=%u uart_min=%u uart_max=%u\r\n", uart_nb_loop, uart_min, uart_max);
-#endif
-				/* Wait a bit in order to display all text */
-				chThdSleepMilliseconds(50);
+		D4_OFF;
+		u32_data = WaitGetDMABuffer();
+		old_data_bit = (uint32_t)(u32_data&1);
+		old_u32_data = u32_data;
+
+		/* Wait until data change or K4/UBTN is pressed to stop/exit */
+		if (sniff_wait_data_change_or_exit_nolog() == TRUE) {
+			if(trace == SNIFF_TRACE_NONE && out->save != NULL)
+				out->save();
+			if(trace == SNIFF_TRACE_SD)
+				sniff_sd_stop();
+			if(trace == SNIFF_TRACE_USB2)
+				sniff_usb_end();
+			/* Wait a bit in order to display all text */
+			chThdSleepMilliseconds(50);
+			if(trace == SNIFF_TRACE_UART1)
 				deinitUART1_sniff();
-				return;
-			}
-			
-			/* Log All Data */
-			/* Start of Frame detected */
-			TST_ON;
-			D4_ON;
+			return;
+		}
+		D4_ON;
 
-			/* Search first edge bit position to synchronize stream */
-			/* Search an edge on each bit from MSB to LSB */
-			/* Old bit = 1 so new bit will be 0 => 11111111 10000000 => 00000000 01111111 just need to reverse it to count leading zero */
-			/* Old bit = 0 so new bit will be 1 => 00000000 01111111 no need to reverse to count leading zero */
-			lsh_bit = old_data_bit ? (~u32_data) : u32_data;
-			lsh_bit = CountLeadingZero(lsh_bit);
-			rsh_bit = 32-lsh_bit;
+		/* Search first edge bit position to synchronize stream */
+		/* Search an edge on each bit from MSB to LSB */
+		/* Old bit = 1 so new bit will be 0 => 11111111 10000000 => 00000000 01111111 just need to reverse it to count leading zero */
+		/* Old bit = 0 so new bit will be 1 => 00000000 01111111 no need to reverse to count leading zero */
+		lsh_bit = old_data_bit ? (~u32_data) : u32_data;
+		lsh_bit = CountLeadingZero(lsh_bit);
+		rsh_bit = 32-lsh_bit;
+
+		f_data = u32_data<<lsh_bit;
+		u32_data = WaitGetDMABuffer();
+		start_cycles = get_cyclecounter64();
+		f_data |= u32_data>>rsh_bit;
+
+		if(proto == ISO15693)
+			sniff_15693_start(d, f_data);
+		else if(proto == ISO14443B)
+			sniff_14443b_start(d, f_data);
+		else
+			sniff_14443a_start(d, &sniff_tables, f_data);
+
+		/* Decode Data until end of frame detected */
+		do {
+			if ( (K4_BUTTON) || (USER_BUTTON) )
+				break;
 
-			/* Shift data */
 			f_data = u32_data<<lsh_bit;
-			/* Next Data */
-			TST_OFF;
 			u32_data = WaitGetDMABuffer();
-			if(start_of_frame == true)
-				sniff_write_bin_timestamp(get_cyclecounter());
-			TST_ON;
 			f_data |= u32_data>>rsh_bit;
 
-			// DownSampling by 4 (input 32bits output 8bits filtered)
-			// In Freq of 3.39MHz => 105.9375KHz on 8bits (each bit is 848KHz so 2bits=423.75KHz)
-			ds_data  = ((downsample_4x[(f_data>>24)])<<6) |
-				   ((downsample_4x[((f_data&0x00FF0000)>>16)])<<4) |
-				   ((downsample_4x[((f_data&0x0000FF00)>>8)])<<2) |
-				   (downsample_4x[(f_data&0x000000FF)]);
-
-			/* Write 8bits raw data */
-			sniff_write_bin_8b(ds_data);
+			if(proto == ISO15693)
+				ret = sniff_15693_word(d, f_data);
+			else if(proto == ISO14443B)
+				ret = sniff_14443b_word(d, f_data);
+			else
+				ret = sniff_14443a_word(d, f_data);
+		} while (ret == SNIFF_DECODER_CONTINUE);
+		end_cycles = get_cyclecounter64();
+
+		/* Noise or lost synchronization, ISO14443A ASCII trace shows
+		 * frames without data */
+		if (d->len == 0 && (d->type != SNIFF_DECODER_14443A ||
+				    out != &sniff_output_ascii))
+			continue;
+
+		if(trace == SNIFF_TRACE_SD) {
+			if(!sniff_sd_frame_start())
+				continue;
+			buf_limit = sniff_sd_limit();
+		} else if(trace == SNIFF_TRACE_USB2) {
+			if(!sniff_usb_room(SNIFF_DECODED_FRAME_MAX))
+				continue;
+			g_sbuf_idx = sniff_usb_pos();
+			buf_limit = sniff_usb_limit();
+		}
+		out->write(d, start_cycles, end_cycles, buf_limit);
+
+		if(trace == SNIFF_TRACE_UART1) {
+			bsp_uart_write_u8(BSP_DEV_UART1, &g_sbuf[0], g_sbuf_idx);
+			g_sbuf_idx = 0;
+		} else if(trace == SNIFF_TRACE_USB2) {
+			sniff_usb_frame_end(g_sbuf_idx);
+			g_sbuf_idx = sniff_usb_pos();
+			buf_limit = sniff_usb_limit();
+		}
+	}
+}
 
-			/* Decode Data until end of frame detected */
-			old_u32_data = f_data;
-			old_data_counter = 0;
-			while (1) {
-				if ( (K4_BUTTON) || (USER_BUTTON) ) {
-					if(end_of_frame == true)
-						sniff_write_bin_timestamp(get_cyclecounter());
-					break;
-				}
+void hydranfc_sniff_14443A(t_hydra_console *con, bool start_of_frame, bool end_of_frame, sniff_trace_t trace)
+{
+	uint8_t options = 0;
 
-				/* New Word */
-				f_data = u32_data<<lsh_bit;
+	(void)con;
 
-				/* Next Data */
-				TST_OFF;
-				u32_data = WaitGetDMABuffer();
-				TST_ON;
+	tprintf("sniff_14443A start\r\n");
+	if(start_of_frame == true)
+		options |= PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP;
+	if(end_of_frame == true)
+		options |= PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP;
+	sniff_decoded(ISO14443A, &sniff_output_ascii, options, trace);
+}
 
-				f_data |= u32_data>>rsh_bit;
+void hydranfc_sniff_14443A_bin(t_hydra_console *con, bool start_of_frame, bool end_of_frame, bool parity, sniff_trace_t trace)
+{
+	uint8_t options = 0;
 
-				/* In New Data 32bits */
-				if (u32_data != old_u32_data) {
-					old_u32_data = u32_data;
-					old_data_counter = 0;
-				} else {
-					old_u32_data = u32_data;
-					/* No new data */
-					if ( (u32_data==0xFFFFFFFF) || (u32_data==0x00000000) ) {
-						old_data_counter++;
-						if (old_data_counter>1) {
-							/* No new data => End Of Frame detected => Wait new data & synchro */
-							if(end_of_frame == true)
-								sniff_write_bin_timestamp(get_cyclecounter());
-							break;
-						}
-					} else {
-						old_data_counter = 0;
-					}
-				}
+	(void)con;
 
-				// DownSampling by 4 (input 32bits output 8bits filtered)
-				// In Freq of 3.39MHz => 105.9375KHz on 8bits (each bit is 848KHz so 2bits=423.75KHz)
-				ds_data  = ((downsample_4x[(f_data>>24)])<<6) |
-					   ((downsample_4x[((f_data&0x00FF0000)>>16)])<<4) |
-					   ((downsample_4x[((f_data&0x0000FF00)>>8)])<<2) |
-					   (downsample_4x[(f_data&0x000000FF)]);
+	tprintf("sniff_14443A_bin start\r\n");
+	if(start_of_frame == true)
+		options |= PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP;
+	if(end_of_frame == true)
+		options |= PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP;
+	if(parity == true)
+		options |= PROTOCOL_OPTIONS_PARITY;
+	sniff_decoded(ISO14443A, &sniff_output_bin, options, trace);
+}
 
-				/* Write 8bits raw data */
-				sniff_write_bin_8b(ds_data);
+/* Sniffer ISO14443-A 106kbps, decoded frames are stored in PCAPNG format in
+ * g_sbuf and written to microSD (nfc_sniff_N.pcapng) when sniffer is stopped
+ */
+void hydranfc_sniff_14443A_pcapng(t_hydra_console *con)
+{
+	(void)con;
 
-				/* For safety to avoid potential buffer overflow ... */
-				if (g_sbuf_idx >= NB_SBUFFER) {
-					g_sbuf_idx = NB_SBUFFER;
-				}
-			}
-			/* End of Frame detected */
-#ifdef STAT_UART_WRITE
-			{
-				uint32_t ticks;
-				ticks = get_cyclecounter();
-#endif
-				bin_frame_hdr.data_size = g_sbuf_idx;
-				memcpy(&g_sbuf[0], (uint8_t*)&bin_frame_hdr, sizeof(bin_frame_hdr));
-				bsp_uart_write_u8(BSP_DEV_UART1, &g_sbuf[0], g_sbuf_idx);
-#ifdef STAT_UART_WRITE
-				ticks = (get_cyclecounter() - ticks);
-				uart_nb_loop++;
+	tprintf("sniff_14443A_pcapng start\r\n");
+	sniff_decoded(ISO14443A, &sniff_output_pcapng, 0, SNIFF_TRACE_NONE);
+}
 
-				if(ticks < uart_min)
-					uart_min = ticks;
+void hydranfc_sniff_14443B(t_hydra_console *con, bool frame_time, bool bin, sniff_trace_t trace)
+{
+	(void)con;
 
-				if(ticks > uart_max)
-					uart_max = ticks;
-			}
-#endif
-			TST_OFF;
-		}
-	} // Main While Loop
+	tprintf("sniff_14443B start\r\n");
+	sniff_decoded(ISO14443B, bin ? &sniff_output_bin : &sniff_output_ascii,
+		      frame_time ? (PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP |
+				    PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP) : 0, trace);
 }
 
+void hydranfc_sniff_15693(t_hydra_console *con, bool frame_time, bool bin, sniff_trace_t trace)
+{
+	(void)con;
+
+	tprintf("sniff_15693 start\r\n");
+	sniff_decoded(ISO15693, bin ? &sniff_output_bin : &sniff_output_ascii,
+		      frame_time ? (PROTOCOL_OPTIONS_START_OF_FRAME_TIMESTAMP |
+				    PROTOCOL_OPTIONS_END_OF_FRAME_TIMESTAMP) : 0, trace);
+}
@@ -0,0 +1,566 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2014-2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "hydranfc_cmd_sniff_iso14443.h"
+#include "hydranfc_cmd_sniff_downsampling.h"
+#include "hydranfc_cmd_sniff_decoder.h"
+
+/*
+ * Sample clock is fc/4, so subcarriers are locked to it:
+ * 847.5kHz (ISO14443B) = 4 samples per cycle, 16 edges per word,
+ * 423.75kHz (ISO15693) = 8 samples per cycle, 8 edges per word.
+ */
+#define SUBC_EDGES_MIN_14443B (8)
+#define SUBC_EDGES_MIN_15693 (4)
+
+/* ISO14443B timings in etu (words) */
+#define B_TR1_MAX (32)
+#define B_SOF_LOW_MIN (9) /* 10 to 11 etu, first one is in start word */
+#define B_SOF_LOW_MAX (12)
+#define B_SOF_HIGH_MIN (2) /* 2 to 3 etu */
+#define B_SOF_HIGH_MAX (4)
+#define B_EGT_MAX (6)
+
+/* ISO15693 VICC SOF: 24 subcarrier cycles (6 words) then logic 1 */
+#define V_SOF_SUB_MIN (4)
+#define V_SOF_SUB_MAX (8)
+
+#define NO_PAUSE (0xFF)
+
+/*
+ * ISO14443A start bit not recognized, Miller Modified is supposed:
+ * 2 to 3.1us at level 0 are not seen => 7 to 11 samples, average 9 samples
+ * + 6 samples (margin), so words are resynchronized by 15 samples.
+ */
+#define A_MILLER_RESYNC (15)
+
+enum {
+	B_TR1,
+	B_SOF_LOW,
+	B_SOF_HIGH,
+	B_DATA,
+	B_STOP,
+	B_EGT,
+};
+
+enum {
+	V_PCD_SOF,
+	V_PCD_SYMBOL,
+	V_VICC_SOF_SUB,
+	V_VICC_SOF_ONE,
+	V_VICC_BIT,
+};
+
+static uint32_t popcount32(uint32_t v)
+{
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+/* Number of level changes between samples of word */
+static uint32_t edges32(uint32_t w)
+{
+	return popcount32((w ^ (w << 1)) & 0xFFFFFFFE);
+}
+
+/* Field level (majority of samples) */
+static uint32_t level32(uint32_t w)
+{
+	return popcount32(w) >= 16;
+}
+
+static uint32_t clz32(uint32_t v)
+{
+	uint32_t n = 0;
+
+	if (v == 0)
+		return 32;
+	while (!(v & 0x80000000)) {
+		v <<= 1;
+		n++;
+	}
+	return n;
+}
+
+static void decoder_init(sniff_decoder_t *d, uint32_t type, uint32_t dir, uint32_t state)
+{
+	d->type = type;
+	d->state = state;
+	d->count = 0;
+	d->data = 0;
+	d->nb_bits = 0;
+	d->ref = 0;
+	d->prev = 0;
+	d->shift = 0;
+	d->pause = NO_PAUSE;
+	d->half[0] = 0;
+	d->half[1] = 0;
+	d->dir = dir;
+	d->eof = 0;
+	d->last_bits = 8;
+	d->start_ds = 0;
+	d->parity_err = 0;
+	memset(d->parity, 0, sizeof(d->parity));
+	d->len = 0;
+}
+
+static void decoder_put_byte(sniff_decoder_t *d, uint32_t data)
+{
+	if (d->len < SNIFF_DECODER_FRAME_MAX)
+		d->frame[d->len++] = data;
+}
+
+/* LSB first */
+static void decoder_put_bit(sniff_decoder_t *d, uint32_t bit)
+{
+	d->data |= bit << d->nb_bits;
+	if (++d->nb_bits == 8) {
+		decoder_put_byte(d, d->data);
+		d->data = 0;
+		d->nb_bits = 0;
+	}
+}
+
+/** \brief Build ISO14443A lookup tables.
+ *
+ * \param t sniff_14443a_tables_t*: tables to build.
+ * \return void
+ *
+ */
+void sniff_14443a_tables_init(sniff_14443a_tables_t *t)
+{
+	uint32_t v;
+	u08_t ds;
+
+	/* Entry v/2 holds results of 16 bits values v (low nibble) and v+1 */
+	for (v = 0; v < 65536; v++) {
+		ds = (downsample_4x[v >> 8] << 2) | downsample_4x[v & 0xFF];
+		if (v & 1)
+			t->ds16[v >> 1] |= ds << 4;
+		else
+			t->ds16[v >> 1] = ds;
+	}
+	memcpy(t->decode, sniff_14443a_decode, sizeof(t->decode));
+}
+
+/** \brief Start decoding an ISO14443A 106kbps frame.
+ * Direction is found from start bit: Miller Modified (PCD) or Manchester
+ * (PICC). When start bit is not recognized, frame is decoded as Miller
+ * Modified (state is 0), it is a PCD frame if previous frame decoded
+ * with d was a PICC frame (state is MILLER_MODIFIED_106KHZ).
+ *
+ * \param d sniff_decoder_t*: decoder state.
+ * \param t sniff_14443a_tables_t*: lookup tables.
+ * \param word uint32_t: first word of frame (start bit).
+ * \return void
+ *
+ */
+void sniff_14443a_start(sniff_decoder_t *d, const sniff_14443a_tables_t *t, uint32_t word)
+{
+	uint32_t proto, prev_picc;
+	u08_t ds;
+
+	prev_picc = (d->type == SNIFF_DECODER_14443A && d->dir == SNIFF_DECODER_DIR_PICC);
+	ds = sniff_downsample_32b(t, word);
+	proto = t->decode[ds] >> SNIFF_14443A_PROTOCOL_SHIFT;
+	if (proto == MANCHESTER_106KHZ) {
+		decoder_init(d, SNIFF_DECODER_14443A, SNIFF_DECODER_DIR_PICC, proto);
+		d->ref = SNIFF_14443A_MANCHESTER_BIT;
+	} else {
+		decoder_init(d, SNIFF_DECODER_14443A, SNIFF_DECODER_DIR_PCD, proto);
+		d->ref = SNIFF_14443A_MILLER_BIT;
+		if (proto != MILLER_MODIFIED_106KHZ) {
+			d->state = prev_picc ? MILLER_MODIFIED_106KHZ : 0;
+			d->shift = A_MILLER_RESYNC;
+		}
+	}
+	d->tables = t;
+	d->start_ds = ds;
+	d->prev = word;
+}
+
+/** \brief Decode next word (one half bit) of an ISO14443A frame.
+ * Each byte is 8 data bits (LSB first) then odd parity bit, end of frame
+ * is seen after 2 unchanged words without edge and incomplete last byte
+ * is kept if it has at least 4 bits.
+ *
+ * \param d sniff_decoder_t*: decoder state.
+ * \param word uint32_t: next word.
+ * \return uint32_t: SNIFF_DECODER_CONTINUE or SNIFF_DECODER_END.
+ *
+ */
+uint32_t sniff_14443a_word(sniff_decoder_t *d, uint32_t word)
+{
+	uint32_t bit;
+	u08_t ds;
+
+	if (word == d->prev && (word == 0x00000000 || word == 0xFFFFFFFF)) {
+		if (++d->count > 1) {
+			if (d->nb_bits > 3 && d->len < SNIFF_DECODER_FRAME_MAX) {
+				d->frame[d->len++] = d->data;
+				d->last_bits = d->nb_bits;
+			}
+			return SNIFF_DECODER_END;
+		}
+	} else {
+		d->count = 0;
+	}
+	d->prev = word;
+
+	if (d->shift)
+		word = (word >> d->shift) | (0xFFFFFFFF << (32 - d->shift));
+	ds = sniff_downsample_32b(d->tables, word);
+	bit = (d->tables->decode[ds] >> d->ref) & 1;
+
+	if (d->nb_bits < 8) {
+		d->data |= bit << d->nb_bits;
+		d->nb_bits++;
+		return SNIFF_DECODER_CONTINUE;
+	}
+
+	/* Odd parity: number of 1 in data and parity bit is odd */
+	d->parity_err |= !((popcount32(d->data) + bit) & 1);
+	if (d->len < SNIFF_DECODER_FRAME_MAX) {
+		d->parity[d->len / 32] |= bit << (d->len % 32);
+		d->frame[d->len++] = d->data;
+	}
+	d->data = 0;
+	d->nb_bits = 0;
+	return SNIFF_DECODER_CONTINUE;
+}
+
+/*
+ * ISO14443B character framing, same for both directions:
+ * SOF (10-11 etu of 0, 2-3 etu of 1), characters (start bit 0,
+ * 8 data bits LSB first, stop bit 1, EGT of 1) and EOF (10-11 etu of 0).
+ */
+static uint32_t sniff_14443b_bit(sniff_decoder_t *d, uint32_t bit)
+{
+	switch (d->state) {
+	case B_SOF_LOW:
+		if (!bit) {
+			if (++d->count > B_SOF_LOW_MAX)
+				return SNIFF_DECODER_END;
+		} else {
+			if (d->count < B_SOF_LOW_MIN)
+				return SNIFF_DECODER_END;
+			d->state = B_SOF_HIGH;
+			d->count = 1;
+		}
+		break;
+
+	case B_SOF_HIGH:
+		if (bit) {
+			if (++d->count > B_SOF_HIGH_MAX)
+				return SNIFF_DECODER_END;
+		} else {
+			if (d->count < B_SOF_HIGH_MIN)
+				return SNIFF_DECODER_END;
+			/* Start bit of first character */
+			d->state = B_DATA;
+			d->data = 0;
+			d->nb_bits = 0;
+		}
+		break;
+
+	case B_DATA:
+		d->data |= bit << d->nb_bits;
+		if (++d->nb_bits == 8)
+			d->state = B_STOP;
+		break;
+
+	case B_STOP:
+		if (!bit) {
+			/* EOF is seen as a 0x00 character without stop bit */
+			d->eof = (d->data == 0);
+			return SNIFF_DECODER_END;
+		}
+		decoder_put_byte(d, d->data);
+		d->state = B_EGT;
+		d->count = 0;
+		break;
+
+	case B_EGT:
+		if (bit) {
+			if (++d->count > B_EGT_MAX)
+				return SNIFF_DECODER_END;
+		} else {
+			d->state = B_DATA;
+			d->data = 0;
+			d->nb_bits = 0;
+		}
+		break;
+
+	default:
+		return SNIFF_DECODER_END;
+	}
+
+	return SNIFF_DECODER_CONTINUE;
+}
+
+/* Word starting shift samples after start of previous word */
+static uint32_t b_aligned(const sniff_decoder_t *d, uint32_t word, uint32_t shift)
+{
+	if (shift)
+		return (d->prev << shift) | (word >> (32 - shift));
+	return d->prev;
+}
+
+/*
+ * PCD NRZ-L bit per word, words are one word late (aligned with prev).
+ * SOF high and EGT durations are not a multiple of etu, so words are
+ * realigned on falling edge of each start bit (as PICC words are aligned
+ * on SOF phase reversal). Samples at 1 before the edge are a bit when they
+ * are the majority of an etu.
+ */
+static uint32_t sniff_14443b_pcd_word(sniff_decoder_t *d, uint32_t word)
+{
+	uint32_t aligned, edge;
+
+	aligned = b_aligned(d, word, d->shift);
+	if ((d->state == B_SOF_HIGH || d->state == B_EGT) && aligned != 0xFFFFFFFF) {
+		edge = clz32(~aligned);
+		if (edge >= 16 && sniff_14443b_bit(d, 1) == SNIFF_DECODER_END)
+			return SNIFF_DECODER_END;
+		d->shift += edge;
+		if (d->shift >= 32) {
+			/* Start bit ends in next word */
+			d->shift -= 32;
+			d->prev = word;
+			return SNIFF_DECODER_CONTINUE;
+		}
+		aligned = b_aligned(d, word, d->shift);
+	}
+	d->prev = word;
+
+	return sniff_14443b_bit(d, level32(aligned));
+}
+
+/** \brief Start decoding an ISO14443B frame.
+ * Direction is found from first word: PCD frame starts with SOF low
+ * level (NRZ-L), PICC frame with unmodulated BPSK subcarrier (TR1).
+ *
+ * \param d sniff_decoder_t*: decoder state.
+ * \param word uint32_t: first word of frame.
+ * \return void
+ *
+ */
+void sniff_14443b_start(sniff_decoder_t *d, uint32_t word)
+{
+	if (edges32(word) >= SUBC_EDGES_MIN_14443B) {
+		decoder_init(d, SNIFF_DECODER_14443B, SNIFF_DECODER_DIR_PICC, B_TR1);
+		d->ref = word;
+		d->count = 1;
+	} else {
+		/* First word is decoded by sniff_14443b_word() (one word late) */
+		decoder_init(d, SNIFF_DECODER_14443B, SNIFF_DECODER_DIR_PCD, B_SOF_LOW);
+		d->prev = word;
+	}
+}
+
+/** \brief Decode next word of an ISO14443B frame.
+ *
+ * \param d sniff_decoder_t*: decoder state.
+ * \param word uint32_t: next word.
+ * \return uint32_t: SNIFF_DECODER_CONTINUE or SNIFF_DECODER_END.
+ *
+ */
+uint32_t sniff_14443b_word(sniff_decoder_t *d, uint32_t word)
+{
+	uint32_t diff, aligned, ret;
+
+	if (d->dir == SNIFF_DECODER_DIR_PCD)
+		return sniff_14443b_pcd_word(d, word);
+
+	if (d->state == B_TR1) {
+		if (edges32(word) < SUBC_EDGES_MIN_14443B)
+			return SNIFF_DECODER_END;
+		diff = word ^ d->ref;
+		if (popcount32(diff) < 8) {
+			if (++d->count > B_TR1_MAX)
+				return SNIFF_DECODER_END;
+			return SNIFF_DECODER_CONTINUE;
+		}
+		/*
+		 * First phase reversal is start of SOF, next words are
+		 * realigned on it and compared with realigned reference.
+		 */
+		d->shift = clz32(diff);
+		if (d->shift)
+			d->ref = (d->ref << d->shift) | (d->ref >> (32 - d->shift));
+		d->prev = word;
+		d->state = B_SOF_LOW;
+		d->count = 0;
+		return SNIFF_DECODER_CONTINUE;
+	}
+
+	aligned = b_aligned(d, word, d->shift);
+	d->prev = word;
+
+	ret = sniff_14443b_bit(d, popcount32(aligned ^ d->ref) < 16);
+	/* PICC frame ends when subcarrier stops (last bit ends in this word) */
+	if (edges32(word) < SUBC_EDGES_MIN_14443B)
+		return SNIFF_DECODER_END;
+	return ret;
+}
+
+/** \brief Start decoding an ISO15693 frame.
+ * Direction is found from first word: VCD frame starts with a pause
+ * (1 out of 4 SOF), VICC frame with 423.75kHz subcarrier (SOF).
+ *
+ * \param d sniff_decoder_t*: decoder state.
+ * \param word uint32_t: first word of frame.
+ * \return void
+ *
+ */
+void sniff_15693_start(sniff_decoder_t *d, uint32_t word)
+{
+	if (edges32(word) >= SUBC_EDGES_MIN_15693)
+		decoder_init(d, SNIFF_DECODER_15693, SNIFF_DECODER_DIR_PICC, V_VICC_SOF_SUB);
+	else
+		decoder_init(d, SNIFF_DECODER_15693, SNIFF_DECODER_DIR_PCD, V_PCD_SOF);
+	d->count = 1;
+}
+
+/*
+ * VCD 1 out of 4: one word per 9.44us period, SOF has pauses in periods
+ * 0 and 5, then each symbol is 8 periods with a pause in period 2*v+1
+ * for bits value v (LSB first).
+ * EOF is a symbol with pause in period 1, end of frame is seen on first
+ * symbol without pause and partial byte (EOF) is dropped.
+ */
+static uint32_t sniff_15693_pcd_word(sniff_decoder_t *d, uint32_t word)
+{
+	uint32_t pause;
+
+	pause = !level32(word);
+
+	switch (d->state) {
+	case V_PCD_SOF:
+		if (pause != (d->count == 5))
+			return SNIFF_DECODER_END;
+		if (++d->count == 8) {
+			d->state = V_PCD_SYMBOL;
+			d->count = 0;
+			d->pause = NO_PAUSE;
+		}
+		break;
+
+	case V_PCD_SYMBOL:
+		if (pause) {
+			if (d->pause != NO_PAUSE || (d->count & 1) == 0)
+				return SNIFF_DECODER_END;
+			d->pause = d->count;
+		}
+		if (++d->count == 8) {
+			if (d->pause == NO_PAUSE) {
+				d->eof = (d->nb_bits == 2 && d->data == 0);
+				return SNIFF_DECODER_END;
+			}
+			decoder_put_bit(d, (d->pause >> 1) & 1);
+			decoder_put_bit(d, d->pause >> 2);
+			d->count = 0;
+			d->pause = NO_PAUSE;
+		}
+		break;
+
+	default:
+		return SNIFF_DECODER_END;
+	}
+
+	return SNIFF_DECODER_CONTINUE;
+}
+
+/*
+ * VICC Manchester (high data rate, one subcarrier): 4 words per bit,
+ * logic 0 is subcarrier then unmodulated, logic 1 is unmodulated then
+ * subcarrier.
+ * EOF is logic 0 followed by subcarrier, end of frame is also seen on
+ * a bit without subcarrier.
+ */
+static uint32_t sniff_15693_vicc_word(sniff_decoder_t *d, uint32_t word)
+{
+	uint32_t sub;
+
+	sub = edges32(word) >= SUBC_EDGES_MIN_15693;
+
+	switch (d->state) {
+	case V_VICC_SOF_SUB:
+		if (sub) {
+			if (++d->count > V_SOF_SUB_MAX)
+				return SNIFF_DECODER_END;
+		} else {
+			if (d->count < V_SOF_SUB_MIN)
+				return SNIFF_DECODER_END;
+			/* First unmodulated word of SOF logic 1 */
+			d->state = V_VICC_SOF_ONE;
+			d->count = 1;
+		}
+		break;
+
+	case V_VICC_SOF_ONE:
+		if (++d->count == 4) {
+			d->state = V_VICC_BIT;
+			d->count = 0;
+			d->half[0] = 0;
+			d->half[1] = 0;
+		}
+		break;
+
+	case V_VICC_BIT:
+		if (sub)
+			d->half[d->count >> 1]++;
+		if (++d->count == 4) {
+			if (d->half[0] && !d->half[1]) {
+				decoder_put_bit(d, 0);
+			} else if (!d->half[0] && d->half[1]) {
+				decoder_put_bit(d, 1);
+			} else {
+				d->eof = (d->half[0] && d->half[1] &&
+					  d->nb_bits == 1 && d->data == 0);
+				return SNIFF_DECODER_END;
+			}
+			d->count = 0;
+			d->half[0] = 0;
+			d->half[1] = 0;
+		}
+		break;
+
+	default:
+		return SNIFF_DECODER_END;
+	}
+
+	return SNIFF_DECODER_CONTINUE;
+}
+
+/** \brief Decode next word of an ISO15693 frame.
+ *
+ * \param d sniff_decoder_t*: decoder state.
+ * \param word uint32_t: next word.
+ * \return uint32_t: SNIFF_DECODER_CONTINUE or SNIFF_DECODER_END.
+ *
+ */
+uint32_t sniff_15693_word(sniff_decoder_t *d, uint32_t word)
+{
+	if (d->dir == SNIFF_DECODER_DIR_PCD)
+		return sniff_15693_pcd_word(d, word);
+	return sniff_15693_vicc_word(d, word);
+}
@@ -0,0 +1,106 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2014-2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRANFC_CMD_SNIFF_DECODER_H_
+#define _HYDRANFC_CMD_SNIFF_DECODER_H_
+
+#include <stdint.h>
+
+#include "hydranfc_cmd_sniff_fused.h"
+
+/*
+ * ISO14443A, ISO14443B and ISO15693 frame decoders.
+ * Input words are 32 samples of TRF7970A subcarrier output @3.39MHz
+ * (MSB first), so one word lasts 9.44us (1 etu @106kbps), aligned on
+ * the first edge of the frame.
+ * No dependency on ChibiOS, can be built on host.
+ */
+
+#define SNIFF_DECODER_FRAME_MAX (256) /* Longer frames are truncated */
+
+/* Frame type */
+#define SNIFF_DECODER_14443A (0)
+#define SNIFF_DECODER_14443B (1)
+#define SNIFF_DECODER_15693 (2)
+
+/* Frame direction */
+#define SNIFF_DECODER_DIR_PCD (0) /* Reader to card */
+#define SNIFF_DECODER_DIR_PICC (1) /* Card to reader */
+
+/* sniff_xxx_word() return value */
+#define SNIFF_DECODER_CONTINUE (0)
+#define SNIFF_DECODER_END (1) /* End of frame (EOF, no signal or coding error) */
+
+/* ISO14443A lookup tables, see sniff_14443a_tables_init() */
+typedef struct {
+	u08_t ds16[SNIFF_DS16_SIZE]; /* Downsampling by 4 of 16 samples */
+	u08_t decode[256]; /* sniff_14443a_decode[] */
+} sniff_14443a_tables_t;
+
+typedef struct {
+	uint32_t type; /* SNIFF_DECODER_xxx */
+	uint32_t state;
+	uint32_t count; /* Words/bits in current state */
+	uint32_t data; /* Byte being decoded */
+	uint32_t nb_bits; /* Bits in data */
+	uint32_t ref; /* BPSK subcarrier phase of logic 1, ISO14443A decode bit */
+	uint32_t prev; /* Previous word, for ISO14443B realignment */
+	uint32_t shift; /* ISO14443B realignment, ISO14443A Miller resync (in samples) */
+	uint32_t pause; /* ISO15693 1 out of 4 pause position */
+	uint32_t half[2]; /* ISO15693 Manchester subcarrier words per half bit */
+	uint32_t dir; /* SNIFF_DECODER_DIR_xxx */
+	uint32_t eof; /* Frame ended by a valid EOF */
+	uint32_t last_bits; /* Bits of last byte (8 if complete) */
+	uint32_t start_ds; /* ISO14443A downsampled start bit */
+	uint32_t parity_err; /* ISO14443A byte with wrong odd parity */
+	uint32_t parity[SNIFF_DECODER_FRAME_MAX / 32]; /* ISO14443A parity bits */
+	const sniff_14443a_tables_t *tables;
+	uint32_t len;
+	uint8_t frame[SNIFF_DECODER_FRAME_MAX];
+} sniff_decoder_t;
+
+/* Downsampling by 4 of 16 samples (4 bits result), 1 lookup */
+static inline uint8_t sniff_downsample_16b(const sniff_14443a_tables_t *t, uint32_t data)
+{
+	return (t->ds16[data >> 1] >> ((data & 1) << 2)) & 0x0F;
+}
+
+/* Downsampling by 4 of 32 samples (8 bits result, 1 bit per 4 samples) */
+static inline uint8_t sniff_downsample_32b(const sniff_14443a_tables_t *t, uint32_t data)
+{
+	return (sniff_downsample_16b(t, data >> 16) << 4) |
+	       sniff_downsample_16b(t, data & 0xFFFF);
+}
+
+/* ISO14443A parity bit of byte i of frame */
+static inline uint32_t sniff_decoder_parity(const sniff_decoder_t *d, uint32_t i)
+{
+	return (d->parity[i / 32] >> (i % 32)) & 1;
+}
+
+void sniff_14443a_tables_init(sniff_14443a_tables_t *t);
+void sniff_14443a_start(sniff_decoder_t *d, const sniff_14443a_tables_t *t, uint32_t word);
+uint32_t sniff_14443a_word(sniff_decoder_t *d, uint32_t word);
+
+void sniff_14443b_start(sniff_decoder_t *d, uint32_t word);
+uint32_t sniff_14443b_word(sniff_decoder_t *d, uint32_t word);
+
+void sniff_15693_start(sniff_decoder_t *d, uint32_t word);
+uint32_t sniff_15693_word(sniff_decoder_t *d, uint32_t word);
+
+#endif /* _HYDRANFC_CMD_SNIFF_DECODER_H_ */
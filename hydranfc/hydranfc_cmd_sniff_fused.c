@@ -0,0 +1,299 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2014-2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Generated by scripts/gen_sniff_14443a_tables.py, do not edit */
+
+#include "hydranfc_cmd_sniff_fused.h"
+
+/* detected_protocol[] << SNIFF_14443A_PROTOCOL_SHIFT |
+ * manchester_106kb[] << SNIFF_14443A_MANCHESTER_BIT |
+ * miller_modified_106kb[] << SNIFF_14443A_MILLER_BIT
+ */
+const u08_t sniff_14443a_decode[256] = {
+	0x00, /* v0 0000 0000 */
+	0x00, /* v1 0000 0001 */
+	0x00, /* v2 0000 0010 */
+	0x00, /* v3 0000 0011 */
+	0x00, /* v4 0000 0100 */
+	0x00, /* v5 0000 0101 */
+	0x00, /* v6 0000 0110 */
+	0x00, /* v7 0000 0111 */
+	0x00, /* v8 0000 1000 */
+	0x00, /* v9 0000 1001 */
+	0x00, /* v10 0000 1010 */
+	0x00, /* v11 0000 1011 */
+	0x00, /* v12 0000 1100 */
+	0x00, /* v13 0000 1101 */
+	0x00, /* v14 0000 1110 */
+	0x00, /* v15 0000 1111 */
+
+	0x00, /* v16 0001 0000 */
+	0x00, /* v17 0001 0001 */
+	0x00, /* v18 0001 0010 */
+	0x00, /* v19 0001 0011 */
+	0x00, /* v20 0001 0100 */
+	0x00, /* v21 0001 0101 */
+	0x00, /* v22 0001 0110 */
+	0x00, /* v23 0001 0111 */
+	0x00, /* v24 0001 1000 */
+	0x00, /* v25 0001 1001 */
+	0x00, /* v26 0001 1010 */
+	0x00, /* v27 0001 1011 */
+	0x00, /* v28 0001 1100 */
+	0x00, /* v29 0001 1101 */
+	0x00, /* v30 0001 1110 */
+	0x04, /* v31 0001 1111 */
+
+	0x00, /* v32 0010 0000 */
+	0x00, /* v33 0010 0001 */
+	0x00, /* v34 0010 0010 */
+	0x00, /* v35 0010 0011 */
+	0x00, /* v36 0010 0100 */
+	0x00, /* v37 0010 0101 */
+	0x00, /* v38 0010 0110 */
+	0x00, /* v39 0010 0111 */
+	0x00, /* v40 0010 1000 */
+	0x00, /* v41 0010 1001 */
+	0x00, /* v42 0010 1010 */
+	0x00, /* v43 0010 1011 */
+	0x00, /* v44 0010 1100 */
+	0x00, /* v45 0010 1101 */
+	0x00, /* v46 0010 1110 */
+	0x00, /* v47 0010 1111 */
+
+	0x00, /* v48 0011 0000 */
+	0x00, /* v49 0011 0001 */
+	0x00, /* v50 0011 0010 */
+	0x00, /* v51 0011 0011 */
+	0x00, /* v52 0011 0100 */
+	0x00, /* v53 0011 0101 */
+	0x00, /* v54 0011 0110 */
+	0x00, /* v55 0011 0111 */
+	0x00, /* v56 0011 1000 */
+	0x00, /* v57 0011 1001 */
+	0x00, /* v58 0011 1010 */
+	0x00, /* v59 0011 1011 */
+	0x00, /* v60 0011 1100 */
+	0x00, /* v61 0011 1101 */
+	0x00, /* v62 0011 1110 */
+	0x04, /* v63 0011 1111 */
+
+	0x00, /* v64 0100 0000 */
+	0x00, /* v65 0100 0001 */
+	0x00, /* v66 0100 0010 */
+	0x00, /* v67 0100 0011 */
+	0x00, /* v68 0100 0100 */
+	0x00, /* v69 0100 0101 */
+	0x00, /* v70 0100 0110 */
+	0x00, /* v71 0100 0111 */
+	0x00, /* v72 0100 1000 */
+	0x00, /* v73 0100 1001 */
+	0x00, /* v74 0100 1010 */
+	0x00, /* v75 0100 1011 */
+	0x00, /* v76 0100 1100 */
+	0x00, /* v77 0100 1101 */
+	0x00, /* v78 0100 1110 */
+	0x00, /* v79 0100 1111 */
+
+	0x08, /* v80 0101 0000 */
+	0x00, /* v81 0101 0001 */
+	0x00, /* v82 0101 0010 */
+	0x00, /* v83 0101 0011 */
+	0x00, /* v84 0101 0100 */
+	0x00, /* v85 0101 0101 */
+	0x00, /* v86 0101 0110 */
+	0x00, /* v87 0101 0111 */
+	0x00, /* v88 0101 1000 */
+	0x00, /* v89 0101 1001 */
+	0x00, /* v90 0101 1010 */
+	0x00, /* v91 0101 1011 */
+	0x00, /* v92 0101 1100 */
+	0x00, /* v93 0101 1101 */
+	0x00, /* v94 0101 1110 */
+	0x00, /* v95 0101 1111 */
+
+	0x00, /* v96 0110 0000 */
+	0x00, /* v97 0110 0001 */
+	0x00, /* v98 0110 0010 */
+	0x00, /* v99 0110 0011 */
+	0x00, /* v100 0110 0100 */
+	0x00, /* v101 0110 0101 */
+	0x00, /* v102 0110 0110 */
+	0x00, /* v103 0110 0111 */
+	0x00, /* v104 0110 1000 */
+	0x00, /* v105 0110 1001 */
+	0x00, /* v106 0110 1010 */
+	0x00, /* v107 0110 1011 */
+	0x00, /* v108 0110 1100 */
+	0x00, /* v109 0110 1101 */
+	0x00, /* v110 0110 1110 */
+	0x00, /* v111 0110 1111 */
+
+	0x08, /* v112 0111 0000 */
+	0x00, /* v113 0111 0001 */
+	0x00, /* v114 0111 0010 */
+	0x00, /* v115 0111 0011 */
+	0x00, /* v116 0111 0100 */
+	0x00, /* v117 0111 0101 */
+	0x00, /* v118 0111 0110 */
+	0x00, /* v119 0111 0111 */
+	0x00, /* v120 0111 1000 */
+	0x00, /* v121 0111 1001 */
+	0x00, /* v122 0111 1010 */
+	0x00, /* v123 0111 1011 */
+	0x00, /* v124 0111 1100 */
+	0x00, /* v125 0111 1101 */
+	0x00, /* v126 0111 1110 */
+	0x00, /* v127 0111 1111 */
+
+	0x00, /* v128 1000 0000 */
+	0x00, /* v129 1000 0001 */
+	0x00, /* v130 1000 0010 */
+	0x00, /* v131 1000 0011 */
+	0x00, /* v132 1000 0100 */
+	0x00, /* v133 1000 0101 */
+	0x00, /* v134 1000 0110 */
+	0x00, /* v135 1000 0111 */
+	0x00, /* v136 1000 1000 */
+	0x00, /* v137 1000 1001 */
+	0x00, /* v138 1000 1010 */
+	0x00, /* v139 1000 1011 */
+	0x00, /* v140 1000 1100 */
+	0x00, /* v141 1000 1101 */
+	0x00, /* v142 1000 1110 */
+	0x00, /* v143 1000 1111 */
+
+	0x00, /* v144 1001 0000 */
+	0x00, /* v145 1001 0001 */
+	0x00, /* v146 1001 0010 */
+	0x00, /* v147 1001 0011 */
+	0x00, /* v148 1001 0100 */
+	0x00, /* v149 1001 0101 */
+	0x00, /* v150 1001 0110 */
+	0x00, /* v151 1001 0111 */
+	0x00, /* v152 1001 1000 */
+	0x00, /* v153 1001 1001 */
+	0x00, /* v154 1001 1010 */
+	0x00, /* v155 1001 1011 */
+	0x00, /* v156 1001 1100 */
+	0x00, /* v157 1001 1101 */
+	0x00, /* v158 1001 1110 */
+	0x04, /* v159 1001 1111 */
+
+	0x0A, /* v160 1010 0000 */
+	0x0A, /* v161 1010 0001 */
+	0x00, /* v162 1010 0010 */
+	0x00, /* v163 1010 0011 */
+	0x00, /* v164 1010 0100 */
+	0x00, /* v165 1010 0101 */
+	0x00, /* v166 1010 0110 */
+	0x00, /* v167 1010 0111 */
+	0x00, /* v168 1010 1000 */
+	0x00, /* v169 1010 1001 */
+	0x00, /* v170 1010 1010 */
+	0x00, /* v171 1010 1011 */
+	0x00, /* v172 1010 1100 */
+	0x00, /* v173 1010 1101 */
+	0x00, /* v174 1010 1110 */
+	0x00, /* v175 1010 1111 */
+
+	0x0A, /* v176 1011 0000 */
+	0x02, /* v177 1011 0001 */
+	0x00, /* v178 1011 0010 */
+	0x00, /* v179 1011 0011 */
+	0x00, /* v180 1011 0100 */
+	0x00, /* v181 1011 0101 */
+	0x00, /* v182 1011 0110 */
+	0x00, /* v183 1011 0111 */
+	0x00, /* v184 1011 1000 */
+	0x00, /* v185 1011 1001 */
+	0x00, /* v186 1011 1010 */
+	0x00, /* v187 1011 1011 */
+	0x00, /* v188 1011 1100 */
+	0x00, /* v189 1011 1101 */
+	0x00, /* v190 1011 1110 */
+	0x00, /* v191 1011 1111 */
+
+	0x02, /* v192 1100 0000 */
+	0x02, /* v193 1100 0001 */
+	0x00, /* v194 1100 0010 */
+	0x00, /* v195 1100 0011 */
+	0x00, /* v196 1100 0100 */
+	0x00, /* v197 1100 0101 */
+	0x00, /* v198 1100 0110 */
+	0x00, /* v199 1100 0111 */
+	0x00, /* v200 1100 1000 */
+	0x00, /* v201 1100 1001 */
+	0x00, /* v202 1100 1010 */
+	0x00, /* v203 1100 1011 */
+	0x00, /* v204 1100 1100 */
+	0x00, /* v205 1100 1101 */
+	0x00, /* v206 1100 1110 */
+	0x00, /* v207 1100 1111 */
+
+	0x02, /* v208 1101 0000 */
+	0x02, /* v209 1101 0001 */
+	0x00, /* v210 1101 0010 */
+	0x00, /* v211 1101 0011 */
+	0x00, /* v212 1101 0100 */
+	0x00, /* v213 1101 0101 */
+	0x00, /* v214 1101 0110 */
+	0x00, /* v215 1101 0111 */
+	0x00, /* v216 1101 1000 */
+	0x00, /* v217 1101 1001 */
+	0x00, /* v218 1101 1010 */
+	0x00, /* v219 1101 1011 */
+	0x00, /* v220 1101 1100 */
+	0x00, /* v221 1101 1101 */
+	0x00, /* v222 1101 1110 */
+	0x00, /* v223 1101 1111 */
+
+	0x0A, /* v224 1110 0000 */
+	0x0A, /* v225 1110 0001 */
+	0x00, /* v226 1110 0010 */
+	0x00, /* v227 1110 0011 */
+	0x00, /* v228 1110 0100 */
+	0x00, /* v229 1110 0101 */
+	0x00, /* v230 1110 0110 */
+	0x00, /* v231 1110 0111 */
+	0x00, /* v232 1110 1000 */
+	0x00, /* v233 1110 1001 */
+	0x00, /* v234 1110 1010 */
+	0x00, /* v235 1110 1011 */
+	0x00, /* v236 1110 1100 */
+	0x00, /* v237 1110 1101 */
+	0x00, /* v238 1110 1110 */
+	0x00, /* v239 1110 1111 */
+
+	0x0B, /* v240 1111 0000 */
+	0x0B, /* v241 1111 0001 */
+	0x00, /* v242 1111 0010 */
+	0x01, /* v243 1111 0011 */
+	0x00, /* v244 1111 0100 */
+	0x00, /* v245 1111 0101 */
+	0x00, /* v246 1111 0110 */
+	0x00, /* v247 1111 0111 */
+	0x01, /* v248 1111 1000 */
+	0x01, /* v249 1111 1001 */
+	0x00, /* v250 1111 1010 */
+	0x00, /* v251 1111 1011 */
+	0x01, /* v252 1111 1100 */
+	0x00, /* v253 1111 1101 */
+	0x00, /* v254 1111 1110 */
+	0x00  /* v255 1111 1111 */
+};
@@ -0,0 +1,39 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2014-2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "types.h"
+
+#ifndef _HYDRANFC_CMD_SNIFF_FUSED_H_
+#define _HYDRANFC_CMD_SNIFF_FUSED_H_
+
+/*
+ * sniff_14443a_decode[] entry for a downsampled symbol (8 bits), see
+ * scripts/gen_sniff_14443a_tables.py
+ */
+#define SNIFF_14443A_MILLER_BIT		(0)
+#define SNIFF_14443A_MANCHESTER_BIT	(1)
+#define SNIFF_14443A_PROTOCOL_SHIFT	(2)
+extern const u08_t sniff_14443a_decode[256];
+
+/*
+ * Downsampling by 4 of 16 bits (downsample_4x[] of both bytes), two 4 bits
+ * results per byte, built at runtime
+ */
+#define SNIFF_DS16_SIZE (65536 / 2)
+
+#endif /* _HYDRANFC_CMD_SNIFF_FUSED_H_ */
@@ -0,0 +1,157 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2014-2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * PCAPNG blocks for sniffer traces (little endian section), see
+ * https://github.com/pcapng/pcapng
+ * Timestamps are in ns since start of capture (DWT cycle counter).
+ */
+
+#include "hal.h"
+
+#include "hydranfc_cmd_sniff_pcapng.h"
+
+#define PCAPNG_BT_SHB (0x0A0D0D0A)
+#define PCAPNG_BT_IDB (0x00000001)
+#define PCAPNG_BT_EPB (0x00000006)
+#define PCAPNG_BYTE_ORDER_MAGIC (0x1A2B3C4D)
+
+#define PCAPNG_OPT_ENDOFOPT (0)
+#define PCAPNG_OPT_IF_TSRESOL (9)
+#define PCAPNG_OPT_EPB_FLAGS (2)
+#define PCAPNG_EPB_FLAGS_INBOUND (1)
+#define PCAPNG_EPB_FLAGS_OUTBOUND (2)
+
+#define PCAPNG_CYCLES_PER_US (STM32_SYSCLK / 1000000)
+
+static uint8_t *put_le16(uint8_t *out, uint16_t val)
+{
+	*out++ = val;
+	*out++ = val >> 8;
+	return out;
+}
+
+static uint8_t *put_le32(uint8_t *out, uint32_t val)
+{
+	*out++ = val;
+	*out++ = val >> 8;
+	*out++ = val >> 16;
+	*out++ = val >> 24;
+	return out;
+}
+
+/** \brief Write Section Header Block and Interface Description Block.
+ *
+ * \param buf uint8_t*: output, PCAPNG_HEADER_SIZE bytes.
+ * \param linktype uint16_t: link type of the interface.
+ * \return uint32_t: number of bytes written.
+ *
+ */
+uint32_t pcapng_write_header(uint8_t *buf, uint16_t linktype)
+{
+	uint8_t *p = buf;
+
+	/* Section Header Block, section length unknown */
+	p = put_le32(p, PCAPNG_BT_SHB);
+	p = put_le32(p, 28);
+	p = put_le32(p, PCAPNG_BYTE_ORDER_MAGIC);
+	p = put_le16(p, 1);
+	p = put_le16(p, 0);
+	p = put_le32(p, 0xFFFFFFFF);
+	p = put_le32(p, 0xFFFFFFFF);
+	p = put_le32(p, 28);
+
+	/* Interface Description Block, no snaplen, ns timestamps */
+	p = put_le32(p, PCAPNG_BT_IDB);
+	p = put_le32(p, 32);
+	p = put_le16(p, linktype);
+	p = put_le16(p, 0);
+	p = put_le32(p, 0);
+	p = put_le16(p, PCAPNG_OPT_IF_TSRESOL);
+	p = put_le16(p, 1);
+	p = put_le32(p, 9);
+	p = put_le32(p, PCAPNG_OPT_ENDOFOPT);
+	p = put_le32(p, 32);
+
+	return p - buf;
+}
+
+/** \brief Set start of capture, timestamps are relative to it.
+ *
+ * \param ts pcapng_ts_t*: timestamp state.
+ * \param cycles uint64_t: 64bits DWT cycle counter.
+ * \return void
+ *
+ */
+void pcapng_ts_init(pcapng_ts_t *ts, uint64_t cycles)
+{
+	ts->start_cycles = cycles;
+}
+
+/** \brief Complete an Enhanced Packet Block of ISO 14443 data.
+ * Data shall be already written at block + PCAPNG_ISO14443_HDR_SIZE.
+ *
+ * \param block uint8_t*: start of block, followed by at most
+ * PCAPNG_ISO14443_TRAILER_MAX bytes after data.
+ * \param ts pcapng_ts_t*: timestamp state.
+ * \param cycles uint64_t: 64bits DWT cycle counter at start of frame.
+ * \param event uint8_t: PCAPNG_ISO14443_EV_xxx.
+ * \param len uint32_t: data length.
+ * \param errors uint32_t: PCAPNG_EPB_FLAGS_ERR_xxx.
+ * \return uint32_t: block length.
+ *
+ */
+uint32_t pcapng_iso14443_finish(uint8_t *block, const pcapng_ts_t *ts,
+				uint64_t cycles, uint8_t event, uint32_t len,
+				uint32_t errors)
+{
+	uint64_t ns;
+	uint32_t cap_len, block_len;
+	uint8_t *p;
+
+	ns = (cycles - ts->start_cycles) * 1000 / PCAPNG_CYCLES_PER_US;
+
+	cap_len = 4 + len;
+	block_len = 28 + ((cap_len + 3) & ~3) + 8 + 4 + 4;
+
+	p = block;
+	p = put_le32(p, PCAPNG_BT_EPB);
+	p = put_le32(p, block_len);
+	p = put_le32(p, 0);
+	p = put_le32(p, ns >> 32);
+	p = put_le32(p, ns);
+	p = put_le32(p, cap_len);
+	p = put_le32(p, cap_len);
+	/* ISO 14443 pseudo header: version, event, length (big endian) */
+	*p++ = 0;
+	*p++ = event;
+	*p++ = len >> 8;
+	*p++ = len;
+
+	p += len;
+	while((p - block) & 3)
+		*p++ = 0;
+	p = put_le16(p, PCAPNG_OPT_EPB_FLAGS);
+	p = put_le16(p, 4);
+	p = put_le32(p, errors | ((event == PCAPNG_ISO14443_EV_PICC_TO_PCD) ?
+		     PCAPNG_EPB_FLAGS_INBOUND : PCAPNG_EPB_FLAGS_OUTBOUND));
+	p = put_le32(p, PCAPNG_OPT_ENDOFOPT);
+	p = put_le32(p, block_len);
+
+	return block_len;
+}
@@ -0,0 +1,52 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2014-2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRANFC_CMD_SNIFF_PCAPNG_H_
+#define _HYDRANFC_CMD_SNIFF_PCAPNG_H_
+
+#include <stdint.h>
+
+/* http://www.kaiser.cx/pcap-iso14443.html */
+#define PCAPNG_LINKTYPE_ISO_14443 (264)
+#define PCAPNG_ISO14443_EV_PICC_TO_PCD (0xFF)
+#define PCAPNG_ISO14443_EV_PCD_TO_PICC (0xFE)
+
+/* epb_flags link-layer-dependent errors (bits 24 to 31) */
+#define PCAPNG_EPB_FLAGS_ERR_CRC (1 << 24)
+#define PCAPNG_EPB_FLAGS_ERR_UNALIGNED (1 << 28)
+#define PCAPNG_EPB_FLAGS_ERR_SYMBOL (1U << 31)
+
+/* Section Header Block + Interface Description Block */
+#define PCAPNG_HEADER_SIZE (28 + 32)
+/* Enhanced Packet Block header + ISO 14443 pseudo header, before data */
+#define PCAPNG_ISO14443_HDR_SIZE (28 + 4)
+/* Padding, epb_flags option, end of options and block length after data */
+#define PCAPNG_ISO14443_TRAILER_MAX (3 + 8 + 4 + 4)
+
+/* Start of capture, 64bits DWT cycle counter (see get_cyclecounter64()) */
+typedef struct {
+	uint64_t start_cycles;
+} pcapng_ts_t;
+
+uint32_t pcapng_write_header(uint8_t *buf, uint16_t linktype);
+void pcapng_ts_init(pcapng_ts_t *ts, uint64_t cycles);
+uint32_t pcapng_iso14443_finish(uint8_t *block, const pcapng_ts_t *ts,
+				uint64_t cycles, uint8_t event, uint32_t len,
+				uint32_t errors);
+
+#endif /* _HYDRANFC_CMD_SNIFF_PCAPNG_H_ */
@@ -0,0 +1,233 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2014-2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ch.h"
+#include "hal.h"
+
+#include "common.h"
+
+#include "hydranfc_cmd_sniff_usb.h"
+
+#define SNIFF_USB_HALF (NB_SBUFFER / 2)
+/* Bytes a sniffer can write after reaching limit (before clamping) */
+#define SNIFF_USB_GUARD (32)
+#define SNIFF_USB_MB_SIZE (32)
+/* Frame is dropped by writer if host does not read it in time */
+#define SNIFF_USB_TIMEOUT_MS (100)
+#define SNIFF_USB_DRAIN_TIMEOUT_MS (1000)
+
+/* Mailbox message: frame offset in g_sbuf (16 LSB) and size (16 MSB) */
+#define SNIFF_USB_MSG(pos, size) ((msg_t)((pos) | ((size) << 16)))
+#define SNIFF_USB_MSG_POS(msg) ((uint32_t)(msg) & 0xFFFF)
+#define SNIFF_USB_MSG_SIZE(msg) ((uint32_t)(msg) >> 16)
+
+static THD_WORKING_AREA(sniff_usb_mem, 512);
+static thread_t *sniff_usb_thread;
+static mailbox_t sniff_usb_mb;
+static msg_t sniff_usb_mb_buf[SNIFF_USB_MB_SIZE];
+
+/* Bytes queued (by sniffer) and sent (by writer) for each half of g_sbuf */
+static uint32_t sniff_usb_posted[2];
+static volatile uint32_t sniff_usb_sent[2];
+static uint32_t sniff_usb_half; /* Half used by sniffer */
+static uint32_t sniff_usb_next; /* Start of next frame in g_sbuf */
+static uint32_t sniff_usb_lost_bytes; /* Queue full (by sniffer) */
+static uint32_t sniff_usb_dropped; /* Frames without room in g_sbuf (by sniffer) */
+static volatile uint32_t sniff_usb_unsent_bytes; /* Not read by host (by writer) */
+
+static THD_FUNCTION(sniff_usb_writer, arg)
+{
+	msg_t msg;
+	uint32_t pos, size, written;
+
+	(void)arg;
+
+	chRegSetThreadName("HydraNFC sniff-usb2");
+	while (!chThdShouldTerminateX()) {
+		if (chMBFetch(&sniff_usb_mb, &msg, TIME_INFINITE) != MSG_OK)
+			continue;
+
+		pos = SNIFF_USB_MSG_POS(msg);
+		size = SNIFF_USB_MSG_SIZE(msg);
+		if (size == 0)
+			continue;
+
+		written = 0;
+		if (SDU2.config->usbp->state == USB_ACTIVE)
+			written = chnWriteTimeout((BaseChannel *)&SDU2, &g_sbuf[pos], size,
+						  MS2ST(SNIFF_USB_TIMEOUT_MS));
+		/* Host not connected or not reading in time */
+		if (written < size)
+			sniff_usb_unsent_bytes += size - written;
+		sniff_usb_sent[pos / SNIFF_USB_HALF] += size;
+	}
+}
+
+/** \brief Start USB2 writer thread, it runs above caller priority.
+ *
+ * \return void
+ *
+ */
+void sniff_usb_start(void)
+{
+	sniff_usb_posted[0] = 0;
+	sniff_usb_posted[1] = 0;
+	sniff_usb_sent[0] = 0;
+	sniff_usb_sent[1] = 0;
+	sniff_usb_half = 0;
+	sniff_usb_next = 0;
+	sniff_usb_lost_bytes = 0;
+	sniff_usb_dropped = 0;
+	sniff_usb_unsent_bytes = 0;
+
+	chMBObjectInit(&sniff_usb_mb, sniff_usb_mb_buf, SNIFF_USB_MB_SIZE);
+	sniff_usb_thread = chThdCreateStatic(sniff_usb_mem, sizeof(sniff_usb_mem),
+					     chThdGetPriorityX() + 1,
+					     sniff_usb_writer, NULL);
+}
+
+/** \brief Wait queued frames are sent and stop USB2 writer thread.
+ *
+ * \return void
+ *
+ */
+void sniff_usb_stop(void)
+{
+	systime_t start;
+
+	start = chVTGetSystemTime();
+	while ((sniff_usb_sent[0] != sniff_usb_posted[0] ||
+		sniff_usb_sent[1] != sniff_usb_posted[1]) &&
+	       (chVTGetSystemTime() - start) < MS2ST(SNIFF_USB_DRAIN_TIMEOUT_MS)) {
+		chThdSleepMilliseconds(10);
+	}
+
+	chThdTerminate(sniff_usb_thread);
+	/* Wake up writer */
+	chMBPost(&sniff_usb_mb, SNIFF_USB_MSG(0, 0), TIME_INFINITE);
+	chThdWait(sniff_usb_thread);
+	sniff_usb_thread = NULL;
+}
+
+/** \brief Start of next frame in g_sbuf.
+ *
+ * \return uint32_t: offset in g_sbuf.
+ *
+ */
+uint32_t sniff_usb_pos(void)
+{
+	return sniff_usb_next;
+}
+
+/** \brief End of space available in g_sbuf for next frame, sniffer shall
+ * clamp g_sbuf_idx to it.
+ *
+ * \return uint32_t: offset in g_sbuf.
+ *
+ */
+uint32_t sniff_usb_limit(void)
+{
+	return (sniff_usb_half + 1) * SNIFF_USB_HALF - SNIFF_USB_GUARD;
+}
+
+/* Switch to other half when all its frames are sent */
+static void sniff_usb_switch(void)
+{
+	uint32_t other;
+
+	other = sniff_usb_half ^ 1;
+	if (sniff_usb_sent[other] == sniff_usb_posted[other]) {
+		sniff_usb_half = other;
+		sniff_usb_next = other * SNIFF_USB_HALF;
+	}
+}
+
+/** \brief Check there is room for a frame before writing it at
+ * sniff_usb_pos(), never blocks.
+ * Frame is lost if current half is full and other one is not sent yet.
+ *
+ * \param size uint32_t: maximum frame size.
+ * \return bool: TRUE if frame can be written, FALSE if it shall be dropped.
+ *
+ */
+bool sniff_usb_frame_start(uint32_t size)
+{
+	if (sniff_usb_next + size > sniff_usb_limit())
+		sniff_usb_switch();
+	if (sniff_usb_next + size <= sniff_usb_limit())
+		return TRUE;
+
+	sniff_usb_dropped++;
+	return FALSE;
+}
+
+/** \brief Drop frame written from sniff_usb_pos() (truncated at
+ * sniff_usb_limit()).
+ *
+ * \return void
+ *
+ */
+void sniff_usb_frame_drop(void)
+{
+	sniff_usb_dropped++;
+	sniff_usb_switch();
+}
+
+/** \brief Queue frame from sniff_usb_pos() to end, never blocks.
+ * Frame is lost if queue is full.
+ *
+ * \param end uint32_t: end of frame in g_sbuf.
+ * \return void
+ *
+ */
+void sniff_usb_frame_end(uint32_t end)
+{
+	uint32_t size;
+
+	size = end - sniff_usb_next;
+	if (size > 0) {
+		if (chMBPost(&sniff_usb_mb, SNIFF_USB_MSG(sniff_usb_next, size),
+			     TIME_IMMEDIATE) == MSG_OK) {
+			sniff_usb_posted[sniff_usb_half] += size;
+			sniff_usb_next = end;
+		} else {
+			sniff_usb_lost_bytes += size;
+		}
+	}
+	sniff_usb_switch();
+}
+
+/** \brief Bytes lost because queue was full or host did not read them.
+ *
+ * \return uint32_t: number of bytes.
+ *
+ */
+uint32_t sniff_usb_lost(void)
+{
+	return sniff_usb_lost_bytes + sniff_usb_unsent_bytes;
+}
+
+/** \brief Frames dropped because there was no room in g_sbuf.
+ *
+ * \return uint32_t: number of frames.
+ *
+ */
+uint32_t sniff_usb_lost_frames(void)
+{
+	return sniff_usb_dropped;
+}
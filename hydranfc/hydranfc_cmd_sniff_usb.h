@@ -0,0 +1,41 @@
+/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2014-2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HYDRANFC_CMD_SNIFF_USB_H_
+#define _HYDRANFC_CMD_SNIFF_USB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Sniffer frames are written in one half of g_sbuf and queued to a writer
+ * thread which sends them on USB2 (SDU2).
+ * Sniffer switches to the other half at end of frame when it is sent,
+ * a frame is dropped when there is no room left in both halves.
+ */
+void sniff_usb_start(void);
+void sniff_usb_stop(void);
+uint32_t sniff_usb_pos(void);
+uint32_t sniff_usb_limit(void);
+bool sniff_usb_frame_start(uint32_t size);
+void sniff_usb_frame_drop(void);
+void sniff_usb_frame_end(uint32_t end);
+uint32_t sniff_usb_lost(void);
+uint32_t sniff_usb_lost_frames(void);
+
+#endif /* _HYDRANFC_CMD_SNIFF_USB_H_ */
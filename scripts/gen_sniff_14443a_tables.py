@@ -0,0 +1,105 @@
+#!/usr/bin/env python
+"""
+Generate hydranfc/hydranfc_cmd_sniff_fused.c from the ISO14443A sniffer
+tables (detected_protocol[], miller_modified_106kb[], manchester_106kb[]
+in hydranfc/hydranfc_cmd_sniff_iso14443.c).
+
+Each entry of sniff_14443a_decode[] fuses the three lookups of a
+downsampled symbol:
+ bit 0: Miller Modified decoded bit
+ bit 1: Manchester decoded bit
+ bit 2-3: detected protocol (start bit)
+
+Usage (from hydrafw root directory):
+gen_sniff_14443a_tables.py [hydranfc/hydranfc_cmd_sniff_fused.c]
+"""
+
+import os
+import re
+import sys
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+SRC = os.path.join(ROOT, 'hydranfc', 'hydranfc_cmd_sniff_iso14443.c')
+OUT = os.path.join(ROOT, 'hydranfc', 'hydranfc_cmd_sniff_fused.c')
+
+SYMBOLS = {
+    'MILLER_MODIFIED_106KHZ': 1,
+    'MANCHESTER_106KHZ': 2,
+}
+
+MILLER_BIT = 0
+MANCHESTER_BIT = 1
+PROTOCOL_SHIFT = 2
+
+HEADER = """/*
+ * HydraBus/HydraNFC
+ *
+ * Copyright (C) 2014-2016 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Generated by scripts/gen_sniff_14443a_tables.py, do not edit */
+
+#include "hydranfc_cmd_sniff_fused.h"
+
+/* detected_protocol[] << SNIFF_14443A_PROTOCOL_SHIFT |
+ * manchester_106kb[] << SNIFF_14443A_MANCHESTER_BIT |
+ * miller_modified_106kb[] << SNIFF_14443A_MILLER_BIT
+ */
+const u08_t sniff_14443a_decode[256] = {
+"""
+
+
+def parse_table(src, name):
+    start = src.index(name + '[')
+    start = src.index('{', start)
+    end = src.index('};', start)
+    body = re.sub(r'/\*.*?\*/', '', src[start + 1:end], flags=re.S)
+    values = []
+    for tok in body.split(','):
+        tok = tok.strip()
+        if tok:
+            values.append(SYMBOLS[tok] if tok in SYMBOLS else int(tok, 0))
+    if len(values) != 256:
+        raise ValueError('%s: %d entries' % (name, len(values)))
+    return values
+
+
+def main():
+    out = sys.argv[1] if len(sys.argv) > 1 else OUT
+    with open(SRC) as f:
+        src = f.read()
+    protocol = parse_table(src, 'detected_protocol')
+    miller = parse_table(src, 'miller_modified_106kb')
+    manchester = parse_table(src, 'manchester_106kb')
+
+    lines = []
+    for i in range(256):
+        val = (protocol[i] << PROTOCOL_SHIFT) | \
+              (manchester[i] << MANCHESTER_BIT) | \
+              (miller[i] << MILLER_BIT)
+        sep = ',' if i < 255 else ' '
+        lines.append('\t0x%02X%s /* v%d %s %s */\n' %
+                     (val, sep, i, format(i >> 4, '04b'), format(i & 0xF, '04b')))
+        if (i & 0xF) == 0xF and i < 255:
+            lines.append('\n')
+
+    with open(out, 'w') as f:
+        f.write(HEADER)
+        f.writelines(lines)
+        f.write('};\n')
+
+
+if __name__ == '__main__':
+    main()
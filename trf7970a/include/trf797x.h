@@ -71,6 +71,13 @@
 #define TX_LENGTH_BYTE_2		0x1E
 #define FIFO				0x1F
 
+//---- Batched register write ------------------------------------
+
+typedef struct {
+	u08_t reg;
+	u08_t value;
+} trf797x_reg_t;
+
 //===============================================================
 
 void Trf797xCommunicationSetup(void);
@@ -81,6 +88,8 @@ void Trf797xEnableSlotCounter(void);
 int Trf797xInitialSettings(void);
 void Trf797xRawWrite(u08_t *pbuf, u08_t length);
 void Trf797xReadCont(u08_t *pbuf, u08_t length);
+u08_t Trf797xReadFifo(u08_t *pbuf, u08_t length);
+void Trf797xIrqSignalI(void);
 void Trf797xReadIrqStatus(u08_t *pbuf);
 void Trf797xReadSingle(u08_t *pbuf, u08_t length);
 void Trf797xResetFIFO(void);
@@ -93,6 +102,8 @@ void Trf797xTurnRfOn(void);
 void Trf797xWriteCont(u08_t *pbuf, u08_t length);
 void Trf797xWriteIsoControl(u08_t iso_control);
 void Trf797xWriteSingle(u08_t *pbuf, u08_t length);
+void Trf797xWriteRegs(const trf797x_reg_t *regs, u08_t nb);
+void Trf797xShadowInvalidate(void);
 
 uint8_t Trf797x_transceive_bits(uint8_t tx_databuf, uint8_t tx_databuf_nb_bits,
 				uint8_t* rx_databuf, uint8_t rx_databuf_nb_bytes,
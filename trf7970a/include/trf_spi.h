@@ -27,8 +27,10 @@ void SpiDirectCommand(u08_t *pbuf);
 void SpiDirectMode(void);
 void SpiRawWrite(u08_t *pbuf, u08_t length);
 void SpiReadCont(u08_t *pbuf, u08_t length);
+u08_t SpiReadFifo(u08_t *pbuf, u08_t length);
 void SpiReadSingle(u08_t *pbuf, u08_t length);
 void SpiSetup(void);
+void SpiWriteBurst(u08_t *pbuf, u08_t length);
 void SpiWriteCont(u08_t *pbuf, u08_t length);
 void SpiWriteSingle(u08_t *pbuf, u08_t length);
 
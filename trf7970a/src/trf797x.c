@@ -22,6 +22,7 @@
 #include "ch.h"
 #include "hal.h"
 
+#include "common.h"
 #include "tools.h"
 
 //===============================================================
@@ -41,13 +42,50 @@ extern s16_t	nfc_state;
 extern u08_t	nfc_protocol;
 extern u08_t	stand_alone_flag;
 
-extern volatile int irq_end_rx;
-extern volatile int irq;
+/* Signaled by Trf797xIrqSignalI() on each TRF7970A IRQ Pin rising edge */
+static BSEMAPHORE_DECL(trf797x_irq_sem, TRUE);
 
 #define SAMPLING_NB_BYTES   (512)
 u08_t   sampling[SAMPLING_NB_BYTES];
 
-//===============================================================
+/*
+ * Shadow of the last value written to each register, used by
+ * Trf797xWriteRegs() to skip redundant writes.
+ * Status, read only and multi-byte registers (IRQ Status, Collision
+ * Position, RSSI, NFCID, NFC Target Protocol, FIFO...) are not cached.
+ */
+#define TRF797X_SHADOW_MASK ( 0x0FFFFFFF & ~((1 << IRQ_STATUS) | \
+				(1 << COLLISION_POSITION) | (1 << RSSI_LEVELS) | \
+				(1 << NFCID) | (1 << NFC_TARGET_PROTOCOL)) )
+/* Registers preset by the TRF7970A when ISO Control is written */
+#define TRF797X_ISO_PRESET_MASK (0x00000FFC) /* 0x02 to 0x0B */
+static u08_t trf797x_shadow[32];
+static u32_t trf797x_shadow_valid;
+
+/* Encoded SPI bursts for Trf797xWriteRegs() (not in CCM, sent with DMA) */
+#define TRF797X_BURST_MAX (64)
+static u08_t trf797x_burst[TRF797X_BURST_MAX];
+
+//===============================================================
+
+static void Trf797xShadowUpdate(u08_t reg, u08_t value)
+{
+	reg &= 0x1F;
+	if(reg == ISO_CONTROL)
+		trf797x_shadow_valid &= ~TRF797X_ISO_PRESET_MASK;
+
+	if((1UL << reg) & TRF797X_SHADOW_MASK) {
+		trf797x_shadow[reg] = value;
+		trf797x_shadow_valid |= (1UL << reg);
+	}
+}
+
+static bool Trf797xShadowMatch(u08_t reg, u08_t value)
+{
+	reg &= 0x1F;
+	return ((trf797x_shadow_valid & (1UL << reg)) &&
+		trf797x_shadow[reg] == value);
+}
 
 //===============================================================
 //                                                              ;
@@ -78,6 +116,10 @@ void Trf797xCommunicationSetup(void)
 
 void Trf797xDirectCommand(u08_t *pbuf)
 {
+	/* Software Initialization resets all registers */
+	if(*pbuf == SOFT_INIT)
+		Trf797xShadowInvalidate();
+
 	SpiDirectCommand(pbuf);
 }
 
@@ -118,6 +160,16 @@ void Trf797x_Init(void)
 
 int Trf797xInitialSettings(void)
 {
+	static const trf797x_reg_t init_regs[] = {
+		{ CHIP_STATE_CONTROL, 0x21 }, /* Configure Chip Status Register */
+		{ MODULATOR_CONTROL, 0x00 },
+		{ REGULATOR_CONTROL, 0x87 }, /* Configure REGULATOR_CONTROL */
+	};
+	static const trf797x_reg_t init_regs_fifo[] = {
+		{ CHIP_STATE_CONTROL, 0x00 }, /* Configure Chip Status Register */
+		{ IRQ_MASK, 0x3E }, /* Configure Collision position and interrupt mask register */
+		{ NFC_FIFO_IRQ_LEVELS, 0x0F }, /* Configure Adjustable FIFO IRQ Levels Register (96B RX & 32B TX) */
+	};
 	int i;
 	u08_t data_buf[2];
 
@@ -137,37 +189,12 @@ int Trf797xInitialSettings(void)
 		}
 	}
 
-	/* Configure Chip Status Register */
-	data_buf[0] = CHIP_STATE_CONTROL;
-	data_buf[1] = 0x21;
-	Trf797xWriteSingle(data_buf, 2);
-
-	data_buf[0] = MODULATOR_CONTROL;
-	data_buf[1] = 0x00;
-	Trf797xWriteSingle(data_buf, 2);
-
-	/* Configure REGULATOR_CONTROL */
-	data_buf[0] = REGULATOR_CONTROL;
-	data_buf[1] = 0x87;
-	Trf797xWriteSingle(data_buf, 2);
+	Trf797xWriteRegs(init_regs, ARRAY_SIZE(init_regs));
 
 	// Reset FIFO CMD
 	Trf797xResetFIFO();
 
-	/* Configure Chip Status Register */
-	data_buf[0] = CHIP_STATE_CONTROL;
-	data_buf[1] = 0x00;
-	Trf797xWriteSingle(data_buf, 2);
-
-	/* Configure Collision position and interrupt mask register */
-	data_buf[0] = IRQ_MASK;
-	data_buf[1] = 0x3E;
-	Trf797xWriteSingle(data_buf, 2);
-
-	/* Configure Adjustable FIFO IRQ Levels Register (96B RX & 32B TX) */
-	data_buf[0] = NFC_FIFO_IRQ_LEVELS;
-	data_buf[1] = 0x0F;
-	Trf797xWriteSingle(data_buf, 2);
+	Trf797xWriteRegs(init_regs_fifo, ARRAY_SIZE(init_regs_fifo));
 
 	/* Read IRQ Status */
 	Trf797xReadIrqStatus(data_buf);
@@ -239,6 +266,26 @@ Trf797xReadIrqStatus(u08_t *pbuf)
 	Trf797xReadCont(pbuf, 2); // read second reg. as dummy read
 }
 
+//===============================================================
+// NAME: u08_t Trf797xReadFifo (u08_t *pbuf, u08_t length)
+//
+// BRIEF: Is used to read FIFO Status and FIFO content in one
+// SPI burst.
+//
+// INPUTS:
+//	Parameters:
+//		u08_t		*pbuf		FIFO data destination
+//		u08_t		length		max number of bytes to read
+//
+// OUTPUTS:
+//	number of bytes read from the FIFO
+//===============================================================
+
+u08_t Trf797xReadFifo(u08_t *pbuf, u08_t length)
+{
+	return SpiReadFifo(pbuf, length);
+}
+
 //===============================================================
 // NAME: void Trf797xReadSingle (u08_t *pbuf, u08_t number)
 //
@@ -377,6 +424,9 @@ void Trf797xTurnRfOn(void)
 
 void Trf797xWriteCont(u08_t *pbuf, u08_t length)
 {
+	/* Forget shadows from the first register upwards */
+	trf797x_shadow_valid &= ~(0xFFFFFFFF << (pbuf[0] & 0x1F));
+
 	SpiWriteCont(pbuf, length);
 }
 
@@ -510,9 +560,124 @@ void Trf797xWriteIsoControl(u08_t iso_control)
 
 void Trf797xWriteSingle(u08_t *pbuf, u08_t length)
 {
+	u08_t i;
+
+	for(i = 0; (i + 1) < length; i += 2)
+		Trf797xShadowUpdate(pbuf[i], pbuf[i + 1]);
+
 	SpiWriteSingle(pbuf, length);
 }
 
+/*
+* Forget all register shadows, to be called when registers are changed
+* without Trf797xWriteSingle()/Trf797xWriteCont()/Trf797xWriteRegs().
+*/
+void Trf797xShadowInvalidate(void)
+{
+	trf797x_shadow_valid = 0;
+}
+
+/*
+* Write nb registers in order, register writes equal to the shadow are skipped.
+* Consecutive registers are merged in one continuous mode write and other ones
+* in one single mode write, each burst is sent with one Slave Select using DMA.
+*/
+void Trf797xWriteRegs(const trf797x_reg_t *regs, u08_t nb)
+{
+	u08_t i, n, k;
+	u08_t len;
+
+	len = 0; /* Pending single mode address/data pairs */
+	i = 0;
+	while(i < nb) {
+		if(Trf797xShadowMatch(regs[i].reg, regs[i].value)) {
+			i++;
+			continue;
+		}
+
+		/* Consecutive (cached) registers */
+		n = 1;
+		while((i + n) < nb && n < (TRF797X_BURST_MAX - 1) &&
+		      regs[i + n].reg == (regs[i].reg + n) &&
+		      ((1UL << regs[i + n].reg) & TRF797X_SHADOW_MASK))
+			n++;
+
+		if(n == 1) {
+			if((len + 2) > TRF797X_BURST_MAX) {
+				SpiWriteBurst(trf797x_burst, len);
+				len = 0;
+			}
+			trf797x_burst[len++] = regs[i].reg & 0x1F; // address, write, single
+			trf797x_burst[len++] = regs[i].value;
+		} else {
+			if(len > 0) {
+				SpiWriteBurst(trf797x_burst, len);
+				len = 0;
+			}
+			trf797x_burst[0] = 0x20 | (regs[i].reg & 0x1F); // address, write, continuous
+			for(k = 0; k < n; k++)
+				trf797x_burst[1 + k] = regs[i + k].value;
+			SpiWriteBurst(trf797x_burst, n + 1);
+		}
+
+		for(k = 0; k < n; k++)
+			Trf797xShadowUpdate(regs[i + k].reg, regs[i + k].value);
+		i += n;
+	}
+
+	if(len > 0)
+		SpiWriteBurst(trf797x_burst, len);
+}
+
+/*
+* Called from TRF7970A IRQ Pin ISR (within chSysLockFromISR()/chSysUnlockFromISR())
+* to wake up the thread waiting in Trf797x_transceive_bits()/Trf797x_transceive_bytes().
+*/
+void Trf797xIrqSignalI(void)
+{
+	chBSemSignalI(&trf797x_irq_sem);
+}
+
+/*
+* Forget IRQs already signaled, to be called before to start a new transfer.
+*/
+static void Trf797xIrqReset(void)
+{
+	chBSemReset(&trf797x_irq_sem, TRUE);
+}
+
+/*
+* Sleep until IRQ RX end (FIFO TX is reset on IRQ TX end).
+* timeout_ms is the max timeout to wait in ms (it is the timeout for whole transfer TX+RX).
+* Return TRUE on IRQ RX end, FALSE on timeout.
+*/
+static bool Trf797xWaitRxEnd(uint8_t timeout_ms)
+{
+	uint8_t irq_status[2];
+	systime_t start, timeout, elapsed;
+
+	start = chVTGetSystemTime();
+	timeout = MS2ST(timeout_ms);
+	while(1) {
+		elapsed = chVTTimeElapsedSinceX(start);
+		if(elapsed >= timeout)
+			return FALSE;
+
+		if(chBSemWaitTimeout(&trf797x_irq_sem, timeout - elapsed) != MSG_OK)
+			return FALSE;
+
+		/* Read/Clear IRQ Status(0x0C=>0x6C)+read dummy */
+		Trf797xReadIrqStatus(irq_status);
+
+		// irq_status[0] shall be equal to 0x40 or 0x80 (or both 0xC0) TX finished and RX finished
+		if(0x40 == irq_status[0]) { /* RX end */
+			return TRUE;
+		} else if(0x80 == irq_status[0]) { /* TX end */
+			Trf797xResetFIFO(); // reset the FIFO after TX
+		}
+	}
+}
+
 /*
 * Send Nb bits (Max 7bits) and receive the data
 * timeout_ms is the max timeout to wait in ms (it is the timeout for whole transfer TX+RX).
@@ -523,8 +688,6 @@ uint8_t Trf797x_transceive_bits(uint8_t tx_databuf, uint8_t tx_databuf_nb_bits,
 				uint8_t timeout_ms,
 				uint8_t flag_crc)
 {
-	int i;
-	uint8_t fifo_size;
 #undef DATA_MAX
 #define DATA_MAX (6)
 	uint8_t data_buf[DATA_MAX];
@@ -540,55 +703,16 @@ uint8_t Trf797x_transceive_bits(uint8_t tx_databuf, uint8_t tx_databuf_nb_bits,
 	data_buf[3] = 0x00; /* Number of Bytes to be sent MSB 0x00 @0x1D */
 	data_buf[4] = (tx_databuf_nb_bits<<1) | 0x01; /* Number of Bits to be sent LSB 0x00 @0x1E = Max 7bits */
 	data_buf[5] = tx_databuf; /* Data (FIFO TX 1st Data @0x1F) */
+	Trf797xIrqReset();
 	Trf797xRawWrite(data_buf, 6);  // writing to FIFO
 
-	irq_end_rx = 0;
-	/* irq is set by External Interrupt on  IRQ Pin */
-	irq = 0;
-	/* Max Timeout TX/RX are finished increment 10us */
-	for(i=0; i < (timeout_ms*100); i++) {
-		if(irq == 1) {
-			irq = 0;
-			/* Read/Clear IRQ Status(0x0C=>0x6C)+read dummy */
-			Trf797xReadIrqStatus(data_buf);
-
-			// data_buf[0] shall be equal to 0x40 or 0x80 (or both 0xC0) TX finished and RX finished
-			if(0x40 == data_buf[0]) { /* RX end */
-				irq_end_rx = 1;
-				break;
-			} else if(0x80 == data_buf[0]) { /* TX end */
-				Trf797xResetFIFO(); // reset the FIFO after TX
-			}
-		}
-		DelayUs(10);
-	}
-	if(0 == irq_end_rx) {
+	if(Trf797xWaitRxEnd(timeout_ms) == FALSE) {
 		/* RX timeout */
-		irq_end_rx = 0;
-		irq = 0;
 		return 0;
-	} else {
-		/* IRQ RX end ok */
-		irq_end_rx = 0;
-		irq = 0;
-
-		/* Read FIFO Status(0x1C=>0x5C) */
-		data_buf[0] = FIFO_CONTROL;
-		Trf797xReadSingle(data_buf, 1);  // determine the number of bytes left in FIFO
-		data_buf[0] = data_buf[0] & 0x7F; /* Clear Flag FIFO Overflow */
-
-		fifo_size = data_buf[0];
-		if(fifo_size>rx_databuf_nb_bytes)
-			fifo_size=rx_databuf_nb_bytes;
-
-		if (fifo_size > 0) {
-			/* Read Continuous FIFO from 0x1F to 0x1F+0x0A(0x1F/0x7F) */
-			rx_databuf[0] = FIFO;
-			Trf797xReadCont(rx_databuf, fifo_size);
-			return fifo_size;
-		}
-		return fifo_size;
 	}
+
+	/* IRQ RX end ok, read FIFO Status(0x1C=>0x7C) and FIFO */
+	return Trf797xReadFifo(rx_databuf, rx_databuf_nb_bytes);
 }
 
 /*
@@ -606,7 +730,6 @@ int Trf797x_transceive_bytes(uint8_t* tx_databuf, uint8_t tx_databuf_nb_bytes,
 	static uint8_t data_buf[DATA_MAX];
 
 	int i;
-	uint8_t fifo_size;
 
 	/* Send Raw Data */
 	data_buf[0] = 0x8F; /* Direct Command => Reset FIFO */
@@ -626,60 +749,37 @@ int Trf797x_transceive_bytes(uint8_t* tx_databuf, uint8_t tx_databuf_nb_bytes,
 		/* Data (FIFO TX 1st Data @0x1F) */
 		data_buf[5+i] = tx_databuf[i];
 	}
+	Trf797xIrqReset();
 	Trf797xRawWrite(data_buf, (tx_databuf_nb_bytes+5));  // writing all
 
-	irq_end_rx = 0;
-	/* irq is set by External Interrupt on  IRQ Pin */
-	irq = 0;
-	/* Max Timeout TX/RX are finished increment 100us */
-	for(i=0; i < (timeout_ms*10); i++) {
-		if(irq == 1) {
-			irq = 0;
-			/* Read/Clear IRQ Status(0x0C=>0x6C)+read dummy */
-			Trf797xReadIrqStatus(data_buf);
-
-			// data_buf[0] shall be equal to 0x40 or 0x80 (or both 0xC0) TX finished and RX finished
-			if(0x40 == data_buf[0]) { /* RX end */
-				irq_end_rx = 1;
-				break;
-			} else if(0x80 == data_buf[0]) { /* TX end */
-				Trf797xResetFIFO(); // reset the FIFO after TX
-			}
-		}
-		DelayUs(100);
-	}
-	if(0 == irq_end_rx) {
+	if(Trf797xWaitRxEnd(timeout_ms) == FALSE) {
 		/* RX timeout */
-		irq_end_rx = 0;
-		irq = 0;
 		return 0;
-	} else {
-		/* IRQ RX end ok */
-		irq_end_rx = 0;
-		irq = 0;
-
-		/* Read FIFO Status(0x1C=>0x5C) */
-		data_buf[0] = FIFO_CONTROL;
-		Trf797xReadSingle(data_buf, 1);  // determine the number of bytes left in FIFO
-		data_buf[0] = data_buf[0] & 0x7F; /* Clear Flag FIFO Overflow */
-
-		fifo_size = data_buf[0];
-		if(fifo_size>rx_databuf_nb_bytes)
-			fifo_size=rx_databuf_nb_bytes;
-
-		if (fifo_size > 0) {
-			/* Read Continuous FIFO from 0x1F to 0x1F+0x0A(0x1F/0x7F) */
-			rx_databuf[0] = FIFO;
-			Trf797xReadCont(rx_databuf, fifo_size);
-			return fifo_size;
-		}
-		return fifo_size;
 	}
+
+	/* IRQ RX end ok, read FIFO Status(0x1C=>0x7C) and FIFO */
+	return Trf797xReadFifo(rx_databuf, rx_databuf_nb_bytes);
 }
 
 void Trf797x_DM0_DM1_Config(void)
 {
-	u08_t tmp_buf[2];
+	static const trf797x_reg_t dm_regs[] = {
+		/* Configure Chip Status Register (0x00) to 0x21 (RF output active and 5v operations) */
+		{ CHIP_STATE_CONTROL, 0x21 },
+		/* Configure Mode ISO Control Register (0x01) to 0x21 (Passive Mode 106 kbps) */
+		{ ISO_CONTROL, 0x21 },
+		/* Write Modulator and SYS_CLK Control Register (0x09) (13.56Mhz SYS_CLK and default Clock 3.39Mhz)) */
+		{ MODULATOR_CONTROL, 0x11 }, /* Freq 3.39Mhz */
+		/* Configure RX Special Settings
+		* Bandpass 450 kHz to 1.5 MHz B5=1/Bandpass 100 kHz to 1.5 MHz=B4=1,
+		* Gain reduction for 10 dB(Can be changed) B2=0&B3=1 or Gain reduction for 0 dB => B2=0& B3=0,
+		* AGC no limit B0=1 */
+		{ RX_SPECIAL_SETTINGS, 0x31 }, //0x39;
+		/* Configure Regulator to 0x87 (Auto & 5V) */
+		{ REGULATOR_CONTROL, 0x87 },
+		/* Configure Test Settings 1 to BIT6/0x40 => MOD Pin becomes receiver subcarrier output (Digital Output for RX/TX) => Used for Sniffer */
+		{ TEST_SETTINGS_1, BIT6 },
+	};
 
 	/* Init TRF797x */
 	Trf797xResetFIFO();
@@ -687,39 +787,7 @@ void Trf797x_DM0_DM1_Config(void)
 
 	/* ************************************************************* */
 	/* Configure NFC chipset as ISO14443B (works with ISO14443A too) */
-
-	/* Configure Chip Status Register (0x00) to 0x21 (RF output active and 5v operations) */
-	tmp_buf[0] = CHIP_STATE_CONTROL;
-	tmp_buf[1] = 0x21;
-	Trf797xWriteSingle(tmp_buf, 2);
-
-	/* Configure Mode ISO Control Register (0x01) to 0x21 (Passive Mode 106 kbps) */
-	tmp_buf[0] = ISO_CONTROL;
-	tmp_buf[1] = 0x21;
-	Trf797xWriteSingle(tmp_buf, 2);
-
-	/* Write Modulator and SYS_CLK Control Register (0x09) (13.56Mhz SYS_CLK and default Clock 3.39Mhz)) */
-	tmp_buf[0] = MODULATOR_CONTROL;
-	tmp_buf[1] = 0x11; /* Freq 3.39Mhz */
-	Trf797xWriteSingle(tmp_buf, 2);
-
-	/* Configure Regulator to 0x87 (Auto & 5V) */
-	tmp_buf[0] = REGULATOR_CONTROL;
-	tmp_buf[1] = 0x87;
-	Trf797xWriteSingle(tmp_buf, 2);
-
-	/* Configure RX Special Settings
-	* Bandpass 450 kHz to 1.5 MHz B5=1/Bandpass 100 kHz to 1.5 MHz=B4=1,
-	* Gain reduction for 10 dB(Can be changed) B2=0&B3=1 or Gain reduction for 0 dB => B2=0& B3=0,
-	* AGC no limit B0=1 */
-	tmp_buf[0] = RX_SPECIAL_SETTINGS;
-	tmp_buf[1] = 0x31; //0x39;
-	Trf797xWriteSingle(tmp_buf, 2);
-
-	/* Configure Test Settings 1 to BIT6/0x40 => MOD Pin becomes receiver subcarrier output (Digital Output for RX/TX) => Used for Sniffer */
-	tmp_buf[0] = TEST_SETTINGS_1;
-	tmp_buf[1] = BIT6;
-	Trf797xWriteSingle(tmp_buf, 2);
+	Trf797xWriteRegs(dm_regs, ARRAY_SIZE(dm_regs));
 
 	Trf797xStopDecoders(); /* Disable Receiver */
 	Trf797xRunDecoders(); /* Enable Receiver */
@@ -812,6 +880,7 @@ void Trf797x_DM0_Enter(void)
 	/* 4. Send extra eight clock cycles (see Figure 6-28, this step is TRF7970A specific) */
 	buf[0] = 0;
 	SPI_LL_Write(&buf[0], 1);
+	Trf797xShadowInvalidate(); /* Chip Status Control written without Trf797xWriteSingle() */
 
 	/* Do not Unselect Chipselect until end of DM0 */
 }
@@ -824,6 +893,7 @@ void Trf797x_DM0_Exit(void)
 		state.
   */
 	SPI_LL_Unselect();
+	Trf797xShadowInvalidate();
 }
 
 /*
@@ -872,6 +942,7 @@ void Trf797x_DM1_Enter(void)
 	/* 8 dummy clocks	Step 18 */
 	buf[0] = 0;
 	SPI_LL_Write(&buf[0], 1);
+	Trf797xShadowInvalidate(); /* Chip Status Control written without Trf797xWriteSingle() */
 
 	/* Do not Unselect Chipselect until end of DM0 */
 }
@@ -884,6 +955,7 @@ void Trf797x_DM1_Exit(void)
 	u08_t buf[2];
 
 	SPI_LL_Unselect();	// Step 21
+	Trf797xShadowInvalidate();
 
 	buf[0] = SPECIAL_FUNCTION;
 	buf[1] = 0x00;
@@ -180,6 +180,54 @@ void SpiReadCont(u08_t *pbuf, u08_t length)
 	DelayUs(1); /* Additional delay to avoid too fast Unselect() and Select() for consecutive SPI_write() */
 }
 
+//===============================================================
+// NAME: u08_t SpiReadFifo (u08_t *pbuf, u08_t length)
+//
+// BRIEF: Is used in SPI mode to read the FIFO Status register
+// and the FIFO content in a single SPI burst.
+//
+// INPUTS:
+//	Parameters:
+//		u08_t		*pbuf		FIFO data destination
+//		u08_t		length		max number of bytes to read
+//
+// OUTPUTS:
+//	number of bytes read from the FIFO
+//
+// PROCESS:	[1] continuous read from FIFO Status (0x1C)
+//			[2] skip TX Length Byte1 & Byte2 (0x1D/0x1E)
+//			[3] read FIFO (0x1F, address does not increment)
+//
+// CHANGE:
+// DATE  		WHO	DETAIL
+// 2016  BVERNOUX Original Code
+//===============================================================
+u08_t SpiReadFifo(u08_t *pbuf, u08_t length)
+{
+	u08_t reg[2];
+	u08_t fifo_size;
+
+	bsp_spi_select(BSP_DEV_SPI2); /* Slave Select assertion. */
+
+	reg[0] = (0x60 | FIFO_CONTROL);				// address, read, continuous
+	bsp_spi_write_u8(BSP_DEV_SPI2, reg, 1);
+	bsp_spi_read_u8(BSP_DEV_SPI2, reg, 1);
+
+	fifo_size = reg[0] & 0x7F; /* Clear Flag FIFO Overflow */
+	if(fifo_size > length)
+		fifo_size = length;
+
+	if(fifo_size > 0) {
+		bsp_spi_read_u8(BSP_DEV_SPI2, reg, 2); /* TX Length Byte1 & Byte2 */
+		bsp_spi_read_u8(BSP_DEV_SPI2, pbuf, fifo_size);
+	}
+
+	bsp_spi_unselect(BSP_DEV_SPI2);
+	DelayUs(1); /* Additional delay to avoid too fast Unselect() and Select() for consecutive SPI_write() */
+
+	return fifo_size;
+}
+
 //===============================================================
 // NAME: void SpiReadSingle (u08_t *pbuf, u08_t number)
 //
@@ -267,6 +315,37 @@ void SpiWriteCont(u08_t *pbuf, u08_t length)
 	DelayUs(1); /* Additional delay to avoid too fast Unselect() and Select() for consecutive SPI_write() */
 }
 
+//===============================================================
+// NAME: void SpiWriteBurst (u08_t *pbuf, u08_t length)
+//
+// BRIEF: Is used in SPI mode to write an already encoded burst
+// (address/command words and data) with one Slave Select.
+//
+// INPUTS:
+//	u08_t	*pbuf	burst to write (shall not be in CCM, DMA)
+//	u08_t	length	number of bytes
+//
+// OUTPUTS:
+//
+// PROCESS:	[1] write the burst with DMA (polling if DMA is busy)
+//
+// CHANGE:
+// DATE  		WHO	DETAIL
+// 2016  BVERNOUX Original Code
+//===============================================================
+
+void SpiWriteBurst(u08_t *pbuf, u08_t length)
+{
+	bsp_spi_select(BSP_DEV_SPI2); /* Slave Select assertion. */
+
+	/* BSP_ERROR: DMA streams already used, nothing sent */
+	if(bsp_spi_write_read_dma(BSP_DEV_SPI2, pbuf, NULL, length) == BSP_ERROR)
+		bsp_spi_write_u8(BSP_DEV_SPI2, pbuf, length);
+
+	bsp_spi_unselect(BSP_DEV_SPI2);
+	DelayUs(1); /* Additional delay to avoid too fast Unselect() and Select() for consecutive SPI_write() */
+}
+
 //===============================================================
 // NAME: void SpiWriteSingle (u08_t *pbuf, u08_t length)
 //